@@ -41,6 +41,17 @@
 /* This guy doesn't exist in 4-byte case */
 #define EXTRABITMASK_NEW 0x20
 
+/* Compact edges (flags format 6) are three bytes laid out like the first
+ * three of a four-byte edge: a six-bit tile, and a 16-bit child field that,
+ * rather than an index, is 0 for no child, the distance back to the child
+ * if COMPACT_FARBIT is clear, and otherwise the position in a table of
+ * indices (stored ahead of the edges) of the child.  A big DAWG's edges
+ * mostly point a little way back, or to the few thousand shared tails, so
+ * this costs three bytes per edge instead of four.
+ */
+#define COMPACT_FARBIT 0x8000
+#define COMPACT_MAXFAR 0x7FFF
+
 #define OLD_THREE_FIELDS \
     XP_U8 highByte; \
     XP_U8 lowByte; \
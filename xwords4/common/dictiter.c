@@ -32,6 +32,9 @@
 #include "dictnry.h"
 #include "dictiter.h"
 #include "dbgutil.h"
+#ifdef XWFEATURE_DICTITER_THREADS
+# include "xwmutex.h"
+#endif
 
 /* Define DI_DEBUG in Makefile. It makes iteration really slow on Android */
 #ifdef DI_DEBUG
@@ -99,6 +102,9 @@ typedef struct _Pat {
     XP_U16 nPatElems;
 } Pat;
 
+/* Top-level edges, i.e. possible first tiles */
+#define MAX_ROOTS 64
+
 typedef struct _Indexer {
     void (*proc)(void* closure);
     void* closure;
@@ -136,8 +142,28 @@ struct DictIter {
     Pat pats[MAX_PATS];
 
     Indexer* indexer;
+#ifdef XWFEATURE_DICTITER_THREADS
+    /* Position of the first word under each top-level edge, plus nWords at
+       the end. Set when the words are counted; nRoots is 0 if they weren't
+       counted that way. */
+    XP_U16 nRoots;
+    DictPosition rootStarts[MAX_ROOTS + 1];
+    XP_Bool oneRoot;            /* don't leave stack[0]'s subtree */
+#endif
 };
 
+#ifdef XWFEATURE_DICTITER_THREADS
+# ifndef MAX_DICTITER_THREADS
+#  define MAX_DICTITER_THREADS 16
+# endif
+static XP_U16 sNThreads = 1;
+
+# define LAST_PEER( ITER, EDGE, DEPTH )                              \
+    (IS_LAST_EDGE( (ITER)->dict, (EDGE) ) || (0 == (DEPTH) && (ITER)->oneRoot))
+#else
+# define LAST_PEER( ITER, EDGE, DEPTH ) IS_LAST_EDGE( (ITER)->dict, (EDGE) )
+#endif
+
 typedef enum { PatErrNone,
                PatErrMissingClose,
                PatErrMultipleSpellings,
@@ -1139,7 +1165,9 @@ nextWord( DictIter* iter, XP_Bool log )
             }
         }
 
-        while ( iter->nEdges > 0 && IS_LAST_EDGE( dict, iter->stack[iter->nEdges-1].edge ) ) {
+        while ( iter->nEdges > 0
+                && LAST_PEER( iter, iter->stack[iter->nEdges-1].edge,
+                              iter->nEdges - 1 ) ) {
             popEdge( iter );
         }
 
@@ -1149,7 +1177,7 @@ nextWord( DictIter* iter, XP_Bool log )
         while ( 0 < iter->nEdges ) {
             /* remove so isn't part of the match of its peers! */
             array_edge* edge = popEdge( iter );
-            if ( !IS_LAST_EDGE( dict, edge ) ) {
+            if ( !LAST_PEER( iter, edge, iter->nEdges ) ) {
                 edge += dict->nodeSize;
                 PatMatch match = {};
                 if ( nextPeerMatch( iter, &edge, &match, log ) ) {
@@ -1565,6 +1593,265 @@ di_stringMatches( DictIter* iter, const XP_UCHAR* str )
 } /* di_stringMatches */
 #endif
 
+#ifdef XWFEATURE_WORDCOUNTS
+/* The dict's per-edge word counts are the iterator's when nothing's
+   filtered out: no patterns, and every word's length within bounds */
+static XP_Bool
+countsApply( const DictIter* iter )
+{
+    const DictionaryCtxt* dict = iter->dict;
+    return !!dict->wordCounts && 0 == iter->nPats
+        && iter->min <= dict->minWordLen && dict->maxWordLen <= iter->max;
+}
+
+/* Go straight to the word at position by subtracting the counts of the
+   siblings passed over at each level. */
+static XP_Bool
+placeWordByCount( DictIter* iter, DictPosition position )
+{
+    const DictionaryCtxt* dict = iter->dict;
+    while ( 0 < iter->nEdges ) {
+        popEdge( iter );
+    }
+
+    XP_Bool found = XP_FALSE;
+    XP_U32 remaining = position;
+    array_edge* edge = dict_getTopEdge( dict );
+    while ( !!edge ) {
+        XP_U32 here = dict_wordsFrom( dict, edge );
+        XP_U32 after = IS_LAST_EDGE( dict, edge ) ? 0
+            : dict_wordsFrom( dict, edge + dict->nodeSize );
+        if ( remaining >= here - after ) { /* not through this edge */
+            remaining -= here - after;
+            edge = 0 < after ? edge + dict->nodeSize : NULL;
+        } else {
+            PatMatch match = {};
+            pushEdge( iter, edge, &match );
+            if ( ISACCEPTING( dict, edge ) ) {
+                if ( 0 == remaining ) {
+                    found = XP_TRUE;
+                    break;
+                }
+                --remaining;
+            }
+            edge = dict_follow( dict, edge );
+        }
+    }
+    XP_ASSERT( found );
+    return found;
+} /* placeWordByCount */
+#else
+# define countsApply( iter ) XP_FALSE
+# define placeWordByCount( iter, position ) XP_FALSE
+#endif
+
+#ifdef XWFEATURE_DICTITER_THREADS
+typedef struct _ParallelCount {
+    MutexState mutex;
+    const DictIter* iter;
+    array_edge* top;
+    XP_U16 nRoots;
+    XP_U16 nextRoot;            /* guarded by mutex */
+    XP_U32 counts[MAX_ROOTS];   /* each written only by its root's worker */
+} ParallelCount;
+
+typedef struct _CountWorker {
+    ParallelCount* pc;
+    LengthsArray* lens;         /* NULL if not wanted */
+    LengthsArray myLens;
+} CountWorker;
+
+void
+di_setNThreads( XP_U16 nThreads )
+{
+    if ( nThreads < 1 ) {
+        nThreads = 1;
+    } else if ( nThreads > MAX_DICTITER_THREADS ) {
+        nThreads = MAX_DICTITER_THREADS;
+    }
+    sNThreads = nThreads;
+}
+
+/* Count the words under one top-level edge, using iter as scratch */
+static XP_U32
+countUnder( DictIter* iter, array_edge* root, LengthsArray* lens )
+{
+    while ( 0 < iter->nEdges ) {
+        popEdge( iter );
+    }
+    iter->oneRoot = XP_TRUE;
+
+    XP_U32 count = 0;
+    PatMatch match = {};
+    if ( HAS_MATCH( iter, root, &match, XP_FALSE ) ) {
+        pushEdge( iter, root, &match );
+        while ( nextWord( iter, XP_FALSE ) ) {
+            ++count;
+            if ( NULL != lens ) {
+                ++lens->lens[iter->nEdges];
+            }
+        }
+    }
+    iter->oneRoot = XP_FALSE;
+    return count;
+}
+
+static void*
+countProc( void* closure )
+{
+    CountWorker* worker = (CountWorker*)closure;
+    ParallelCount* pc = worker->pc;
+    LengthsArray* lens = NULL;
+    if ( NULL != worker->lens ) {
+        lens = &worker->myLens;
+        XP_MEMSET( lens, 0, sizeof(*lens) );
+    }
+
+    DictIter scratch;
+    XP_MEMCPY( &scratch, pc->iter, sizeof(scratch) );
+
+    for ( ; ; ) {
+        XP_S16 root = -1;
+        WITH_MUTEX( &pc->mutex );
+        if ( pc->nextRoot < pc->nRoots ) {
+            root = pc->nextRoot++;
+        }
+        END_WITH_MUTEX();
+        if ( root < 0 ) {
+            break;
+        }
+        array_edge* edge = pc->top + (root * scratch.dict->nodeSize);
+        pc->counts[root] = countUnder( &scratch, edge, lens );
+    }
+    return NULL;
+}
+
+/* Count each top-level edge's subtree separately, spreading them across
+   sNThreads threads, and remember where each subtree's words start so
+   di_getNthWord() can begin there. */
+static XP_U32
+countByRoots( DictIter* iter, LengthsArray* lens )
+{
+    const DictionaryCtxt* dict = iter->dict;
+    ParallelCount pc = { .iter = iter, .top = dict_getTopEdge( dict ), };
+    if ( !!pc.top ) {
+        for ( array_edge* edge = pc.top; ; edge += dict->nodeSize ) {
+            XP_ASSERT( pc.nRoots < MAX_ROOTS );
+            ++pc.nRoots;
+            if ( IS_LAST_EDGE( dict, edge ) ) {
+                break;
+            }
+        }
+    }
+    MUTEX_INIT( &pc.mutex, XP_FALSE );
+
+    XP_U16 nHelpers = XP_MIN( sNThreads, pc.nRoots );
+    if ( 0 < nHelpers ) {
+        --nHelpers;             /* we're one of them */
+    }
+    pthread_t threads[MAX_DICTITER_THREADS];
+    CountWorker workers[MAX_DICTITER_THREADS];
+    XP_U16 nStarted = 0;
+    for ( XP_U16 ii = 0; ii < nHelpers; ++ii ) {
+        workers[nStarted].pc = &pc;
+        workers[nStarted].lens = lens;
+        if ( 0 == pthread_create( &threads[nStarted], NULL, countProc,
+                                  &workers[nStarted] ) ) {
+            ++nStarted;
+        } else {
+            XP_LOGFF( "pthread_create() failed; using %d helpers", nStarted );
+            break;
+        }
+    }
+
+    CountWorker self = { .pc = &pc, .lens = lens, };
+    (void)countProc( &self );
+
+    if ( NULL != lens ) {
+        XP_MEMCPY( lens, &self.myLens, sizeof(*lens) );
+    }
+    for ( XP_U16 ii = 0; ii < nStarted; ++ii ) {
+        (void)pthread_join( threads[ii], NULL );
+        if ( NULL != lens ) {
+            for ( int jj = 0; jj < VSIZE(lens->lens); ++jj ) {
+                lens->lens[jj] += workers[ii].myLens.lens[jj];
+            }
+        }
+    }
+    MUTEX_DESTROY( &pc.mutex );
+
+    XP_U32 total = 0;
+    iter->nRoots = pc.nRoots;
+    for ( XP_U16 ii = 0; ii < pc.nRoots; ++ii ) {
+        iter->rootStarts[ii] = total;
+        total += pc.counts[ii];
+    }
+    iter->rootStarts[pc.nRoots] = total;
+    return total;
+} /* countByRoots */
+
+/* Make the first word under the root'th top-level edge current. There must
+   be one. */
+static void
+firstWordUnder( DictIter* iter, XP_U16 root )
+{
+    const DictionaryCtxt* dict = iter->dict;
+    while ( 0 < iter->nEdges ) {
+        popEdge( iter );
+    }
+    array_edge* edge = dict_getTopEdge( dict ) + (root * dict->nodeSize);
+    PatMatch match = {};
+    if ( HAS_MATCH( iter, edge, &match, XP_FALSE ) ) {
+        pushEdge( iter, edge, &match );
+        if ( !nextWord( iter, XP_FALSE ) ) {
+            XP_ASSERT(0);
+        }
+    } else {
+        XP_ASSERT(0);
+    }
+}
+
+/* Start from the nearest of the current word and the first words of the
+   subtree holding position and the one after it. Returns the position of
+   the word that's current; the caller walks from there. */
+static DictPosition
+placeWordByRoots( DictIter* iter, DictPosition position, XP_Bool validWord )
+{
+    const DictPosition* starts = iter->rootStarts;
+    XP_U16 root = 0;
+    while ( starts[root+1] <= position ) {
+        ++root;
+    }
+    XP_ASSERT( root < iter->nRoots );
+
+    /* Closer to the following subtree's first word (or, if none, the last
+       word)? */
+    DictPosition end = starts[root+1];
+    DictPosition result = starts[root];
+    XP_S16 startRoot = root;
+    if ( (end - position) < (position - starts[root]) ) {
+        startRoot = -1;
+        for ( XP_U16 next = root + 1; next < iter->nRoots; ++next ) {
+            if ( starts[next] < starts[next+1] ) {
+                startRoot = next;
+                break;
+            }
+        }
+        result = 0 <= startRoot ? end : end - 1;
+    }
+
+    if ( validWord && XP_ABS( position - iter->position )
+         <= XP_ABS( position - result ) ) {
+        result = iter->position;
+    } else if ( 0 <= startRoot ) {
+        firstWordUnder( iter, startRoot );
+    } else {
+        (void)di_lastWord( iter );
+    }
+    return result;
+} /* placeWordByRoots */
+#endif
+
 static XP_U32
 countWordsIn( DictIter* iter, LengthsArray* lens )
 {
@@ -1573,6 +1860,17 @@ countWordsIn( DictIter* iter, LengthsArray* lens )
     }
 
     XP_U32 count = 0;
+#ifdef XWFEATURE_WORDCOUNTS
+    /* indexers have to see every word */
+    if ( NULL == lens && NULL == iter->indexer && countsApply( iter ) ) {
+        return dict_wordsFrom( iter->dict, dict_getTopEdge( iter->dict ) );
+    }
+#endif
+#ifdef XWFEATURE_DICTITER_THREADS
+    if ( NULL == iter->indexer ) {
+        return countByRoots( iter, lens );
+    }
+#endif
     for ( XP_Bool ok = firstWord( iter, XP_FALSE );
           ok;
           ok = nextWord( iter, XP_FALSE) ) {
@@ -1592,7 +1890,8 @@ di_countWords( const DictIter* iter, LengthsArray* lens )
     DictIter counter;
     initIterFrom( &counter, iter, NULL );
 
-    XP_U32 result = countWordsIn( &counter, lens );
+    XP_U32 result = NULL == lens ? counter.nWords
+        : countWordsIn( &counter, lens );
     /* LOG_RETURNF( "%d", result ); */
     return result;
 }
@@ -1882,10 +2181,19 @@ di_getNthWord( DictIter* iter, XWEnv xwe, DictPosition position, XP_U16 depth,
             }
         }
 
-        if ( !success ) {
+        if ( !success && countsApply( iter ) ) {
+            success = placeWordByCount( iter, position );
+            if ( success ) {
+                iter->position = position;
+            }
+        } else if ( !success ) {
             XP_U32 wordIndex;
             if ( !!data && !!data->prefixes && !!data->indices ) {
                 wordIndex = placeWordClose( iter, position, depth, data );
+#ifdef XWFEATURE_DICTITER_THREADS
+            } else if ( 0 < iter->nRoots ) {
+                wordIndex = placeWordByRoots( iter, position, validWord );
+#endif
             } else {
                 wordCount /= 2;             /* mid-point */
 
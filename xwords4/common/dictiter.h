@@ -109,6 +109,12 @@ void di_wordToString( const DictIter* iter, XP_UCHAR* buf, XP_U16 buflen,
                       const XP_UCHAR* delim );
 void di_stringToTiles( const XP_UCHAR* str, Tile out[], XP_U16* nTiles );
 DictPosition di_getPosition( const DictIter* iter );
+
+#ifdef XWFEATURE_DICTITER_THREADS
+/* How many threads counting an iterator's words uses, each taking a
+   first-tile subtree at a time.  Process-wide; default 1. */
+void di_setNThreads( XP_U16 nThreads );
+#endif
 #ifdef CPLUS
 }
 #endif
@@ -31,25 +31,37 @@ extern "C" {
 # define DMGR_MAX_DICTS 4
 #endif
 
-    /* Maintains a LRU list of DMGR_MAX_DICTS dicts and their key.  There's no
-       crossplatform linked list implementation for Android and a short list
-       will probably do, so we'll keep this really simple: Any mention of a
-       key, whether lookup or addition, moves the item to the front of the
-       list.  If somebody has to die he comes off the end. */
+    /* Maps keys (file names, usually) to dicts, holding a ref on each.  Any
+       dict that's still in use by somebody else stays registered, however
+       many there are, so every game on a wordlist shares a single copy.
+       Of the idle ones, those only we hold, the DMGR_MAX_DICTS most recently
+       used are kept in case they're wanted again soon; past that the least
+       recently used is dropped.  Two keys can lead to the same dict, e.g.
+       two paths to one file: dmgr_getMd5() finds it by content. */
 
 typedef struct _DictPair {
     XP_UCHAR* key;
+    XP_U32 keyHash;
+    XP_U32 lastUse;
     const DictionaryCtxt* dict;
 } DictPair;
 
 struct DictMgrCtxt {
-    DictPair pairs[DMGR_MAX_DICTS];
+    DictPair* pairs;
+    XP_U16 nPairs;
+    XP_U16 nAlloced;
+    XP_U32 useCount;
+    DMgrStats stats;
     MutexState mutex;
     MPSLOT
 };
 
-static void moveToFront( DictMgrCtxt* dmgr, XP_U16 indx );
 static XP_S16 findFor( DictMgrCtxt* dmgr, const XP_UCHAR* key );
+static XP_S16 findForMd5( DictMgrCtxt* dmgr, const XP_UCHAR* md5 );
+static void touch( DictMgrCtxt* dmgr, const DictionaryCtxt* dict );
+static void addPair( DictMgrCtxt* dmgr, XWEnv xwe, const XP_UCHAR* key,
+                     const DictionaryCtxt* dict );
+static void dropIdle( DictMgrCtxt* dmgr, XWEnv xwe );
 #if defined DEBUG && defined PRINT_LOTS
     static void printInOrder( const DictMgrCtxt* dmgr );
 #else
@@ -71,12 +83,15 @@ dmgr_make( MPFORMAL_NOCOMMA )
 void
 dmgr_destroy( DictMgrCtxt* dmgr, XWEnv xwe )
 {
-    XP_U16 ii;
-    for ( ii = 0; ii < DMGR_MAX_DICTS; ++ii ) {
+    XP_LOGFF( "hits: %d; md5 hits: %d; misses: %d; evictions: %d",
+              dmgr->stats.hits, dmgr->stats.md5Hits, dmgr->stats.misses,
+              dmgr->stats.evictions );
+    for ( XP_U16 ii = 0; ii < dmgr->nPairs; ++ii ) {
         DictPair* pair = &dmgr->pairs[ii];
         dict_unref( pair->dict, xwe );
         XP_FREEP( dmgr->mpool, &pair->key );
     }
+    XP_FREEP( dmgr->mpool, &dmgr->pairs );
     MUTEX_DESTROY( &dmgr->mutex );
     XP_FREE( dmgr->mpool, dmgr );
 }
@@ -91,7 +106,10 @@ dmgr_get( DictMgrCtxt* dmgr, XWEnv xwe, const XP_UCHAR* key )
     XP_S16 index = findFor( dmgr, key );
     if ( 0 <= index ) {
         result = dict_ref( dmgr->pairs[index].dict, xwe ); /* so doesn't get nuked in a race */
-        moveToFront( dmgr, index );
+        touch( dmgr, result );
+        ++dmgr->stats.hits;
+    } else {
+        ++dmgr->stats.misses;
     }
 
     XP_LOGFF( "(key=%s)=>%p", key, result );
@@ -100,35 +118,67 @@ dmgr_get( DictMgrCtxt* dmgr, XWEnv xwe, const XP_UCHAR* key )
     return result;
 }
 
+const DictionaryCtxt*
+dmgr_getMd5( DictMgrCtxt* dmgr, XWEnv xwe, const XP_UCHAR* md5 )
+{
+    const DictionaryCtxt* result = NULL;
+    if ( !!md5 ) {
+        WITH_MUTEX_CHECKED( &dmgr->mutex, 1 );
+        XP_S16 index = findForMd5( dmgr, md5 );
+        if ( 0 <= index ) {
+            result = dict_ref( dmgr->pairs[index].dict, xwe );
+            touch( dmgr, result );
+            ++dmgr->stats.md5Hits;
+        }
+        END_WITH_MUTEX();
+    }
+    XP_LOGFF( "(md5=%s)=>%p", md5, result );
+    return result;
+}
+
 void
 dmgr_put( DictMgrCtxt* dmgr, XWEnv xwe, const XP_UCHAR* key, const DictionaryCtxt* dict )
 {
     WITH_MUTEX( &dmgr->mutex );
 
     XP_S16 loc = findFor( dmgr, key );
-    if ( NOT_FOUND == loc ) { /* reuse the last one */
-        moveToFront( dmgr, VSIZE(dmgr->pairs) - 1 );
-        DictPair* pair = dmgr->pairs; /* the head */
+    if ( NOT_FOUND == loc ) {
+        addPair( dmgr, xwe, key, dict );
+    } else if ( dmgr->pairs[loc].dict != dict ) {
+        DictPair* pair = &dmgr->pairs[loc];
         dict_unref( pair->dict, xwe );
         pair->dict = dict_ref( dict, xwe );
-        replaceStringIfDifferent( dmgr->mpool, &pair->key, key );
-    } else {
-        moveToFront( dmgr, loc );
     }
+    touch( dmgr, dict );
+    dropIdle( dmgr, xwe );
     XP_LOGFF( "(key=%s, dict=%p)", key, dict );
     printInOrder( dmgr );
 
     END_WITH_MUTEX();
 }
 
+void
+dmgr_getStats( DictMgrCtxt* dmgr, DMgrStats* stats )
+{
+    WITH_MUTEX( &dmgr->mutex );
+    *stats = dmgr->stats;
+    END_WITH_MUTEX();
+}
+
+static XP_U32
+hashKey( const XP_UCHAR* key )
+{
+    return finishHash( augmentHash( 0, (const XP_U8*)key, XP_STRLEN(key) ) );
+}
+
 static XP_S16
 findFor( DictMgrCtxt* dmgr, const XP_UCHAR* key )
 {
     XP_S16 result = NOT_FOUND;
-    XP_U16 ii;
-    for ( ii = 0; ii < VSIZE(dmgr->pairs); ++ii ) {
+    XP_U32 hash = hashKey( key );
+    for ( XP_U16 ii = 0; ii < dmgr->nPairs; ++ii ) {
         DictPair* pair = &dmgr->pairs[ii];
-        if ( !!pair->key && 0 == XP_STRCMP( key, pair->key ) ) {
+        if ( hash == pair->keyHash && 0 == XP_STRCMP( key, pair->key ) ) {
             result = ii;
             break;
         }
@@ -136,13 +186,102 @@ findFor( DictMgrCtxt* dmgr, const XP_UCHAR* key )
     return result;
 }
 
-static void 
-moveToFront( DictMgrCtxt* dmgr, XP_U16 indx )
+static XP_S16
+findForMd5( DictMgrCtxt* dmgr, const XP_UCHAR* md5 )
 {
-    if ( 0 < indx ) {
-        DictPair tmp = dmgr->pairs[indx];
-        XP_MEMMOVE( &dmgr->pairs[1], &dmgr->pairs[0], indx * sizeof(tmp));
-        dmgr->pairs[0] = tmp;
+    XP_S16 result = NOT_FOUND;
+    for ( XP_U16 ii = 0; ii < dmgr->nPairs; ++ii ) {
+        const XP_UCHAR* sum = dict_getMd5Sum( dmgr->pairs[ii].dict );
+        if ( !!sum && 0 == XP_STRCMP( md5, sum ) ) {
+            result = ii;
+            break;
+        }
+    }
+    return result;
+}
+
+/* All of a dict's keys share its time of last use */
+static void
+touch( DictMgrCtxt* dmgr, const DictionaryCtxt* dict )
+{
+    ++dmgr->useCount;
+    for ( XP_U16 ii = 0; ii < dmgr->nPairs; ++ii ) {
+        DictPair* pair = &dmgr->pairs[ii];
+        if ( pair->dict == dict ) {
+            pair->lastUse = dmgr->useCount;
+        }
+    }
+}
+
+static void
+addPair( DictMgrCtxt* dmgr, XWEnv xwe, const XP_UCHAR* key,
+         const DictionaryCtxt* dict )
+{
+    if ( dmgr->nPairs == dmgr->nAlloced ) {
+        dmgr->nAlloced = 0 == dmgr->nAlloced ? DMGR_MAX_DICTS : dmgr->nAlloced * 2;
+        dmgr->pairs = XP_REALLOC( dmgr->mpool, dmgr->pairs,
+                                  dmgr->nAlloced * sizeof(dmgr->pairs[0]) );
+    }
+    DictPair* pair = &dmgr->pairs[dmgr->nPairs++];
+    pair->key = copyString( dmgr->mpool, key );
+    pair->keyHash = hashKey( key );
+    pair->lastUse = 0;
+    pair->dict = dict_ref( dict, xwe );
+}
+
+/* Idle means the only refs are ours, one per key. Nobody can take another
+   without our mutex, which the caller holds. */
+static XP_Bool
+isIdle( const DictMgrCtxt* dmgr, const DictionaryCtxt* dict )
+{
+    XP_U16 nOurs = 0;
+    for ( XP_U16 ii = 0; ii < dmgr->nPairs; ++ii ) {
+        if ( dmgr->pairs[ii].dict == dict ) {
+            ++nOurs;
+        }
+    }
+    XP_U16 refCount;
+    WITH_MUTEX( &((DictionaryCtxt*)dict)->mutex );
+    refCount = dict->refCount;
+    END_WITH_MUTEX();
+    return refCount == nOurs;
+}
+
+static void
+dropIdle( DictMgrCtxt* dmgr, XWEnv xwe )
+{
+    for ( ; ; ) {
+        XP_U16 nIdle = 0;
+        XP_S16 oldest = NOT_FOUND;
+        for ( XP_U16 ii = 0; ii < dmgr->nPairs; ++ii ) {
+            const DictPair* pair = &dmgr->pairs[ii];
+            XP_Bool firstKey = XP_TRUE;
+            for ( XP_U16 jj = 0; firstKey && jj < ii; ++jj ) {
+                firstKey = dmgr->pairs[jj].dict != pair->dict;
+            }
+            if ( firstKey && isIdle( dmgr, pair->dict ) ) {
+                ++nIdle;
+                if ( NOT_FOUND == oldest
+                     || pair->lastUse < dmgr->pairs[oldest].lastUse ) {
+                    oldest = ii;
+                }
+            }
+        }
+        if ( nIdle <= DMGR_MAX_DICTS ) {
+            break;
+        }
+
+        const DictionaryCtxt* dict = dmgr->pairs[oldest].dict;
+        XP_LOGFF( "dropping %s", dmgr->pairs[oldest].key );
+        for ( XP_U16 ii = dmgr->nPairs; ii-- > 0; ) {
+            DictPair* pair = &dmgr->pairs[ii];
+            if ( pair->dict == dict ) {
+                XP_FREEP( dmgr->mpool, &pair->key );
+                *pair = dmgr->pairs[--dmgr->nPairs];
+                dict_unref( dict, xwe );
+            }
+        }
+        ++dmgr->stats.evictions;
     }
 }
 
@@ -150,10 +289,10 @@ moveToFront( DictMgrCtxt* dmgr, XP_U16 indx )
 static void
 printInOrder( const DictMgrCtxt* dmgr )
 {
-    XP_U16 ii;
-    for ( ii = 0; ii < VSIZE(dmgr->pairs); ++ii ) {
-        const XP_UCHAR* name = dmgr->pairs[ii].key;
-        XP_LOGFF( "dict[%d]: %s", ii, (NULL == name)? "<empty>" : name );
+    for ( XP_U16 ii = 0; ii < dmgr->nPairs; ++ii ) {
+        const DictPair* pair = &dmgr->pairs[ii];
+        XP_LOGFF( "dict[%d]: %s (%p, last used %d)", ii, pair->key,
+                  pair->dict, pair->lastUse );
     }
 }
 #endif
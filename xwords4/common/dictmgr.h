@@ -34,6 +34,18 @@ void dmgr_destroy( DictMgrCtxt* dmgr, XWEnv xwe );
 
 void dmgr_put( DictMgrCtxt* dmgr, XWEnv xwe, const XP_UCHAR* key, const DictionaryCtxt* dict );
 const DictionaryCtxt* dmgr_get( DictMgrCtxt* dmgr, XWEnv xwe, const XP_UCHAR* key );
+/* Like dmgr_get(), but for a dict with that content under any key */
+const DictionaryCtxt* dmgr_getMd5( DictMgrCtxt* dmgr, XWEnv xwe,
+                                   const XP_UCHAR* md5 );
+
+typedef struct _DMgrStats {
+    XP_U32 hits;                /* dmgr_get() found it */
+    XP_U32 md5Hits;             /* dmgr_getMd5() found it */
+    XP_U32 misses;              /* dmgr_get() didn't */
+    XP_U32 evictions;           /* idle dicts dropped */
+} DMgrStats;
+
+void dmgr_getStats( DictMgrCtxt* dmgr, DMgrStats* stats );
 
 #ifdef CPLUS
 }
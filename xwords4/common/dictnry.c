@@ -183,6 +183,85 @@ loadSpecialData( DictionaryCtxt* ctxt, XP_U8 const** ptrp,
     *ptrp = ptr;
     return success;
 } /* loadSpecialData */
+
+#ifdef XWFEATURE_COMPACT_DAWG
+static XP_U32
+dict_compact_index_from( const DictionaryCtxt* dict, array_edge* p_edge )
+{
+    array_edge_old* edge = (array_edge_old*)p_edge;
+    XP_U32 result = (edge->highByte << 8) | edge->lowByte;
+
+    if ( 0 == result ) {
+        /* no child */
+    } else if ( 0 == (result & COMPACT_FARBIT) ) {
+        /* wraps, and so fails checkSanity(), if it points before base */
+        result = ((p_edge - dict->base) / 3) - result;
+    } else {
+        result &= ~COMPACT_FARBIT;
+        result = result < dict->nFarIndices ? dict->farIndices[result]
+            : 0xFFFFFFFF;
+    }
+    return result;
+} /* dict_compact_index_from */
+
+static array_edge*
+dict_compact_follow( const DictionaryCtxt* dict, array_edge* in )
+{
+    array_edge_old* edge = (array_edge_old*)in;
+    XP_U16 field = (edge->highByte << 8) | edge->lowByte;
+
+    array_edge* result;
+    if ( 0 == field ) {
+        result = NULL;
+    } else if ( 0 == (field & COMPACT_FARBIT) ) {
+        /* no need to know our own index to go back from it */
+        result = in - (field + (field << 1));
+    } else {
+        XP_U32 index = dict->farIndices[field & ~COMPACT_FARBIT];
+        result = &dict->base[index + (index << 1)];
+    }
+    return result;
+} /* dict_compact_follow */
+
+/* Compact dicts keep the indices of far children right after the specials:
+ * a 16-bit count and that many 32-bit indices.
+ */
+static XP_Bool
+loadFarIndices( DictionaryCtxt* dctx, const XP_U8** ptrp, const XP_U8* end )
+{
+    const XP_U8* ptr = *ptrp;
+    XP_U16 nFar = 0;
+    XP_Bool success = sizeof(nFar) <= end - ptr;
+    if ( success ) {
+        XP_MEMCPY( &nFar, ptr, sizeof(nFar) );
+        ptr += sizeof(nFar);
+        nFar = XP_NTOHS( nFar );
+        success = nFar <= COMPACT_MAXFAR + 1
+            && nFar * sizeof(XP_U32) <= end - ptr;
+    }
+
+    if ( success ) {
+        XP_ASSERT( !dctx->farIndices );
+        if ( 0 < nFar ) {
+            dctx->farIndices = XP_MALLOC( dctx->mpool,
+                                          nFar * sizeof(dctx->farIndices[0]) );
+            for ( int ii = 0; ii < nFar; ++ii ) {
+                XP_U32 index;
+                XP_MEMCPY( &index, ptr, sizeof(index) );
+                ptr += sizeof(index);
+                dctx->farIndices[ii] = XP_NTOHL( index );
+            }
+        }
+        dctx->nFarIndices = nFar;
+
+        dctx->func_dict_index_from = dict_compact_index_from;
+        dctx->func_dict_follow = dict_compact_follow;
+        *ptrp = ptr;
+    }
+    LOG_RETURNF( "%s (nFar: %d)", boolToStr(success), nFar );
+    return success;
+} /* loadFarIndices */
+#endif
     
 XP_Bool
 parseCommon( DictionaryCtxt* dctx, XWEnv xwe, const XP_U8** ptrp, const XP_U8* end )
@@ -190,6 +269,9 @@ parseCommon( DictionaryCtxt* dctx, XWEnv xwe, const XP_U8** ptrp, const XP_U8* e
     const XP_U8* ptr = *ptrp;
     XP_Bool hasHeader = XP_FALSE;
     XP_Bool isUTF8 = XP_FALSE;
+#ifdef XWFEATURE_COMPACT_DAWG
+    XP_Bool isCompact = XP_FALSE;
+#endif
     XP_U16 charSize;
 
     XP_U16 flags;
@@ -230,6 +312,15 @@ parseCommon( DictionaryCtxt* dctx, XWEnv xwe, const XP_U8** ptrp, const XP_U8* e
             isUTF8 = XP_TRUE;
             dctx->is_4_byte = XP_TRUE;
             break;
+#ifdef XWFEATURE_COMPACT_DAWG
+        case 0x0006:
+            /* three bytes, but with 4-byte edges' six-bit tiles */
+            nodeSize = 3;
+            isUTF8 = XP_TRUE;
+            dctx->is_4_byte = XP_TRUE;
+            isCompact = XP_TRUE;
+            break;
+#endif
         default:
             formatOk = XP_FALSE;
             break;
@@ -375,6 +466,11 @@ parseCommon( DictionaryCtxt* dctx, XWEnv xwe, const XP_U8** ptrp, const XP_U8* e
     if ( formatOk ) {
         formatOk = loadSpecialData( dctx, &ptr, end );
     }
+#ifdef XWFEATURE_COMPACT_DAWG
+    if ( formatOk && isCompact ) {
+        formatOk = loadFarIndices( dctx, &ptr, end );
+    }
+#endif
 
     if ( formatOk ) {
         XP_ASSERT( ptr < end );
@@ -1195,6 +1291,183 @@ dict_super_edge_with_tile( const DictionaryCtxt* dict, array_edge* from,
     return from;
 } /* edge_with_tile */
 
+#ifdef XWFEATURE_NODEMAP
+# ifdef __GNUC__
+#  define NODE_BITCOUNT(bits) __builtin_popcount(bits)
+# else
+#  define NODE_BITCOUNT(bits) countBits(bits)
+# endif
+
+static array_edge*
+dict_map_edge_with_tile( const DictionaryCtxt* dict, array_edge* from,
+                         Tile tile )
+{
+    XP_U32 index = from - dict->base;
+    /* constant divisors: no division instruction */
+    index = 3 == dict->nodeSize ? index / 3 : index / 4;
+    const XP_U32* bits = &dict->nodeMap[index * dict->nodeMapWords];
+
+    XP_U16 word = tile / 32;
+    XP_U32 mask = (XP_U32)1 << (tile % 32);
+    if ( 0 == (bits[word] & mask) ) {
+        from = NULL;
+    } else {
+        XP_U16 nBefore = NODE_BITCOUNT( bits[word] & (mask - 1) );
+        while ( word-- > 0 ) {
+            nBefore += NODE_BITCOUNT( bits[word] );
+        }
+        from += nBefore * dict->nodeSize;
+        XP_ASSERT( EDGETILE( dict, from ) == tile );
+    }
+    return from;
+} /* dict_map_edge_with_tile */
+
+/* Give each edge a bitmap of its tile and those of the siblings that follow
+ * it.  (Per edge rather than per node because dict2dawg shares the tails of
+ * sibling lists, so follow() can land mid-list.)  Since siblings are sorted
+ * by tile, the edge for a tile is then found with one bit test and a count
+ * of the bits below it, rather than by walking the siblings.  Costs 4 bytes
+ * per edge (8 for dicts with more than 32 faces), so it's optional; without
+ * it edge_with_tile keeps scanning.
+ */
+static void
+buildNodeMap( DictionaryCtxt* dict, XP_U32 numEdges )
+{
+    XP_ASSERT( !dict->nodeMap );
+    if ( 0 < numEdges ) {
+        XP_U8 nWords = (dict->nFaces + 31) / 32;
+        dict->nodeMap = XP_CALLOC( dict->mpool,
+                                   numEdges * nWords * sizeof(dict->nodeMap[0]) );
+        dict->nodeMapWords = nWords;
+
+        /* Walk backwards so each edge can copy its next sibling's bits */
+        array_edge* edge = dict->base + (numEdges * dict->nodeSize);
+        for ( XP_U32 ii = numEdges; ii-- > 0; ) {
+            edge -= dict->nodeSize;
+            XP_U32* bits = &dict->nodeMap[ii * nWords];
+            if ( !IS_LAST_EDGE( dict, edge ) ) {
+                XP_MEMCPY( bits, bits + nWords, nWords * sizeof(bits[0]) );
+            }
+            Tile tile = EDGETILE( dict, edge );
+            bits[tile / 32] |= (XP_U32)1 << (tile % 32);
+        }
+
+        dict->func_dict_edge_with_tile = dict_map_edge_with_tile;
+    }
+} /* buildNodeMap */
+#endif
+
+#ifdef XWFEATURE_WORDCOUNTS
+typedef struct _CountState {
+    DictionaryCtxt* dict;
+    XP_U8* minLens;
+    XP_U8* maxLens;             /* 0: edge not counted yet */
+} CountState;
+
+#define EDGE_INDEX( dict, edge ) \
+    ((XP_U32)(((array_edge*)(edge) - (dict)->base) / (dict)->nodeSize))
+
+/* Count, for each edge from first to the end of its sibling list, the words
+ * through it and its later siblings.  Recursion is only as deep as the
+ * longest word.
+ */
+static void
+countFrom( CountState* cs, XP_U32 first )
+{
+    DictionaryCtxt* dict = cs->dict;
+    XP_U32 last = first;
+    while ( !IS_LAST_EDGE( dict, dict->base + (last * dict->nodeSize) ) ) {
+        ++last;
+    }
+
+    /* Backwards, since each edge adds its next sibling's numbers.  A tail
+       shared with another list may already be done. */
+    for ( XP_U32 ii = last + 1; ii-- > first; ) {
+        if ( 0 != cs->maxLens[ii] ) {
+            continue;
+        }
+        array_edge* edge = dict->base + (ii * dict->nodeSize);
+        XP_U32 count = 0;
+        XP_U8 minLen = 0xFF;
+        XP_U8 maxLen = 0;
+        XP_U32 child = dict_index_from( dict, edge );
+        if ( 0 != child ) {
+            if ( 0 == cs->maxLens[child] ) {
+                countFrom( cs, child );
+            }
+            count = dict->wordCounts[child];
+            minLen = cs->minLens[child] + 1;
+            maxLen = cs->maxLens[child] + 1;
+        }
+        if ( ISACCEPTING( dict, edge ) ) {
+            ++count;
+            minLen = 1;
+            maxLen = XP_MAX( maxLen, 1 );
+        }
+        if ( ii < last ) {
+            count += dict->wordCounts[ii+1];
+            minLen = XP_MIN( minLen, cs->minLens[ii+1] );
+            maxLen = XP_MAX( maxLen, cs->maxLens[ii+1] );
+        }
+        XP_ASSERT( 0 < maxLen );     /* every edge leads to a word */
+        dict->wordCounts[ii] = count;
+        cs->minLens[ii] = minLen;
+        cs->maxLens[ii] = maxLen;
+    }
+} /* countFrom */
+
+/* Give each edge the number of words through it and its later siblings, so
+ * that the words below a node, and so the position of any word, are known
+ * without walking the wordlist (see dictiter.c).  Costs 4 bytes per edge.
+ */
+static void
+buildWordCounts( DictionaryCtxt* dict, XP_U32 numEdges )
+{
+    XP_ASSERT( !dict->wordCounts );
+    if ( 0 < numEdges && !!dict->topEdge ) {
+        dict->wordCounts = XP_CALLOC( dict->mpool,
+                                      numEdges * sizeof(dict->wordCounts[0]) );
+        CountState cs = {
+            .dict = dict,
+            .minLens = XP_MALLOC( dict->mpool, numEdges ),
+            .maxLens = XP_CALLOC( dict->mpool, numEdges ),
+        };
+        XP_U32 top = EDGE_INDEX( dict, dict->topEdge );
+        countFrom( &cs, top );
+        dict->minWordLen = cs.minLens[top];
+        dict->maxWordLen = cs.maxLens[top];
+        XP_ASSERT( 0 == dict->nWords
+                   || dict->nWords == dict->wordCounts[top] );
+        XP_FREE( dict->mpool, cs.minLens );
+        XP_FREE( dict->mpool, cs.maxLens );
+    }
+} /* buildWordCounts */
+
+/* How many words go through edge and its later siblings */
+XP_U32
+dict_wordsFrom( const DictionaryCtxt* dict, array_edge* edge )
+{
+    XP_ASSERT( !!dict->wordCounts );
+    return dict->wordCounts[EDGE_INDEX( dict, edge )];
+}
+#endif
+
+#if defined XWFEATURE_NODEMAP || defined XWFEATURE_WORDCOUNTS
+/* Build the optional lookup tables.  Platform code calls this once the
+ * edges are in place and have passed checkSanity().
+ */
+void
+dict_buildTables( DictionaryCtxt* dict, XP_U32 numEdges )
+{
+# ifdef XWFEATURE_NODEMAP
+    buildNodeMap( dict, numEdges );
+# endif
+# ifdef XWFEATURE_WORDCOUNTS
+    buildWordCounts( dict, numEdges );
+# endif
+}
+#endif
+
 void
 dict_super_init( MPFORMAL DictionaryCtxt* dict )
 {
@@ -1226,6 +1499,15 @@ dict_super_destroy( DictionaryCtxt* dict )
     XP_FREEP( dict->mpool, &dict->name );
     XP_FREEP( dict->mpool, &dict->isoCode );
     XP_FREEP( dict->mpool, &dict->langName );
+#ifdef XWFEATURE_NODEMAP
+    XP_FREEP( dict->mpool, &dict->nodeMap );
+#endif
+#ifdef XWFEATURE_WORDCOUNTS
+    XP_FREEP( dict->mpool, &dict->wordCounts );
+#endif
+#ifdef XWFEATURE_COMPACT_DAWG
+    XP_FREEP( dict->mpool, &dict->farIndices );
+#endif
 }
 
 const XP_UCHAR* 
@@ -1234,6 +1516,154 @@ dict_getLangName( const DictionaryCtxt* ctxt )
     return ctxt->langName;
 }
 
+#ifdef XWFEATURE_GADDAG
+/* Header written by dict2dawg's emitGaddag(); keep in sync. */
+#define GADDAG_VERSION 2
+#define GADDAG_MD5_LEN 32
+#define GADDAG_HEADER_LEN (2 + 1 + 1 + 4 + 4 + GADDAG_MD5_LEN)
+
+static XP_U32
+gaddag_index_from( const GaddagData* gd, array_edge* p_edge )
+{
+    array_edge_new* edge = (array_edge_new*)p_edge;
+    XP_U32 result = ((edge->highByte << 8) | edge->lowByte) & 0x0000FFFF;
+
+    if ( gd->is_4_byte ) {
+        result |= ((XP_U32)edge->moreBits) << 16;
+    } else if ( (edge->bits & EXTRABITMASK_NEW) != 0 ) {
+        result |= 0x00010000;
+    }
+    return result;
+} /* gaddag_index_from */
+
+array_edge*
+gaddag_follow( const GaddagData* gd, array_edge* in )
+{
+    array_edge* result = NULL;
+    XP_U32 index = gaddag_index_from( gd, in );
+    if ( index > 0 ) {
+        XP_ASSERT( index < gd->numEdges );
+        result = &gd->base[index * gd->nodeSize];
+    }
+    return result;
+} /* gaddag_follow */
+
+/* val is a tile+1, or GADDAG_SEP */
+array_edge*
+gaddag_edge_with_val( const GaddagData* gd, array_edge* from, XP_U8 val )
+{
+    for ( ; ; ) {
+        XP_U8 candidate = GADDAGVAL( gd, from );
+        if ( candidate == val ) {
+            break;
+        }
+        /* edges are sorted, so we can quit early */
+        if ( candidate > val || IS_LAST_EDGE( dict, from ) ) {
+            from = NULL;
+            break;
+        }
+        from += gd->nodeSize;
+    }
+    return from;
+} /* gaddag_edge_with_val */
+
+/* Walk every edge as checkSanity() does for the DAWG: values in range and
+ * sorted within each node, and indices in bounds.  Once this passes the
+ * engine needn't check anything during search.
+ */
+static XP_Bool
+gaddagIsSane( const GaddagData* gd, XP_U16 nFaces )
+{
+    XP_Bool passed = XP_TRUE;
+    array_edge* edge = gd->base;
+    XP_S16 prevVal = -1;
+    for ( XP_U32 ii = 0; ii < gd->numEdges && passed; ++ii ) {
+        XP_U8 val = GADDAGVAL( gd, edge );
+        if ( val <= prevVal || val > nFaces ) {
+            XP_LOGFF( "node %d (out of %d) has too-large or out-of-order tile",
+                      ii, gd->numEdges );
+            passed = XP_FALSE;
+        } else if ( gaddag_index_from( gd, edge ) >= gd->numEdges ) {
+            XP_LOGFF( "node %d (out of %d) has too-high index", ii,
+                      gd->numEdges );
+            passed = XP_FALSE;
+        }
+        prevVal = IS_LAST_EDGE( dict, edge ) ? -1 : val;
+        edge += gd->nodeSize;
+    }
+    return passed && -1 == prevVal;
+} /* gaddagIsSane */
+
+/* Attach a GADDAG, ptr pointing at the contents of the file dict2dawg wrote
+ * for this dictionary.  Returns false, leaving the dict unchanged, if it
+ * wasn't built along with this dict: its header carries the dict's md5sum.
+ */
+XP_Bool
+dict_setGaddag( DictionaryCtxt* dict, const XP_U8* ptr, XP_U32 len )
+{
+    XP_Bool success = len > GADDAG_HEADER_LEN;
+    GaddagData gd = {};
+    if ( success ) {
+        XP_U16 version;
+        XP_MEMCPY( &version, ptr, sizeof(version) );
+        ptr += sizeof(version);
+        gd.nodeSize = *ptr++;
+        XP_U8 nFaces = *ptr++;
+        XP_U32 nWords;
+        XP_MEMCPY( &nWords, ptr, sizeof(nWords) );
+        ptr += sizeof(nWords);
+        nWords = XP_NTOHL( nWords );
+        XP_U32 topOffset;
+        XP_MEMCPY( &topOffset, ptr, sizeof(topOffset) );
+        ptr += sizeof(topOffset);
+        topOffset = XP_NTOHL( topOffset );
+        const XP_U8* md5 = ptr;
+        ptr += GADDAG_MD5_LEN;
+        len -= GADDAG_HEADER_LEN;
+
+        const XP_UCHAR* dictMd5 = dict_getMd5Sum( dict );
+
+        if ( GADDAG_VERSION != XP_NTOHS( version ) ) {
+            XP_LOGFF( "bad version %d", XP_NTOHS( version ) );
+            success = XP_FALSE;
+        } else if ( (3 != gd.nodeSize && 4 != gd.nodeSize)
+                    || 0 != (len % gd.nodeSize) ) {
+            XP_LOGFF( "bad node size %d", gd.nodeSize );
+            success = XP_FALSE;
+        } else if ( nFaces != dict->nFaces
+                    || (0 != dict->nWords && nWords != dict->nWords) ) {
+            XP_LOGFF( "face count %d or word count %d doesn't match dict",
+                      nFaces, nWords );
+            success = XP_FALSE;
+        } else if ( NULL == dictMd5
+                    || GADDAG_MD5_LEN != XP_STRLEN( dictMd5 )
+                    || 0 != XP_MEMCMP( md5, dictMd5, GADDAG_MD5_LEN ) ) {
+            XP_LOGFF( "md5sum doesn't match dict's" );
+            success = XP_FALSE;
+        } else {
+            gd.is_4_byte = 4 == gd.nodeSize;
+            gd.numEdges = len / gd.nodeSize;
+            gd.base = (array_edge*)ptr;
+            success = topOffset < gd.numEdges
+                && gaddagIsSane( &gd, nFaces );
+            if ( success ) {
+                gd.topEdge = gd.base + (topOffset * gd.nodeSize);
+                dict->gaddag = gd;
+            }
+        }
+    }
+    XP_LOGFF( "=> %s", boolToStr(success) );
+    return success;
+} /* dict_setGaddag */
+
+/* NULL if there's no GADDAG */
+const GaddagData*
+dict_getGaddag( const DictionaryCtxt* dict )
+{
+    return NULL == dict->gaddag.topEdge ? NULL : &dict->gaddag;
+}
+#endif
+
 #ifdef XWFEATURE_DICTSANITY
 XP_Bool
 checkSanity( DictionaryCtxt* dict, const XP_U32 numEdges )
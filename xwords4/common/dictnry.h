@@ -59,6 +59,21 @@ typedef struct _XP_Bitmaps {
 
 #define HEADERFLAGS_DUPS_SUPPORTED_BIT 0x0001
 
+#ifdef XWFEATURE_GADDAG
+/* Optional GADDAG built from the same wordlist as the DAWG (see dict2dawg's
+   -gaddag option).  Its edges use the DAWG's format but have their own node
+   size, and hold tile+1 so that GADDAG_SEP, which separates the reversed
+   part of each path from the forward part, can sort first.  The memory
+   belongs to the platform code that passed it to dict_setGaddag(). */
+typedef struct _GaddagData {
+    array_edge* base;
+    array_edge* topEdge;
+    XP_U32 numEdges;
+    XP_U8 nodeSize;
+    XP_Bool is_4_byte;
+} GaddagData;
+#endif
+
 struct DictionaryCtxt {
     void (*destructor)( DictionaryCtxt* dict, XWEnv xwe );
 
@@ -108,6 +123,22 @@ struct DictionaryCtxt {
     XP_Bool isUTF8;
 #ifdef DEBUG
     XP_U32 numEdges;
+#endif
+#ifdef XWFEATURE_GADDAG
+    GaddagData gaddag;
+#endif
+#ifdef XWFEATURE_NODEMAP
+    XP_U32* nodeMap;            /* see buildNodeMap() */
+    XP_U8 nodeMapWords;         /* XP_U32s per edge in nodeMap */
+#endif
+#ifdef XWFEATURE_WORDCOUNTS
+    XP_U32* wordCounts;         /* see buildWordCounts() */
+    XP_U8 minWordLen;
+    XP_U8 maxWordLen;
+#endif
+#ifdef XWFEATURE_COMPACT_DAWG
+    XP_U32* farIndices;         /* compact edges' far children; see dawg.h */
+    XP_U16 nFarIndices;
 #endif
     MPSLOT
 };
@@ -153,6 +184,21 @@ struct DictionaryCtxt {
     ((Tile)(((array_edge_old*)(edge))->bits & \
             ((dict)->is_4_byte?LETTERMASK_NEW_4:LETTERMASK_NEW_3)))
 
+#ifdef XWFEATURE_GADDAG
+/* ISACCEPTING() and IS_LAST_EDGE() work on GADDAG edges too */
+# define GADDAG_SEP 0
+# define GADDAGVAL(gd,edge) \
+    ((XP_U8)(((array_edge_old*)(edge))->bits & \
+             ((gd)->is_4_byte?LETTERMASK_NEW_4:LETTERMASK_NEW_3)))
+# define GADDAGTILE(gd,edge) ((Tile)(GADDAGVAL(gd,edge) - 1))
+
+XP_Bool dict_setGaddag( DictionaryCtxt* dict, const XP_U8* ptr, XP_U32 len );
+const GaddagData* dict_getGaddag( const DictionaryCtxt* dict );
+array_edge* gaddag_follow( const GaddagData* gd, array_edge* in );
+array_edge* gaddag_edge_with_val( const GaddagData* gd, array_edge* from,
+                                  XP_U8 val );
+#endif
+
 const DictionaryCtxt* p_dict_ref( const DictionaryCtxt* dict, XWEnv xwe
 #ifdef DEBUG_REF
                                   ,const char* func, const char* file, int line
@@ -232,6 +278,14 @@ XP_U16 countSpecials( DictionaryCtxt* ctxt );
 XP_Bool parseCommon( DictionaryCtxt* dict, XWEnv xwe, const XP_U8** ptrp,
                      const XP_U8* end );
 XP_Bool checkSanity( DictionaryCtxt* dict, XP_U32 numEdges );
+#if defined XWFEATURE_NODEMAP || defined XWFEATURE_WORDCOUNTS
+void dict_buildTables( DictionaryCtxt* dict, XP_U32 numEdges );
+#else
+# define dict_buildTables( dict, numEdges )
+#endif
+#ifdef XWFEATURE_WORDCOUNTS
+XP_U32 dict_wordsFrom( const DictionaryCtxt* dict, array_edge* edge );
+#endif
 
 /* To be called only by subclasses!!! */
 void dict_super_init( MPFORMAL DictionaryCtxt* ctxt );
@@ -22,6 +22,9 @@
 #include "dictnry.h"
 #include "util.h"
 #include "dbgutil.h"
+#ifdef XWFEATURE_ENGINE_THREADS
+# include "xwmutex.h"
+#endif
 
 #ifdef CPLUS
 extern "C" {
@@ -33,11 +36,6 @@ typedef XP_U8 Engine_rack[MAX_UNIQUE_TILES+1];
 # define NUM_SAVED_ENGINE_MOVES 10
 #endif
 
-typedef struct BlankTuple {
-    short col;
-    Tile tile;
-} BlankTuple;
-
 typedef struct _PossibleMove {
     XP_U16 score; /* Because I'm doing a memcmp to sort these things, the
                      comparison must be done differently on little-endian
@@ -49,27 +47,28 @@ typedef struct _PossibleMove {
 } PossibleMove;
 
 /* MoveIterationData is a cache of moves so that next and prev searches don't
- * always trigger an actual search.  Instead we save up to
- * NUM_SAVED_ENGINE_MOVES moves that sort together; then iteration is just
- * returning the next or previous in the cache.  The cache, savedMoves[], is
- * sorted in increasing order, with any unused entries at the low end (since
- * they sort as if score == 0).  nInMoveCache is the actual number of entries.
+ * always trigger an actual search.  Instead we save up to nMovesToSave moves
+ * that sort together; then iteration is just returning the next or previous
+ * in the cache.  The cache, engine->savedMoves[], is sorted in increasing
+ * order, with any unused entries at the low end (since they sort as if
+ * score == 0).  nInMoveCache is the actual number of entries.
  * curCacheIndex is the index of the move most recently returned, or outside
  * the range if nothing's been returned yet from the current cache.
  *
  * The cache is empty if nInMoveCache == 0, or if curCacheIndex is in a
  * position that, given engine->usePrev, indicates it's been walked through
  * the cache already rather than being poised to enter it.
+ *
+ * While a search is running savedMoves[0..nSaved) is instead a heap with
+ * the move that'll be dropped next (the lowest; the highest if usePrev) at
+ * the root.  chooseMove() sorts it into the form above.
  */
 
 typedef struct MoveIterationData {
-    /* savedMoves: if any entries are unused (because result set doesn't fill,
-       they're at the low end (where sort'll put 'em) */
-    PossibleMove savedMoves[NUM_SAVED_ENGINE_MOVES];
-    //XP_U16 lowestSavedScore;
+    XP_U16 nSaved;              /* size of the heap during search */
     PossibleMove lastSeenMove;
     XP_U16 nInMoveCache; /* num entries, 
-                            0 <= nInMoveCache < NUM_SAVED_ENGINE_MOVES */
+                            0 <= nInMoveCache <= nMovesToSave */
     XP_U16 bottom;   /* lowest non-0 entry */
     XP_S16 curCacheIndex;       /* what we last returned */
 #ifdef DEBUG
@@ -77,9 +76,41 @@ typedef struct MoveIterationData {
 #endif
 } MoveIterationData;
 
-/* one bit per tile that's possible here *\/ */
+/* One bit per tile that's possible here.  Also used for the set of tiles on
+ * the rack, so that the two can be intersected and only tiles in both
+ * visited.  Sized for the largest alphabet, not the current one, so it's
+ * the same for every language.
+ */
 typedef XP_U32 CrossBits;
-typedef struct Crosscheck { CrossBits bits[2]; } Crosscheck;
+#define CROSSBITS_NBITS (sizeof(CrossBits) * 8)
+#define CROSSBITS_NWORDS \
+    ((MAX_UNIQUE_TILES + CROSSBITS_NBITS - 1) / CROSSBITS_NBITS)
+typedef struct Crosscheck { CrossBits bits[CROSSBITS_NWORDS]; } Crosscheck;
+
+/* Crosschecks and cross-word scores for every square, in both directions of
+ * search, kept across searches.  Squares are invalidated as the model
+ * reports changes to the tiles that determine them.  Indexed by direction
+ * (0 is horizontal) then row and col as the search sees them.  Pending tiles
+ * aren't reported, so searches that include them don't use the cache.
+ */
+typedef struct _CrossCache {
+    const ModelCtxt* model;
+    const DictionaryCtxt* dict;
+    XP_U32 boardGen;
+    XP_Bool valid[2][MAX_ROWS][MAX_COLS];
+    Crosscheck checks[2][MAX_ROWS][MAX_COLS];
+    XP_U16 scores[2][MAX_ROWS][MAX_COLS];
+} CrossCache;
+
+/* What bounding scores in the current row needs; see setRowBounds() */
+typedef struct _RowBounds {
+    XP_Bool hasTile[MAX_COLS];
+    XP_Bool usable[MAX_COLS];   /* empty, and something in the rack fits */
+    XP_U8 wordMult[MAX_COLS];
+    XP_U8 letterMult[MAX_COLS];
+    XP_U8 crossMult[MAX_COLS];  /* wordMult if it makes a crossword, else 0 */
+    XP_U16 tileVals[MAX_COLS];  /* value of the tile already there */
+} RowBounds;
 
 struct EngineCtxt {
     const ModelCtxt* model;
@@ -88,6 +119,9 @@ struct EngineCtxt {
     XP_S16 turn;
 
     Engine_rack rack;
+    Crosscheck rackSet;         /* non-blank tiles with rack[tile] > 0 */
+    XP_U16 rackVals[MAX_TRAY_TILES]; /* values of the rack's tiles, highest
+                                        first */
     Tile blankTile;
     XP_Bool usePrev;
     XP_Bool searchInProgress;
@@ -97,6 +131,8 @@ struct EngineCtxt {
     XP_U16 curRow;
     XP_U16 blankCount;
     XP_U16 nMovesToSave;
+    XP_U16 maxMovesToSave;      /* room in savedMoves */
+    PossibleMove* savedMoves;
     XP_U16 star_row;
     XP_Bool returnNOW;
     XP_Bool skipProgressCallback;
@@ -107,8 +143,11 @@ struct EngineCtxt {
     XP_S16 blankValues[MAX_TRAY_TILES];
     Crosscheck rowChecks[MAX_ROWS]; // also used in xwscore
     XP_U16 scoreCache[MAX_ROWS];
+    CrossCache* crossCache;
+    RowBounds rowBounds;
 
-    XP_U16 nTilesMax;
+    XP_U16 nTilesMax;           /* how many more tiles a move may use */
+    XP_U16 nTilesAvail;         /* nTilesMax before any are placed */
 #ifdef XWFEATURE_BONUSALL
     XP_U16 allTilesBonus;
 #endif
@@ -119,15 +158,111 @@ struct EngineCtxt {
     const BdHintLimits* searchLimits;
 #endif
     XP_U16 lastRowToFill;
+#ifdef XWFEATURE_ENGINE_THREADS
+    XP_Bool isWorker;           /* copy searching on a helper thread */
+#endif
+#ifdef XWFEATURE_ENGINE_STATS
+    EngineStats stats;
+#endif
 
 #ifdef DEBUG
     XP_U16 curLimit;
     TrayTileSet tts;
+    XP_U16 tileBounds[MAX_TRAY_TILES+1]; /* for the current anchor */
 #endif
     MPSLOT
 }; /* EngineCtxt */
 
+static void
+cc_add( Crosscheck* set, Tile tile )
+{
+    XP_ASSERT( tile < MAX_UNIQUE_TILES );
+    set->bits[tile / CROSSBITS_NBITS]
+        |= (CrossBits)1 << (tile % CROSSBITS_NBITS);
+}
+
+static void
+cc_remove( Crosscheck* set, Tile tile )
+{
+    XP_ASSERT( tile < MAX_UNIQUE_TILES );
+    set->bits[tile / CROSSBITS_NBITS]
+        &= ~((CrossBits)1 << (tile % CROSSBITS_NBITS));
+}
+
+/* out = set1 & set2; returns false if that's empty */
+static XP_Bool
+cc_intersect( Crosscheck* out, const Crosscheck* set1, const Crosscheck* set2 )
+{
+    CrossBits any = 0;
+    for ( int ii = 0; ii < CROSSBITS_NWORDS; ++ii ) {
+        any |= out->bits[ii] = set1->bits[ii] & set2->bits[ii];
+    }
+    return 0 != any;
+}
+
+/* Tiles the rack can supply, limited to those in check if it's non-null.
+ * Returns false if there are none.
+ */
+static XP_Bool
+playableTiles( const EngineCtxt* engine, const Crosscheck* check,
+               Crosscheck* out )
+{
+    XP_Bool result;
+    if ( 0 == engine->rack[engine->blankTile] ) {
+        result = NULL == check
+            ? cc_intersect( out, &engine->rackSet, &engine->rackSet )
+            : cc_intersect( out, check, &engine->rackSet );
+    } else if ( NULL == check ) {
+        XP_MEMSET( out, 0xFF, sizeof(*out) );
+        result = XP_TRUE;
+    } else {
+        result = cc_intersect( out, check, check );
+    }
+    return result;
+}
+
+/* Starting at edge, the first edge of the node whose tile is in set, or
+ * NULL.  bias is subtracted from an edge's tile bits to get the tile.
+ */
+static array_edge*
+edgeInSet( array_edge* edge, XP_U16 nodeSize, XP_U8 mask, XP_U8 bias,
+           const Crosscheck* set )
+{
+    for ( ; ; ) {
+        Tile tile = (((array_edge_old*)edge)->bits & mask) - bias;
+        XP_ASSERT( tile < MAX_UNIQUE_TILES );
+        if ( 0 != (set->bits[tile / CROSSBITS_NBITS]
+                   & ((CrossBits)1 << (tile % CROSSBITS_NBITS))) ) {
+            break;
+        } else if ( IS_LAST_EDGE( dict, edge ) ) {
+            edge = NULL;
+            break;
+        }
+        edge += nodeSize;
+    }
+    return edge;
+} /* edgeInSet */
+
+static array_edge*
+dawgEdgeInSet( const DictionaryCtxt* dict, array_edge* edge,
+               const Crosscheck* set )
+{
+    return edgeInSet( edge, dict->nodeSize,
+                      dict->is_4_byte ? LETTERMASK_NEW_4 : LETTERMASK_NEW_3,
+                      0, set );
+}
+
+/* Like dawgEdgeInSet() but starting after edge */
+static array_edge*
+dawgNextEdgeInSet( const DictionaryCtxt* dict, array_edge* edge,
+                   const Crosscheck* set )
+{
+    return IS_LAST_EDGE( dict, edge ) ? NULL
+        : dawgEdgeInSet( dict, edge + dict->nodeSize, set );
+}
+
 static void findMovesOneRow( EngineCtxt* engine, XWEnv xwe );
+static void setRowBounds( EngineCtxt* engine );
 static Tile localGetBoardTile( EngineCtxt* engine, XP_U16 col, 
                                XP_U16 row, XP_Bool substBlank );
 static void findMovesForAnchor( EngineCtxt* engine, XWEnv xwe,
@@ -135,6 +270,9 @@ static void findMovesForAnchor( EngineCtxt* engine, XWEnv xwe,
 static void figureCrosschecks( EngineCtxt* engine, XP_U16 col, 
                                XP_U16 row, XP_U16* scoreP,
                                Crosscheck* check );
+static void getCrosschecks( EngineCtxt* engine, XP_U16 col, XP_U16 row,
+                            XP_U16* scoreP, Crosscheck* check );
+static void updateCrossCache( EngineCtxt* engine );
 static XP_Bool isAnchorSquare( EngineCtxt* engine, XP_U16 col, XP_U16 row );
 static array_edge* edge_from_tile( const DictionaryCtxt* dict, 
                                    array_edge* from, Tile tile );
@@ -150,16 +288,26 @@ static XP_Bool rack_remove( EngineCtxt* engine, Tile tile, XP_Bool* isBlank );
 static void rack_replace( EngineCtxt* engine, Tile tile, XP_Bool isBlank );
 static void considerMove( EngineCtxt* engine, XWEnv xwe, Tile* tiles, short tileLength,
                           short firstCol, short lastRow );
-static void considerScoreWordHasBlanks( EngineCtxt* engine, XWEnv xwe, XP_U16 blanksLeft,
+typedef struct _MoveScore MoveScore;
+static void considerScoreWordHasBlanks( EngineCtxt* engine, XWEnv xwe,
+                                        const MoveScore* ms,
                                         PossibleMove* posmove,
-                                        XP_U16 lastRow,
-                                        BlankTuple* usedBlanks,
-                                        XP_U16 usedBlanksCount );
+                                        XP_U16 lastRow );
 static void saveMoveIfQualifies( EngineCtxt* engine, PossibleMove* posmove );
 static XP_Bool move_cache_empty( const EngineCtxt* engine );
 static void init_move_cache( EngineCtxt* engine );
 static PossibleMove* next_from_cache( EngineCtxt* engine );
 static void set_search_limits( EngineCtxt* engine );
+static XP_U16 setupPass( EngineCtxt* engine );
+static XP_Bool isLastPass( const EngineCtxt* engine );
+#ifdef XWFEATURE_ENGINE_THREADS
+static void findMovesParallel( EngineCtxt* engine, XWEnv xwe );
+#endif
+#ifdef XWFEATURE_GADDAG
+static void gaddagForAnchor( EngineCtxt* engine, XWEnv xwe,
+                             const GaddagData* gd, XP_S16 prevAnchor,
+                             XP_U16 col, XP_U16 row );
+#endif
 
 #ifdef DEBUG
 static void assertPMTilesInTiles( const EngineCtxt* engine,
@@ -176,6 +324,21 @@ static XP_S16 cmpMoves( PossibleMove* m1, PossibleMove* m2 );
 #define HILITE_CELL( engine, xwe, col, row )         \
     util_hiliteCell( (engine)->util, (xwe), (col), (row) )
 
+#ifdef XWFEATURE_ENGINE_STATS
+# define STAT_INC( engine, field ) ++(engine)->stats.field
+#else
+# define STAT_INC( engine, field )
+#endif
+
+#ifdef XWFEATURE_ENGINE_THREADS
+# ifndef MAX_ENGINE_THREADS
+#  define MAX_ENGINE_THREADS 16
+# endif
+static XP_U16 sNThreads = 1;
+#endif
+#define MAX_SAVED_ENGINE_MOVES 1000
+static XP_U16 sMaxMovesToSave = NUM_SAVED_ENGINE_MOVES;
+
 /* not implemented yet */
 XP_U16
 engine_getScoreCache( EngineCtxt* engine, XP_U16 row )
@@ -197,11 +360,37 @@ engine_make( XW_UtilCtxt* util )
 
     result->util = util;
 
+    result->maxMovesToSave = sMaxMovesToSave;
+    result->savedMoves = (PossibleMove*)
+        XP_MALLOC( util->mpool,
+                   result->maxMovesToSave * sizeof(*result->savedMoves) );
+    XP_MEMSET( result->savedMoves, 0,
+               result->maxMovesToSave * sizeof(*result->savedMoves) );
+
     engine_reset( result );
 
     return result;
 } /* engine_make */
 
+void
+engine_setMaxMovesToSave( XP_U16 nMoves )
+{
+    if ( nMoves < 1 ) {
+        nMoves = 1;
+    } else if ( nMoves > MAX_SAVED_ENGINE_MOVES ) {
+        nMoves = MAX_SAVED_ENGINE_MOVES;
+    }
+    sMaxMovesToSave = nMoves;
+}
+
+#ifdef XWFEATURE_ENGINE_STATS
+void
+engine_getStats( const EngineCtxt* engine, EngineStats* stats )
+{
+    *stats = engine->stats;
+}
+#endif
+
 void
 engine_writeToStream( EngineCtxt* XP_UNUSED(ctxt), 
                       XWStreamCtxt* XP_UNUSED(stream) )
@@ -242,6 +431,10 @@ void
 engine_destroy( EngineCtxt* engine )
 {
     XP_ASSERT( engine != NULL );
+    if ( !!engine->crossCache ) {
+        XP_FREE( engine->mpool, engine->crossCache );
+    }
+    XP_FREE( engine->mpool, engine->savedMoves );
     XP_FREE( engine->mpool, engine );
 } /* engine_destroy */
 
@@ -255,10 +448,23 @@ initTray( EngineCtxt* engine, const TrayTileSet* tts )
 
     if ( result ) {
         XP_MEMSET( engine->rack, 0, sizeof(engine->rack) );
+        XP_MEMSET( &engine->rackSet, 0, sizeof(engine->rackSet) );
+        XP_MEMSET( engine->rackVals, 0, sizeof(engine->rackVals) );
         for ( int ii = 0; ii < tts->nTiles; ++ii ) {
             Tile tile = tts->tiles[ii];
             XP_ASSERT( tile < MAX_UNIQUE_TILES );
             ++engine->rack[tile];
+            if ( tile != engine->blankTile ) {
+                cc_add( &engine->rackSet, tile );
+            }
+
+            /* insertion sort, highest first */
+            XP_U16 val = dict_getTileValue( engine->dict, tile );
+            int jj;
+            for ( jj = ii; jj > 0 && engine->rackVals[jj-1] < val; --jj ) {
+                engine->rackVals[jj] = engine->rackVals[jj-1];
+            }
+            engine->rackVals[jj] = val;
         }
     }
 
@@ -290,11 +496,11 @@ print_savedMoves( const EngineCtxt* engine, const char* label )
 {
     int ii;
     int pos = 0;
-    char buf[(NUM_SAVED_ENGINE_MOVES*10) + 3] = {};
+    char buf[(MAX_SAVED_ENGINE_MOVES*10) + 3] = {};
     for ( ii = 0; ii < engine->nMovesToSave; ++ii ) {
-        if ( 0 < engine->miData.savedMoves[ii].score ) {
+        if ( 0 < engine->savedMoves[ii].score ) {
             pos += XP_SNPRINTF( &buf[pos], VSIZE(buf)-pos, "[%d]: %d; ", 
-                                ii, engine->miData.savedMoves[ii].score );
+                                ii, engine->savedMoves[ii].score );
         }
     }
     XP_LOGF( "%s: %s", label, buf );
@@ -303,51 +509,105 @@ print_savedMoves( const EngineCtxt* engine, const char* label )
 # define print_savedMoves( engine, label )
 #endif
 
+/* Heap of saved moves: the root is the one to drop first */
+static XP_Bool
+dropsBefore( const EngineCtxt* engine, PossibleMove* m1, PossibleMove* m2 )
+{
+    XP_S16 cmpVal = cmpMoves( m1, m2 );
+    return engine->usePrev ? cmpVal > 0 : cmpVal < 0;
+}
+
+static void
+siftDown( EngineCtxt* engine, XP_U16 indx, XP_U16 nMoves )
+{
+    PossibleMove* heap = engine->savedMoves;
+    PossibleMove moving = heap[indx];
+    for ( ; ; ) {
+        XP_U16 child = (2 * indx) + 1;
+        if ( child >= nMoves ) {
+            break;
+        }
+        if ( child + 1 < nMoves
+             && dropsBefore( engine, &heap[child+1], &heap[child] ) ) {
+            ++child;
+        }
+        if ( !dropsBefore( engine, &heap[child], &moving ) ) {
+            break;
+        }
+        heap[indx] = heap[child];
+        indx = child;
+    }
+    heap[indx] = moving;
+}
+
+static void
+siftUp( EngineCtxt* engine, XP_U16 indx )
+{
+    PossibleMove* heap = engine->savedMoves;
+    PossibleMove moving = heap[indx];
+    while ( 0 < indx ) {
+        XP_U16 parent = (indx - 1) / 2;
+        if ( !dropsBefore( engine, &moving, &heap[parent] ) ) {
+            break;
+        }
+        heap[indx] = heap[parent];
+        indx = parent;
+    }
+    heap[indx] = moving;
+}
+
+/* Turn the heap into the cache: sorted in increasing order at the top of
+ * savedMoves[0..nMovesToSave), with unused entries zeroed at the bottom.
+ */
+static void
+sortSavedMoves( EngineCtxt* engine )
+{
+    PossibleMove* moves = engine->savedMoves;
+    XP_U16 nSaved = engine->miData.nSaved;
+
+    /* Heapsort: each pass moves the root to the end, so the array winds up
+       in the order the moves would be dropped, reversed */
+    for ( XP_U16 nLeft = nSaved; nLeft > 1; ) {
+        --nLeft;
+        PossibleMove tmp = moves[0];
+        moves[0] = moves[nLeft];
+        moves[nLeft] = tmp;
+        siftDown( engine, 0, nLeft );
+    }
+    if ( !engine->usePrev ) {   /* highest-first; reverse it */
+        for ( XP_U16 ii = 0; ii < nSaved / 2; ++ii ) {
+            PossibleMove tmp = moves[ii];
+            moves[ii] = moves[nSaved-1-ii];
+            moves[nSaved-1-ii] = tmp;
+        }
+    }
+
+    XP_U16 nEmpty = engine->nMovesToSave - nSaved;
+    XP_MEMMOVE( &moves[nEmpty], &moves[0], nSaved * sizeof(moves[0]) );
+    XP_MEMSET( &moves[0], 0, nEmpty * sizeof(moves[0]) );
+} /* sortSavedMoves */
+
 static XP_Bool
 chooseMove( EngineCtxt* engine, PossibleMove** move ) 
 {
-    XP_U16 ii;
     PossibleMove* chosen = NULL;
     XP_Bool result;
-    XP_Bool done;
-
-    print_savedMoves( engine, "unsorted moves" );
 
     /* First, sort 'em.  Put the higher-scoring moves at the top where they'll
-       get picked up first.  Don't sort if we're working for a robot; we've
-       only been saving the single best move anyway.  At least not until we
-       start applying other criteria than score to moves. */
-
-    done = !move_cache_empty( engine );
-    while ( !done ) { /* while so can break */
-        done = XP_TRUE;
-        PossibleMove* cur = engine->miData.savedMoves;
-        for ( ii = 0; ii < engine->nMovesToSave-1; ++ii ) {
-            PossibleMove* next = cur + 1;
-            if ( cmpMoves( cur, next ) > 0 ) {
-                PossibleMove tmp;
-                XP_MEMCPY( &tmp, cur, sizeof(tmp) );
-                XP_MEMCPY( cur, next, sizeof(*cur) );
-                XP_MEMCPY( next, &tmp, sizeof(*next) );
-                done = XP_FALSE;
-            }
-            cur = next;
-        }
-
-        if ( done ) {
-            if ( !engine->isRobot ) {
-                init_move_cache( engine );
-            }
-            print_savedMoves( engine, "sorted moves" );
+       get picked up first. */
+    if ( move_cache_empty( engine ) ) {
+        sortSavedMoves( engine );
+        if ( !engine->isRobot ) {
+            init_move_cache( engine );
         }
+        print_savedMoves( engine, "sorted moves" );
     }
 
     /* now pick the one we're supposed to return */
     if ( engine->isRobot ) {
-        XP_ASSERT( engine->miData.nInMoveCache <= NUM_SAVED_ENGINE_MOVES );
         XP_ASSERT( engine->miData.nInMoveCache <= engine->nMovesToSave );
         /* PENDING not nInMoveCache-1 below?? */
-        chosen = &engine->miData.savedMoves[engine->miData.nInMoveCache];
+        chosen = &engine->savedMoves[engine->miData.nInMoveCache];
     } else {
         chosen = next_from_cache( engine );
     }
@@ -370,15 +630,19 @@ normalizeIQ( EngineCtxt* engine, XP_U16 iq )
 {
     engine->isRobot = 0 < iq;
     if ( 0 == iq ) {            /* human */
-        engine->nMovesToSave = NUM_SAVED_ENGINE_MOVES; /* save 'em all */
+        engine->nMovesToSave = engine->maxMovesToSave; /* save 'em all */
     } else if ( 1 == iq ) {            /* smartest robot */
         engine->nMovesToSave = 1;
     } else {
+        /* Not maxMovesToSave: asking for more hints shouldn't make robots
+           dumber */
         XP_U16 count = NUM_SAVED_ENGINE_MOVES * iq / 100;
         engine->nMovesToSave = 1;
         if ( count > 0 ) {
             engine->nMovesToSave += XP_RANDOM() % count;
         }
+        engine->nMovesToSave = XP_MIN( engine->nMovesToSave,
+                                       engine->maxMovesToSave );
     }
 }
 
@@ -444,6 +708,7 @@ engine_findMove( EngineCtxt* engine, XWEnv xwe, const ModelCtxt* model,
         engine->nTilesMin = 1;
     }
 #endif
+    engine->nTilesAvail = engine->nTilesMax;
 
     engine->model = model;
     engine->dict = model_getPlayerDict( model, turn );
@@ -476,9 +741,9 @@ engine_findMove( EngineCtxt* engine, XWEnv xwe, const ModelCtxt* model,
 
         if ( move_cache_empty( engine ) ) {
             set_search_limits( engine );
+            updateCrossCache( engine );
 
-            XP_MEMSET( engine->miData.savedMoves, 0,
-                       sizeof(engine->miData.savedMoves) );
+            engine->miData.nSaved = 0;
 
             if ( engine->searchInProgress ) {
                 goto resumePoint;
@@ -486,31 +751,14 @@ engine_findMove( EngineCtxt* engine, XWEnv xwe, const ModelCtxt* model,
                 engine->searchHorizontal = XP_TRUE;
                 engine->searchInProgress = XP_TRUE;
             }
-            for ( ; ; ) {
-                XP_U16 firstRowToFill = 0;
-                engine->numRows = model_numRows(engine->model);
-                engine->numCols = model_numCols(engine->model);
-                if ( !engine->searchHorizontal ) {
-                    XP_U16 tmp = engine->numRows;
-                    engine->numRows = engine->numCols;
-                    engine->numCols = tmp;
-                }
-
-                if ( 0 ) {
-#ifdef XWFEATURE_SEARCHLIMIT
-                } else if ( !!searchLimits ) {
-                    if ( engine->searchHorizontal ) {
-                        firstRowToFill = searchLimits->top;
-                        engine->lastRowToFill = searchLimits->bottom;
-                    } else {
-                        firstRowToFill = searchLimits->left;
-                        engine->lastRowToFill = searchLimits->right;
-                    }
+#ifdef XWFEATURE_ENGINE_THREADS
+            if ( 1 < sNThreads ) {
+                findMovesParallel( engine, xwe );
+                goto outer;
+            }
 #endif
-                } else {
-                    engine->lastRowToFill = engine->numRows - 1;
-                }
-
+            for ( ; ; ) {
+                XP_U16 firstRowToFill = setupPass( engine );
                 for ( engine->curRow = firstRowToFill;
                       engine->curRow <= engine->lastRowToFill;
                       ++engine->curRow ) {
@@ -524,11 +772,7 @@ engine_findMove( EngineCtxt* engine, XWEnv xwe, const ModelCtxt* model,
                     }
                 }
 
-                if ( !engine->searchHorizontal 
-#ifdef XWFEATURE_SEARCHLIMIT
-                     || (engine->isFirstMove && !searchLimits) 
-#endif
-                     ) {
+                if ( isLastPass( engine ) ) {
                     engine->searchInProgress = XP_FALSE;
                     break;
                 } else {
@@ -587,6 +831,226 @@ engine_findMove( EngineCtxt* engine, XWEnv xwe, const ModelCtxt* model,
     return result;
 } /* engine_findMove */
 
+/* Set numRows and numCols for the current direction of search, and the range
+ * of rows (columns, if vertical) that need searching.  Returns the first.
+ */
+static XP_U16
+setupPass( EngineCtxt* engine )
+{
+    XP_U16 firstRowToFill = 0;
+    engine->numRows = model_numRows( engine->model );
+    engine->numCols = model_numCols( engine->model );
+    if ( !engine->searchHorizontal ) {
+        XP_U16 tmp = engine->numRows;
+        engine->numRows = engine->numCols;
+        engine->numCols = tmp;
+    }
+
+    if ( 0 ) {
+#ifdef XWFEATURE_SEARCHLIMIT
+    } else if ( !!engine->searchLimits ) {
+        const BdHintLimits* searchLimits = engine->searchLimits;
+        if ( engine->searchHorizontal ) {
+            firstRowToFill = searchLimits->top;
+            engine->lastRowToFill = searchLimits->bottom;
+        } else {
+            firstRowToFill = searchLimits->left;
+            engine->lastRowToFill = searchLimits->right;
+        }
+#endif
+    } else {
+        engine->lastRowToFill = engine->numRows - 1;
+    }
+    return firstRowToFill;
+} /* setupPass */
+
+static XP_Bool
+isLastPass( const EngineCtxt* engine )
+{
+    return !engine->searchHorizontal
+#ifdef XWFEATURE_SEARCHLIMIT
+        || (engine->isFirstMove && !engine->searchLimits)
+#endif
+        ;
+}
+
+#ifdef XWFEATURE_ENGINE_THREADS
+/* Parallel search.  Each row of each pass is a unit of work, and the units
+ * are handed out in order to a pool of threads each searching with a private
+ * copy of the EngineCtxt (so its own crosschecks, scoreCache and saved
+ * moves.)  The caller's thread is one of the pool, and uses the caller's
+ * engine, so it alone makes the hilite and progress callbacks.  When all
+ * units are done the helpers' saved moves are run through
+ * saveMoveIfQualifies() on the caller's engine.  Since that keeps the best N
+ * by cmpMoves() no matter the order they arrive in, the result is the same
+ * as the serial search's.
+ *
+ * Helpers pass the caller's XWEnv down to figureMoveScore(), so this is only
+ * safe on platforms where that isn't tied to a thread.
+ */
+typedef struct _SearchUnit {
+    XP_Bool horizontal;
+    XP_U16 row;
+} SearchUnit;
+
+typedef struct _ParallelSearch {
+    XWEnv xwe;
+    MutexState mutex;
+    SearchUnit units[MAX_ROWS * 2];
+    XP_U16 nUnits;
+    XP_U16 nextUnit;            /* guarded by mutex */
+    XP_Bool abort;              /* guarded by mutex */
+} ParallelSearch;
+
+typedef struct _SearchWorker {
+    ParallelSearch* ps;
+    EngineCtxt* engine;
+} SearchWorker;
+
+void
+engine_setNThreads( XP_U16 nThreads )
+{
+    if ( nThreads < 1 ) {
+        nThreads = 1;
+    } else if ( nThreads > MAX_ENGINE_THREADS ) {
+        nThreads = MAX_ENGINE_THREADS;
+    }
+    sNThreads = nThreads;
+}
+
+static void
+searchUnits( SearchWorker* worker )
+{
+    ParallelSearch* ps = worker->ps;
+    EngineCtxt* engine = worker->engine;
+
+    for ( ; ; ) {
+        const SearchUnit* unit = NULL;
+        WITH_MUTEX( &ps->mutex );
+        if ( !ps->abort && ps->nextUnit < ps->nUnits ) {
+            unit = &ps->units[ps->nextUnit++];
+        }
+        END_WITH_MUTEX();
+        if ( !unit ) {
+            break;
+        }
+
+        engine->searchHorizontal = unit->horizontal;
+        (void)setupPass( engine );
+        engine->curRow = unit->row;
+        findMovesOneRow( engine, ps->xwe );
+
+        if ( engine->returnNOW ) {
+            WITH_MUTEX( &ps->mutex );
+            ps->abort = XP_TRUE;
+            END_WITH_MUTEX();
+            break;
+        }
+    }
+} /* searchUnits */
+
+static void*
+searchProc( void* closure )
+{
+    searchUnits( (SearchWorker*)closure );
+    return NULL;
+}
+
+static void
+findMovesParallel( EngineCtxt* engine, XWEnv xwe )
+{
+    ParallelSearch ps = { .xwe = xwe, };
+    MUTEX_INIT( &ps.mutex, XP_FALSE );
+
+    /* Same rows, same order as the serial loop in engine_findMove() */
+    engine->searchHorizontal = XP_TRUE;
+    for ( ; ; ) {
+        XP_U16 row = setupPass( engine );
+        for ( ; row <= engine->lastRowToFill; ++row ) {
+            if ( !engine->isFirstMove || row == engine->star_row ) {
+                XP_ASSERT( ps.nUnits < VSIZE(ps.units) );
+                ps.units[ps.nUnits].horizontal = engine->searchHorizontal;
+                ps.units[ps.nUnits].row = row;
+                ++ps.nUnits;
+            }
+        }
+        if ( isLastPass( engine ) ) {
+            break;
+        }
+        engine->searchHorizontal = XP_FALSE;
+    }
+
+    XP_U16 nHelpers = XP_MIN( sNThreads, ps.nUnits );
+    if ( 0 < nHelpers ) {
+        --nHelpers;             /* we're one of them */
+    }
+    EngineCtxt* helpers = NULL;
+    pthread_t threads[MAX_ENGINE_THREADS];
+    SearchWorker workers[MAX_ENGINE_THREADS];
+    XP_U16 nStarted = 0;
+    if ( 0 < nHelpers ) {
+        helpers = (EngineCtxt*)XP_MALLOC( engine->mpool,
+                                          nHelpers * sizeof(*helpers) );
+    }
+    for ( XP_U16 ii = 0; ii < nHelpers; ++ii ) {
+        EngineCtxt* helper = &helpers[ii];
+        XP_MEMCPY( helper, engine, sizeof(*helper) );
+        helper->isWorker = XP_TRUE;
+#ifdef XWFEATURE_ENGINE_STATS
+        XP_MEMSET( &helper->stats, 0, sizeof(helper->stats) );
+#endif
+        helper->skipProgressCallback = XP_TRUE;
+        helper->savedMoves = (PossibleMove*)
+            XP_MALLOC( engine->mpool, engine->nMovesToSave
+                       * sizeof(*helper->savedMoves) );
+
+        workers[nStarted].ps = &ps;
+        workers[nStarted].engine = helper;
+        if ( 0 == pthread_create( &threads[nStarted], NULL, searchProc,
+                                  &workers[nStarted] ) ) {
+            ++nStarted;
+        } else {
+            XP_LOGFF( "pthread_create() failed; using %d helpers", nStarted );
+            XP_FREE( engine->mpool, helper->savedMoves );
+            break;
+        }
+    }
+
+    SearchWorker self = { .ps = &ps, .engine = engine, };
+    searchUnits( &self );
+
+    for ( XP_U16 ii = 0; ii < nStarted; ++ii ) {
+        (void)pthread_join( threads[ii], NULL );
+    }
+
+    if ( ps.abort ) {
+        /* Interrupted: drop it all. There's no resuming a parallel search */
+        engine->returnNOW = XP_TRUE;
+        engine->searchInProgress = XP_FALSE;
+    } else {
+        for ( XP_U16 ii = 0; ii < nStarted; ++ii ) {
+            const EngineCtxt* helper = workers[ii].engine;
+            for ( XP_U16 jj = 0; jj < helper->miData.nSaved; ++jj ) {
+                saveMoveIfQualifies( engine, &helper->savedMoves[jj] );
+            }
+#ifdef XWFEATURE_ENGINE_STATS
+            engine->stats.nCandidates += helper->stats.nCandidates;
+            engine->stats.nNodes += helper->stats.nNodes;
+#endif
+        }
+        engine->searchInProgress = XP_FALSE;
+    }
+
+    for ( XP_U16 ii = 0; ii < nStarted; ++ii ) {
+        XP_FREE( engine->mpool, helpers[ii].savedMoves );
+    }
+    if ( !!helpers ) {
+        XP_FREE( engine->mpool, helpers );
+    }
+    MUTEX_DESTROY( &ps.mutex );
+} /* findMovesParallel */
+#endif
+
 static void
 findMovesOneRow( EngineCtxt* engine, XWEnv xwe )
 {
@@ -618,11 +1082,11 @@ findMovesOneRow( EngineCtxt* engine, XWEnv xwe )
         if ( col < firstSearchCol || col > lastSearchCol ) {
             engine->scoreCache[col] = 0;
         } else {
-            figureCrosschecks( engine, col, row, 
-                               &engine->scoreCache[col],
-                               &engine->rowChecks[col]);
+            getCrosschecks( engine, col, row, &engine->scoreCache[col],
+                            &engine->rowChecks[col] );
         }
     }
+    setRowBounds( engine );
 
     XP_S16 prevAnchor = firstSearchCol - 1;
     for ( XP_U16 col = firstSearchCol; col <= lastSearchCol && !engine->returnNOW;
@@ -723,7 +1187,11 @@ figureCrosschecks( EngineCtxt* engine, XP_U16 x, XP_U16 y, XP_U16* scoreP,
             if ( in_edge == NULL ) {
                 /* Only way to have gotten here is if a user's played a word
                    not in this dict.  We'll not be able to build on it! */
-                XP_ASSERT( check->bits[0] == 0L && check->bits[1] == 0L );
+#ifdef DEBUG
+                for ( int ii = 0; ii < CROSSBITS_NWORDS; ++ii ) {
+                    XP_ASSERT( 0 == check->bits[ii] );
+                }
+#endif
                 goto outer;
             }
             ++startY;
@@ -753,9 +1221,7 @@ figureCrosschecks( EngineCtxt* engine, XP_U16 x, XP_U16 y, XP_U16* scoreP,
             XP_ASSERT( tile < MAX_UNIQUE_TILES );
             tiles[0] = tile;
             if ( lookup( dict, in_edge, tiles, 0, tilesAfter ) ) {
-                XP_ASSERT( (tile >> 5)
-                           < (VSIZE(check->bits)) );
-                check->bits[tile>>5] |= (1L << (tile & 0x1F));
+                cc_add( check, tile );
             }
 
             if ( IS_LAST_EDGE(dict,candidateEdge ) ) {
@@ -770,6 +1236,75 @@ figureCrosschecks( EngineCtxt* engine, XP_U16 x, XP_U16 y, XP_U16* scoreP,
     }
 } /* figureCrosschecks */
 
+static void
+invalidateCrossCache( void* closure, XP_U16 col, XP_U16 row )
+{
+    CrossCache* cache = (CrossCache*)closure;
+    /* A tile at col,row can change the crosscheck of any square in its column
+       when searching horizontally, and in its row when searching
+       vertically. */
+    for ( XP_U16 ii = 0; ii < MAX_ROWS; ++ii ) {
+        cache->valid[0][ii][col] = XP_FALSE;
+        cache->valid[1][ii][row] = XP_FALSE;
+    }
+}
+
+/* Bring the cache up to date with the model before a search starts */
+static void
+updateCrossCache( EngineCtxt* engine )
+{
+    if ( !engine->includePending ) {
+        const ModelCtxt* model = engine->model;
+        CrossCache* cache = engine->crossCache;
+        XP_Bool flush = XP_TRUE;
+        if ( !cache ) {
+            cache = engine->crossCache
+                = (CrossCache*)XP_MALLOC( engine->mpool, sizeof(*cache) );
+        } else if ( cache->model == model && cache->dict == engine->dict ) {
+            flush = !model_changesSince( model, cache->boardGen,
+                                         invalidateCrossCache, cache );
+        }
+
+        if ( flush ) {
+            XP_MEMSET( cache->valid, 0, sizeof(cache->valid) );
+            cache->model = model;
+            cache->dict = engine->dict;
+        }
+        cache->boardGen = model_getBoardGen( model );
+    }
+} /* updateCrossCache */
+
+static void
+getCrosschecks( EngineCtxt* engine, XP_U16 col, XP_U16 row, XP_U16* scoreP,
+                Crosscheck* check )
+{
+    CrossCache* cache = engine->includePending ? NULL : engine->crossCache;
+    if ( !cache ) {
+        figureCrosschecks( engine, col, row, scoreP, check );
+    } else {
+        XP_U16 dir = engine->searchHorizontal ? 0 : 1;
+        XP_ASSERT( row < MAX_ROWS && col < MAX_COLS );
+        Crosscheck* cached = &cache->checks[dir][row][col];
+        XP_U16* cachedScore = &cache->scores[dir][row][col];
+        if ( !cache->valid[dir][row][col] ) {
+            XP_MEMSET( cached, 0, sizeof(*cached) );
+            figureCrosschecks( engine, col, row, cachedScore, cached );
+            cache->valid[dir][row][col] = XP_TRUE;
+            /* Checking a hit costs what the cache saves: only on request */
+#if defined DEBUG && defined DEBUG_CROSSCACHE
+        } else {
+            Crosscheck fresh = {};
+            XP_U16 freshScore;
+            figureCrosschecks( engine, col, row, &freshScore, &fresh );
+            XP_ASSERT( freshScore == *cachedScore );
+            XP_ASSERT( 0 == XP_MEMCMP( &fresh, cached, sizeof(fresh) ) );
+#endif
+        }
+        *check = *cached;
+        *scoreP = *cachedScore;
+    }
+} /* getCrosschecks */
+
 XP_Bool
 engine_check( const DictionaryCtxt* dict, Tile* tiles, XP_U16 nTiles )
 {
@@ -846,6 +1381,11 @@ hiliteForAnchor( EngineCtxt* engine, XWEnv xwe, XP_U16 col, XP_U16 row )
         row = tmp;
     }
 
+#ifdef XWFEATURE_ENGINE_THREADS
+    if ( engine->isWorker ) {
+        /* only the caller's thread talks to the UI */
+    } else
+#endif
     if ( !HILITE_CELL( engine, xwe, col, row ) ) {
         engine->returnNOW = XP_TRUE;
     }
@@ -854,6 +1394,277 @@ hiliteForAnchor( EngineCtxt* engine, XWEnv xwe, XP_U16 col, XP_U16 row )
 # define hiliteForAnchor( engine, xwe, col, row )
 #endif
 
+/* Score-bound pruning.  Once savedMoves is full a move has to score at
+ * least as well as the lowest saved one to be kept, so there's no point
+ * searching for or scoring moves that can't.
+ *
+ * Before searching from an anchor figure, for each number of tiles, the most
+ * a move through it could score, and don't let the search place more tiles
+ * than the largest number whose bound can still compete.  That bound ignores
+ * the dictionary.  The squares a move covers are a run of the usable empty
+ * squares after the previous anchor (searches from it have already found
+ * moves starting further left), and for each such run the tiles already on
+ * the board and the bonuses are known exactly.  Only the assignment of rack
+ * tiles to squares is guessed at, pairing the highest values with the
+ * squares that multiply them most.
+ *
+ * Then each word the search finds gets the same treatment with its tiles
+ * known, which is exact unless blanks are involved, before being handed to
+ * the (much slower) figureMoveScore().
+ *
+ * None of this helps when looking for lower scores (usePrev).
+ */
+static XP_Bool
+canPrune( const EngineCtxt* engine )
+{
+    return !engine->usePrev
+        && engine->miData.nSaved == engine->nMovesToSave;
+}
+
+static XWBonusType
+localGetSquareBonus( const EngineCtxt* engine, XP_U16 col, XP_U16 row )
+{
+    if ( !engine->searchHorizontal ) {
+        XP_U16 tmp = col;
+        col = row;
+        row = tmp;
+    }
+    return model_getSquareBonus( engine->model, col, row );
+}
+
+/* Called with the rack full, once the row's crosschecks are known */
+static void
+setRowBounds( EngineCtxt* engine )
+{
+    RowBounds* rb = &engine->rowBounds;
+    XP_U16 row = engine->curRow;
+    const DictionaryCtxt* dict = engine->dict;
+
+    for ( XP_U16 col = 0; col < engine->numCols; ++col ) {
+        XP_U8 wordMult = 1;
+        XP_U8 letterMult = 1;
+        switch ( localGetSquareBonus( engine, col, row ) ) {
+        case BONUS_DOUBLE_LETTER: letterMult = 2; break;
+        case BONUS_TRIPLE_LETTER: letterMult = 3; break;
+        case BONUS_QUAD_LETTER: letterMult = 4; break;
+        case BONUS_DOUBLE_WORD: wordMult = 2; break;
+        case BONUS_TRIPLE_WORD: wordMult = 3; break;
+        case BONUS_QUAD_WORD: wordMult = 4; break;
+        default: break;
+        }
+        rb->wordMult[col] = wordMult;
+        rb->letterMult[col] = letterMult;
+
+        Tile tile = localGetBoardTile( engine, col, row, XP_TRUE );
+        rb->hasTile[col] = EMPTY_TILE != tile;
+        if ( !rb->hasTile[col] ) {
+            Crosscheck playable;
+            rb->tileVals[col] = 0;
+            rb->usable[col] = playableTiles( engine, &engine->rowChecks[col],
+                                             &playable );
+            XP_Bool hasCross =
+                (0 < row && EMPTY_TILE
+                 != localGetBoardTile( engine, col, row-1, XP_FALSE ))
+                || (row + 1 < engine->numRows && EMPTY_TILE
+                    != localGetBoardTile( engine, col, row+1, XP_FALSE ));
+            rb->crossMult[col] = hasCross ? wordMult : 0;
+        } else {
+            rb->tileVals[col] = dict_getTileValue( dict, tile );
+            rb->usable[col] = XP_FALSE;
+            rb->crossMult[col] = 0;
+        }
+    }
+} /* setRowBounds */
+
+static XP_U16
+tileCountBonus( const EngineCtxt* engine, XP_U16 nTiles )
+{
+    XP_U16 result = 0;
+    if ( engine->util->gameInfo->bingoMin <= nTiles ) {
+        result += BINGO_BONUS;
+    }
+#ifdef XWFEATURE_BONUSALL
+    if ( nTiles == engine->nTilesAvail ) {
+        result += engine->allTilesBonus;
+    }
+#endif
+    return result;
+}
+
+/* Most a move placing tiles on exactly the nTiles squares in cols could
+ * score, leaving out bonuses for the number of tiles used.
+ */
+static XP_U32
+boundForSquares( const EngineCtxt* engine, const XP_U16* cols,
+                 XP_U16 nTiles )
+{
+    const RowBounds* rb = &engine->rowBounds;
+
+    /* The word runs through any tiles touching the run at either end */
+    XP_S16 first = cols[0];
+    while ( 0 < first && rb->hasTile[first-1] ) {
+        --first;
+    }
+    XP_U16 last = cols[nTiles-1];
+    while ( last + 1 < engine->numCols && rb->hasTile[last+1] ) {
+        ++last;
+    }
+    XP_U32 boardScore = 0;
+    for ( XP_U16 col = first; col <= last; ++col ) {
+        boardScore += rb->tileVals[col];
+    }
+
+    XP_U32 wordMult = 1;
+    for ( XP_U16 ii = 0; ii < nTiles; ++ii ) {
+        wordMult *= rb->wordMult[cols[ii]];
+    }
+
+    XP_U32 result = boardScore * wordMult;
+    XP_U32 mults[MAX_TRAY_TILES];
+    for ( XP_U16 ii = 0; ii < nTiles; ++ii ) {
+        XP_U16 col = cols[ii];
+        result += engine->scoreCache[col] * rb->crossMult[col];
+
+        XP_U32 mult = rb->letterMult[col] * (wordMult + rb->crossMult[col]);
+        XP_U16 jj;
+        for ( jj = ii; jj > 0 && mults[jj-1] < mult; --jj ) {
+            mults[jj] = mults[jj-1];
+        }
+        mults[jj] = mult;
+    }
+    for ( XP_U16 ii = 0; ii < nTiles; ++ii ) {
+        result += mults[ii] * engine->rackVals[ii];
+    }
+    return result;
+} /* boundForSquares */
+
+/* Return how many tiles a move through the anchor at col may use and still
+ * be worth saving; 0 means don't bother searching from it.
+ */
+static XP_U16
+boundTilesForAnchor( EngineCtxt* engine, XP_S16 prevAnchor, XP_U16 col )
+{
+    const RowBounds* rb = &engine->rowBounds;
+    XP_U16 result = 0;
+    if ( rb->usable[col] ) {
+        XP_U16 cols[MAX_COLS];
+        XP_U16 nCols = 0;
+        XP_S16 anchorIndx = 0;
+        for ( XP_U16 cc = prevAnchor + 1; cc < engine->numCols; ++cc ) {
+            if ( rb->usable[cc] ) {
+                if ( cc == col ) {
+                    anchorIndx = nCols;
+                }
+                cols[nCols++] = cc;
+            } else if ( rb->hasTile[cc] ) {
+                /* part of the word, but nothing's placed on it */
+            } else if ( cc < col ) {
+                nCols = 0;  /* nothing fits here, so no word crosses it */
+            } else {
+                break;
+            }
+        }
+
+        XP_U16 minScore = engine->savedMoves[0].score;
+        for ( XP_U16 nTiles = 1; nTiles <= engine->nTilesMax; ++nTiles ) {
+            /* try each run of nTiles squares that covers the anchor */
+            XP_Bool found = XP_FALSE;
+            XP_U32 bound = 0;
+            XP_S16 start = XP_MAX( 0, anchorIndx - nTiles + 1 );
+            for ( ; start <= anchorIndx && start + nTiles <= nCols; ++start ) {
+                XP_U32 one = boundForSquares( engine, &cols[start], nTiles );
+                if ( !found || one > bound ) {
+                    bound = one;
+                    found = XP_TRUE;
+                }
+            }
+            if ( found ) {
+                bound += tileCountBonus( engine, nTiles );
+#ifdef DEBUG
+                engine->tileBounds[nTiles] = (XP_U16)XP_MIN( bound, 0xFFFF );
+#endif
+                if ( bound >= minScore ) {
+                    result = nTiles;
+                }
+            }
+        }
+    }
+    return result;
+} /* boundTilesForAnchor */
+
+/* The engine scores its own moves.  figureMoveScore() works for any move
+ * on any board, walking it to find each word's extent and calling
+ * model_getTile() for every letter.  Here the row's RowBounds and the
+ * crossword sums in scoreCache already hold everything but the new tiles'
+ * values, so a move's score is one pass over the squares it covers.  Blank
+ * assignments only lower the values of the tiles they replace, so each costs
+ * a subtraction per blank.
+ */
+struct _MoveScore {
+    XP_U16 score;               /* if none of the tiles is a blank */
+    XP_U16 blankCosts[MAX_TRAY_TILES]; /* what it loses if tiles[ii] is */
+    XP_U16 nWords;              /* including crosswords */
+};
+
+static void
+scoreMove( const EngineCtxt* engine, const Tile* tiles, XP_U16 nTiles,
+           XP_U16 firstCol, MoveScore* ms )
+{
+    const RowBounds* rb = &engine->rowBounds;
+    const DictionaryCtxt* dict = engine->dict;
+    XP_U16 blankVal = dict_getTileValue( dict, engine->blankTile );
+    XP_U16 letterVals[MAX_TRAY_TILES]; /* less blankVal; multiplied */
+    XP_U16 crossMults[MAX_TRAY_TILES];
+
+    XP_U16 col = firstCol;
+    while ( 0 < col && rb->hasTile[col-1] ) {
+        --col;
+    }
+    XP_U16 wordLen = 0;
+    XP_U32 wordScore = 0;
+    XP_U32 wordMult = 1;
+    XP_U32 crossScore = 0;
+    XP_U16 nPlaced = 0;
+    XP_U16 nWords = 0;
+    for ( ; col < engine->numCols; ++col, ++wordLen ) {
+        if ( rb->hasTile[col] ) {
+            wordScore += rb->tileVals[col];
+        } else if ( nPlaced < nTiles ) {
+            XP_U16 letterMult = rb->letterMult[col];
+            XP_U16 val = dict_getTileValue( dict, tiles[nPlaced] );
+            XP_ASSERT( val >= blankVal );
+            letterVals[nPlaced] = (val - blankVal) * letterMult;
+            crossMults[nPlaced] = rb->crossMult[col];
+            ++nPlaced;
+
+            val *= letterMult;
+            wordScore += val;
+            wordMult *= rb->wordMult[col];
+            if ( 0 < rb->crossMult[col] ) {
+                crossScore += rb->crossMult[col]
+                    * (engine->scoreCache[col] + val);
+                ++nWords;
+            }
+        } else {
+            break;
+        }
+    }
+    XP_ASSERT( nPlaced == nTiles );
+
+    if ( 1 < wordLen ) {        /* one-letter words don't count */
+        ++nWords;
+    } else {
+        wordMult = 0;
+    }
+    XP_U32 score = (wordScore * wordMult) + crossScore
+        + tileCountBonus( engine, nTiles );
+    ms->score = (XP_U16)XP_MIN( score, 0xFFFF );
+    for ( XP_U16 ii = 0; ii < nTiles; ++ii ) {
+        ms->blankCosts[ii] = letterVals[ii] * (wordMult + crossMults[ii]);
+    }
+    ms->nWords = nWords;
+} /* scoreMove */
+
 static void
 findMovesForAnchor( EngineCtxt* engine, XWEnv xwe, XP_S16* prevAnchor,
                     XP_U16 col, XP_U16 row ) 
@@ -865,8 +1676,26 @@ findMovesForAnchor( EngineCtxt* engine, XWEnv xwe, XP_S16* prevAnchor,
 
     hiliteForAnchor( engine, xwe, col, row );
 
+    XP_U16 nTilesMax = engine->nTilesMax;
+    XP_U16 nTilesUseful = nTilesMax;
+#ifdef DEBUG
+    XP_MEMSET( engine->tileBounds, 0xFF, sizeof(engine->tileBounds) );
+#endif
+    if ( canPrune( engine ) ) {
+        nTilesUseful = boundTilesForAnchor( engine, *prevAnchor, col );
+    }
+    engine->nTilesMax = nTilesUseful;
+
     if ( engine->returnNOW ) {
         /* time to bail */
+    } else if ( 0 == nTilesUseful ) {
+        *prevAnchor = col;
+#ifdef XWFEATURE_GADDAG
+    } else if ( !!dict_getGaddag( engine->dict ) ) {
+        gaddagForAnchor( engine, xwe, dict_getGaddag( engine->dict ),
+                         *prevAnchor, col, row );
+        *prevAnchor = col;
+#endif
     } else {
         limit = col - *prevAnchor - 1;
 #ifdef TEST_MINLIMIT
@@ -892,6 +1721,8 @@ findMovesForAnchor( EngineCtxt* engine, XWEnv xwe, XP_S16* prevAnchor,
     done:
         *prevAnchor = col;
     }
+
+    engine->nTilesMax = nTilesMax;
 } /* findMovesForAnchor */
 
 static array_edge*
@@ -932,28 +1763,26 @@ leftPart( EngineCtxt* engine, XWEnv xwe, Tile* tiles, XP_U16 tileLength,
           XP_U16 anchorCol, XP_U16 row )
 {
     DEBUG_ASSIGN( engine->curLimit, tileLength );
+    STAT_INC( engine, nNodes );
 
     extendRight( engine, xwe, tiles, tileLength, edge, XP_FALSE, firstCol,
                  anchorCol, row );
     if ( !engine->returnNOW ) {
-        if ( (limit > 0) && (edge != NULL) ) {
-            XP_U16 nodeSize = engine->dict->nodeSize;
-            if ( engine->nTilesMax > 0 ) {
-                for ( ; ; ) {
-                    XP_Bool isBlank;
-                    Tile tile = EDGETILE( engine->dict, edge );
-                    if ( rack_remove( engine, tile, &isBlank ) ) {
-                        tiles[tileLength] = tile;
-                        leftPart( engine, xwe, tiles, tileLength+1,
-                                  dict_follow( engine->dict, edge ), 
-                                  limit-1, firstCol-1, anchorCol, row );
-                        rack_replace( engine, tile, isBlank );
-                    }
-
-                    if ( IS_LAST_EDGE( dict, edge ) || engine->returnNOW ) {
-                        break;
-                    }
-                    edge += nodeSize;
+        Crosscheck playable;
+        if ( (limit > 0) && (edge != NULL) && (engine->nTilesMax > 0)
+             && playableTiles( engine, NULL, &playable ) ) {
+            const DictionaryCtxt* dict = engine->dict;
+            for ( edge = dawgEdgeInSet( dict, edge, &playable );
+                  !!edge && !engine->returnNOW;
+                  edge = dawgNextEdgeInSet( dict, edge, &playable ) ) {
+                XP_Bool isBlank;
+                Tile tile = EDGETILE( dict, edge );
+                if ( rack_remove( engine, tile, &isBlank ) ) {
+                    tiles[tileLength] = tile;
+                    leftPart( engine, xwe, tiles, tileLength+1,
+                              dict_follow( dict, edge ),
+                              limit-1, firstCol-1, anchorCol, row );
+                    rack_replace( engine, tile, isBlank );
                 }
             }
         }
@@ -967,6 +1796,7 @@ extendRight( EngineCtxt* engine, XWEnv xwe, Tile* tiles, XP_U16 tileLength,
 {
     Tile tile;
     const DictionaryCtxt* dict = engine->dict;
+    STAT_INC( engine, nNodes );
 
     if ( col == engine->numCols ) { /* we're off the board */
         goto check_exit;
@@ -978,46 +1808,24 @@ extendRight( EngineCtxt* engine, XWEnv xwe, Tile* tiles, XP_U16 tileLength,
             goto no_check; // don't check at the end
         }
     } else if ( tile == EMPTY_TILE ) {
-        if ( engine->nTilesMax > 0 ) {
-            CrossBits check = engine->rowChecks[col].bits[0];
-            XP_Bool advanced = XP_FALSE;
-            for ( ; ; ) {
-                XP_Bool contains;
+        Crosscheck playable;
+        if ( engine->nTilesMax > 0
+             && playableTiles( engine, &engine->rowChecks[col], &playable ) ) {
+            for ( edge = dawgEdgeInSet( dict, edge, &playable ); !!edge;
+                  edge = dawgNextEdgeInSet( dict, edge, &playable ) ) {
+                XP_Bool isBlank;
                 tile = EDGETILE( dict, edge );
-
-                /* If it's bigger than 32, use the second crosscheck.  This is
-                   a hack to optimize for the vastly more common case.  Even
-                   with languages that have more than 32 tiles at least half
-                   will be less than 32 in value. */
-                if ( (tile & ~0x1F) != 0 ) {
-                    if ( !advanced ) {
-                        check = engine->rowChecks[col].bits[1];
-                        advanced = XP_TRUE;
-                    }
-                    contains = (check & (1L << (tile-32))) != 0;
-                } else {
-                    contains = (check & (1L << tile)) != 0;
-                }
-
-                if ( contains ) {
-                    XP_Bool isBlank;
-                    if ( rack_remove( engine, tile, &isBlank ) ) {
-                        tiles[tileLength] = tile;
-                        extendRight( engine, xwe, tiles, tileLength+1,
-                                     edge_from_tile( dict, edge, tile ), 
-                                     ISACCEPTING( dict, edge ), firstCol, 
-                                     col+1, row );
-                        rack_replace( engine, tile, isBlank );
-                        if ( engine->returnNOW ) {
-                            goto no_check;
-                        }
+                if ( rack_remove( engine, tile, &isBlank ) ) {
+                    tiles[tileLength] = tile;
+                    extendRight( engine, xwe, tiles, tileLength+1,
+                                 edge_from_tile( dict, edge, tile ), 
+                                 ISACCEPTING( dict, edge ), firstCol, 
+                                 col+1, row );
+                    rack_replace( engine, tile, isBlank );
+                    if ( engine->returnNOW ) {
+                        goto no_check;
                     }
                 }
-
-                if ( IS_LAST_EDGE( dict, edge ) ) {
-                    break;
-                }
-                edge += dict->nodeSize;
             }
         }
 
@@ -1041,6 +1849,199 @@ extendRight( EngineCtxt* engine, XWEnv xwe, Tile* tiles, XP_U16 tileLength,
     return;
 } /* extendRight */
 
+#ifdef XWFEATURE_GADDAG
+/* With a GADDAG, search starts at the anchor and works left, placing tiles
+ * only on the empty squares between it and the previous anchor (so that, as
+ * with leftPart(), each move is found from its leftmost anchor) and
+ * consuming any tiles already on the board.  At the start of the word the
+ * path crosses GADDAG_SEP and continues right from the anchor.  Unlike
+ * leftPart() that never builds a left part that can't reach the anchor.
+ */
+typedef struct _GaddagSearch {
+    const GaddagData* gd;
+    XWEnv xwe;
+    XP_S16 prevAnchor;
+    XP_U16 anchorCol;
+    XP_U16 row;
+    XP_U16 nPlaced;
+    Tile board[MAX_COLS+1];   /* the row, with an EMPTY_TILE past the end */
+    Tile placed[MAX_COLS];    /* tiles from the rack, by column */
+} GaddagSearch;
+
+static void gaddagLeft( EngineCtxt* engine, GaddagSearch* gs, XP_U16 col,
+                        array_edge* node );
+
+/* Like dawgEdgeInSet().  Callers step past GADDAG_SEP first. */
+static array_edge*
+gaddagEdgeInSet( const GaddagData* gd, array_edge* edge,
+                 const Crosscheck* set )
+{
+    XP_ASSERT( GADDAG_SEP != GADDAGVAL( gd, edge ) );
+    return edgeInSet( edge, gd->nodeSize,
+                      gd->is_4_byte ? LETTERMASK_NEW_4 : LETTERMASK_NEW_3,
+                      1, set );
+}
+
+static array_edge*
+gaddagNextEdgeInSet( const GaddagData* gd, array_edge* edge,
+                     const Crosscheck* set )
+{
+    return IS_LAST_EDGE( dict, edge ) ? NULL
+        : gaddagEdgeInSet( gd, edge + gd->nodeSize, set );
+}
+
+/* The word covering firstCol..lastCol is complete */
+static void
+gaddagRecord( EngineCtxt* engine, GaddagSearch* gs, XP_U16 firstCol,
+              XP_U16 lastCol )
+{
+#ifdef XWFEATURE_SEARCHLIMIT
+    if ( gs->nPlaced < engine->nTilesMin ) {
+        return;
+    }
+#endif
+    Tile tiles[MAX_COLS];
+    XP_U16 nTiles = 0;
+    for ( XP_U16 col = firstCol; col <= lastCol; ++col ) {
+        if ( EMPTY_TILE == gs->board[col] ) {
+            tiles[nTiles++] = gs->placed[col];
+        }
+    }
+    XP_ASSERT( nTiles == gs->nPlaced );
+    considerMove( engine, gs->xwe, tiles, nTiles, firstCol, gs->row );
+} /* gaddagRecord */
+
+/* Past the separator: extend right from col, whose edges are in node */
+static void
+gaddagRight( EngineCtxt* engine, GaddagSearch* gs, XP_U16 firstCol,
+             XP_U16 col, array_edge* node )
+{
+    const GaddagData* gd = gs->gd;
+    STAT_INC( engine, nNodes );
+    if ( NULL == node || col >= engine->numCols ) {
+        /* done */
+    } else if ( EMPTY_TILE != gs->board[col] ) {
+        array_edge* edge = gaddag_edge_with_val( gd, node, gs->board[col] + 1 );
+        if ( !!edge ) {
+            if ( ISACCEPTING( dict, edge ) && EMPTY_TILE == gs->board[col+1] ) {
+                gaddagRecord( engine, gs, firstCol, col );
+            }
+            gaddagRight( engine, gs, firstCol, col + 1,
+                         gaddag_follow( gd, edge ) );
+        }
+    } else {
+        Crosscheck playable;
+        if ( engine->nTilesMax > 0
+             && playableTiles( engine, &engine->rowChecks[col], &playable ) ) {
+            XP_Bool nextEmpty = EMPTY_TILE == gs->board[col+1];
+            for ( array_edge* edge = gaddagEdgeInSet( gd, node, &playable );
+                  !!edge && !engine->returnNOW;
+                  edge = gaddagNextEdgeInSet( gd, edge, &playable ) ) {
+                XP_Bool isBlank;
+                Tile tile = GADDAGTILE( gd, edge );
+                if ( rack_remove( engine, tile, &isBlank ) ) {
+                    gs->placed[col] = tile;
+                    ++gs->nPlaced;
+                    if ( nextEmpty && ISACCEPTING( dict, edge ) ) {
+                        gaddagRecord( engine, gs, firstCol, col );
+                    }
+                    gaddagRight( engine, gs, firstCol, col + 1,
+                                 gaddag_follow( gd, edge ) );
+                    --gs->nPlaced;
+                    rack_replace( engine, tile, isBlank );
+                }
+            }
+        }
+    }
+} /* gaddagRight */
+
+/* edge, for the square at col, has been consumed going left.  If the word
+ * can start here, cross the separator and go right; if it can continue
+ * left, do that.
+ */
+static void
+gaddagAfterLeft( EngineCtxt* engine, GaddagSearch* gs, XP_U16 col,
+                 array_edge* edge )
+{
+    const GaddagData* gd = gs->gd;
+    array_edge* node = gaddag_follow( gd, edge );
+    if ( !!node && !engine->returnNOW ) {
+        /* The separator sorts first, so it's here or nowhere */
+        if ( GADDAG_SEP == GADDAGVAL( gd, node )
+             && (0 == col || EMPTY_TILE == gs->board[col-1]) ) {
+            XP_U16 anchorCol = gs->anchorCol;
+            if ( ISACCEPTING( dict, node )
+                 && EMPTY_TILE == gs->board[anchorCol+1] ) {
+                gaddagRecord( engine, gs, col, anchorCol );
+            }
+            gaddagRight( engine, gs, col, anchorCol + 1,
+                         gaddag_follow( gd, node ) );
+        }
+        if ( col > 0 ) {
+            gaddagLeft( engine, gs, col - 1, node );
+        }
+    }
+} /* gaddagAfterLeft */
+
+static void
+gaddagLeft( EngineCtxt* engine, GaddagSearch* gs, XP_U16 col,
+            array_edge* node )
+{
+    const GaddagData* gd = gs->gd;
+    STAT_INC( engine, nNodes );
+    if ( EMPTY_TILE != gs->board[col] ) {
+        array_edge* edge = gaddag_edge_with_val( gd, node, gs->board[col] + 1 );
+        if ( !!edge ) {
+            gaddagAfterLeft( engine, gs, col, edge );
+        }
+    } else {
+        Crosscheck playable;
+        if ( col > gs->prevAnchor && engine->nTilesMax > 0
+             && playableTiles( engine, &engine->rowChecks[col], &playable ) ) {
+            array_edge* edge = node;
+            if ( GADDAG_SEP == GADDAGVAL( gd, edge ) ) {
+                edge = IS_LAST_EDGE( dict, edge ) ? NULL : edge + gd->nodeSize;
+            }
+            if ( !!edge ) {
+                edge = gaddagEdgeInSet( gd, edge, &playable );
+            }
+            for ( ; !!edge && !engine->returnNOW;
+                  edge = gaddagNextEdgeInSet( gd, edge, &playable ) ) {
+                XP_Bool isBlank;
+                Tile tile = GADDAGTILE( gd, edge );
+                if ( rack_remove( engine, tile, &isBlank ) ) {
+                    gs->placed[col] = tile;
+                    ++gs->nPlaced;
+                    gaddagAfterLeft( engine, gs, col, edge );
+                    --gs->nPlaced;
+                    rack_replace( engine, tile, isBlank );
+                }
+            }
+        }
+    }
+} /* gaddagLeft */
+
+static void
+gaddagForAnchor( EngineCtxt* engine, XWEnv xwe, const GaddagData* gd,
+                 XP_S16 prevAnchor, XP_U16 col, XP_U16 row )
+{
+    GaddagSearch gs = {
+        .gd = gd,
+        .xwe = xwe,
+        .prevAnchor = prevAnchor,
+        .anchorCol = col,
+        .row = row,
+    };
+    for ( XP_U16 ii = 0; ii < engine->numCols; ++ii ) {
+        gs.board[ii] = localGetBoardTile( engine, ii, row, XP_FALSE );
+    }
+    gs.board[engine->numCols] = EMPTY_TILE;
+
+    DEBUG_ASSIGN( engine->curLimit, 0 );
+    gaddagLeft( engine, &gs, col, gd->topEdge );
+} /* gaddagForAnchor */
+#endif
+
 static XP_Bool
 rack_remove( EngineCtxt* engine, Tile tile, XP_Bool* isBlank )
 {
@@ -1052,7 +2053,9 @@ rack_remove( EngineCtxt* engine, Tile tile, XP_Bool* isBlank )
 
     XP_Bool found = XP_TRUE;
     if ( engine->rack[(short)tile] > 0 ) { /* we have the tile itself */
-        --engine->rack[(short)tile];
+        if ( 0 == --engine->rack[(short)tile] ) {
+            cc_remove( &engine->rackSet, tile );
+        }
         *isBlank = XP_FALSE;
     } else if ( engine->rack[blankIndex] > 0 ) { /* we have and must use a
                                                     blank */
@@ -1074,9 +2077,10 @@ rack_replace( EngineCtxt* engine, Tile tile, XP_Bool isBlank )
 {
     if ( isBlank ) {
         --engine->blankCount;
-        tile = engine->blankTile;
+        ++engine->rack[(short)engine->blankTile];
+    } else if ( 1 == ++engine->rack[(short)tile] ) {
+        cc_add( &engine->rackSet, tile );
     }
-    ++engine->rack[(short)tile];
 
     ++engine->nTilesMax;
 } /* rack_replace */
@@ -1089,33 +2093,49 @@ considerMove( EngineCtxt* engine, XWEnv xwe, Tile* tiles, XP_S16 tileLength,
          && !util_engineProgressCallback( engine->util, xwe ) ) {
         engine->returnNOW = XP_TRUE;
     } else {
+        STAT_INC( engine, nCandidates );
+        MoveScore ms;
+        scoreMove( engine, tiles, tileLength, firstCol, &ms );
 
-        /* if this never gets hit then the top-level caller of leftPart should
-           never pass a value greater than 7 for limit.  I think we're always
-           guaranteed to run out of tiles before finding a legal move with
-           larger values but that it's expensive to look only to fail. */
-        XP_ASSERT( engine->curLimit < MAX_TRAY_TILES );
-
-        PossibleMove posmove = {};
-        MoveInfo* mip = &posmove.moveInfo;
-        mip->isHorizontal = engine->searchHorizontal;
-        mip->commonCoord = (XP_U8)lastRow;
-        for ( XP_U16 col = firstCol; mip->nTiles < tileLength; ++col ) {
-            /* is it one of the new ones? */
-            if ( localGetBoardTile( engine, col, lastRow, XP_FALSE )
-                 == EMPTY_TILE ) { 
-                mip->tiles[mip->nTiles].tile = tiles[mip->nTiles];
-                mip->tiles[mip->nTiles].varCoord = (XP_U8)col;
-                ++mip->nTiles;
+        /* Hack: When a single-tile move involves two words it'll be found by
+           both the horizontal and vertical passes. Since it's really the same
+           move both times we don't want both. It'd be better I think to
+           change the move comparison code to detect it as a duplicate, but
+           that's a lot of work. Instead, drop it from the vertical pass. */
+        if ( !engine->searchHorizontal && 1 == tileLength
+             && 1 < ms.nWords ) {
+            XP_ASSERT( ms.nWords == 2 ); /* I think this is the limit */
+            // XP_LOGF( "%s(): dropping", __func__ );
+        } else if ( canPrune( engine )
+                    && ms.score < engine->savedMoves[0].score ) {
+            /* can't compete, and blanks only lower the score */
+        } else {
+            /* if this never gets hit then the top-level caller of leftPart
+               should never pass a value greater than 7 for limit.  I think
+               we're always guaranteed to run out of tiles before finding a
+               legal move with larger values but that it's expensive to look
+               only to fail. */
+            XP_ASSERT( engine->curLimit < MAX_TRAY_TILES );
+
+            PossibleMove posmove = {};
+            MoveInfo* mip = &posmove.moveInfo;
+            mip->isHorizontal = engine->searchHorizontal;
+            mip->commonCoord = (XP_U8)lastRow;
+            for ( XP_U16 col = firstCol; mip->nTiles < tileLength; ++col ) {
+                /* is it one of the new ones? */
+                if ( !engine->rowBounds.hasTile[col] ) {
+                    mip->tiles[mip->nTiles].tile = tiles[mip->nTiles];
+                    mip->tiles[mip->nTiles].varCoord = (XP_U8)col;
+                    ++mip->nTiles;
+                }
             }
-        }
 
-        BlankTuple blankTuples[MAX_NUM_BLANKS];
-        considerScoreWordHasBlanks( engine, xwe, engine->blankCount, &posmove,
-                                    lastRow, blankTuples, 0 );
+            considerScoreWordHasBlanks( engine, xwe, &ms, &posmove, lastRow );
+        }
     }
 } /* considerMove */
 
+#ifdef DEBUG
 static void
 countWords( const WNParams* wnp, void* closure )
 {
@@ -1125,169 +2145,101 @@ countWords( const WNParams* wnp, void* closure )
     }
 }
 
+/* scoreMove() had better agree with the model */
 static void
-considerScoreWordHasBlanks( EngineCtxt* engine, XWEnv xwe, XP_U16 blanksLeft,
-                            PossibleMove* posmove,
-                            XP_U16 lastRow, BlankTuple* usedBlanks,
-                            const XP_U16 usedBlanksCount )
+checkScore( EngineCtxt* engine, XWEnv xwe, const PossibleMove* posmove,
+            const MoveScore* ms, XP_U16 score )
 {
-    XP_U16 ii;
-
-    if ( blanksLeft == 0 ) {
-        /* Hack: When a single-tile move involves two words it'll be found by
-           both the horizontal and vertical passes. Since it's really the same
-           move both times we don't want both. It'd be better I think to
-           change the move comparison code to detect it as a duplicate, but
-           that's a lot of work. Instead, add a callback in the single-tile
-           vertical case to count words, and when the count it > 1 drop the
-           move.*/
-        WordNotifierInfo* wiip = NULL;
-        WordNotifierInfo wii;
-        XP_U16 singleTileWordCount = 0;
-        if ( !engine->searchHorizontal && 1 == posmove->moveInfo.nTiles ) {
-            wii.proc = countWords;
-            wii.closure = &singleTileWordCount;
-            wiip = &wii;
-        }
-
-        XP_U16 score = figureMoveScore( engine->model, xwe, engine->turn,
-                                        &posmove->moveInfo,
-                                        engine, (XWStreamCtxt*)NULL, wiip );
-
-        if ( singleTileWordCount > 1  ) { /* only set by special-case code above */
-            XP_ASSERT( singleTileWordCount == 2 ); /* I think this is the limit */
-            // XP_LOGF( "%s(): dropping", __func__ );
-        } else {
+    XP_U16 nWords = 0;
+    WordNotifierInfo wii = { .proc = countWords, .closure = &nWords, };
+    XP_U16 modelScore = figureMoveScore( engine->model, xwe, engine->turn,
+                                         &posmove->moveInfo, engine,
+                                         (XWStreamCtxt*)NULL, &wii );
 #ifdef XWFEATURE_BONUSALL
-            if ( 0 != engine->allTilesBonus && 0 == engine->nTilesMax ) {
-                XP_LOGFF( "adding bonus: %d becoming %d", score,
-                         score + engine->allTilesBonus );
-                score += engine->allTilesBonus;
-            }
+    if ( posmove->moveInfo.nTiles == engine->nTilesAvail ) {
+        modelScore += engine->allTilesBonus;
+    }
 #endif
-            posmove->score = score;
-            posmove->nBlanks = usedBlanksCount;
-            XP_MEMSET( &posmove->blankVals, 0, sizeof(posmove->blankVals) );
-            for ( ii = 0; ii < usedBlanksCount; ++ii ) {
-                short col = usedBlanks[ii].col;
-                posmove->blankVals[col] = usedBlanks[ii].tile;
-            }
-            XP_ASSERT( posmove->moveInfo.isHorizontal ==
-                       engine->searchHorizontal );
-            posmove->moveInfo.commonCoord = (XP_U8)lastRow;
-            saveMoveIfQualifies( engine, posmove );
-        }
-    } else {
-        Tile bTile;
-        BlankTuple* bt;
-
-        --blanksLeft;
-        XP_ASSERT( engine->blankValues[blanksLeft] < 128 );
-        bTile = (Tile)engine->blankValues[blanksLeft];
-        bt = &usedBlanks[usedBlanksCount];
-
-        /* for each letter for which the blank might be standing in... */
-        for ( ii = 0; ii < posmove->moveInfo.nTiles; ++ii ) {
-            CellTile tile = posmove->moveInfo.tiles[ii].tile;
-            if ( (tile & TILE_VALUE_MASK) == bTile && !IS_BLANK(tile) ) {
-                posmove->moveInfo.tiles[ii].tile |= TILE_BLANK_BIT;
-                bt->col = ii;
-                bt->tile = bTile;
-                considerScoreWordHasBlanks( engine, xwe, blanksLeft,
-                                            posmove, lastRow,
-                                            usedBlanks,
-                                            usedBlanksCount + 1 );
-                /* now put things back */
-                posmove->moveInfo.tiles[ii].tile &= ~TILE_BLANK_BIT;
+    XP_ASSERT( score == modelScore );
+    XP_ASSERT( nWords == ms->nWords );
+}
+#else
+# define checkScore( engine, xwe, posmove, ms, score ) XP_USE(xwe)
+#endif
+
+/* Which of the tiles showing its letter a blank replaces changes nothing but
+ * what blankCosts[] takes off the score.  So rather than save the move once
+ * per placement, give each blank the cheapest tile still free: the one
+ * placement that can't be beaten by any other.
+ */
+static void
+considerScoreWordHasBlanks( EngineCtxt* engine, XWEnv xwe,
+                            const MoveScore* ms, PossibleMove* posmove,
+                            XP_U16 lastRow )
+{
+    MoveInfo* mi = &posmove->moveInfo;
+    XP_U16 score = ms->score;
+
+    XP_MEMSET( &posmove->blankVals, 0, sizeof(posmove->blankVals) );
+    for ( XP_U16 nn = 0; nn < engine->blankCount; ++nn ) {
+        XP_ASSERT( engine->blankValues[nn] < 128 );
+        Tile bTile = (Tile)engine->blankValues[nn];
+
+        XP_S16 cheapest = -1;
+        for ( XP_U16 ii = 0; ii < mi->nTiles; ++ii ) {
+            CellTile tile = mi->tiles[ii].tile;
+            if ( (tile & TILE_VALUE_MASK) != bTile || IS_BLANK(tile) ) {
+                /* not a candidate */
+            } else if ( cheapest < 0
+                        || ms->blankCosts[ii] < ms->blankCosts[cheapest] ) {
+                cheapest = ii;
             }
         }
+        XP_ASSERT( 0 <= cheapest ); /* the blank itself is one */
+        mi->tiles[cheapest].tile |= TILE_BLANK_BIT;
+        posmove->blankVals[cheapest] = bTile;
+        score -= ms->blankCosts[cheapest];
     }
+
+    checkScore( engine, xwe, posmove, ms, score );
+    XP_ASSERT( score <= engine->tileBounds[mi->nTiles] );
+    posmove->score = score;
+    posmove->nBlanks = engine->blankCount;
+    XP_ASSERT( mi->isHorizontal == engine->searchHorizontal );
+    mi->commonCoord = (XP_U8)lastRow;
+    saveMoveIfQualifies( engine, posmove );
 } /* considerScoreWordHasBlanks */
 
 static void
 saveMoveIfQualifies( EngineCtxt* engine, PossibleMove* posmove )
 {
-    XP_S16 mostest;
-    XP_S16 cmpVal;
-    XP_Bool usePrev = engine->usePrev;
-    XP_Bool foundEmpty = XP_FALSE;
     MoveIterationData* miData = &engine->miData;
+    PossibleMove* heap = engine->savedMoves;
+    XP_Bool usePrev = engine->usePrev;
 
     assertPMTilesInTiles( engine, posmove );
 
-    if ( 1 == engine->nMovesToSave ) { /* only saving one */
-        mostest = 0;
+    XP_Bool isFull = miData->nSaved == engine->nMovesToSave;
+    /* Once we're full most candidates lose to the root on score alone */
+    if ( isFull && (usePrev ? posmove->score > heap[0].score
+                    : posmove->score < heap[0].score) ) {
+        /* not good enough */
     } else {
-        mostest = -1;
         /* we're not interested if we've seen this */
-        cmpVal = cmpMoves( posmove, &miData->lastSeenMove );
+        XP_S16 cmpVal = cmpMoves( posmove, &miData->lastSeenMove );
         if ( !usePrev && cmpVal >= 0 ) {
             /* XP_LOGF( "%s: dropping %d: >= %d", __func__, */
             /*          posmove->score, miData->lastSeenMove.score ); */
         } else if ( usePrev && cmpVal <= 0 ) {
             /* XP_LOGF( "%s: dropping %d: <= %d", __func__, */
             /*          posmove->score, miData->lastSeenMove.score ); */
-        } else {
-            XP_S16 ii;
-            /* terminate i at 1 because mostest starts at 0 */
-            for ( ii = 0; ii < engine->nMovesToSave; ++ii ) {
-                /* Find the mostest value move and overwrite it.  Note that
-                   there might not be one, as all may have the same or higher
-                   scores and those that have the same score may compare
-                   higher.
-
-                   <eeh> can't have this asssertion until I start noting the
-                   mostest saved score (setting miData.mostestSavedScore)
-                   below. */
-                /* 1/20/2001  I don't see that this assertion is valid.  I
-                   simply don't understand why it isn't tripped all the time
-                   in the old crosswords. */
-                /* XP_ASSERT( (miData->lastSeenMove.score == 0x7fff) */
-                /*    || (miData->savedMoves[i].score */
-                /*        <= posmove->score) ); */
-
-                if ( 0 == miData->savedMoves[ii].score ) {
-                    foundEmpty = XP_TRUE;
-                    mostest = ii;
-                    break;
-                } else if ( -1 == mostest ) {
-                    mostest = ii;
-                } else {
-                    cmpVal = cmpMoves( &miData->savedMoves[mostest],
-                                       &miData->savedMoves[ii] );
-                    if ( !usePrev && cmpVal > 0 ) {
-                        mostest = ii;
-                    } else if ( usePrev && cmpVal < 0 ) {
-                        mostest = ii;
-                    }
-                }
-            }
-        }
-    }
-
-    while ( mostest >= 0 ) {     /* while: so we can break */
-        /* record the score we're dumping.  No point in considering any scores
-           lower than this for the rest of this round. */
-        /* miData->lowestSavedScore =  */
-        /*     miData->savedMoves[lowest].score; */
-        /* XP_DEBUGF( "lowestSavedScore now %d\n",  */
-        /* miData->lowestSavedScore ); */
-        if ( foundEmpty ) {
-            /* we're good */
-        } else {
-            cmpVal = cmpMoves( posmove, &miData->savedMoves[mostest]);
-            if ( !usePrev && cmpVal <= 0 ) {
-                break;
-            } else if ( usePrev && cmpVal >= 0 ) {
-                break;
-            }
+        } else if ( !isFull ) {
+            heap[miData->nSaved] = *posmove;
+            siftUp( engine, miData->nSaved++ );
+        } else if ( dropsBefore( engine, &heap[0], posmove ) ) {
+            heap[0] = *posmove;
+            siftDown( engine, 0, miData->nSaved );
         }
-        /* XP_LOGF( "saving move with score %d at %d (replacing %d)\n", */
-        /*          posmove->score, mostest, */
-        /*          miData->savedMoves[mostest].score ); */
-        XP_MEMCPY( &miData->savedMoves[mostest], posmove,
-                   sizeof(miData->savedMoves[mostest]) );
-        break;
     }
 } /* saveMoveIfQualifies */
 
@@ -1301,7 +2253,7 @@ set_search_limits( EngineCtxt* engine )
         XP_U16 srcIndx = engine->usePrev
             ? engine->nMovesToSave-1 : miData->bottom;
         XP_MEMCPY( &miData->lastSeenMove, 
-                   &miData->savedMoves[srcIndx],
+                   &engine->savedMoves[srcIndx],
                    sizeof(miData->lastSeenMove) );
         //miData->lowestSavedScore = 0;
     } else {
@@ -1313,25 +2265,26 @@ set_search_limits( EngineCtxt* engine )
 static void
 init_move_cache( EngineCtxt* engine )
 {
-    XP_U16 nInMoveCache = engine->nMovesToSave;
+    XP_U16 nMovesToSave = engine->nMovesToSave;
+    XP_U16 nInMoveCache = nMovesToSave;
     MoveIterationData* miData = &engine->miData;
     XP_U16 ii;
 
-    XP_ASSERT( engine->nMovesToSave == NUM_SAVED_ENGINE_MOVES );
+    XP_ASSERT( nMovesToSave == engine->maxMovesToSave );
 
-    for ( ii = 0; ii < NUM_SAVED_ENGINE_MOVES; ++ii ) {
-        if ( 0 == miData->savedMoves[ii].score ) {
+    for ( ii = 0; ii < nMovesToSave; ++ii ) {
+        if ( 0 == engine->savedMoves[ii].score ) {
             --nInMoveCache;
         } else {
             break;
         }
     }
     miData->nInMoveCache = nInMoveCache;
-    miData->bottom = NUM_SAVED_ENGINE_MOVES - nInMoveCache;
+    miData->bottom = nMovesToSave - nInMoveCache;
 
     miData->curCacheIndex = engine->usePrev
-        ? NUM_SAVED_ENGINE_MOVES - nInMoveCache - 1
-        : NUM_SAVED_ENGINE_MOVES;
+        ? nMovesToSave - nInMoveCache - 1
+        : nMovesToSave;
 }
 
 static PossibleMove*
@@ -1345,7 +2298,7 @@ next_from_cache( EngineCtxt* engine )
         } else {
             --miData->curCacheIndex;
         }
-        move = &miData->savedMoves[miData->curCacheIndex];
+        move = &engine->savedMoves[miData->curCacheIndex];
     }
     return move;
 }
@@ -1359,7 +2312,7 @@ move_cache_empty( const EngineCtxt* engine )
     if ( 0 == miData->nInMoveCache ) {
         empty = XP_TRUE;
     } else if ( engine->usePrev ) {
-        empty = miData->curCacheIndex >= NUM_SAVED_ENGINE_MOVES - 1;
+        empty = miData->curCacheIndex >= engine->nMovesToSave - 1;
     } else {
         empty = miData->curCacheIndex <= miData->bottom;
     }
@@ -65,6 +65,28 @@ XP_Bool engine_findMove( EngineCtxt* ctxt, XWEnv xwe, const ModelCtxt* model, XP
                          MoveInfo* result, XP_U16* score );
 XP_Bool engine_check( const DictionaryCtxt* dict, Tile* buf, XP_U16 buflen );
 
+/* How many moves a hint search keeps, best first.  Process-wide, taking
+   effect for engines made afterward; clamped to 1..1000.  Robots keep far
+   fewer regardless. */
+void engine_setMaxMovesToSave( XP_U16 nMoves );
+
+#ifdef XWFEATURE_ENGINE_STATS
+/* Work done by all of an engine's searches since it was made, for
+   benchmarking (see linux/enginebench.c) */
+typedef struct EngineStats {
+    XP_U32 nCandidates;         /* complete words considered as moves */
+    XP_U32 nNodes;              /* dictionary nodes the search visited */
+} EngineStats;
+
+void engine_getStats( const EngineCtxt* engine, EngineStats* stats );
+#endif
+
+#ifdef XWFEATURE_ENGINE_THREADS
+/* How many threads engine_findMove() searches with.  Process-wide; 1, the
+   default, means search serially on the caller's thread. */
+void engine_setNThreads( XP_U16 nThreads );
+#endif
+
 #ifdef CPLUS
 }
 #endif
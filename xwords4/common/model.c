@@ -270,6 +270,8 @@ model_setSize( ModelCtxt* model, XP_U16 nCols )
         vol->tiles = XP_MALLOC( vol->mpool, TILES_SIZE(model, nCols) );
     }
     XP_MEMSET( vol->tiles, TILE_EMPTY_BIT, TILES_SIZE(model, nCols) );
+    /* Everything's changed: make sure no journal client thinks otherwise */
+    vol->changes.gen += MODEL_NCHANGES + 1;
 
     if ( !!vol->stack ) {
         stack_init( vol->stack, vol->gi->nPlayers, vol->gi->inDuplicateMode );
@@ -852,14 +854,53 @@ model_getCellOwner( ModelCtxt* model, XP_U16 col, XP_U16 row )
     return result;
 } /* model_getCellOwner */
 
+/* What the tile is to anybody not looking at pending tiles */
+static CellTile
+committedTile( CellTile tile )
+{
+    if ( 0 != (tile & TILE_PENDING_BIT) ) {
+        tile = EMPTY_TILE;
+    }
+    return tile & (TILE_VALUE_MASK | TILE_BLANK_BIT | TILE_EMPTY_BIT);
+}
+
 static void
 setModelTileRaw( ModelCtxt* model, XP_U16 col, XP_U16 row, CellTile tile )
 {
     XP_ASSERT( col < model->nCols );
     XP_ASSERT( row < model->nRows );
-    model->vol.tiles[(row*model->nCols) + col] = tile;
+    CellTile* cell = &model->vol.tiles[(row*model->nCols) + col];
+    if ( committedTile( *cell ) != committedTile( tile ) ) {
+        BoardChanges* changes = &model->vol.changes;
+        XP_U16 indx = changes->gen++ % MODEL_NCHANGES;
+        changes->cols[indx] = col;
+        changes->rows[indx] = row;
+    }
+    *cell = tile;
 } /* model_setTile */
 
+XP_U32
+model_getBoardGen( const ModelCtxt* model )
+{
+    return model->vol.changes.gen;
+}
+
+XP_Bool
+model_changesSince( const ModelCtxt* model, XP_U32 gen,
+                    BoardChangeProc proc, void* closure )
+{
+    const BoardChanges* changes = &model->vol.changes;
+    XP_U32 nChanges = changes->gen - gen; /* wraps if gen is from the future */
+    XP_Bool known = nChanges <= MODEL_NCHANGES;
+    if ( known ) {
+        for ( ; gen != changes->gen; ++gen ) {
+            XP_U16 indx = gen % MODEL_NCHANGES;
+            (*proc)( closure, changes->cols[indx], changes->rows[indx] );
+        }
+    }
+    return known;
+} /* model_changesSince */
+
 static CellTile 
 getModelTileRaw( const ModelCtxt* model, XP_U16 col, XP_U16 row )
 {
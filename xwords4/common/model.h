@@ -243,6 +243,16 @@ void model_foreachPendingCell( ModelCtxt* model, XWEnv xwe, XP_S16 turn,
                                BoardListener bl, void* data );
 void model_foreachPrevCell( ModelCtxt* model, XWEnv xwe, BoardListener bl, void* data );
 
+/* Changes to committed (not pending) tiles, for clients like the engine that
+   cache what they figure from the board.  model_changesSince() calls proc
+   for each cell changed since model_getBoardGen() returned gen, and returns
+   XP_FALSE, without calling proc, if it no longer knows (so the client must
+   assume everything changed.) */
+typedef void (*BoardChangeProc)( void* closure, XP_U16 col, XP_U16 row );
+XP_U32 model_getBoardGen( const ModelCtxt* model );
+XP_Bool model_changesSince( const ModelCtxt* model, XP_U32 gen,
+                            BoardChangeProc proc, void* closure );
+
 void model_writeGameHistory( ModelCtxt* model, XWEnv xwe, XWStreamCtxt* stream,
                              ServerCtxt* server, /* for player names */
                              XP_Bool gameOver );
@@ -49,6 +49,18 @@ typedef struct _RecordWordsInfo {
     XP_U16 nWords;
 } RecordWordsInfo;
 
+#ifndef MODEL_NCHANGES
+# define MODEL_NCHANGES 32
+#endif
+
+/* Ring of the most recent cells whose committed tile changed, for
+   model_changesSince() */
+typedef struct _BoardChanges {
+    XP_U32 gen;                 /* number of changes ever made */
+    XP_U8 cols[MODEL_NCHANGES];
+    XP_U8 rows[MODEL_NCHANGES];
+} BoardChanges;
+
 typedef struct ModelVolatiles {
     XW_DUtilCtxt* dutil;
     XW_UtilCtxt* util;
@@ -66,6 +78,7 @@ typedef struct ModelVolatiles {
     WordNotifierInfo wni; 
     XP_U16 nTilesOnBoard;
     CellTile* tiles;
+    BoardChanges changes;
 
     XP_U16 nBonuses;
     XWBonusType* bonuses;
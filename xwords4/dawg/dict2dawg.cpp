@@ -48,6 +48,8 @@
 #include <netinet/in.h>
 #include <assert.h>
 #include <errno.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <algorithm>
 
 #include <string>
@@ -97,13 +99,25 @@ std::vector<wchar_t> gRevMap;
 #ifdef DEBUG
 bool gDebug = false;
 #endif
-std::map<NodeList, int> gSubsHash;
+static std::vector<int> gSubsTable; // offsets into gNodes; 0 is empty
+static size_t gSubsCount = 0;
 bool gForceFour = false;             // use four bytes regardless of need?
 static int gFileSize = 0;
 int gNBytesPerNode;
 bool gUseUnicode;
 int gLimLow = 2;
 int gLimHigh = MAX_WORD_LEN;
+static char* gGaddagOut = NULL;         // where to write GADDAG, if anywhere
+static char* gGaddagMd5 = NULL;         // -gaddagmd5: md5sum to stamp it with
+static std::vector<char> gAccepted; // words kept, for the GADDAG, each
+                                    // followed by '\0'
+static size_t gNAccepted = 0;
+static bool gStats = false;         // report time and memory per phase
+static char* gFarOut = NULL;        // -compact: where to write far table
+static bool gCompact = false;       // using compact nodes (see dawg.h)
+static std::vector<unsigned int> gFarTable; // compact nodes' far children
+static bool gBuildingGaddag = false;
+static WordList* gInputStrings = NULL;
 
 
 // OWL is 1.7M
@@ -141,8 +155,15 @@ static void printNode( int index, Node node );
 static void moveTopToFront( int* firstRef );
 static void emitNodes( unsigned int nBytesPerOutfile, const char* outFileBase );
 static void outputNode( Node node, int nBytes, FILE* outfile );
+static bool buildFarTable( void );
+static void outputCompactNode( Node node, unsigned int index, FILE* outfile );
 static void printOneLevel( int index, char* str, int curlen );
 static void readFromSortedArray( void );
+static void noteAccepted( const Letter* word );
+static void buildGaddag( void );
+static void emitGaddag( const char* fileName, int firstRootChildOffset );
+static void stampGaddag( const char* fileName, const char* md5File );
+static void reportStats( const char* phase );
 
 int 
 main( int argc, char** argv ) 
@@ -150,7 +171,11 @@ main( int argc, char** argv )
     gReadWordProc = readFromSortedArray;
 
     const char* inFileName;
-    if ( NULL == parseARGV( argc, argv, &inFileName ) ) {
+    const char* tableFile = parseARGV( argc, argv, &inFileName );
+    if ( gGaddagMd5 ) {
+        stampGaddag( gGaddagOut, gGaddagMd5 );
+        exit( 0 );
+    } else if ( NULL == tableFile ) {
         usage(argv[0]);
         exit(1);
     }
@@ -196,10 +221,13 @@ main( int argc, char** argv )
         gInFile = fopen( inFileName, "r" );
     }
     
+    reportStats( "start" );
     (*gReadWordProc)();
+    reportStats( "read" );
 
     int firstRootChildOffset = buildNode(0);
     moveTopToFront( &firstRootChildOffset );
+    reportStats( "build" );
 
     if ( gStartNodeOut ) {
         write32( gStartNodeOut, firstRootChildOffset );
@@ -229,17 +257,214 @@ main( int argc, char** argv )
 
     if ( gBytesPerNodeFile ) {
         FILE* OFILE = fopen( gBytesPerNodeFile, "w" );
-        fprintf( OFILE, "%d", gNBytesPerNode );
+        // "c3" tells the makefile to set the compact format's flags
+        fprintf( OFILE, gCompact ? "c%d" : "%d", gNBytesPerNode );
         fclose( OFILE );
     }
-    fprintf( stderr, "Used %d per node.\n", gNBytesPerNode );
+    fprintf( stderr, "Used %d per node%s.\n", gNBytesPerNode,
+             gCompact ? " (compact)" : "" );
 
     if ( NULL != inFileName ) {
         fclose( gInFile );
     }
 
+    reportStats( "emit" );
+
+    if ( gGaddagOut ) {
+        buildGaddag();
+    }
 } /* main */
 
+// With -stats, say how long each phase took and the peak RSS so far
+static void
+reportStats( const char* phase )
+{
+    static struct timeval s_last;
+    struct timeval now;
+    gettimeofday( &now, NULL );
+    if ( gStats && 0 != strcmp( phase, "start" ) ) {
+        struct rusage usage;
+        getrusage( RUSAGE_SELF, &usage );
+        double secs = (now.tv_sec - s_last.tv_sec)
+            + ((now.tv_usec - s_last.tv_usec) / 1000000.0);
+        fprintf( stderr, "stats: %-12s %7.2f s; peak RSS %ld KB\n", phase,
+                 secs, usage.ru_maxrss );
+    }
+    s_last = now;
+}
+
+// GADDAG companion file.  For each word c1..cn and each 1 <= i <= n it
+// holds the string ci..c1 SEP ci+1..cn, so a search can start at any letter
+// of a word, work left, and then (past SEP) right.  Letters are shifted up
+// by one so that SEP can be 0 and come first in every node, making it cheap
+// to look for.  The strings go through the same buildNode() as the DAWG,
+// and the file is:
+//
+//   16 bits  version (2)
+//    8 bits  bytes per node (3 or 4)
+//    8 bits  number of faces, to match against the dictionary's
+//   32 bits  word count, ditto
+//   32 bits  offset of the start node
+//   32 bytes the .xwd's md5sum, as hex
+//   nodes in the same format as the DAWG's, but with tile values face+1
+//
+// all big-endian.  The md5sum isn't known until the .xwd's been put
+// together, so it's written as zeroes here and filled in later by
+// -gaddagmd5.  Keep in sync with dict_setGaddag() in common/dictnry.c
+
+#define GADDAG_VERSION 2
+#define GADDAG_MD5_OFFSET (2 + 1 + 1 + 4 + 4)
+#define GADDAG_MD5_LEN 32
+
+static void
+buildGaddag( void )
+{
+    // Letters are 1-based here (0 terminates); outputNode() subtracts one
+    // on the way out.  So SEP is 1 and letters move up one.
+    const char sep = 1;
+    gRevMap.insert( gRevMap.begin() + sep, L'^' ); // for debug printing
+
+    // A word of n letters makes n strings of n+1 letters each. Put them
+    // all in one buffer and sort pointers into it.
+    size_t poolSize = 0;
+    for ( size_t off = 0; off < gAccepted.size(); ) {
+        size_t len = strlen( &gAccepted[off] );
+        poolSize += len * (len + 2);
+        off += len + 1;
+    }
+    Letter* pool = (Letter*)malloc( poolSize );
+    if ( NULL == pool ) {
+        ERROR_EXIT( "can't allocate GADDAG string storage" );
+    }
+    WordList* wordlist = new WordList;
+    Letter* next = pool;
+    for ( size_t off = 0; off < gAccepted.size(); ) {
+        const Letter* word = (const Letter*)&gAccepted[off];
+        size_t len = strlen( (const char*)word );
+        off += len + 1;
+        for ( size_t ii = 1; ii <= len; ++ii ) {
+            wordlist->push_back( next );
+            for ( size_t jj = ii; jj-- > 0; ) {
+                *next++ = word[jj] + 1;
+            }
+            *next++ = sep;
+            for ( size_t jj = ii; jj < len; ++jj ) {
+                *next++ = word[jj] + 1;
+            }
+            *next++ = '\0';
+        }
+    }
+    assert( next == pool + poolSize );
+    std::vector<char>().swap( gAccepted ); // done with it
+    std::sort( wordlist->begin(), wordlist->end(), firstBeforeSecond );
+    fprintf( stderr, "GADDAG: %zd strings from %zd words\n", wordlist->size(),
+             gNAccepted );
+    reportStats( "gaddag sort" );
+
+    // Start over, reading from the new list
+    gBuildingGaddag = true;
+    gNodes.clear();
+    gSubsTable.clear();
+    gSubsCount = 0;
+    gNodes.push_back( (Node)0xFFFFFFFF );
+    gInputStrings = wordlist;
+    gNextWordIndex = 0;
+    gReadWordProc = readFromSortedArray;
+    gDone = false;
+    gCurrentWord = gCurrentWordBuf;
+    gCurrentWordBuf[0] = '\0';
+    gCurrentWordLen = 0;
+    (*gReadWordProc)();
+
+    int firstRootChildOffset = buildNode(0);
+    moveTopToFront( &firstRootChildOffset );
+    reportStats( "gaddag build" );
+    emitGaddag( gGaddagOut, firstRootChildOffset );
+    reportStats( "gaddag emit" );
+
+    delete wordlist;
+    free( pool );
+} // buildGaddag
+
+static void
+emitGaddag( const char* fileName, int firstRootChildOffset )
+{
+    unsigned char nFaces = gRevMap.size() - 2; // less terminator and SEP
+    int nBytes = 3;
+    if ( gNodes.size() > 0x1FFFF || gForceFour || nFaces > 0x1F ) {
+        nBytes = 4;
+    }
+    fprintf( stderr, "There are %zd (0x%zx) nodes in this GADDAG; "
+             "using %d bytes per node.\n", gNodes.size(), gNodes.size(),
+             nBytes );
+
+    FILE* OUTFILE = fopen( fileName, "w" );
+    if ( !OUTFILE ) {
+        ERROR_EXIT( "unable to open %s", fileName );
+    }
+    uint16_t version = htons( GADDAG_VERSION );
+    fwrite( &version, sizeof(version), 1, OUTFILE );
+    unsigned char byt = nBytes;
+    fwrite( &byt, 1, 1, OUTFILE );
+    fwrite( &nFaces, 1, 1, OUTFILE );
+    uint32_t tmp = htonl( gWordCount );
+    fwrite( &tmp, sizeof(tmp), 1, OUTFILE );
+    tmp = htonl( firstRootChildOffset );
+    fwrite( &tmp, sizeof(tmp), 1, OUTFILE );
+    char md5[GADDAG_MD5_LEN] = {};
+    fwrite( md5, sizeof(md5), 1, OUTFILE );
+
+    for ( unsigned int ii = 0; ii < gNodes.size(); ++ii ) {
+        outputNode( gNodes[ii], nBytes, OUTFILE );
+    }
+    fclose( OUTFILE );
+} // emitGaddag
+
+// Bind a GADDAG to the .xwd built alongside it by writing in the md5sum
+// the .xwd's header carries (the makefile's _md5sum.bin), so that a reader
+// won't pair it with a rebuilt dictionary that happens to have the same
+// face and word counts.
+static void
+stampGaddag( const char* fileName, const char* md5File )
+{
+    char md5[GADDAG_MD5_LEN + 1] = {};
+    FILE* md5F = fopen( md5File, "r" );
+    if ( !md5F ) {
+        ERROR_EXIT( "unable to open %s", md5File );
+    }
+    size_t nRead = fread( md5, 1, GADDAG_MD5_LEN, md5F );
+    fclose( md5F );
+    if ( GADDAG_MD5_LEN != nRead
+         || GADDAG_MD5_LEN != strspn( md5, "0123456789abcdefABCDEF" ) ) {
+        ERROR_EXIT( "%s doesn't start with an md5sum", md5File );
+    }
+
+    FILE* OUTFILE = fopen( fileName, "r+" );
+    if ( !OUTFILE ) {
+        ERROR_EXIT( "unable to open %s", fileName );
+    }
+    uint16_t version;
+    if ( 1 != fread( &version, sizeof(version), 1, OUTFILE )
+         || GADDAG_VERSION != ntohs( version ) ) {
+        ERROR_EXIT( "%s isn't a version %d GADDAG", fileName, GADDAG_VERSION );
+    }
+    if ( 0 != fseek( OUTFILE, GADDAG_MD5_OFFSET, SEEK_SET )
+         || 1 != fwrite( md5, GADDAG_MD5_LEN, 1, OUTFILE ) ) {
+        ERROR_EXIT( "unable to write md5sum to %s", fileName );
+    }
+    fclose( OUTFILE );
+} // stampGaddag
+
+static void
+noteAccepted( const Letter* word )
+{
+    if ( gGaddagOut && !gBuildingGaddag && '\0' != word[0] ) {
+        gAccepted.insert( gAccepted.end(), (const char*)word,
+                          (const char*)word + strlen( (const char*)word ) + 1 );
+        ++gNAccepted;
+    }
+}
+
 // We now have an array of nodes with the last subarray being the
 // logical top of the tree.  Move them to the start, fixing all fco
 // refs, so that legacy code like Palm can assume top==0.
@@ -381,34 +606,90 @@ printNodes( NodeList& nodesR )
     }
 }
 
-// Hashing.  We'll keep a hash of offsets into the existing nodes
-// array, and as the key use a string that represents the entire sub
-// array.  Since the key is what we're matching for, there should never
-// be more than one value per hash and so we don't need buckets.
-// Return -1 if there's no match.
+// Hashing.  Every distinct sub array is stored once in gNodes, and
+// gSubsTable, an open-addressed hash table, holds the offset of each.  It
+// keeps no copies: a lookup hashes the candidate and compares it against
+// gNodes in place.  Only a sub array's last node has the last-sibling bit,
+// so matching the candidate's nodes means matching its length too.
+
+static size_t
+hashNodes( const Node* nodes, size_t len )
+{
+    uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a, a node at a time
+    for ( size_t ii = 0; ii < len; ++ii ) {
+        hash ^= nodes[ii];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash ^ (hash >> 29);
+}
 
+static size_t
+subArrayLen( int nodeLoc )
+{
+    size_t len = 1;
+    while ( !TrieNodeGetIsLastSibling( gNodes[nodeLoc + len - 1] ) ) {
+        ++len;
+    }
+    return len;
+}
+
+static bool
+subArrayIs( int nodeLoc, const NodeList& edges )
+{
+    return nodeLoc + edges.size() <= gNodes.size()
+        && std::equal( edges.begin(), edges.end(), gNodes.begin() + nodeLoc );
+}
+
+// Return -1 if there's no match.
 static int
 findSubArray( NodeList& newedgesR )
 {
-    std::map<NodeList, int>::iterator iter = gSubsHash.find( newedgesR );
-    if ( iter != gSubsHash.end() ) {
-        return iter->second;
-    } else {
-        return -1;
+    if ( 0 < gSubsTable.size() ) {
+        size_t mask = gSubsTable.size() - 1;
+        for ( size_t slot = hashNodes( &newedgesR[0], newedgesR.size() ) & mask;
+              0 != gSubsTable[slot]; slot = (slot + 1) & mask ) {
+            if ( subArrayIs( gSubsTable[slot], newedgesR ) ) {
+                return gSubsTable[slot];
+            }
+        }
     }
+    return -1;
 } // findSubArray
 
+static void
+insertSubArray( int nodeLoc, size_t hash )
+{
+    size_t mask = gSubsTable.size() - 1;
+    size_t slot = hash & mask;
+    while ( 0 != gSubsTable[slot] ) {
+        slot = (slot + 1) & mask;
+    }
+    gSubsTable[slot] = nodeLoc;
+}
+
 // add to the hash
 static void
 registerSubArray( NodeList& edgesR, int nodeLoc )
 {
 #ifdef DEBUG
-    std::map<NodeList, int>::iterator iter = gSubsHash.find( edgesR );
-    if ( iter != gSubsHash.end() ) {
+    if ( 0 <= findSubArray( edgesR ) ) {
         ERROR_EXIT( "entry for key shouldn't exist!!" );
     }
 #endif
-    gSubsHash[edgesR] = nodeLoc;
+    // Keep it under half full
+    if ( (gSubsCount + 1) * 2 > gSubsTable.size() ) {
+        std::vector<int> old;
+        old.swap( gSubsTable );
+        gSubsTable.assign( old.empty() ? 1024 : old.size() * 2, 0 );
+        for ( size_t ii = 0; ii < old.size(); ++ii ) {
+            int loc = old[ii];
+            if ( 0 != loc ) {
+                insertSubArray( loc, hashNodes( &gNodes[loc], subArrayLen( loc ) ) );
+            }
+        }
+    }
+    insertSubArray( nodeLoc, hashNodes( &edgesR[0], edgesR.size() ) );
+    ++gSubsCount;
 } // registerSubArray
 
 static int
@@ -421,16 +702,15 @@ wordlen( const Letter* word )
 static void
 readFromSortedArray( void )
 {
-    // The first time we need a new word, we read 'em all in.
-    static WordList* sInputStrings = NULL; // we'll just let this leak
-
-    if ( sInputStrings == NULL ) {
-        sInputStrings = parseAndSort();
+    // The first time we need a new word, we read 'em all in.  We'll just
+    // let them leak.
+    if ( gInputStrings == NULL ) {
+        gInputStrings = parseAndSort();
         gNextWordIndex = 0;
 
 #ifdef DEBUG
         if ( gDebug ) {
-            printWords( sInputStrings );
+            printWords( gInputStrings );
         }
 #endif
     }
@@ -439,9 +719,9 @@ readFromSortedArray( void )
         Letter* word = (Letter*)"";
 
         if ( !gDone ) {
-            gDone = gNextWordIndex == sInputStrings->size();
+            gDone = gNextWordIndex == gInputStrings->size();
             if ( !gDone ) {
-                word = sInputStrings->at(gNextWordIndex++);
+                word = gInputStrings->at(gNextWordIndex++);
 #ifdef DEBUG
             } else if ( gDebug ) {
                 fprintf( stderr, "gDone set to true\n" );
@@ -485,6 +765,7 @@ readFromSortedArray( void )
     
         gCurrentWord = word;
         gCurrentWordLen = wordlen(word);
+        noteAccepted( word );
         break;
     }
 
@@ -684,6 +965,7 @@ readFromFile( void )
     }
     gCurrentWordLen = wordlen(word);
     strncpy( (char*)gCurrentWordBuf, (char*)word, sizeof(gCurrentWordBuf) );
+    noteAccepted( gCurrentWordBuf );
 
 #ifdef DEBUG
     if ( gDebug ) {
@@ -991,6 +1273,26 @@ emitNodes( unsigned int nBytesPerOutfile, const char* outFileBase )
         }
     }
 
+    // Compact nodes only make sense where we'd otherwise need four bytes.
+    // The far table file gets written regardless, empty if unused, so the
+    // makefile can always include it.
+    if ( gFarOut ) {
+        if ( 4 == gNBytesPerNode && !gForceFour && buildFarTable() ) {
+            gCompact = true;
+            gNBytesPerNode = 3;
+        }
+        FILE* OFILE = fopen( gFarOut, "w" );
+        if ( gCompact ) {
+            uint16_t count = htons( gFarTable.size() );
+            fwrite( &count, sizeof(count), 1, OFILE );
+            for ( size_t ii = 0; ii < gFarTable.size(); ++ii ) {
+                uint32_t index = htonl( gFarTable[ii] );
+                fwrite( &index, sizeof(index), 1, OFILE );
+            }
+        }
+        fclose( OFILE );
+    }
+
     unsigned int nextIndex = 0;
     int nextFileNum;
 
@@ -1029,7 +1331,13 @@ emitNodes( unsigned int nBytesPerOutfile, const char* outFileBase )
             } else {
                 // emit the subarray
                 while ( nextIndex < ii ) {
-                    outputNode( gNodes[nextIndex], gNBytesPerNode, OUTFILE );
+                    if ( gCompact ) {
+                        outputCompactNode( gNodes[nextIndex], nextIndex,
+                                           OUTFILE );
+                    } else {
+                        outputNode( gNodes[nextIndex], gNBytesPerNode,
+                                    OUTFILE );
+                    }
                     ++nextIndex;
                 }
                 curSize += nextSize;
@@ -1158,6 +1466,73 @@ outputNode( Node node, int nBytes, FILE* outfile )
     }
 } // outputNode
 
+// A child within 0x7FFF nodes before its parent is written as the
+// distance back to it; anything else goes in the far table.
+static bool
+isNearChild( unsigned int index, unsigned int fco )
+{
+    return fco < index && index - fco <= 0x7FFF;
+}
+
+// Collect the children compact nodes can't reach by distance.  They're
+// mostly the shared tails of words, so there are few of them; but if there
+// are too many to index in 15 bits, compact nodes aren't possible.
+static bool
+buildFarTable( void )
+{
+    std::vector<unsigned int> targets;
+    for ( unsigned int ii = 0; ii < gNodes.size(); ++ii ) {
+        unsigned int fco = TrieNodeGetFirstChildOffset( gNodes[ii] );
+        if ( 0 != fco && !isNearChild( ii, fco ) ) {
+            targets.push_back( fco );
+        }
+    }
+    std::sort( targets.begin(), targets.end() );
+    targets.erase( std::unique( targets.begin(), targets.end() ),
+                   targets.end() );
+
+    bool success = targets.size() <= 0x8000;
+    if ( success ) {
+        gFarTable.swap( targets );
+    } else {
+        fprintf( stderr, "%zd far children: too many for compact nodes\n",
+                 targets.size() );
+    }
+    return success;
+}
+
+// Same as outputNode()'s four-byte format without the fourth byte, but the
+// first two hold either how far back the child is or, with the high bit
+// set, where it is in the far table.
+static void
+outputCompactNode( Node node, unsigned int index, FILE* outfile )
+{
+    unsigned int fco = TrieNodeGetFirstChildOffset(node);
+    unsigned int field = 0;
+    if ( 0 == fco ) {
+        // no child
+    } else if ( isNearChild( index, fco ) ) {
+        field = index - fco;
+    } else {
+        std::vector<unsigned int>::iterator iter =
+            std::lower_bound( gFarTable.begin(), gFarTable.end(), fco );
+        assert( iter != gFarTable.end() && *iter == fco );
+        field = 0x8000 | (iter - gFarTable.begin());
+    }
+
+    unsigned char bytes[3];
+    bytes[0] = field >> 8;
+    bytes[1] = field & 0xFF;
+    bytes[2] = TrieNodeGetLetter(node) - 1; // see outputNode()
+    if ( TrieNodeGetIsLastSibling(node) ) {
+        bytes[2] |= 0x40;
+    }
+    if ( TrieNodeGetIsTerminal(node) ) {
+        bytes[2] |= 0x80;
+    }
+    fwrite( bytes, sizeof(bytes), 1, outfile );
+} // outputCompactNode
+
 static void
 write32( const char* fileName, uint32_t value )
 {
@@ -1189,7 +1564,13 @@ usage( const char* name )
 #ifdef DEBUG
              "\t[-debug]            # turn on verbose output\n"
 #endif
+             "\t[-gaddag file]      # also write GADDAG companion file\n"
+             "\t[-gaddagmd5 file md5File] # only stamp GADDAG with the .xwd's\n"
+             "\t                    #     md5sum, once that's known\n"
              "\t[-force4]           # always use 4 bytes per node\n"
+             "\t[-compact farFile]  # 3 bytes instead of 4 where possible;\n"
+             "\t                    #     writes table (maybe empty) for xwd\n"
+             "\t[-stats]            # report time and peak RSS per phase\n"
              "\t[-lang  lang]       # e.g. en_US\n"
              "\t[-fsize nBytes]     # max buffer [default %zd]\n"
              "\t[-r]                # drop words with letters not in mapfile\n"
@@ -1260,8 +1641,17 @@ parseARGV( int argc, char** argv, const char** inFileName )
             gCountFile = argv[index++];
         } else if ( 0 == strcmp( arg, "-ns" ) ) {
             gBytesPerNodeFile = argv[index++];
+        } else if ( 0 == strcmp( arg, "-gaddag" ) ) {
+            gGaddagOut = argv[index++];
+        } else if ( 0 == strcmp( arg, "-gaddagmd5" ) ) {
+            gGaddagOut = argv[index++];
+            gGaddagMd5 = argv[index++];
+        } else if ( 0 == strcmp( arg, "-stats" ) ) {
+            gStats = true;
         } else if ( 0 == strcmp( arg, "-force4" ) ) {
             gForceFour = true;
+        } else if ( 0 == strcmp( arg, "-compact" ) ) {
+            gFarOut = argv[index++];
         } else if ( 0 == strcmp( arg, "-fsize" ) ) {
             gFileSize = atoi(argv[index++]);
         } else if ( 0 == strcmp( arg, "-lang" ) ) {
@@ -0,0 +1,548 @@
+/* -*- compile-command: "make -j3 MEMDEBUG=TRUE enginebench"; -*- */
+/*
+ * Copyright 2026 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/* Engine benchmark: times engine_findMove() on a fixed set of positions so
+ * changes to the engine can be measured without playing whole games.
+ *
+ * The corpus is text.  Each game starts with a "game <boardSize>" line and
+ * is followed by one line per turn, players alternating, giving the rack
+ * the player to move held and the move that was then played:
+ *
+ *     rack A E I ? R S T move H7 4:M 5:E 6:N 7:?D
+ *
+ * "H7" is the row (V for a column), then come col:face pairs, '?' marking a
+ * blank.  A turn with no move is a pass.  Each turn is a position: its rack
+ * is searched with everything before it on the board, then its move is
+ * played.  Lines starting with '#' are ignored.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "enginebench.h"
+#include "main.h"
+#include "engine.h"
+#include "model.h"
+#include "util.h"
+#include "strutils.h"
+
+#define MAX_LINE 512
+
+#ifndef XWFEATURE_ENGINE_STATS
+typedef struct EngineStats { int unused; } EngineStats;
+#endif
+
+typedef struct _BenchState {
+    const DictionaryCtxt* dict;
+    XW_DUtilCtxt* dutil;
+    CurGameInfo gi;
+    UtilVtable vtable;
+    XW_UtilCtxt util;
+    MPSLOT
+} BenchState;
+
+static XW_DUtilCtxt*
+eb_getDevUtilCtxt( XW_UtilCtxt* uc, XWEnv XP_UNUSED(xwe) )
+{
+    BenchState* bs = (BenchState*)uc->closure;
+    return bs->dutil;
+}
+
+static XP_Bool
+eb_hiliteCell( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+               XP_U16 XP_UNUSED(col), XP_U16 XP_UNUSED(row) )
+{
+    return XP_TRUE;             /* keep going */
+}
+
+static XP_Bool
+eb_engineProgressCallback( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe) )
+{
+    return XP_TRUE;             /* keep going */
+}
+
+#ifdef XWFEATURE_SEARCHLIMIT
+static XP_Bool
+eb_getTraySearchLimits( XW_UtilCtxt* XP_UNUSED(uc), XWEnv XP_UNUSED(xwe),
+                        XP_U16* XP_UNUSED(min), XP_U16* XP_UNUSED(max) )
+{
+    return XP_TRUE;
+}
+#endif
+
+static void
+initState( MPFORMAL BenchState* bs, XW_DUtilCtxt* dutil,
+           const DictionaryCtxt* dict, XP_U16 boardSize )
+{
+    XP_MEMSET( bs, 0, sizeof(*bs) );
+    MPASSIGN( bs->mpool, mpool );
+    bs->dict = dict;
+    bs->dutil = dutil;
+
+    bs->gi.nPlayers = 2;
+    bs->gi.boardSize = boardSize;
+    bs->gi.traySize = bs->gi.bingoMin = 7;
+    for ( int ii = 0; ii < bs->gi.nPlayers; ++ii ) {
+        bs->gi.players[ii].isLocal = XP_TRUE;
+        bs->gi.players[ii].robotIQ = 1;
+    }
+
+    bs->vtable.m_util_getDevUtilCtxt = eb_getDevUtilCtxt;
+    bs->vtable.m_util_hiliteCell = eb_hiliteCell;
+    bs->vtable.m_util_engineProgressCallback = eb_engineProgressCallback;
+#ifdef XWFEATURE_SEARCHLIMIT
+    bs->vtable.m_util_getTraySearchLimits = eb_getTraySearchLimits;
+#endif
+    bs->util.vtable = &bs->vtable;
+    bs->util.gameInfo = &bs->gi;
+    bs->util.closure = bs;
+#ifdef MEM_DEBUG
+    bs->util.mpool = mpool;
+#endif
+}
+
+static ModelCtxt*
+makeModel( BenchState* bs )
+{
+    ModelCtxt* model = model_make( MPPARM(bs->mpool) NULL_XWE, bs->dict,
+                                   NULL, &bs->util, bs->gi.boardSize );
+    model_setNPlayers( model, bs->gi.nPlayers );
+    return model;
+}
+
+static XP_Bool
+findMove( EngineCtxt* engine, const ModelCtxt* model, XP_U16 turn,
+          const TrayTileSet* tiles, XP_Bool hint, MoveInfo* mi,
+          XP_U16* score )
+{
+    XP_Bool canMove;
+    (void)engine_findMove( engine, NULL_XWE, model, turn, XP_FALSE, XP_TRUE,
+                           tiles, XP_FALSE,
+#ifdef XWFEATURE_BONUSALL
+                           0,
+#endif
+#ifdef XWFEATURE_SEARCHLIMIT
+                           NULL, XP_FALSE,
+#endif
+                           hint ? 0 : 1, &canMove, mi, score );
+    return canMove && 0 < mi->nTiles;
+}
+
+/* Play mi for turn, whose tray is exactly tiles */
+static void
+playMove( ModelCtxt* model, XP_U16 turn, const MoveInfo* mi,
+          const TrayTileSet* newTiles )
+{
+    TrayTileSet drawn = *newTiles;
+    model_makeTurnFromMoveInfo( model, NULL_XWE, turn, mi );
+    (void)model_commitTurn( model, NULL_XWE, turn, &drawn );
+}
+
+static void
+setTray( ModelCtxt* model, XP_U16 turn, const TrayTileSet* tiles )
+{
+    TrayTileSet old = *model_getPlayerTiles( model, turn );
+    if ( 0 < old.nTiles ) {
+        model_removePlayerTiles( model, turn, &old );
+    }
+    model_assignPlayerTiles( model, turn, tiles );
+}
+
+static const XP_UCHAR*
+faceFor( const DictionaryCtxt* dict, Tile tile )
+{
+    return tile == dict_getBlankTile( dict ) ? "?"
+        : dict_getTileString( dict, tile );
+}
+
+static XP_Bool
+tileFor( const DictionaryCtxt* dict, const char* face, Tile* tile )
+{
+    XP_Bool found = XP_FALSE;
+    if ( 0 == strcmp( face, "?" ) ) {
+        found = dict_hasBlankTile( dict );
+        *tile = dict_getBlankTile( dict );
+    } else {
+        XP_U16 nFaces = dict_numTileFaces( dict );
+        for ( Tile tt = 0; !found && tt < nFaces; ++tt ) {
+            for ( const XP_UCHAR* fp = NULL; ; ) {
+                fp = dict_getNextTileString( dict, tt, fp );
+                if ( !fp ) {
+                    break;
+                } else if ( 0 == strcmp( fp, face ) ) {
+                    *tile = tt;
+                    found = XP_TRUE;
+                    break;
+                }
+            }
+        }
+    }
+    return found;
+}
+
+static void
+writeTurn( FILE* out, const DictionaryCtxt* dict, const TrayTileSet* tiles,
+           const MoveInfo* mi )
+{
+    fprintf( out, "rack" );
+    for ( int ii = 0; ii < tiles->nTiles; ++ii ) {
+        fprintf( out, " %s", faceFor( dict, tiles->tiles[ii] ) );
+    }
+    if ( !!mi ) {
+        fprintf( out, " move %c%d", mi->isHorizontal ? 'H' : 'V',
+                 mi->commonCoord );
+        for ( int ii = 0; ii < mi->nTiles; ++ii ) {
+            Tile tile = mi->tiles[ii].tile;
+            fprintf( out, " %d:%s%s", mi->tiles[ii].varCoord,
+                     IS_BLANK(tile) ? "?" : "",
+                     dict_getTileString( dict, tile & TILE_VALUE_MASK ) );
+        }
+    }
+    fprintf( out, "\n" );
+}
+
+/* Parse a "rack ... [move ...]" line.  mi->nTiles is 0 for a pass. */
+static XP_Bool
+parseTurn( const DictionaryCtxt* dict, char* line, TrayTileSet* tiles,
+           MoveInfo* mi )
+{
+    XP_Bool ok = XP_TRUE;
+    XP_MEMSET( tiles, 0, sizeof(*tiles) );
+    XP_MEMSET( mi, 0, sizeof(*mi) );
+
+    char* saveptr;
+    char* tok = strtok_r( line, " \t\n", &saveptr );
+    ok = !!tok && 0 == strcmp( tok, "rack" );
+    XP_Bool inMove = XP_FALSE;
+    while ( ok && NULL != (tok = strtok_r( NULL, " \t\n", &saveptr ) ) ) {
+        Tile tile;
+        if ( !inMove && 0 == strcmp( tok, "move" ) ) {
+            inMove = XP_TRUE;
+            tok = strtok_r( NULL, " \t\n", &saveptr );
+            ok = !!tok && ('H' == tok[0] || 'V' == tok[0]);
+            if ( ok ) {
+                mi->isHorizontal = 'H' == tok[0];
+                mi->commonCoord = atoi( &tok[1] );
+            }
+        } else if ( !inMove ) {
+            ok = tiles->nTiles < VSIZE(tiles->tiles)
+                && tileFor( dict, tok, &tile );
+            if ( ok ) {
+                tiles->tiles[tiles->nTiles++] = tile;
+            }
+        } else {
+            char* face = strchr( tok, ':' );
+            ok = !!face && mi->nTiles < VSIZE(mi->tiles);
+            if ( ok ) {
+                XP_Bool isBlank = '?' == *++face;
+                ok = tileFor( dict, isBlank ? face + 1 : face, &tile );
+                if ( ok ) {
+                    MoveInfoTile* mit = &mi->tiles[mi->nTiles++];
+                    mit->varCoord = atoi( tok );
+                    mit->tile = isBlank ? tile | TILE_BLANK_BIT : tile;
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+static double
+nowMs( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (ts.tv_sec * 1000.0) + (ts.tv_nsec / 1000000.0);
+}
+
+static int
+cmpDoubles( const void* p1, const void* p2 )
+{
+    double d1 = *(const double*)p1;
+    double d2 = *(const double*)p2;
+    return d1 < d2 ? -1 : d1 > d2 ? 1 : 0;
+}
+
+static double
+percentile( const double* sorted, size_t count, int pct )
+{
+    return sorted[(count - 1) * pct / 100];
+}
+
+/* One line per position: its searches' latencies, and the work each did */
+static void
+reportPosition( int gameNo, int turnNo, double* repTimes, int nReps,
+                const EngineStats* before, const EngineStats* after )
+{
+    qsort( repTimes, nReps, sizeof(repTimes[0]), cmpDoubles );
+    fprintf( stdout, "%4d %4d %9.3f %9.3f %9.3f", gameNo, turnNo,
+             percentile( repTimes, nReps, 50 ),
+             percentile( repTimes, nReps, 99 ), repTimes[nReps-1] );
+#ifdef XWFEATURE_ENGINE_STATS
+    fprintf( stdout, " %11u %11u",
+             (after->nCandidates - before->nCandidates) / nReps,
+             (after->nNodes - before->nNodes) / nReps );
+#else
+    XP_USE( before );
+    XP_USE( after );
+#endif
+    fprintf( stdout, "\n" );
+}
+
+/* Destroy the engines, first adding their stats to the total */
+static void
+destroyEngines( EngineCtxt** engines, XP_U16 nEngines, EngineStats* stats )
+{
+    for ( int ii = 0; ii < nEngines; ++ii ) {
+        if ( !!engines[ii] ) {
+#ifdef XWFEATURE_ENGINE_STATS
+            EngineStats es;
+            engine_getStats( engines[ii], &es );
+            stats->nCandidates += es.nCandidates;
+            stats->nNodes += es.nNodes;
+#else
+            XP_USE( stats );
+#endif
+            engine_destroy( engines[ii] );
+            engines[ii] = NULL;
+        }
+    }
+}
+
+static int
+replayCorpus( BenchState* bs, FILE* in, const BenchParams* bp )
+{
+    int result = 0;
+    size_t nPositions = 0;
+    size_t nAlloced = 0;
+    double* times = NULL;
+    XP_U32 totalScore = 0;
+    EngineStats stats = {};
+    double* repTimes = malloc( bp->nReps * sizeof(repTimes[0]) );
+    int gameNo = 0;
+    int turnNo = 0;
+
+    ModelCtxt* model = NULL;
+    EngineCtxt* engines[2] = {};
+    XP_U16 turn = 0;
+    int lineNo = 0;
+    char line[MAX_LINE];
+    while ( 0 == result && !!fgets( line, sizeof(line), in ) ) {
+        ++lineNo;
+        if ( '#' == line[0] || '\n' == line[0] ) {
+            continue;
+        } else if ( 0 == strncmp( line, "game ", 5 ) ) {
+            if ( !!model ) {
+                model_destroy( model, NULL_XWE );
+            }
+            bs->gi.boardSize = atoi( &line[5] );
+            model = makeModel( bs );
+            turn = 0;
+            ++gameNo;
+            turnNo = 0;
+            destroyEngines( engines, VSIZE(engines), &stats );
+            for ( int ii = 0; ii < VSIZE(engines); ++ii ) {
+                engines[ii] = engine_make( &bs->util );
+            }
+            continue;
+        }
+
+        TrayTileSet tiles;
+        MoveInfo played;
+        if ( !model || !parseTurn( bs->dict, line, &tiles, &played ) ) {
+            fprintf( stderr, "%s:%d: can't parse\n", bp->corpusPath, lineNo );
+            result = 1;
+            break;
+        }
+
+        if ( 0 == nPositions ) {
+            fprintf( stdout, "game turn    p50 ms    p99 ms    max ms" );
+#ifdef XWFEATURE_ENGINE_STATS
+            fprintf( stdout, "  candidates       nodes" );
+#endif
+            fprintf( stdout, "\n" );
+        }
+
+        setTray( model, turn, &tiles );
+        EngineStats before = {};
+        EngineStats after = {};
+#ifdef XWFEATURE_ENGINE_STATS
+        engine_getStats( engines[turn], &before );
+#endif
+        for ( int rep = 0; rep < bp->nReps; ++rep ) {
+            MoveInfo mi;
+            XP_U16 score = 0;
+            engine_reset( engines[turn] );
+            double start = nowMs();
+            if ( findMove( engines[turn], model, turn, &tiles, bp->hints,
+                           &mi, &score ) ) {
+                totalScore += score;
+            }
+            double elapsed = nowMs() - start;
+
+            if ( nPositions == nAlloced ) {
+                nAlloced = 0 == nAlloced ? 256 : nAlloced * 2;
+                times = realloc( times, nAlloced * sizeof(times[0]) );
+            }
+            times[nPositions++] = elapsed;
+            repTimes[rep] = elapsed;
+        }
+#ifdef XWFEATURE_ENGINE_STATS
+        engine_getStats( engines[turn], &after );
+#endif
+        reportPosition( gameNo, ++turnNo, repTimes, bp->nReps, &before,
+                        &after );
+
+        if ( 0 < played.nTiles ) {
+            TrayTileSet none = {};
+            playMove( model, turn, &played, &none );
+        }
+        engine_reset( engines[0] );
+        engine_reset( engines[1] );
+        turn = (turn + 1) % bs->gi.nPlayers;
+    }
+
+    destroyEngines( engines, VSIZE(engines), &stats );
+    if ( !!model ) {
+        model_destroy( model, NULL_XWE );
+    }
+
+    if ( 0 == result && 0 < nPositions ) {
+        double total = 0;
+        for ( size_t ii = 0; ii < nPositions; ++ii ) {
+            total += times[ii];
+        }
+        qsort( times, nPositions, sizeof(times[0]), cmpDoubles );
+        fprintf( stdout, "all positions:\n" );
+        fprintf( stdout, "searches: %zu (%s); total %.1f ms; score sum %u\n",
+                 nPositions, bp->hints ? "hints" : "robot", total,
+                 totalScore );
+        fprintf( stdout, "latency ms: p50 %.3f  p90 %.3f  p99 %.3f  "
+                 "max %.3f\n", percentile( times, nPositions, 50 ),
+                 percentile( times, nPositions, 90 ),
+                 percentile( times, nPositions, 99 ),
+                 times[nPositions-1] );
+#ifdef XWFEATURE_ENGINE_STATS
+        fprintf( stdout, "candidates: %u (%.1f/search); nodes: %u "
+                 "(%.1f/search)\n", stats.nCandidates,
+                 (double)stats.nCandidates / nPositions, stats.nNodes,
+                 (double)stats.nNodes / nPositions );
+#endif
+    }
+    free( times );
+    free( repTimes );
+    return result;
+} /* replayCorpus */
+
+static int
+drawTiles( Tile* bag, int* nInBag, TrayTileSet* tiles, int want )
+{
+    while ( tiles->nTiles < want && 0 < *nInBag ) {
+        int index = XP_RANDOM() % *nInBag;
+        tiles->tiles[tiles->nTiles++] = bag[index];
+        bag[index] = bag[--*nInBag];
+    }
+    return tiles->nTiles;
+}
+
+/* Robot vs. robot, smartest possible, writing every turn */
+static void
+makeGame( BenchState* bs, FILE* out )
+{
+    const DictionaryCtxt* dict = bs->dict;
+    XP_U16 boardSize = bs->gi.boardSize;
+    fprintf( out, "game %d\n", boardSize );
+
+    Tile bag[MAX_UNIQUE_TILES * 16];
+    int nInBag = 0;
+    XP_U16 nFaces = dict_numTileFaces( dict );
+    for ( Tile tile = 0; tile < nFaces; ++tile ) {
+        XP_U16 count = dict_numTilesForSize( dict, tile, boardSize );
+        for ( int ii = 0; ii < count && nInBag < VSIZE(bag); ++ii ) {
+            bag[nInBag++] = tile;
+        }
+    }
+
+    ModelCtxt* model = makeModel( bs );
+    EngineCtxt* engine = engine_make( &bs->util );
+    for ( XP_U16 turn = 0; turn < bs->gi.nPlayers; ++turn ) {
+        TrayTileSet tiles = {};
+        drawTiles( bag, &nInBag, &tiles, bs->gi.traySize );
+        model_assignPlayerTiles( model, turn, &tiles );
+    }
+
+    for ( XP_U16 turn = 0, nPasses = 0; nPasses < bs->gi.nPlayers;
+          turn = (turn + 1) % bs->gi.nPlayers ) {
+        TrayTileSet tiles = *model_getPlayerTiles( model, turn );
+        if ( 0 == tiles.nTiles ) {
+            break;
+        }
+        MoveInfo mi;
+        XP_U16 score;
+        engine_reset( engine );
+        if ( findMove( engine, model, turn, &tiles, XP_FALSE, &mi, &score ) ) {
+            writeTurn( out, dict, &tiles, &mi );
+            TrayTileSet newTiles = {};
+            drawTiles( bag, &nInBag, &newTiles, mi.nTiles );
+            playMove( model, turn, &mi, &newTiles );
+            nPasses = 0;
+        } else {
+            writeTurn( out, dict, &tiles, NULL );
+            ++nPasses;
+        }
+    }
+
+    engine_destroy( engine );
+    model_destroy( model, NULL_XWE );
+} /* makeGame */
+
+int
+eb_run( MPFORMAL XW_DUtilCtxt* dutil, const DictionaryCtxt* dict,
+        const BenchParams* bp )
+{
+    int result = 1;
+    BenchState bs;
+    initState( MPPARM(mpool) &bs, dutil, dict, bp->boardSize );
+
+    if ( 0 < bp->makeGames ) {
+        FILE* out = fopen( bp->corpusPath, "w" );
+        if ( !!out ) {
+            fprintf( out, "# made by enginebench with %s\n",
+                     dict_getShortName( dict ) );
+            for ( int ii = 0; ii < bp->makeGames; ++ii ) {
+                makeGame( &bs, out );
+            }
+            fclose( out );
+            result = 0;
+        }
+    } else {
+        FILE* in = fopen( bp->corpusPath, "r" );
+        if ( !!in ) {
+            result = replayCorpus( &bs, in, bp );
+            fclose( in );
+        }
+    }
+
+    if ( 0 != result ) {
+        fprintf( stderr, "enginebench: failed with %s\n", bp->corpusPath );
+    }
+    return result;
+} /* eb_run */
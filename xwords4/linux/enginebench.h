@@ -0,0 +1,41 @@
+/*
+ * Copyright 2026 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _ENGINEBENCH_H_
+#define _ENGINEBENCH_H_
+
+#include "dutil.h"
+#include "dictnry.h"
+
+typedef struct _BenchParams {
+    const char* corpusPath;
+    XP_U16 makeGames;           /* >0: write this many games to corpusPath */
+    XP_U16 boardSize;           /* for games being made */
+    XP_U16 nReps;               /* times to search each position */
+    XP_Bool hints;              /* search as for hints, not robot moves */
+} BenchParams;
+
+/* Replay the positions in bp->corpusPath through engine_findMove() and
+   print latency percentiles for each position and over all of them (and,
+   with XWFEATURE_ENGINE_STATS, how much work the searches did); or, if
+   bp->makeGames is set, create the corpus by having the robot play itself.
+   Returns 0 on success, for use as an exit code. */
+int eb_run( MPFORMAL XW_DUtilCtxt* dutil, const DictionaryCtxt* dict,
+            const BenchParams* bp );
+
+#endif
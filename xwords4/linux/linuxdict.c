@@ -21,6 +21,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -33,6 +34,7 @@
 #include "strutils.h"
 #include "linuxutl.h"
 #include "dictmgr.h"
+#include "xwmutex.h"
 
 typedef struct DictStart {
     XP_U32 numNodes;
@@ -44,14 +46,32 @@ typedef struct LinuxDictionaryCtxt {
     DictionaryCtxt super;
     XP_U8* dictBase;
     size_t dictLength;
+    XP_UCHAR* path;             /* for the digest cache */
+    struct timespec mtime;
+    ino_t ino;
     XP_Bool useMMap;
+#ifdef XWFEATURE_GADDAG
+    XP_U8* gaddagBase;
+    size_t gaddagLength;
+#endif
 } LinuxDictionaryCtxt;
 
 /************************ Prototypes ***********************/
+static XP_Bool locateDictFile( LinuxDictionaryCtxt* dctx,
+                               const LaunchParams* params,
+                               const char* fileName );
+static const DictionaryCtxt* findLoaded( const LinuxDictionaryCtxt* dctx,
+                                         const LaunchParams* params,
+                                         XWEnv xwe );
 static XP_Bool initFromDictFile( LinuxDictionaryCtxt* dctx, 
-                                 const LaunchParams* params,
                                  const char* fileName );
+static void discard( LinuxDictionaryCtxt* dctx, XWEnv xwe );
 static void linux_dictionary_destroy( DictionaryCtxt* dict, XWEnv xwe );
+#ifdef XWFEATURE_GADDAG
+static void loadGaddag( LinuxDictionaryCtxt* dctx, const char* dictPath );
+#else
+# define loadGaddag( dctx, dictPath )
+#endif
 static const XP_UCHAR* linux_dict_getShortName( const DictionaryCtxt* dict );
 
 /*****************************************************************************
@@ -76,11 +96,31 @@ linux_dictionary_make( MPFORMAL XWEnv xwe, const LaunchParams* params,
         result->useMMap = useMMap;
 
         if ( !!dictFileName ) {
-            XP_Bool success = initFromDictFile( result, params, dictFileName );
+            /* Same wordlist by another name? Share that one, and don't load
+               this one at all if its digest's to be had without */
+            LinuxDictionaryCtxt* same = NULL;
+            XP_Bool success = locateDictFile( result, params, dictFileName );
             if ( success ) {
-                result->super.func_dict_getShortName = linux_dict_getShortName;
-                setBlankTile( &result->super );
-            } else {
+                same = (LinuxDictionaryCtxt*)findLoaded( result, params, xwe );
+            }
+            if ( !same && success ) {
+                success = initFromDictFile( result, dictFileName );
+                if ( success ) {
+                    result->super.func_dict_getShortName = linux_dict_getShortName;
+                    setBlankTile( &result->super );
+
+                    same = (LinuxDictionaryCtxt*)
+                        dmgr_getMd5( params->dictMgr, xwe,
+                                     dict_getMd5Sum( &result->super ) );
+                }
+            }
+
+            if ( !!same ) {
+                discard( result, xwe );
+                result = same;
+                dmgr_put( params->dictMgr, xwe, dictFileName, &result->super );
+                goto done;
+            } else if ( !success ) {
                 XP_ASSERT( 0 ); /* gonna crash anyway */
                 XP_FREE( mpool, result );
                 result = NULL;
@@ -92,17 +132,156 @@ linux_dictionary_make( MPFORMAL XWEnv xwe, const LaunchParams* params,
         }
         (void)dict_ref( &result->super, xwe );
     }
-
+ done:
     return &result->super;
 } /* gtk_dictionary_make */
 
+/* Hashing a big wordlist is most of what loading it costs, so the digest's
+ * cached beside it in foo.xwd.md5 along with the file's size, inode and
+ * mtime (to the nanosecond: a wordlist can be regenerated within a second)
+ * and the length hashed. If any of those don't match the cache is stale. If
+ * the directory isn't writable we just hash every time.
+ */
+#define DIGEST_CACHE_FMT "v2 %llu %llu %llu %lu %u"
+#define MD5_HEX_LEN 32
+
+static void
+digestCachePath( const LinuxDictionaryCtxt* dctx, char* buf, size_t bufLen )
+{
+    snprintf( buf, bufLen, "%s.md5", dctx->path );
+}
+
+/* The sidecar's digest, if it's for this file as it is now.  *hashedLen is
+ * what it covers.
+ */
+static XP_Bool
+readCachedDigest( const LinuxDictionaryCtxt* dctx, XP_U32* hashedLen,
+                  XP_UCHAR* out )
+{
+    XP_Bool found = XP_FALSE;
+    char cachePath[PATH_MAX];
+    digestCachePath( dctx, cachePath, sizeof(cachePath) );
+    FILE* cacheF = fopen( cachePath, "r" );
+    if ( !!cacheF ) {
+        unsigned long long size, ino, secs;
+        unsigned long nsecs;
+        char digest[MD5_HEX_LEN + 2];
+        found = 6 == fscanf( cacheF, DIGEST_CACHE_FMT " %33s", &size, &ino,
+                             &secs, &nsecs, hashedLen, digest )
+            && size == dctx->dictLength
+            && ino == (unsigned long long)dctx->ino
+            && secs == (unsigned long long)dctx->mtime.tv_sec
+            && nsecs == (unsigned long)dctx->mtime.tv_nsec
+            && MD5_HEX_LEN == XP_STRLEN( digest )
+            && MD5_HEX_LEN == strspn( digest, "0123456789abcdef" );
+        if ( found ) {
+            XP_MEMCPY( out, digest, XP_STRLEN(digest) + 1 );
+        }
+        fclose( cacheF );
+    }
+    return found;
+}
+
+static void
+writeCachedDigest( const LinuxDictionaryCtxt* dctx, XP_U32 len,
+                   const XP_UCHAR* digest )
+{
+    char cachePath[PATH_MAX];
+    digestCachePath( dctx, cachePath, sizeof(cachePath) );
+    char tmpPath[PATH_MAX + 16];
+    snprintf( tmpPath, sizeof(tmpPath), "%s.%d", cachePath, getpid() );
+
+    /* Write then rename so a reader never sees half a file */
+    FILE* cacheF = fopen( tmpPath, "w" );
+    if ( !!cacheF ) {
+        fprintf( cacheF, DIGEST_CACHE_FMT " %s\n",
+                 (unsigned long long)dctx->dictLength,
+                 (unsigned long long)dctx->ino,
+                 (unsigned long long)dctx->mtime.tv_sec,
+                 (unsigned long)dctx->mtime.tv_nsec, len, digest );
+        if ( 0 != fclose( cacheF ) || 0 != rename( tmpPath, cachePath ) ) {
+            (void)unlink( tmpPath );
+        }
+    }
+}
+
 void
-computeChecksum( DictionaryCtxt* XP_UNUSED(dctx), XWEnv XP_UNUSED(xwe),
+computeChecksum( DictionaryCtxt* dict, XWEnv XP_UNUSED(xwe),
                  const XP_U8* ptr, XP_U32 len, XP_UCHAR* out )
 {
-    gchar* checksum = g_compute_checksum_for_data( G_CHECKSUM_MD5, ptr, len );
-    XP_MEMCPY( out, checksum, XP_STRLEN(checksum) + 1 );
-    g_free( checksum );
+    LinuxDictionaryCtxt* dctx = (LinuxDictionaryCtxt*)dict;
+    XP_U32 hashedLen;
+    if ( !dctx->path || !readCachedDigest( dctx, &hashedLen, out )
+         || hashedLen != len ) {
+        gchar* checksum = g_compute_checksum_for_data( G_CHECKSUM_MD5, ptr, len );
+        XP_MEMCPY( out, checksum, XP_STRLEN(checksum) + 1 );
+        g_free( checksum );
+        if ( !!dctx->path ) {
+            writeCachedDigest( dctx, len, out );
+        }
+    }
+}
+
+/* The md5sum a dict built with a header carries in it, as parseCommon()
+ * would find it: after the flags, header length, word count and note.
+ */
+static XP_Bool
+readHeaderDigest( const char* path, XP_UCHAR* out )
+{
+    XP_Bool found = XP_FALSE;
+    FILE* dictF = fopen( path, "r" );
+    if ( !!dictF ) {
+        XP_U8 buf[512];
+        size_t nRead = fread( buf, 1, sizeof(buf), dictF );
+        fclose( dictF );
+
+        /* The note's short: if the md5sum's not in what was read, do
+           without */
+        XP_U16 flags, headerLen;
+        const XP_U8* ptr = buf;
+        const XP_U8* end = buf + nRead;
+        if ( ptr + sizeof(flags) + sizeof(headerLen) + sizeof(XP_U32) <= end ) {
+            XP_MEMCPY( &flags, ptr, sizeof(flags) );
+            ptr += sizeof(flags);
+            XP_MEMCPY( &headerLen, ptr, sizeof(headerLen) );
+            ptr += sizeof(headerLen);
+            if ( 0 != (DICT_HEADER_MASK & XP_NTOHS(flags))
+                 && sizeof(XP_U32) <= XP_NTOHS(headerLen) ) {
+                if ( ptr + XP_NTOHS(headerLen) < end ) {
+                    end = ptr + XP_NTOHS(headerLen);
+                }
+                ptr += sizeof(XP_U32); /* word count */
+                const XP_U8* noteEnd = memchr( ptr, '\0', end - ptr );
+                if ( !!noteEnd ) {
+                    ptr = noteEnd + 1;
+                    const XP_U8* md5End = memchr( ptr, '\0', end - ptr );
+                    found = !!md5End && MD5_HEX_LEN == md5End - ptr;
+                    if ( found ) {
+                        XP_MEMCPY( out, ptr, MD5_HEX_LEN + 1 );
+                    }
+                }
+            }
+        }
+    }
+    return found;
+}
+
+/* A loaded dict with the same contents, found without loading this one:
+ * by the digest in its header if it has one, else by the sidecar's.
+ * Returns it reffed, or NULL.
+ */
+static const DictionaryCtxt*
+findLoaded( const LinuxDictionaryCtxt* dctx, const LaunchParams* params,
+            XWEnv xwe )
+{
+    const DictionaryCtxt* result = NULL;
+    XP_UCHAR digest[MD5_HEX_LEN + 2];
+    XP_U32 hashedLen;
+    if ( readHeaderDigest( dctx->path, digest )
+         || readCachedDigest( dctx, &hashedLen, digest ) ) {
+        result = dmgr_getMd5( params->dictMgr, xwe, digest );
+    }
+    return result;
 }
 
 void
@@ -146,26 +325,42 @@ dict_splitFaces( DictionaryCtxt* dict, XWEnv XP_UNUSED(xwe), const XP_U8* utf8,
     dict->facePtrs = ptrs;
 } /* dict_splitFaces */
 
+/* Find the file and note what the digest cache checks, but don't load it */
 static XP_Bool
-initFromDictFile( LinuxDictionaryCtxt* dctx, const LaunchParams* params, 
-                  const char* fileName )
+locateDictFile( LinuxDictionaryCtxt* dctx, const LaunchParams* params,
+                const char* fileName )
 {
-    XP_Bool formatOk = XP_TRUE;
-    size_t dictLength;
-    XP_U32 topOffset;
+    XP_Bool found = XP_FALSE;
     char path[256];
 
     if ( file_exists( fileName ) ) {
         snprintf( path, VSIZE(path), "%s", fileName );
-    } else if ( !getDictPath( params, fileName, path, VSIZE(path) ) ) {
+        found = XP_TRUE;
+    } else if ( getDictPath( params, fileName, path, VSIZE(path) ) ) {
+        found = XP_TRUE;
+    } else {
         XP_LOGF( "%s: path=%s", __func__, path );
-        goto closeAndExit;
     }
     struct stat statbuf;
-    if ( 0 != stat( path, &statbuf ) || 0 == statbuf.st_size ) {
-        goto closeAndExit;
+    if ( found ) {
+        found = 0 == stat( path, &statbuf ) && 0 < statbuf.st_size;
+    }
+    if ( found ) {
+        dctx->dictLength = statbuf.st_size;
+        dctx->mtime = statbuf.st_mtim;
+        dctx->ino = statbuf.st_ino;
+        dctx->path = copyString( dctx->super.mpool, path );
     }
-    dctx->dictLength = statbuf.st_size;
+    return found;
+}
+
+static XP_Bool
+initFromDictFile( LinuxDictionaryCtxt* dctx, const char* fileName )
+{
+    XP_Bool formatOk = XP_TRUE;
+    size_t dictLength;
+    XP_U32 topOffset;
+    const char* path = dctx->path;
 
     {
         FILE* dictF = fopen( path, "r" );
@@ -221,6 +416,8 @@ initFromDictFile( LinuxDictionaryCtxt* dctx, const LaunchParams* params,
         if ( ! checkSanity( &dctx->super, numEdges ) ) {
             goto closeAndExit;
         }
+        dict_buildTables( &dctx->super, numEdges );
+        loadGaddag( dctx, path );
     }
     goto ok;
 
@@ -231,6 +428,69 @@ initFromDictFile( LinuxDictionaryCtxt* dctx, const LaunchParams* params,
     return formatOk;
 } /* initFromDictFile */
 
+#ifdef XWFEATURE_GADDAG
+/* If there's a foo.gdg next to foo.xwd, hand it to the dict. It's optional:
+   without it (or if it doesn't match) the engine just uses the DAWG. */
+static void
+loadGaddag( LinuxDictionaryCtxt* dctx, const char* dictPath )
+{
+    char path[PATH_MAX];
+    const char* suffix = ".xwd";
+    const char* gdgSuffix = ".gdg";
+    size_t suffixLen = XP_STRLEN( suffix );
+    /* snprintf() returns what it would have written: don't trust it past
+       the end of path */
+    int len = snprintf( path, VSIZE(path), "%s", dictPath );
+    XP_Bool tooLong = len < 0 || (size_t)len >= VSIZE(path);
+    if ( !tooLong ) {
+        if ( (size_t)len >= suffixLen
+             && 0 == XP_STRCMP( &path[len-suffixLen], suffix ) ) {
+            len -= suffixLen;
+        }
+        tooLong = len + XP_STRLEN(gdgSuffix) >= VSIZE(path);
+        if ( !tooLong ) {
+            snprintf( &path[len], VSIZE(path) - len, "%s", gdgSuffix );
+        }
+    }
+
+    struct stat statbuf;
+    FILE* gdgF;
+    if ( tooLong ) {
+        XP_LOGFF( "path too long: %s", dictPath );
+    } else if ( 0 != stat( path, &statbuf ) || 0 == statbuf.st_size
+                || NULL == (gdgF = fopen( path, "r" )) ) {
+        /* nothing to do */
+    } else {
+        XP_U8* base;
+        size_t length = statbuf.st_size;
+        if ( dctx->useMMap ) {
+            base = mmap( NULL, length, PROT_READ, MAP_PRIVATE,
+                         fileno(gdgF), 0 );
+            if ( MAP_FAILED == base ) {
+                base = NULL;
+            }
+        } else {
+            base = XP_MALLOC( dctx->super.mpool, length );
+            if ( length != fread( base, 1, length, gdgF ) ) {
+                XP_FREEP( dctx->super.mpool, &base );
+            }
+        }
+        fclose( gdgF );
+
+        if ( !base ) {
+            XP_LOGFF( "unable to load %s", path );
+        } else if ( dict_setGaddag( &dctx->super, base, length ) ) {
+            dctx->gaddagBase = base;
+            dctx->gaddagLength = length;
+        } else if ( dctx->useMMap ) {
+            (void)munmap( base, length );
+        } else {
+            XP_FREE( dctx->super.mpool, base );
+        }
+    }
+} /* loadGaddag */
+#endif
+
 static void
 freeSpecials( LinuxDictionaryCtxt* ctxt )
 {
@@ -262,6 +522,14 @@ freeSpecials( LinuxDictionaryCtxt* ctxt )
     XP_FREEP( ctxt->super.mpool, &ctxt->super.charEnds );
 } /* freeSpecials */
 
+/* Drop one that's never been reffed, so dict_unref() can't be used */
+static void
+discard( LinuxDictionaryCtxt* dctx, XWEnv xwe )
+{
+    MUTEX_DESTROY( &dctx->super.mutex );
+    linux_dictionary_destroy( &dctx->super, xwe );
+}
+
 static void
 linux_dictionary_destroy( DictionaryCtxt* dict, XWEnv XP_UNUSED(xwe) )
 {
@@ -276,7 +544,17 @@ linux_dictionary_destroy( DictionaryCtxt* dict, XWEnv XP_UNUSED(xwe) )
             XP_FREE( dict->mpool, ctxt->dictBase );
         }
     }
+#ifdef XWFEATURE_GADDAG
+    if ( !!ctxt->gaddagBase ) {
+        if ( ctxt->useMMap ) {
+            (void)munmap( ctxt->gaddagBase, ctxt->gaddagLength );
+        } else {
+            XP_FREE( dict->mpool, ctxt->gaddagBase );
+        }
+    }
+#endif
 
+    XP_FREEP( dict->mpool, &ctxt->path );
     dict_super_destroy( &ctxt->super );
 
     XP_FREE( dict->mpool, ctxt );
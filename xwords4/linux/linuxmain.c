@@ -69,6 +69,7 @@
 # include "gtkmain.h"
 #endif
 #include "model.h"
+#include "engine.h"
 #include "util.h"
 #include "strutils.h"
 #include "dbgutil.h"
@@ -807,6 +808,17 @@ typedef enum {
 #ifdef XWFEATURE_ROBOTPHONIES
     ,CMD_MAKE_PHONY_PCT
 #endif
+#ifdef XWFEATURE_ENGINE_THREADS
+    ,CMD_ENGINE_THREADS
+#endif
+#ifdef XWFEATURE_DICTITER_THREADS
+    ,CMD_DICTITER_THREADS
+#endif
+    ,CMD_ENGINE_MOVES
+    ,CMD_BENCH_CORPUS
+    ,CMD_BENCH_MAKE_GAMES
+    ,CMD_BENCH_REPS
+    ,CMD_BENCH_HINTS
 #ifdef USE_GLIBLOOP		/* just because hard to implement otherwise */
     ,CMD_UNDOPCT
 #endif
@@ -973,6 +985,24 @@ static CmdInfoRec CmdInfoRecs[] = {
     ,{ CMD_MAKE_PHONY_PCT, true, "make-phony-pct",
        "what pct of the time should robot play a bad word" }
 #endif
+#ifdef XWFEATURE_ENGINE_THREADS
+    ,{ CMD_ENGINE_THREADS, true, "engine-threads",
+       "number of threads robot and hint searches use" }
+#endif
+#ifdef XWFEATURE_DICTITER_THREADS
+    ,{ CMD_DICTITER_THREADS, true, "dictiter-threads",
+       "number of threads counting --test-pat matches uses" }
+#endif
+    ,{ CMD_ENGINE_MOVES, true, "engine-moves",
+       "how many top-scoring moves hint searches keep (for analysis)" }
+    ,{ CMD_BENCH_CORPUS, true, "bench-corpus",
+       "positions file enginebench replays (or writes)" }
+    ,{ CMD_BENCH_MAKE_GAMES, true, "bench-make-games",
+       "enginebench: write this many robot games to the corpus instead" }
+    ,{ CMD_BENCH_REPS, true, "bench-reps",
+       "enginebench: how many times to search each position (default 5)" }
+    ,{ CMD_BENCH_HINTS, false, "bench-hints",
+       "enginebench: search as for hints rather than robot moves" }
 #ifdef USE_GLIBLOOP
     ,{ CMD_UNDOPCT, true, "undo-pct",
        "each second, what are the odds of doing an undo" }
@@ -2526,6 +2556,33 @@ dawg2dict( const LaunchParams* params, GSList* testDicts )
     return 0;
 }
 
+/* Run as enginebench: e.g.
+ *   ./enginebench --test-dict CollegeEng_2to8.xwd --bench-corpus bench.txt
+ */
+static int
+engineBench( LaunchParams* params, GSList* testDicts )
+{
+    int result = 1;
+    BenchParams* bp = &params->benchParams;
+    if ( !testDicts || !bp->corpusPath ) {
+        fprintf( stderr, "enginebench needs --test-dict and --bench-corpus\n" );
+    } else {
+        if ( 0 == bp->nReps ) {
+            bp->nReps = 5;      /* enough for a per-position p50 to mean much */
+        }
+        bp->boardSize = params->pgi.boardSize;
+        DictionaryCtxt* dict =
+            linux_dictionary_make( MPPARM(params->mpool) NULL_XWE, params,
+                                   g_slist_nth_data( testDicts, 0 ),
+                                   params->useMmap );
+        if ( NULL != dict ) {
+            result = eb_run( MPPARM(params->mpool) params->dutil, dict, bp );
+            dict_unref( dict, NULL_XWE );
+        }
+    }
+    return result;
+}
+
 #ifdef XWFEATURE_TESTPATSTR
 static int
 testOneString( const LaunchParams* params, GSList* testDicts )
@@ -3331,6 +3388,31 @@ main( int argc, char** argv )
             }
             break;
 #endif
+#ifdef XWFEATURE_ENGINE_THREADS
+        case CMD_ENGINE_THREADS:
+            engine_setNThreads( atoi( optarg ) );
+            break;
+#endif
+#ifdef XWFEATURE_DICTITER_THREADS
+        case CMD_DICTITER_THREADS:
+            di_setNThreads( atoi( optarg ) );
+            break;
+#endif
+        case CMD_ENGINE_MOVES:
+            engine_setMaxMovesToSave( atoi( optarg ) );
+            break;
+        case CMD_BENCH_CORPUS:
+            mainParams.benchParams.corpusPath = optarg;
+            break;
+        case CMD_BENCH_MAKE_GAMES:
+            mainParams.benchParams.makeGames = atoi( optarg );
+            break;
+        case CMD_BENCH_REPS:
+            mainParams.benchParams.nReps = atoi( optarg );
+            break;
+        case CMD_BENCH_HINTS:
+            mainParams.benchParams.hints = XP_TRUE;
+            break;
 
 #ifdef USE_GLIBLOOP
         case CMD_UNDOPCT:
@@ -3398,6 +3480,8 @@ main( int argc, char** argv )
     int result = 0;
     if ( g_str_has_suffix( argv[0], "dawg2dict" ) ) {
         result = dawg2dict( &mainParams, testDicts );
+    } else if ( g_str_has_suffix( argv[0], "enginebench" ) ) {
+        result = engineBench( &mainParams, testDicts );
 #ifdef XWFEATURE_TESTPATSTR
     } else if ( !!mainParams.iterTestPatStr ) {
         result = testOneString( &mainParams, testDicts );
@@ -33,6 +33,7 @@
 #include "vtabmgr.h"
 #include "dictmgr.h"
 #include "dutil.h"
+#include "enginebench.h"
 
 typedef struct ServerInfo {
     XP_U16 nRemotePlayers;
@@ -146,6 +147,7 @@ typedef struct _LaunchParams {
     DeviceRole serverRole;
 
     const XP_UCHAR* testMinMax;
+    BenchParams benchParams;    /* when run as enginebench */
     const XP_UCHAR* dumpDelim;
 
     GSList* iterTestPats;
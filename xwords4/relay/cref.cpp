@@ -351,6 +351,18 @@ CookieRef::SocketForHost( HostID dest )
     return result;
 }
 
+AddrInfo::ClientToken
+CookieRef::TokenForHost( HostID hid )
+{
+    AddrInfo::ClientToken token = AddrInfo::NULL_TOKEN;
+    RWReadLock rrl( &m_socketsRWLock );
+    HostRec* hr = m_sockets[hid - 1];
+    if ( !!hr ) {
+        token = hr->m_addr.clientToken();
+    }
+    return token;
+}
+
 bool 
 CookieRef::AlreadyHere( unsigned short seed, const AddrInfo* addr, 
                         HostID* prevHostID )
@@ -395,6 +407,8 @@ CookieRef::AlreadyHere( HostID hid, unsigned short seed, const AddrInfo* addr,
             } else {
                 logf( XW_LOGINFO, "%s: hids match; nuking existing record "
                       "for socket b/c assumed closed", __func__ );
+                CRefMgr::Get()->UnindexToken( hr->m_addr.clientToken(), hid,
+                                              GetCid() );
                 delete hr;
                 m_sockets[hid-1] = NULL;
             }
@@ -438,6 +452,8 @@ CookieRef::removeSocket( const AddrInfo* addr )
                     m_nPlayersHere -= hr->m_nPlayersH;
                     cancelAckTimer( hid );
                 }
+                CRefMgr::Get()->UnindexToken( hr->m_addr.clientToken(),
+                                              ii + 1, GetCid() );
                 m_sockets[ii] = NULL;
                 delete hr;
                 found = true;
@@ -995,6 +1011,7 @@ CookieRef::increasePlayerCounts( CRefEvent* evt, bool reconn, HostID* hidp,
         logf( XW_LOGINFO, "%s: adding socket rec with ts %lx for hid %d", __func__, 
               addr->created(), hostid );
     }
+    CRefMgr::Get()->IndexToken( addr->clientToken(), hostid, GetCid() );
 
     printSeeds(__func__);
 
@@ -1428,6 +1445,10 @@ CookieRef::removeDevice( const CRefEvent* const evt )
     if ( dbmgr->HaveDevice( ConnName(), evt->u.devgone.hid,
                             evt->u.devgone.seed ) ) {
         dbmgr->KillGame( ConnName(), evt->u.devgone.hid );
+        /* dead games aren't found by token */
+        for ( HostID hid = 1; hid <= MAX_DEVICES; ++hid ) {
+            CRefMgr::Get()->UnindexToken( TokenForHost( hid ), hid, GetCid() );
+        }
 
         RWReadLock rrl( &m_socketsRWLock );
         for ( unsigned int ii = 0; ii < VSIZE(m_sockets); ++ii ) {
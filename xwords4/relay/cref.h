@@ -114,6 +114,8 @@ class CookieRef {
 
     int GetHeartbeat() { return m_heartbeat; }
     const AddrInfo* SocketForHost( HostID dest );
+    /* NULL_TOKEN if there's no such host */
+    AddrInfo::ClientToken TokenForHost( HostID hid );
     HostID HostForSocket( const AddrInfo* addr );
 
     /* connect case */
@@ -63,7 +63,10 @@ CRefMgr::CRefMgr()
     /* pthread_mutex_init( &m_SocketStuffMutex, NULL ); */
     pthread_mutex_init( &m_roomsFilledMutex, NULL );
     pthread_mutex_init( &m_freeList_mutex, NULL );
-    pthread_rwlock_init( &m_cookieMapRWLock, NULL );
+    for ( int ii = 0; ii < N_SHARDS; ++ii ) {
+        pthread_rwlock_init( &m_shards[ii].rwlock, NULL );
+        pthread_rwlock_init( &m_indexes[ii].rwlock, NULL );
+    }
     m_db = DBMgr::Get();
     m_cidlock = CidLock::GetInstance();
 }
@@ -76,7 +79,10 @@ CRefMgr::~CRefMgr()
     delete m_cidlock;
 
     pthread_mutex_destroy( &m_freeList_mutex );
-    pthread_rwlock_destroy( &m_cookieMapRWLock );
+    for ( int ii = 0; ii < N_SHARDS; ++ii ) {
+        pthread_rwlock_destroy( &m_shards[ii].rwlock );
+        pthread_rwlock_destroy( &m_indexes[ii].rwlock );
+    }
 
     s_instance = NULL;
 }
@@ -86,18 +92,21 @@ CRefMgr::CloseAll()
 {
     /* Get every cref instance, shut it down */
 
-    for ( ; ; ) {
-        CookieRef* cref = NULL;
-        {
-            RWWriteLock rwl( &m_cookieMapRWLock );
-            CookieMap::iterator iter = m_cookieMap.begin();
-            if ( iter == m_cookieMap.end() ) {
-                break;
-            }
-            cref = iter->second; 
+    for ( int ii = 0; ii < N_SHARDS; ++ii ) {
+        CrefShard& shard = m_shards[ii];
+        for ( ; ; ) {
+            CookieRef* cref = NULL;
             {
-                SafeCref scr( cref->GetCid(), false ); /* cref */
-                scr.Shutdown();
+                RWWriteLock rwl( &shard.rwlock );
+                CookieMap::iterator iter = shard.crefs.begin();
+                if ( iter == shard.crefs.end() ) {
+                    break;
+                }
+                cref = iter->second; 
+                {
+                    SafeCref scr( cref->GetCid(), false ); /* cref */
+                    scr.Shutdown();
+                }
             }
         }
     }
@@ -120,7 +129,12 @@ CRefMgr::GetNumRoomsFilled( void )
 int 
 CRefMgr::GetSize( void )
 {
-    return m_cookieMap.size();
+    int size = 0;
+    for ( int ii = 0; ii < N_SHARDS; ++ii ) {
+        RWReadLock rwl( &m_shards[ii].rwlock );
+        size += m_shards[ii].crefs.size();
+    }
+    return size;
 }
 
 void
@@ -148,52 +162,111 @@ CRefMgr::GetStats( CrefMgrInfo& mgrInfo )
     }
     mgrInfo.m_ports = m_ports.c_str();
 
-    RWReadLock rwl( &m_cookieMapRWLock );
-    mgrInfo.m_nCrefsCurrent = m_cookieMap.size();
-
-    CookieMap::iterator iter;
-    for ( iter = m_cookieMap.begin(); iter != m_cookieMap.end(); ++iter ) {
-        CookieRef* cref = iter->second;
-
-        CrefInfo info;
-        info.m_cookie = cref->Cookie();
-        info.m_connName = cref->ConnName();
-        info.m_cid = cref->GetCid();
-        info.m_curState = cref->CurState();
-        info.m_nPlayersSought = cref->GetPlayersSought();
-        info.m_nPlayersHere = cref->GetPlayersHere();
-        info.m_startTime = cref->GetStarttime();
-        info.m_langCode = cref->GetLangCode();
-        
-        SafeCref sc(cref->GetCid(), false );
-        sc.GetHostsConnected( &info.m_hostsIds, &info.m_hostSeeds, 
-                              &info.m_hostIps );
-        
-        mgrInfo.m_crefInfo.push_back( info );
+    mgrInfo.m_nCrefsCurrent = 0;
+    for ( int ii = 0; ii < N_SHARDS; ++ii ) {
+        CrefShard& shard = m_shards[ii];
+        RWReadLock rwl( &shard.rwlock );
+        mgrInfo.m_nCrefsCurrent += shard.crefs.size();
+
+        CookieMap::iterator iter;
+        for ( iter = shard.crefs.begin(); iter != shard.crefs.end(); ++iter ) {
+            CookieRef* cref = iter->second;
+
+            CrefInfo info;
+            info.m_cookie = cref->Cookie();
+            info.m_connName = cref->ConnName();
+            info.m_cid = cref->GetCid();
+            info.m_curState = cref->CurState();
+            info.m_nPlayersSought = cref->GetPlayersSought();
+            info.m_nPlayersHere = cref->GetPlayersHere();
+            info.m_startTime = cref->GetStarttime();
+            info.m_langCode = cref->GetLangCode();
+
+            SafeCref sc(cref->GetCid(), false );
+            sc.GetHostsConnected( &info.m_hostsIds, &info.m_hostSeeds, 
+                                  &info.m_hostIps );
+
+            mgrInfo.m_crefInfo.push_back( info );
+        }
+    }
+}
+
+void
+CRefMgr::IndexToken( AddrInfo::ClientToken token, HostID hid, CookieID cid )
+{
+    if ( AddrInfo::NULL_TOKEN != token ) {
+        uint64_t key = tokenKey( token, hid );
+        IndexShard& index = indexFor( key );
+        RWWriteLock rwl( &index.rwlock );
+        index.byToken[key] = cid;
     }
 }
 
+void
+CRefMgr::UnindexToken( AddrInfo::ClientToken token, HostID hid,
+                       CookieID cid )
+{
+    if ( AddrInfo::NULL_TOKEN != token ) {
+        uint64_t key = tokenKey( token, hid );
+        IndexShard& index = indexFor( key );
+        RWWriteLock rwl( &index.rwlock );
+        unordered_map<uint64_t, CookieID>::iterator iter =
+            index.byToken.find( key );
+        if ( index.byToken.end() != iter && cid == iter->second ) {
+            index.byToken.erase( iter );
+        }
+    }
+}
+
+CRefMgr::IndexShard&
+CRefMgr::indexFor( const string& connName )
+{
+    return m_indexes[hash<string>()( connName ) % N_SHARDS];
+}
+
+CRefMgr::IndexShard&
+CRefMgr::indexFor( uint64_t tokenKey )
+{
+    return m_indexes[(tokenKey >> 8) % N_SHARDS]; /* i.e. by token */
+}
+
 CookieID
 CRefMgr::cookieIDForConnName( const char* connName )
 {
     CookieID cid = 0;
-    /* for now, just walk the existing data structure and see if the thing's
-       in use.  If it isn't, return a new id. */
+    string key( connName );
+    IndexShard& index = indexFor( key );
+    RWReadLock rwl( &index.rwlock );
+    unordered_map<string, CookieID>::const_iterator iter =
+        index.byConnName.find( key );
+    if ( index.byConnName.end() != iter ) {
+        cid = iter->second;
+    }
+    return cid;
+} /* cookieIDForConnName */
 
-    RWReadLock rwl( &m_cookieMapRWLock );
+CookieID
+CRefMgr::CookieIdForName( const char* name )
+{
+    return cookieIDForConnName( name );
+}
 
-    CookieMap::iterator iter = m_cookieMap.begin();
-    while ( iter != m_cookieMap.end() ) {
-        CookieRef* cref = iter->second;
-        if ( 0 == strcmp( cref->ConnName(), connName ) ) {
-            cid = iter->first;
-            break;
-        }
-        ++iter;
+/* Just a hint: the caller has to check the cref it gets still has that
+ * device, since hosts are unindexed only as they're removed */
+CookieID
+CRefMgr::cidForToken( AddrInfo::ClientToken token, HostID hid )
+{
+    CookieID cid = 0;
+    uint64_t key = tokenKey( token, hid );
+    IndexShard& index = indexFor( key );
+    RWReadLock rwl( &index.rwlock );
+    unordered_map<uint64_t, CookieID>::const_iterator iter =
+        index.byToken.find( key );
+    if ( index.byToken.end() != iter ) {
+        cid = iter->second;
     }
-
     return cid;
-} /* cookieIDForConnName */
+}
 
 void
 CRefMgr::addToFreeList( CookieRef* cref )
@@ -394,7 +467,8 @@ CRefMgr::getMakeCookieRef( const char* const connName, HostID hid, bool* isDead
 }
 
 CidInfo*
-CRefMgr::getMakeCookieRef( const AddrInfo::ClientToken clientToken, HostID srcID )
+CRefMgr::getMakeCookieRef( const AddrInfo::ClientToken clientToken, HostID srcID,
+                           const DBMgr::TokenGame* found )
 {
     CookieRef* cref = NULL;
     CidInfo* cinfo = NULL;
@@ -403,6 +477,20 @@ CRefMgr::getMakeCookieRef( const AddrInfo::ClientToken clientToken, HostID srcID
     int nPlayersT = 0;
     int nAlreadyHere = 0;
 
+    /* Live game with this device in it?  Then the DB can't tell us more */
+    CookieID liveCid = cidForToken( clientToken, srcID );
+    if ( 0 != liveCid ) {
+        cinfo = m_cidlock->Claim( liveCid );
+        cref = cinfo->GetRef();
+        if ( NULL != cref && clientToken == cref->TokenForHost( srcID ) ) {
+            logf( XW_LOGINFO, "%s() => %p (live)", __func__, cinfo );
+            return cinfo;
+        }
+        m_cidlock->Relinquish( cinfo, NULL == cref );
+        cinfo = NULL;
+        cref = NULL;
+    }
+
     for ( int ii = 0; ; ++ii ) {     /* for: see comment above */
         if ( ii > 5 ) {
             assert(0);
@@ -410,11 +498,21 @@ CRefMgr::getMakeCookieRef( const AddrInfo::ClientToken clientToken, HostID srcID
         }
 
         char connName[MAX_CONNNAME_LEN+1] = {0};
-        CookieID cid = m_db->FindGame( clientToken, srcID,
-                                       connName, sizeof(connName),
-                                       curCookie, sizeof(curCookie),
-                                       &curLangCode, &nPlayersT, &nAlreadyHere );
+        CookieID cid;
+        if ( 0 == ii && NULL != found ) { /* the caller's asked already */
+            cid = found->cid;
+            snprintf( connName, sizeof(connName), "%s", found->connName );
+            snprintf( curCookie, sizeof(curCookie), "%s", found->room );
+            curLangCode = found->lang;
+            nPlayersT = found->nPlayersT;
+            nAlreadyHere = found->nPlayersH;
+        } else {
+            cid = m_db->FindGame( clientToken, srcID,
+                                  connName, sizeof(connName),
+                                  curCookie, sizeof(curCookie),
+                                  &curLangCode, &nPlayersT, &nAlreadyHere );
             // &seed );
+        }
         if ( 0 != cid ) {           /* already open */
             cinfo = m_cidlock->Claim( cid );
             if ( NULL == cinfo->GetRef() ) {
@@ -516,7 +614,6 @@ CRefMgr::AddNew( const char* cookie, const char* connName, CookieID cid,
 
     CookieRef* ref = getFromFreeList();
 
-    RWWriteLock rwl( &m_cookieMapRWLock );
     logf( XW_LOGINFO, "making new cref: %d", cid );
     
     if ( !!ref ) {
@@ -528,14 +625,24 @@ CRefMgr::AddNew( const char* cookie, const char* connName, CookieID cid,
 
     ref->assignConnName();
 
-    pair<CookieMap::iterator,bool> result =
-        m_cookieMap.insert( pair<CookieID, CookieRef*>(ref->GetCid(), ref ) );
-    assert( result.second );
+    {
+        CrefShard& shard = shardFor( ref->GetCid() );
+        RWWriteLock rwl( &shard.rwlock );
+        pair<CookieMap::iterator,bool> result =
+            shard.crefs.insert( pair<CookieID, CookieRef*>(ref->GetCid(), ref ) );
+        assert( result.second );
+    }
+    {
+        string name( ref->ConnName() );
+        IndexShard& index = indexFor( name );
+        RWWriteLock rwl( &index.rwlock );
+        index.byConnName[name] = ref->GetCid();
+    }
     logf( XW_LOGINFO, "%s: paired cookie %s/connName %s with cid %d", __func__, 
           (cookie?cookie:"NULL"), connName, ref->GetCid() );
 
 #ifdef RELAY_HEARTBEAT
-    if ( m_cookieMap.size() == 1 ) {
+    if ( GetSize() == 1 ) {
         RelayConfigs* cfg = RelayConfigs::GetConfigs();
         int heartbeat;
         if ( cfg->GetValueFor( "HEARTBEAT", &heartbeat ) ) {
@@ -554,30 +661,40 @@ CRefMgr::Recycle_locked( CookieRef* cref )
 {
     logf( XW_LOGINFO, "%s(cref=%p,cookie=%s)", __func__, cref, cref->Cookie() );
     CookieID cid = cref->GetCid();
+    string connName( cref->ConnName() );
     DBMgr::Get()->ClearCID( cref->ConnName() );
+    for ( HostID hid = 1; hid <= CookieRef::MAX_DEVICES; ++hid ) {
+        UnindexToken( cref->TokenForHost( hid ), hid, cid );
+    }
     cref->Clear();
     addToFreeList( cref );
 
     cref->Unlock();
 
-    /* don't grab this lock until after releasing cref's lock; otherwise
+    /* don't grab these locks until after releasing cref's lock; otherwise
        deadlock happens. */
-    RWWriteLock rwl( &m_cookieMapRWLock );
-
-    CookieMap::iterator iter = m_cookieMap.begin();
-    while ( iter != m_cookieMap.end() ) {
-        CookieRef* ref = iter->second;
-        if ( ref == cref ) {
+    {
+        IndexShard& index = indexFor( connName );
+        RWWriteLock rwl( &index.rwlock );
+        unordered_map<string, CookieID>::iterator iter =
+            index.byConnName.find( connName );
+        if ( index.byConnName.end() != iter && cid == iter->second ) {
+            index.byConnName.erase( iter );
+        }
+    }
+    {
+        CrefShard& shard = shardFor( cid );
+        RWWriteLock rwl( &shard.rwlock );
+        CookieMap::iterator iter = shard.crefs.find( cid );
+        assert( iter != shard.crefs.end() && iter->second == cref );
+        if ( iter != shard.crefs.end() ) {
             logf( XW_LOGINFO, "%s: erasing cref cid %d", __func__, cid );
-            m_cookieMap.erase( iter );
-            break;
+            shard.crefs.erase( iter );
         }
-        ++iter;
     }
-    assert( iter != m_cookieMap.end() ); /* we found something */
 
 #ifdef RELAY_HEARTBEAT
-    if ( m_cookieMap.size() == 0 ) {
+    if ( GetSize() == 0 ) {
         TimerMgr::GetTimerMgr()->ClearTimer( heartbeatProc, this );
     }
 #endif
@@ -606,10 +723,10 @@ CRefMgr::checkHeartbeats( time_t now )
 {
     vector<CookieRef*> crefs;
 
-    {
-        RWReadLock rwl( &m_cookieMapRWLock );
-        CookieMap::iterator iter = m_cookieMap.begin();
-        while ( iter != m_cookieMap.end() ) {
+    for ( int ii = 0; ii < N_SHARDS; ++ii ) {
+        RWReadLock rwl( &m_shards[ii].rwlock );
+        CookieMap::iterator iter = m_shards[ii].crefs.begin();
+        while ( iter != m_shards[ii].crefs.end() ) {
             crefs.push_back(iter->second);
             ++iter;
         }
@@ -629,28 +746,41 @@ CRefMgr::uptime( void )
     return time(NULL) - m_startTime;
 }
 
-/* static */ CookieMapIterator
+CookieMapIterator
 CRefMgr::GetCookieIterator()
 {
-    CookieMapIterator iter(&m_cookieMapRWLock);
-    return iter;
+    return CookieMapIterator( this );
 }
 
+/* Locks are taken in shard order, and writers hold only one at a time, so
+   neither they nor other iterators can deadlock with this. */
+CookieMapIterator::CookieMapIterator( CRefMgr* mgr )
+    : m_mgr( mgr )
+    , m_next( 0 )
+{
+    for ( int ii = 0; ii < CRefMgr::N_SHARDS; ++ii ) {
+        CRefMgr::CrefShard& shard = m_mgr->m_shards[ii];
+        pthread_rwlock_rdlock( &shard.rwlock );
+        CookieMap::const_iterator iter;
+        for ( iter = shard.crefs.begin(); iter != shard.crefs.end(); ++iter ) {
+            m_cids.push_back( iter->second->GetCid() );
+        }
+    }
+}
 
-CookieMapIterator::CookieMapIterator(pthread_rwlock_t* rwlock)
-    : m_rwl( rwlock )
-    ,_iter( CRefMgr::Get()->m_cookieMap.begin() )
+CookieMapIterator::~CookieMapIterator()
 {
+    for ( int ii = CRefMgr::N_SHARDS - 1; ii >= 0; --ii ) {
+        pthread_rwlock_unlock( &m_mgr->m_shards[ii].rwlock );
+    }
 }
 
 CookieID
 CookieMapIterator::Next()
 {
     CookieID cid = 0;
-    if ( _iter != CRefMgr::Get()->m_cookieMap.end() ) {
-        CookieRef* cref = _iter->second;
-        cid = cref->GetCid();
-        ++_iter;
+    if ( m_next < m_cids.size() ) {
+        cid = m_cids[m_next++];
     }
     return cid;
 }
@@ -787,12 +917,13 @@ SafeCref::SafeCref( const AddrInfo* addr )
     }
 }
 
-SafeCref::SafeCref( const AddrInfo::ClientToken clientToken, HostID srcID )
+SafeCref::SafeCref( const AddrInfo::ClientToken clientToken, HostID srcID,
+                    const DBMgr::TokenGame* found )
     : m_cinfo( NULL )
     , m_mgr( CRefMgr::Get() )
     , m_isValid( false )
 {
-    CidInfo* cinfo = m_mgr->getMakeCookieRef( clientToken, srcID );
+    CidInfo* cinfo = m_mgr->getMakeCookieRef( clientToken, srcID, found );
     if ( NULL != cinfo && NULL != cinfo->GetRef() ) {
         m_locked = cinfo->GetRef()->Lock();
         m_cinfo = cinfo;
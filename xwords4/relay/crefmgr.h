@@ -23,6 +23,7 @@
 #define _CREFMGR_H_
 
 #include <list>
+#include <unordered_map>
 
 #include "cref.h"
 #include "dbmgr.h"
@@ -101,6 +102,15 @@ class CRefMgr {
 
     void GetStats( CrefMgrInfo& info );
 
+    /* For CookieRef: remember which game a device's packets belong to, so
+       the lookup by token needn't go to the DB while the game's live */
+    void IndexToken( AddrInfo::ClientToken token, HostID hid, CookieID cid );
+    void UnindexToken( AddrInfo::ClientToken token, HostID hid, CookieID cid );
+    /* The live game SafeCref( clientToken, srcID ) would most likely find
+       without asking the DB, or 0.  For routing packets by game. */
+    CookieID CidForToken( AddrInfo::ClientToken token, HostID hid )
+        { return cidForToken( token, hid ); }
+
  private:
     friend class SafeCref;
 
@@ -129,7 +139,8 @@ class CRefMgr {
                                bool isPublic, bool* isDead );
 
     CidInfo* getMakeCookieRef( const char* const connName, HostID hid, bool* isDead );
-    CidInfo* getMakeCookieRef( const AddrInfo::ClientToken clientToken, HostID srcID );
+    CidInfo* getMakeCookieRef( const AddrInfo::ClientToken clientToken, HostID srcID,
+                               const DBMgr::TokenGame* found );
 
     CidInfo* getCookieRef( CookieID cid, bool failOk = false );
     CidInfo* getCookieRef( const AddrInfo* addr );
@@ -143,6 +154,7 @@ class CRefMgr {
                                 bool wantsPublic, bool* alreadyHere );
 
     CookieID cookieIDForConnName( const char* connName );
+    CookieID cidForToken( AddrInfo::ClientToken token, HostID hid );
     CookieID nextCID( const char* connName );
 
     static void heartbeatProc( void* closure );
@@ -151,8 +163,29 @@ class CRefMgr {
     pthread_mutex_t m_roomsFilledMutex;
     int m_nRoomsFilled;
 
-    pthread_rwlock_t m_cookieMapRWLock;
-    CookieMap m_cookieMap;
+    /* Crefs are spread across shards by cid, each with its own lock, so
+       threads working on different games don't wait on each other.  The
+       secondary indexes are sharded the same way by their own keys. */
+    static const int N_SHARDS = 16;
+    typedef struct {
+        pthread_rwlock_t rwlock;
+        CookieMap crefs;
+    } CrefShard;
+    typedef struct {
+        pthread_rwlock_t rwlock;
+        unordered_map<string, CookieID> byConnName;
+        unordered_map<uint64_t, CookieID> byToken; /* see tokenKey() */
+    } IndexShard;
+
+    CrefShard& shardFor( CookieID cid ) { return m_shards[cid % N_SHARDS]; }
+    IndexShard& indexFor( const string& connName );
+    IndexShard& indexFor( uint64_t tokenKey );
+    static uint64_t tokenKey( AddrInfo::ClientToken token, HostID hid ) {
+        return ((uint64_t)token << 8) | hid;
+    }
+
+    CrefShard m_shards[N_SHARDS];
+    IndexShard m_indexes[N_SHARDS];
 
     time_t m_startTime;
     string m_ports;
@@ -183,7 +216,9 @@ class SafeCref {
     SafeCref( const char* const connName, HostID hid );
     SafeCref( CookieID cid, bool failOk = false );
     SafeCref( const AddrInfo* addr );
-    SafeCref( const AddrInfo::ClientToken clientToken, HostID srcID );
+    /* found: what DBMgr::FindGame() reported, if the caller's asked */
+    SafeCref( const AddrInfo::ClientToken clientToken, HostID srcID,
+              const DBMgr::TokenGame* found = NULL );
     /* SafeCref( CookieRef* cref ); */
     ~SafeCref();
 
@@ -406,14 +441,17 @@ class SafeCref {
 }; /* SafeCref class */
 
 
+/* Holds every shard's read lock for as long as it exists, so no cref goes
+   away while the ctrl and http walkers are using its cid. */
 class CookieMapIterator {
  public:
-    CookieMapIterator(pthread_rwlock_t* rwlock);
-    ~CookieMapIterator() {}
+    CookieMapIterator( CRefMgr* mgr );
+    ~CookieMapIterator();
     CookieID Next();
  private:
-    RWReadLock m_rwl;
-    CookieMap::const_iterator _iter;
+    CRefMgr* m_mgr;
+    vector<CookieID> m_cids;
+    size_t m_next;
 };
 
 #endif
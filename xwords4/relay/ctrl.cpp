@@ -51,6 +51,9 @@
 #include "tpool.h"
 #include "devmgr.h"
 #include "udpack.h"
+#include "udpqueue.h"
+#include "timermgr.h"
+#include "dbmgr.h"
 #include "strwpf.h"
 
 /* this is *only* for testing.  Don't abuse!!!! */
@@ -83,6 +86,9 @@ static bool cmd_shutdown( int sock, const char* cmd, int argc, gchar** argv );
 static bool cmd_rev( int sock, const char* cmd, int argc, gchar** argv );
 static bool cmd_uptime( int sock, const char* cmd, int argc, gchar** argv );
 static bool cmd_crash( int sock, const char* cmd, int argc, gchar** argv );
+static bool cmd_queues( int sock, const char* cmd, int argc, gchar** argv );
+static bool cmd_timers( int sock, const char* cmd, int argc, gchar** argv );
+static bool cmd_db( int sock, const char* cmd, int argc, gchar** argv );
 
 static void print_prompt( int sock );
 
@@ -132,6 +138,7 @@ static const FuncRec gFuncs[] = {
     { "?", cmd_help },
     { "acks", cmd_acks },
     { "crash", cmd_crash },
+    { "db", cmd_db },
     /* { "eject", cmd_kill_eject }, */
     { "get", cmd_get },
     { "help", cmd_help },
@@ -139,12 +146,14 @@ static const FuncRec gFuncs[] = {
     /* { "lock", cmd_lock }, */
     { "print", cmd_print },
     { "devs", cmd_devs },
+    { "queues", cmd_queues },
     { "quit", cmd_quit },
     { "rev", cmd_rev },
     { "set", cmd_set },
     { "shutdown", cmd_shutdown },
     { "start", cmd_start },
     { "stop", cmd_stop },
+    { "timers", cmd_timers },
     { "uptime", cmd_uptime },
 };
 
@@ -418,6 +427,51 @@ cmd_uptime( int sock, const char* cmd, int argc, gchar** argv )
     return false;
 }
 
+static bool
+cmd_queues( int sock, const char* cmd, int argc, gchar** argv )
+{
+    if ( 1 == argc ) {
+        StrWPF result;
+        UdpQueue::get()->printStats( result );
+        send( sock, result.c_str(), result.size(), 0 );
+    } else {
+        print_to_sock( sock, true,
+                       "* %s -- prints depth and latency of packet queues",
+                       cmd );
+    }
+    return false;
+}
+
+static bool
+cmd_timers( int sock, const char* cmd, int argc, gchar** argv )
+{
+    if ( 1 == argc ) {
+        StrWPF result;
+        TimerMgr::GetTimerMgr()->PrintStats( result );
+        send( sock, result.c_str(), result.size(), 0 );
+    } else {
+        print_to_sock( sock, true,
+                       "* %s -- prints number of pending timers",
+                       cmd );
+    }
+    return false;
+}
+
+static bool
+cmd_db( int sock, const char* cmd, int argc, gchar** argv )
+{
+    if ( 1 == argc ) {
+        StrWPF result;
+        DBMgr::Get()->PrintStats( result );
+        send( sock, result.c_str(), result.size(), 0 );
+    } else {
+        print_to_sock( sock, true,
+                       "* %s -- prints db connection use and query latencies",
+                       cmd );
+    }
+    return false;
+}
+
 static bool
 cmd_crash( int sock, const char* cmd, int argc, gchar** argv )
 {
@@ -41,6 +41,68 @@
 
 #define ARRAYSUM "sum_array(nPerDevice)"
 
+#ifdef HAVE_STIME
+# define UNSENT " AND stime = 'epoch'"
+#else
+# define UNSENT ""
+#endif
+
+/* Messages are stored via prepared statements, the payload going as a binary
+ * parameter (or base64 text, if USE_B64) rather than escaped into the query.
+ * msghash is the hex md5 of the payload, same as postgres's md5(msg), and
+ * replaces comparing whole payloads when looking for duplicates.  Ids come
+ * from msgs_id_seq ahead of time (see nextMsgID()) so a message can be
+ * handed out and acked before it's written.  That makes storing one twice
+ * harmless: if a row with its id is already there, that id comes back as
+ * though it had just been added.  DO UPDATE rather than DO NOTHING so that
+ * holds even for a row another connection (say, one that died mid-pipeline)
+ * hasn't finished committing.  No row means a duplicate was skipped.
+ */
+#define STORE_BY_ID(INSERT)                                             \
+    "WITH ins AS (" INSERT " ON CONFLICT (id) DO UPDATE SET id = "      \
+    "EXCLUDED.id RETURNING id) SELECT id FROM ins UNION "               \
+    "SELECT id FROM " MSGS_TABLE " WHERE id = $1::INTEGER"
+
+#define STORE_DEV_SQL(COL, TYPE)                                        \
+    STORE_BY_ID(                                                        \
+    "INSERT INTO " MSGS_TABLE " (id, devid, " COL ", msglen, msghash) " \
+    "VALUES ($1::INTEGER, $2::INTEGER, $3::" TYPE ", $4::INTEGER, "     \
+    "$5::TEXT)" )
+
+#define STORE_CONN_SQL(COL, TYPE)                                       \
+    STORE_BY_ID(                                                        \
+    "INSERT INTO " MSGS_TABLE                                           \
+    " (id, connname, hid, devid, token, " COL ", msglen, msghash) "     \
+    "SELECT $1::INTEGER, $2::VARCHAR, $3::INTEGER, $4::INTEGER, "       \
+    "$5::INTEGER, $6::" TYPE ", $7::INTEGER, $8::TEXT "                 \
+    "WHERE NOT EXISTS (SELECT 1 FROM " MSGS_TABLE                       \
+    " WHERE connname = $2::VARCHAR AND hid = $3::INTEGER"               \
+    " AND msghash = $8::TEXT" UNSENT ")" )
+
+/* indexed by m_useB64 */
+static const char* s_storeDevSQL[] = {
+    STORE_DEV_SQL( "msg", "BYTEA" ), STORE_DEV_SQL( "msg64", "TEXT" ),
+};
+static const char* s_storeConnSQL[] = {
+    STORE_CONN_SQL( "msg", "BYTEA" ), STORE_CONN_SQL( "msg64", "TEXT" ),
+};
+
+#define STORED_SQL(COND, ORNULL)                                        \
+    "SELECT id, msg64, msg, msglen, token, connname, hid, devid, "      \
+    "msghash FROM " MSGS_TABLE                                          \
+    " WHERE " COND UNSENT " AND (connname IN (SELECT connname FROM "    \
+    GAMES_TABLE " WHERE NOT " GAMES_TABLE ".dead)" ORNULL ") ORDER BY id"
+
+static const char* s_storedByDevSQL = 
+    STORED_SQL( "devid = $1::INTEGER", " OR connname IS NULL" );
+static const char* s_storedByConnSQL = 
+    STORED_SQL( "hid = $1::INTEGER AND connname = $2::VARCHAR", "" );
+
+/* Past this many, stores wait for the next round trip */
+#define MAX_STORE_BATCH 64
+/* How many message ids to fetch from msgs_id_seq at a time */
+#define MSG_ID_BLOCK 64
+
 static DBMgr* s_instance = NULL;
 
 #define MAX_NUM_PLAYERS 4
@@ -48,7 +110,23 @@ static DBMgr* s_instance = NULL;
 
 static int here_less_seed( const char* seeds, int perDeviceSum, 
                            unsigned short seed );
-static void destr_function( void* conn );
+static void close_proc( PGconn* conn );
+static int storedMsgID( PGresult* result );
+static int intAt( PGresult* result, int row, int col );
+
+struct DBMgr::Pending {
+    Pending( DBMgr* self, DoneProc proc, void* closure )
+        : self(self), proc(proc), closure(closure)
+        , relayID(DEVID_NONE), stamp(0), msgs(NULL), out(NULL) {}
+
+    DBMgr* self;
+    DoneProc proc;
+    void* closure;
+    DevIDRelay relayID;         /* GetStoredMessages() */
+    uint32_t stamp;
+    vector<MsgInfo>* msgs;
+    void* out;                  /* getDevID(), FindGame() */
+};
 
 /* static */ DBMgr*
 DBMgr::Get() 
@@ -72,9 +150,53 @@ DBMgr::DBMgr()
         assert(0);
     }
 
-    pthread_key_create( &m_conn_key, destr_function );
+    char dbName[128];
+    int port;
+    if ( !RelayConfigs::GetConfigs()->GetValueFor( "DB_NAME", dbName, 
+                                                   sizeof(dbName) ) ) {
+        assert( 0 );
+    }
+    if ( !RelayConfigs::GetConfigs()->GetValueFor( "DB_PORT", &port ) ) {
+        assert( 0 );
+    }
+    StrWPF params;
+    params.catf( "dbname = %s ", dbName );
+    params.catf( "port = %d ", port );
+
+    int poolSize;
+    if ( !RelayConfigs::GetConfigs()->GetValueFor( "DB_POOL_SIZE", &poolSize )
+         || 0 >= poolSize ) {
+        poolSize = 8;
+    }
+    m_pool = new DBPool( params.c_str(), poolSize, close_proc );
 
     pthread_mutex_init( &m_haveNoMessagesMutex, NULL );
+    pthread_mutex_init( &m_preparedMutex, NULL );
+    pthread_mutex_init( &m_storeMutex, NULL );
+    pthread_cond_init( &m_storeCondVar, NULL );
+    m_storeWriterActive = false;
+    pthread_mutex_init( &m_idsMutex, NULL );
+    pthread_mutex_init( &m_flushMutex, NULL );
+
+    int cacheSize;
+    if ( !RelayConfigs::GetConfigs()->GetValueFor( "MSGCACHE_SIZE",
+                                                   &cacheSize ) ) {
+        cacheSize = 10000;
+    }
+    if ( !RelayConfigs::GetConfigs()->GetValueFor( "MSGCACHE_FLUSH_SECS",
+                                                   &m_flushSecs ) ) {
+        m_flushSecs = 5;
+    }
+    m_cache = NULL;
+    if ( 0 < cacheSize ) {
+        m_cache = new MsgCache( cacheSize );
+        pthread_t thread;
+        int result = pthread_create( &thread, NULL, flush_thread, this );
+        assert( 0 == result );
+        pthread_detach( thread );
+    }
+    logf( XW_LOGINFO, "%s: cacheSize=%d; flushSecs=%d", __func__, cacheSize,
+          m_flushSecs );
 
     srand( time( NULL ) );
 }
@@ -84,8 +206,7 @@ DBMgr::~DBMgr()
     assert( s_instance == this );
     s_instance = NULL;
 
-    int err = pthread_key_delete( m_conn_key );
-    logf( XW_LOGINFO, "%s: pthread_key_delete=>%d", __func__, err );
+    delete m_pool;
 }
 
 void
@@ -107,10 +228,7 @@ DBMgr::AddNew( const char* cookie, const char* connName, CookieID cid,
         .appendParam(isPublic?"TRUE":"FALSE" )
         .finish();
 
-    PGresult* result = PQexecParams( getThreadConn(), qb.c_str(),
-                                     qb.paramCount(), NULL,
-                                     qb.paramValues(),
-                                     NULL, NULL, 0 );
+    PGresult* result = exec( qb );
     if ( PGRES_COMMAND_OK != PQresultStatus(result) ) {
         logf( XW_LOGERROR, "PQexec=>%s;%s", PQresStatus(PQresultStatus(result)), 
               PQresultErrorMessage(result) );
@@ -136,7 +254,7 @@ DBMgr::FindGameFor( const char* connName, char* cookieBuf, int bufLen,
     query.catf( fmt, connName, nPlayersS, seed, hid, hid );
     logf( XW_LOGINFO, "query: %s", query.c_str() );
 
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     assert( 1 >= PQntuples( result ) );
     found = 1 == PQntuples( result );
     if ( found ) {
@@ -166,7 +284,7 @@ DBMgr::FindGame( const char* connName, HostID hid, char* roomBuf, int roomBufLen
     query.catf( fmt, hid, connName );
     logf( XW_LOGINFO, "query: %s", query.c_str() );
 
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     assert( 1 >= PQntuples( result ) );
     if ( 1 == PQntuples( result ) ) {
         int col = 0;
@@ -189,32 +307,69 @@ DBMgr::FindGame( const AddrInfo::ClientToken clientToken, HostID hid,
                  char* roomBuf, int roomBufLen,
                  int* langP, int* nPlayersTP, int* nPlayersHP )
 {
-    CookieID cid = 0;
+    StrWPF query;
+    formatTokenGameQuery( query, clientToken, hid );
+    logf( XW_LOGINFO, "query: %s", query.c_str() );
+
+    TokenGame game;
+    PGresult* result = exec( query.c_str() );
+    if ( readTokenGame( result, &game ) ) {
+        snprintf( roomBuf, roomBufLen, "%s", game.room );
+        *langP = game.lang;
+        *nPlayersTP = game.nPlayersT;
+        *nPlayersHP = game.nPlayersH;
+        snprintf( connNameBuf, connNameBufLen, "%s", game.connName );
+    }
+    PQclear( result );
+
+    logf( XW_LOGINFO, "%s(ct=%d,hid=%d) => %d (connname=%s)", __func__, clientToken,
+          hid, game.cid, connNameBuf );
+    return game.cid;
+}
+
+bool
+DBMgr::FindGame( const AddrInfo::ClientToken clientToken, HostID hid,
+                 TokenGame* game, DoneProc proc, void* closure )
+{
+    StrWPF query;
+    formatTokenGameQuery( query, clientToken, hid );
+    logf( XW_LOGINFO, "query: %s", query.c_str() );
+
+    Pending* pending = new Pending( this, proc, closure );
+    pending->out = game;
+    m_pool->QueryAsync( query.c_str(), vector<string>(), 0, gotTokenGame,
+                        pending );
+    return false;
+}
+
+/* static */ void
+DBMgr::formatTokenGameQuery( StrWPF& query, AddrInfo::ClientToken clientToken,
+                             HostID hid )
+{
     const char* fmt = "SELECT cid, room, lang, nTotal, nPerDevice[%d], connname FROM "
         GAMES_TABLE " WHERE tokens[%d] = %d and NOT dead";
         // " LIMIT 1"
         ;
-    StrWPF query;
     query.catf( fmt, hid, hid, clientToken );
-    logf( XW_LOGINFO, "query: %s", query.c_str() );
+}
 
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
-    if ( 1 == PQntuples( result ) ) {
+/* static */ bool
+DBMgr::readTokenGame( PGresult* result, TokenGame* game )
+{
+    memset( game, 0, sizeof(*game) );
+    bool found = 1 == PQntuples( result );
+    if ( found ) {
         int col = 0;
-        cid = atoi( PQgetvalue( result, 0, col++ ) );
-        // room
-        snprintf( roomBuf, roomBufLen, "%s", PQgetvalue( result, 0, col++ ) );
-        // lang
-        *langP = atoi( PQgetvalue( result, 0, col++ ) );
-        *nPlayersTP = atoi( PQgetvalue( result, 0, col++ ) );
-        *nPlayersHP = atoi( PQgetvalue( result, 0, col++ ) );
-        snprintf( connNameBuf, connNameBufLen, "%s", PQgetvalue( result, 0, col++ ) );
+        game->cid = atoi( PQgetvalue( result, 0, col++ ) );
+        snprintf( game->room, sizeof(game->room), "%s",
+                  PQgetvalue( result, 0, col++ ) );
+        game->lang = atoi( PQgetvalue( result, 0, col++ ) );
+        game->nPlayersT = atoi( PQgetvalue( result, 0, col++ ) );
+        game->nPlayersH = atoi( PQgetvalue( result, 0, col++ ) );
+        snprintf( game->connName, sizeof(game->connName), "%s",
+                  PQgetvalue( result, 0, col++ ) );
     }
-    PQclear( result );
-
-    logf( XW_LOGINFO, "%s(ct=%d,hid=%d) => %d (connname=%s)", __func__, clientToken,
-          hid, cid, connNameBuf );
-    return cid;
+    return found;
 }
 
 bool
@@ -228,7 +383,7 @@ DBMgr::FindPlayer( DevIDRelay relayID, AddrInfo::ClientToken token,
     StrWPF query;
     query.catf( fmt, GAMES_TABLE, relayID, token );
 
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     int nTuples = PQntuples( result );
     vector<string> names(nTuples);
     for ( int ii = 0; ii < nTuples; ++ii ) {
@@ -246,7 +401,7 @@ DBMgr::FindPlayer( DevIDRelay relayID, AddrInfo::ClientToken token,
             StrWPF query;
             query.catf( fmt, hid, GAMES_TABLE, name,
                         hid, relayID, hid, token );
-            result = PQexec( getThreadConn(), query.c_str() );
+            result = exec( query.c_str() );
             int nTuples2 = PQntuples( result );
             for ( int jj = 0; jj < nTuples2; ++jj ) {
                 connName = name;
@@ -275,7 +430,7 @@ DBMgr::FindRelayIDFor( const char* connName, HostID hid,
     query.catf( "SELECT devids[%d] FROM " GAMES_TABLE " WHERE "
                 "connname = '%s' AND seeds[%d] = %d", hid, 
                 connName, hid, seed );
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     int nTuples = PQntuples( result );
     assert( nTuples <= 1 );
     bool found = nTuples == 1;
@@ -316,10 +471,7 @@ DBMgr::SeenSeed( const char* cookie, unsigned short seed,
         .appendParam(wantsPublic?"TRUE":"FALSE" )
         .finish();
 
-    PGresult* result = PQexecParams( getThreadConn(), qb.c_str(),
-                                     qb.paramCount(), NULL,
-                                     qb.paramValues(),
-                                     NULL, NULL, 0 );
+    PGresult* result = exec( qb );
     bool found = 1 == PQntuples( result );
     if ( found ) {
         int col = 0;
@@ -358,10 +510,7 @@ DBMgr::FindRecentOpen( const char* cookie, int lang, int nPlayersT, int nPlayers
         .appendParam(wantsPublic?"TRUE":"FALSE" )
         .finish();
 
-    PGresult* result = PQexecParams( getThreadConn(), qb.c_str(),
-                                     qb.paramCount(), NULL,
-                                     qb.paramValues(), 
-                                     NULL, NULL, 0 );
+    PGresult* result = exec( qb );
     CookieID cid = 0;
     if ( 1 == PQntuples( result ) ) {
         int col = 0;
@@ -384,7 +533,7 @@ DBMgr::AllDevsAckd( const char* const connName )
     query.catf( cmd, connName );
     logf( XW_LOGINFO, "query: %s", query.c_str() );
 
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     int nTuples = PQntuples( result );
     assert( nTuples <= 1 );
     bool full = nTuples == 1 && 't' == PQgetvalue( result, 0, 0 )[0];
@@ -620,7 +769,7 @@ DBMgr::HIDForSeed( const char* const connName, unsigned short seed )
     StrWPF query;
     query.catf( fmt, connName, seed );
     logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     if ( 1 == PQntuples( result ) ) {
         snprintf( seeds, sizeof(seeds), "%s", PQgetvalue( result, 0, 0 ) );
     }
@@ -667,7 +816,7 @@ DBMgr::HaveDevice( const char* connName, HostID hid, int seed )
     StrWPF query;
     query.catf( fmt, connName, hid, seed );
     logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     found = 1 == PQntuples( result );
     PQclear( result );
     return found;
@@ -710,19 +859,42 @@ DBMgr::RecordSent( const char* const connName, HostID hid, int nBytes )
     query.catf( fmt, hid, hid, nBytes, hid, connName );
     logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
 
-    execSql( query );
+    /* Just stats, and adds land in any order: no need to wait */
+    execSqlAsync( query );
 }
 
 void
 DBMgr::RecordSent( const int* msgIDs, int nMsgIDs )
 {
-    if ( nMsgIDs > 0 ) {
+    /* Cached messages' lengths are known here */
+    vector<int> uncached;
+    map<pair<string, HostID>, int> sent;
+    for ( int ii = 0; ii < nMsgIDs; ++ii ) {
+        string connName;
+        HostID hid;
+        int len;
+        if ( NULL != m_cache
+             && m_cache->Lookup( msgIDs[ii], &connName, &hid, &len ) ) {
+            if ( !connName.empty() ) {
+                sent[make_pair( connName, hid )] += len;
+            }
+        } else {
+            uncached.push_back( msgIDs[ii] );
+        }
+    }
+    map<pair<string, HostID>, int>::const_iterator iter;
+    for ( iter = sent.begin(); iter != sent.end(); ++iter ) {
+        RecordSent( iter->first.first.c_str(), iter->first.second,
+                    iter->second );
+    }
+
+    if ( 0 < uncached.size() ) {
         StrWPF query;
         query.catf( "SELECT connname,hid,sum(msglen)"
                     " FROM " MSGS_TABLE " WHERE id IN (" );
-        for ( int ii = 0; ; ) {
-            query.catf( "%d", msgIDs[ii] );
-            if ( ++ii == nMsgIDs ) {
+        for ( size_t ii = 0; ; ) {
+            query.catf( "%d", uncached[ii] );
+            if ( ++ii == uncached.size() ) {
                 break;
             } else {
                 query.append( "," );
@@ -730,7 +902,7 @@ DBMgr::RecordSent( const int* msgIDs, int nMsgIDs )
         }
         query.append( ") GROUP BY connname,hid" );
 
-        PGresult* result = PQexec( getThreadConn(), query.c_str() );
+        PGresult* result = exec( query.c_str() );
         if ( PGRES_TUPLES_OK == PQresultStatus( result ) ) {
             int ntuples = PQntuples( result );
             for ( int ii = 0; ii < ntuples; ++ii ) {
@@ -757,7 +929,11 @@ DBMgr::RecordAddress( const char* const connName, HostID hid,
     query.catf( fmt, hid, ntoa, connName );
     logf( XW_LOGVERBOSE0, "%s: query: %s", __func__, query.c_str() );
 
-    execSql( query );
+    /* Only the latest address matters */
+    StrWPF key;
+    key.append( "addr:" );
+    formatKey( key, connName, hid );
+    execSqlAsync( query, key );
 }
 
 void
@@ -769,7 +945,7 @@ DBMgr::GetPlayerCounts( const char* const connName, int* nTotal, int* nHere )
     query.catf( fmt, connName );
     logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
 
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     assert( 1 == PQntuples( result ) );
     *nTotal = atoi( PQgetvalue( result, 0, 0 ) );
     *nHere = atoi( PQgetvalue( result, 0, 1 ) );
@@ -785,6 +961,11 @@ DBMgr::KillGame( const char* const connName, int hid )
     StrWPF query;
     query.catf( fmt, hid, hid, connName );
     execSql( query );
+
+    if ( NULL != m_cache ) {
+        syncCache( DEVID_NONE, connName );
+        m_cache->DropGame( connName );
+    }
 }
 
 void
@@ -793,9 +974,10 @@ DBMgr::WaitDBConn( void )
     int nSeconds = 0;
     int toSleep = 1;
     for ( ; ; ) {
-        PGconn* conn = DBMgr::getThreadConn();
+        PGconn* conn = m_pool->Get();
         if ( !!conn ) {
             ConnStatusType status = PQstatus( conn );
+            m_pool->Put( conn );
             if ( CONNECTION_OK == status ) {
                 break;
             }
@@ -837,7 +1019,7 @@ DBMgr::PublicRooms( int lang, int nPlayers, int* nNames, string& names )
     query.catf( fmt, lang, nPlayers );
     logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
 
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     int nTuples = PQntuples( result );
     for ( int ii = 0; ii < nTuples; ++ii ) {
         names.append( PQgetvalue( result, ii, 0 ) );
@@ -860,7 +1042,7 @@ DBMgr::TokenFor( const char* const connName, int hid, DevIDRelay* devid,
         " WHERE connName='%s'";
     StrWPF query;
     query.catf( fmt, hid, hid, connName );
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     if ( 1 == PQntuples( result ) ) {
         AddrInfo::ClientToken token_tmp = atoi( PQgetvalue( result, 0, 0 ) );
         DevIDRelay devid_tmp = atoi( PQgetvalue( result, 0, 1 ) );
@@ -893,13 +1075,16 @@ DBMgr::execSql( const char* const query )
 {
     bool ok = false;
     for ( int ii = 0; !ok && ii < 3; ++ii ) {
-        PGresult* result = PQexec( getThreadConn(), query );
+        PGconn* conn = m_pool->Get();
+        PGresult* result = NULL == conn ? NULL : m_pool->Exec( conn, query );
         ok = PGRES_COMMAND_OK == PQresultStatus(result);
         if ( !ok ) {
             logf( XW_LOGERROR, "%s(%s): PQexec=>%s;%s", __func__, query, 
                   PQresStatus(PQresultStatus(result)), 
                   PQresultErrorMessage(result) );
-            clearThreadConn();
+        }
+        m_pool->Put( conn, !ok );   /* a fresh one for any retry */
+        if ( !ok ) {
             usleep( 20000 );
         }
         PQclear( result );
@@ -908,13 +1093,35 @@ DBMgr::execSql( const char* const query )
     return ok;
 }
 
+PGresult*
+DBMgr::exec( const char* query )
+{
+    PGresult* result = NULL;
+    PGconn* conn = m_pool->Get();
+    if ( NULL != conn ) {
+        result = m_pool->Exec( conn, query );
+        m_pool->Put( conn );
+    }
+    return result;
+}
+
+PGresult*
+DBMgr::exec( QueryBuilder& qb )
+{
+    PGresult* result = NULL;
+    PGconn* conn = m_pool->Get();
+    if ( NULL != conn ) {
+        result = m_pool->ExecParams( conn, qb.c_str(), qb.paramCount(),
+                                     qb.paramValues() );
+        m_pool->Put( conn );
+    }
+    return result;
+}
+
 bool
 DBMgr::execParams( QueryBuilder& qb )
 {
-    PGresult* result = PQexecParams( getThreadConn(), qb.c_str(),
-                                     qb.paramCount(), NULL,
-                                     qb.paramValues(), 
-                                     NULL, NULL, 0 );
+    PGresult* result = exec( qb );
     bool success = PGRES_COMMAND_OK == PQresultStatus( result );
     if ( !success ) {
         logf( XW_LOGERROR, "PQexecParams(%s)=>%s;%s", qb.c_str(),
@@ -925,6 +1132,60 @@ DBMgr::execParams( QueryBuilder& qb )
     return success;
 }
 
+bool
+DBMgr::prepare( PGconn* conn, const char* name, const char* sql )
+{
+    bool success;
+    {
+        MutexLock ml( &m_preparedMutex );
+        set<string>& names = m_prepared[conn];
+        success = names.end() != names.find( name );
+    }
+
+    if ( !success ) {
+        PGresult* result = PQprepare( conn, name, sql, 0, NULL );
+        success = PGRES_COMMAND_OK == PQresultStatus( result );
+        if ( success ) {
+            MutexLock ml( &m_preparedMutex );
+            m_prepared[conn].insert( name );
+        } else {
+            logf( XW_LOGERROR, "PQprepare(%s)=>%s;%s", sql,
+                  PQresStatus(PQresultStatus(result)), 
+                  PQresultErrorMessage(result) );
+        }
+        PQclear( result );
+    }
+    return success;
+}
+
+PGresult*
+DBMgr::execPrepared( const char* name, const char* sql, int nParams,
+                     const char* const* values, int resultFormat )
+{
+    PGresult* result = NULL;
+    PGconn* conn = m_pool->Get();
+    if ( NULL != conn && prepare( conn, name, sql ) ) {
+        result = m_pool->ExecPrepared( conn, name, nParams, values, NULL, 
+                                       NULL, resultFormat );
+        if ( PGRES_TUPLES_OK != PQresultStatus( result )
+             && PGRES_COMMAND_OK != PQresultStatus( result ) ) {
+            logf( XW_LOGERROR, "PQexecPrepared(%s)=>%s;%s", name,
+                  PQresStatus(PQresultStatus(result)), 
+                  PQresultErrorMessage(result) );
+        }
+    }
+    m_pool->Put( conn );
+    return result;
+}
+
+/* Statements prepared on a connection go away with it */
+void
+DBMgr::forgetConn( PGconn* conn )
+{
+    MutexLock ml( &m_preparedMutex );
+    m_prepared.erase( conn );
+}
+
 void
 DBMgr::readArray( const char* const connName, const char* column, int arr[]  ) /* len 4 */
 {
@@ -934,7 +1195,7 @@ DBMgr::readArray( const char* const connName, const char* column, int arr[]  ) /
     query.catf( fmt, column, connName );
     logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
 
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     assert( 1 == PQntuples( result ) );
     const char* arrStr = PQgetvalue( result, 0, 0 );
     logf( XW_LOGINFO, "%s: arrStr=\"%s\"", __func__, arrStr );
@@ -943,30 +1204,65 @@ DBMgr::readArray( const char* const connName, const char* column, int arr[]  ) /
 }
 
 // parse something created by comms.c's formatRelayID
+/* static */ int
+DBMgr::splitRelayID( const string& relayID, string& connName )
+{
+    size_t pos = relayID.find_first_of( '/' );
+    connName = relayID.substr( 0, pos );
+    return relayID[pos + 1] - '0';
+}
+
 DevIDRelay 
 DBMgr::getDevID( string& relayID )
 {
-    size_t pos = relayID.find_first_of( '/' );
-    string connName = relayID.substr( 0, pos );
-    int hid = relayID[pos + 1] - '0';
+    string connName;
+    int hid = splitRelayID( relayID, connName );
     DevIDRelay result = getDevID( connName.c_str(), hid );
     // Not an error. Remove or downlog when confirm working
     logf( XW_LOGERROR, "%s(%s) => %d", __func__, relayID.c_str(), result );
     return result;
 }
 
+bool
+DBMgr::getDevID( string& relayID, DevIDRelay* devID, DoneProc proc,
+                 void* closure )
+{
+    string connName;
+    int hid = splitRelayID( relayID, connName );
+    StrWPF query;
+    formatDevIDQuery( query, connName.c_str(), hid );
+    logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
+
+    Pending* pending = new Pending( this, proc, closure );
+    pending->out = devID;
+    m_pool->QueryAsync( query.c_str(), vector<string>(), 0, gotDevID,
+                        pending );
+    return false;
+}
+
+/* static */ void
+DBMgr::formatDevIDQuery( StrWPF& query, const char* connName, int hid )
+{
+    const char* fmt = "SELECT devids[%d], tokens[%d] FROM " GAMES_TABLE
+        " WHERE connName='%s'";
+    query.catf( fmt, hid, hid, connName );
+}
+
 DevIDRelay 
-DBMgr::getDevID( const char* connName, int hid )
+DBMgr::getDevID( const char* connName, int hid, AddrInfo::ClientToken* tokenp )
 {
     DevIDRelay devID = DEVID_NONE;
-    const char* fmt = "SELECT devids[%d] FROM " GAMES_TABLE " WHERE connName='%s'";
     StrWPF query;
-    query.catf( fmt, hid, connName );
+    formatDevIDQuery( query, connName, hid );
     logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
 
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     if ( 1 == PQntuples( result ) ) {
         devID = (DevIDRelay)strtoul( PQgetvalue( result, 0, 0 ), NULL, 10 );
+        if ( NULL != tokenp ) {
+            *tokenp = (AddrInfo::ClientToken)
+                strtoul( PQgetvalue( result, 0, 1 ), NULL, 10 );
+        }
     }
     PQclear( result );
     return devID;
@@ -997,7 +1293,7 @@ DBMgr::getDevID( const DevID* devID )
 
     if ( 0 < query.size() ) {
         logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-        PGresult* result = PQexec( getThreadConn(), query.c_str() );
+        PGresult* result = exec( query.c_str() );
         int nTuples = PQntuples( result );
         assert( 1 >= nTuples );
         if ( 1 == nTuples ) {
@@ -1021,6 +1317,8 @@ DBMgr::getDevID( const DevID* devID )
 int
 DBMgr::CountStoredMessages( const char* const connName, int hid )
 {
+    syncCache( DEVID_NONE, connName );
+
     StrWPF test;
     test.catf( "connname = '%s'", connName );
 #ifdef HAVE_STIME
@@ -1042,57 +1340,42 @@ DBMgr::CountStoredMessages( const char* const connName )
 int
 DBMgr::CountStoredMessages( DevIDRelay relayID )
 {
-    StrWPF test;
-    test.catf( "devid = %d", relayID );
+    int count;
+    if ( NULL == m_cache || !m_cache->CountMailbox( relayID, &count ) ) {
+        syncCache( relayID, NULL );
+
+        StrWPF test;
+        test.catf( "devid = %d", relayID );
 #ifdef HAVE_STIME
-    test.catf( "AND stime = 'epoch'" );
+        test.catf( "AND stime = 'epoch'" );
 #endif
-
-    return getCountWhere( MSGS_TABLE, test );
+        count = getCountWhere( MSGS_TABLE, test );
+    }
+    return count;
 }
 
 int
 DBMgr::StoreMessage( DevIDRelay destDevID, const uint8_t* const buf,
                      int len )
 {
-    int msgID = 0;
     clearHasNoMessages( destDevID );
 
-    size_t newLen;
-    const char* fmt = "INSERT INTO " MSGS_TABLE " "
-        "(devid, %s, msglen) VALUES(%d, %s'%s', %d) RETURNING id";
-    
-    StrWPF query;
-    if ( m_useB64 ) {
-        gchar* b64 = g_base64_encode( buf, len );
-        query.catf( fmt, "msg64", destDevID, "", b64, len );
-        g_free( b64 );
-    } else {
-        uint8_t* bytes = PQescapeByteaConn( getThreadConn(), buf, 
-                                                  len, &newLen );
-        assert( NULL != bytes );
-        query.catf( fmt, "msg",  destDevID, "E", bytes, len );
-        PQfreemem( bytes );
-    }
-
-    logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
-    if ( 1 == PQntuples( result ) ) {
-        msgID = atoi( PQgetvalue( result, 0, 0 ) );
-    }
-    PQclear( result );
-    return msgID;
+    MsgCache::Msg msg;
+    msg.devID = destDevID;
+    msg.hid = 0;
+    msg.token = 0;
+    msg.msg.assign( buf, buf + len );
+    return storeOrCache( msg );
 }
 
 int
 DBMgr::StoreMessage( const char* const connName, int destHid,
                      const uint8_t* buf, int len )
 {
-    int msgID = 0;
     clearHasNoMessages( connName, destHid );
 
-    DevIDRelay devID = getDevID( connName, destHid );
+    AddrInfo::ClientToken token = 0;
+    DevIDRelay devID = getDevID( connName, destHid, &token );
     if ( DEVID_NONE == devID ) {
         logf( XW_LOGERROR, "%s: warning: devid not found for connName=%s, "
               "hid=%d", __func__, connName, destHid );
@@ -1100,121 +1383,404 @@ DBMgr::StoreMessage( const char* const connName, int destHid,
         clearHasNoMessages( devID );
     }
 
-    size_t newLen;
-    const char* fmt = "INSERT INTO " MSGS_TABLE " "
-        "(connname, hid, devid, token, %s, msglen) "
-        "SELECT '%s', %d, %d, "
-        "(SELECT tokens[%d] from " GAMES_TABLE " where connname='%s'), "
-        "%s'%s', %d "
-        ;
-    
-    StrWPF query;
-    if ( m_useB64 ) {
-        gchar* b64 = g_base64_encode( buf, len );
-        query.catf( fmt, "msg64", connName, destHid, devID, destHid, connName,
-                    "", b64, len );
-        
-        query.catf( " WHERE NOT EXISTS (SELECT 1 FROM " MSGS_TABLE
-                    " WHERE connname='%s' AND hid=%d AND msg64='%s'"
-#ifdef HAVE_STIME
-                    " AND stime='epoch'" 
+    MsgCache::Msg msg;
+    msg.devID = devID;
+    msg.connName = connName;
+    msg.hid = destHid;
+    msg.token = token;
+    msg.msg.assign( buf, buf + len );
+    return storeOrCache( msg );
+}
+
+/* Messages for a known device go into the cache to be written later, unless
+ * it's full.  Those that aren't written here and now must be in the DB
+ * before the cache is told it's missing something for that device.
+ */
+int
+DBMgr::storeOrCache( MsgCache::Msg& msg )
+{
+    int msgID = 0;
+    gchar* hash = g_compute_checksum_for_data( G_CHECKSUM_MD5, &msg.msg[0],
+                                               msg.msg.size() );
+    msg.hash = hash;
+    g_free( hash );
+    msg.stored = time( NULL );
+    msg.id = nextMsgID();
+
+    bool isDup = false;
+    if ( 0 == msg.id ) {
+        logf( XW_LOGERROR, "%s: no id for message; dropping it", __func__ );
+    } else if ( NULL != m_cache && DEVID_NONE != msg.devID
+                && m_cache->Add( msg, &isDup ) ) {
+        msgID = msg.id;
+        logf( XW_LOGINFO, "%s(connName=%s, devid=%d, len=%zu) => %d (cached)",
+              __func__, msg.connName.c_str(), msg.devID, msg.msg.size(),
+              msgID );
+    } else if ( isDup ) {
+        logf( XW_LOGINFO, "Not stored; duplicate?" );
+    } else {
+        StoreReq req;
+        reqFor( msg, &req );
+        msgID = storeMessage( &req );
+        if ( NULL != m_cache && DEVID_NONE != msg.devID ) {
+            m_cache->Forget( msg.devID );
+        }
+    }
+    return msgID;
+}
+
+/* Ids are handed out before messages are written, so fetch a block at a
+ * time.  0 if postgres can't be reached.
+ */
+int
+DBMgr::nextMsgID()
+{
+    int id = 0;
+    MutexLock ml( &m_idsMutex );
+    if ( 0 == m_freeIDs.size() ) {
+        StrWPF query;
+        query.catf( "SELECT nextval('" MSGS_TABLE "_id_seq')"
+                    " FROM generate_series(1, %d)", MSG_ID_BLOCK );
+        PGresult* result = exec( query.c_str() );
+        if ( PGRES_TUPLES_OK == PQresultStatus( result ) ) {
+            /* highest first, so they come off the back in order */
+            for ( int ii = PQntuples( result ) - 1; ii >= 0; --ii ) {
+                m_freeIDs.push_back( atoi( PQgetvalue( result, ii, 0 ) ) );
+            }
+        } else {
+            logf( XW_LOGERROR, "%s: %s", __func__,
+                  PQresultErrorMessage( result ) );
+        }
+        PQclear( result );
+    }
+    if ( 0 < m_freeIDs.size() ) {
+        id = m_freeIDs.back();
+        m_freeIDs.pop_back();
+    }
+    return id;
+}
+
+void
+DBMgr::reqFor( const MsgCache::Msg& msg, StoreReq* req )
+{
+    req->connName = msg.connName.empty() ? NULL : msg.connName.c_str();
+    req->hid = msg.hid;
+    req->devID = msg.devID;
+    req->token = msg.token;
+    req->buf = &msg.msg[0];
+    req->len = msg.msg.size();
+    req->hash = msg.hash.c_str();
+    req->id = msg.id;
+}
+
+/* Group commit: the first caller to find no write in progress writes every
+ * store queued so far, its own included, while later callers queue up
+ * behind it for the next batch.  Under a reconnect storm that's one round
+ * trip per batch rather than per message.
+ */
+int
+DBMgr::storeMessage( StoreReq* req )
+{
+    req->msgID = -1;
+    req->done = false;
+
+    pthread_mutex_lock( &m_storeMutex );
+    m_storeQueue.push_back( req );
+    while ( !req->done ) {
+        if ( m_storeWriterActive ) {
+            pthread_cond_wait( &m_storeCondVar, &m_storeMutex );
+        } else {
+            m_storeWriterActive = true;
+            size_t count = m_storeQueue.size();
+            if ( count > MAX_STORE_BATCH ) {
+                count = MAX_STORE_BATCH;
+            }
+            vector<StoreReq*> reqs( m_storeQueue.begin(),
+                                    m_storeQueue.begin() + count );
+            m_storeQueue.erase( m_storeQueue.begin(),
+                                m_storeQueue.begin() + count );
+            pthread_mutex_unlock( &m_storeMutex );
+
+            writeStores( reqs );
+
+            pthread_mutex_lock( &m_storeMutex );
+            vector<StoreReq*>::iterator iter;
+            for ( iter = reqs.begin(); iter != reqs.end(); ++iter ) {
+                (*iter)->done = true;
+            }
+            m_storeWriterActive = false;
+            pthread_cond_broadcast( &m_storeCondVar );
+        }
+    }
+    pthread_mutex_unlock( &m_storeMutex );
+
+    logf( XW_LOGINFO, "%s(connName=%s, devid=%d, len=%d) => %d", __func__,
+          NULL == req->connName ? "" : req->connName, req->devID, req->len,
+          req->msgID );
+    return 0 < req->msgID ? req->msgID : 0;
+}
+
+/* Requests whose results a failed pipeline never got to may have been
+ * written all the same, so they're sent again, one at a time on a fresh
+ * connection.  That's safe: the store SQL finds a message already there by
+ * its id rather than adding it twice.
+ */
+void
+DBMgr::writeStores( vector<StoreReq*>& reqs )
+{
+    size_t nDone = 0;
+    PGconn* conn = storeConn();
+#ifdef LIBPQ_HAS_PIPELINING
+    if ( NULL != conn && 1 < reqs.size()
+         && !pipelineStores( conn, reqs, &nDone ) ) {
+        m_pool->Put( conn, true );
+        conn = storeConn();
+    }
+#endif
+
+    for ( ; NULL != conn && nDone < reqs.size(); ++nDone ) {
+        PGresult* result = NULL;
+        sendStore( conn, reqs[nDone], false, &result );
+        reqs[nDone]->msgID = storedMsgID( result );
+        PQclear( result );
+    }
+
+    if ( NULL == conn ) {
+        logf( XW_LOGERROR, "%s: no connection; dropping %zu messages",
+              __func__, reqs.size() - nDone );
+    }
+    m_pool->Put( conn );
+}
+
+/* A connection with the store statements prepared on it, or NULL */
+PGconn*
+DBMgr::storeConn()
+{
+    PGconn* conn = m_pool->Get();
+    if ( NULL != conn
+         && ( !prepare( conn, "storeDev", s_storeDevSQL[m_useB64] )
+              || !prepare( conn, "storeConn", s_storeConnSQL[m_useB64] ) ) ) {
+        m_pool->Put( conn, true );
+        conn = NULL;
+    }
+    return conn;
+}
+
+#ifdef LIBPQ_HAS_PIPELINING
+/* Send them all, then read the results.  Each gets its own sync, hence its
+ * own transaction, so one failing (say on the UNIQUE constraint) doesn't
+ * abort the rest.  *nDone is how many results were read; false if the
+ * connection's no longer usable.
+ */
+bool
+DBMgr::pipelineStores( PGconn* conn, vector<StoreReq*>& reqs, size_t* nDone )
+{
+    bool ok = 1 == PQenterPipelineMode( conn );
+    uint32_t start = DBPool::NowMillis();
+    size_t nSent;
+    for ( nSent = 0; ok && nSent < reqs.size(); ++nSent ) {
+        ok = sendStore( conn, reqs[nSent], true, NULL )
+            && 1 == PQpipelineSync( conn );
+    }
+
+    /* Whatever went out before a failed send still gets its result read */
+    if ( !ok && 0 < nSent ) {
+        --nSent;
+        ok = 1 == PQpipelineSync( conn );
+    }
+
+    size_t nRead = 0;
+    while ( ok && nRead < nSent ) {
+        PGresult* result = PQgetResult( conn );
+        ok = NULL != result;
+        if ( ok ) {
+            int msgID = storedMsgID( result );
+            m_pool->NoteQuery( start, 0 <= msgID );
+            PQclear( result );
+            result = PQgetResult( conn ); /* NULL, ending the query */
+            assert( NULL == result );
+            PQclear( result );
+            result = PQgetResult( conn ); /* then the sync */
+            ok = PGRES_PIPELINE_SYNC == PQresultStatus( result );
+            PQclear( result );
+            if ( ok ) {     /* committed, or rolled back, for sure */
+                reqs[nRead++]->msgID = msgID;
+            }
+        }
+    }
+    *nDone = nRead;
+
+    if ( !ok || 1 != PQexitPipelineMode( conn ) ) {
+        logf( XW_LOGERROR, "%s: pipeline failed after %zu of %zu: %s",
+              __func__, *nDone, reqs.size(), PQerrorMessage( conn ) );
+        ok = false;
+    }
+    return ok;
+}
 #endif
-                    " )", connName, destHid, b64 );
-        g_free( b64 );
+
+bool
+DBMgr::sendStore( PGconn* conn, const StoreReq* req, bool async,
+                  PGresult** resultp )
+{
+    gchar* b64 = NULL;
+    const char* payload;
+    int payloadLen = 0;
+    int payloadFormat = 0;
+    if ( m_useB64 ) {
+        b64 = g_base64_encode( req->buf, req->len );
+        payload = b64;
     } else {
-        uint8_t* bytes = PQescapeByteaConn( getThreadConn(), buf, 
-                                                  len, &newLen );
-        assert( NULL != bytes );
-    
-        query.catf( fmt, "msg", connName, destHid, devID, destHid, connName,
-                    "E", bytes, len );
-        PQfreemem( bytes );
+        payload = (const char*)req->buf;
+        payloadLen = req->len;
+        payloadFormat = 1;      /* binary */
     }
-    query.catf(" RETURNING id;");
 
-    logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
-    if ( 1 == PQntuples( result ) ) {
-        msgID = atoi( PQgetvalue( result, 0, 0 ) );
+    char id[16];
+    char hid[16];
+    char devID[16];
+    char token[16];
+    char len[16];
+    snprintf( id, sizeof(id), "%d", req->id );
+    snprintf( hid, sizeof(hid), "%d", req->hid );
+    snprintf( devID, sizeof(devID), "%d", req->devID );
+    snprintf( token, sizeof(token), "%d", req->token );
+    snprintf( len, sizeof(len), "%d", req->len );
+
+    const char* name;
+    int nParams;
+    const char* values[8];
+    int lengths[8] = { 0 };
+    int formats[8] = { 0 };
+    if ( NULL == req->connName ) {
+        name = "storeDev";
+        nParams = 5;
+        const char* params[] = { id, devID, payload, len, req->hash };
+        memcpy( values, params, sizeof(params) );
+        lengths[2] = payloadLen;
+        formats[2] = payloadFormat;
     } else {
-        logf( XW_LOGINFO, "Not stored; duplicate?" );
+        name = "storeConn";
+        nParams = 8;
+        const char* params[] = { id, req->connName, hid, devID, token,
+                                 payload, len, req->hash };
+        memcpy( values, params, sizeof(params) );
+        lengths[5] = payloadLen;
+        formats[5] = payloadFormat;
     }
-    PQclear( result );
-    return msgID;
+
+    bool success;
+    if ( async ) {
+        success = 1 == PQsendQueryPrepared( conn, name, nParams, values,
+                                            lengths, formats, 0 );
+    } else {
+        *resultp = m_pool->ExecPrepared( conn, name, nParams, values, lengths,
+                                         formats, 0 );
+        success = NULL != *resultp;
+    }
+    g_free( b64 );
+    return success;
 }
 
+/* Expects binary-format results, so bytea comes back as is */
 void
 DBMgr::decodeMessage( PGresult* result, bool useB64, int rowIndx, int b64indx, 
                       int byteaIndex, vector<uint8_t>& buf )
 {
-    const char* from = NULL;
     if ( useB64 ) {
-        from = PQgetvalue( result, rowIndx, b64indx );
-    }
-    if ( NULL == from || '\0' == from[0] ) {
-        useB64 = false;
-        from = PQgetvalue( result, rowIndx, byteaIndex );
+        useB64 = !PQgetisnull( result, rowIndx, b64indx )
+            && 0 < PQgetlength( result, rowIndx, b64indx );
     }
 
     if ( useB64 ) {
+        const char* from = PQgetvalue( result, rowIndx, b64indx );
         gsize out_len;
         guchar* txt = g_base64_decode( (const gchar*)from, &out_len );
         buf.insert( buf.end(), txt, txt + out_len );
         assert( buf.size() == out_len );
         g_free( txt );
     } else {
-        size_t to_length;
-        uint8_t* bytes = PQunescapeBytea( (const uint8_t*)from, &to_length );
-        buf.insert( buf.end(), bytes, bytes + to_length );
-        assert( buf.size() == to_length );
-        PQfreemem( bytes );
+        const uint8_t* bytes = 
+            (const uint8_t*)PQgetvalue( result, rowIndx, byteaIndex );
+        buf.insert( buf.end(), bytes, 
+                    bytes + PQgetlength( result, rowIndx, byteaIndex ) );
     }
 }
 
 void
-DBMgr::storedMessagesImpl( string test, vector<DBMgr::MsgInfo>& msgs, 
-                           bool nullConnnameOK )
-{
-    StrWPF query;
-    query.catf( "SELECT id, msg64, msg, msglen, token, connname FROM "
-                MSGS_TABLE " WHERE %s "
-#ifdef HAVE_STIME 
-                " AND stime = 'epoch' "
-#endif
-                " AND (connname IN (SELECT connname FROM " GAMES_TABLE
-                " WHERE NOT " GAMES_TABLE ".dead)", test.c_str() );
-
-    if ( nullConnnameOK ) {
-        query.catf( " OR connname IS NULL ");
-    }
-    query.catf( ") ORDER BY id" );
-
-    logf( XW_LOGINFO, "%s: query: %s", __func__, query.c_str() );
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+DBMgr::storedMessagesImpl( const char* name, const char* sql, int nParams,
+                           const char* const* values,
+                           vector<MsgCache::Msg>& msgs )
+{
+    PGresult* result = execPrepared( name, sql, nParams, values, 1 );
+    readStoredMessages( result, msgs );
+    logf( XW_LOGINFO, "%s(%s, %s): found %d", __func__, name, values[0],
+          PQntuples( result ) );
+    PQclear( result );
+}
 
+void
+DBMgr::readStoredMessages( PGresult* result, vector<MsgCache::Msg>& msgs )
+{
     int nTuples = PQntuples( result );
     for ( int ii = 0; ii < nTuples; ++ii ) {
-        int id = atoi( PQgetvalue( result, ii, 0 ) );
-        AddrInfo::ClientToken token = atoi( PQgetvalue( result, ii, 4 ) );
-        const char* connname = PQgetvalue( result, ii, 5 );
-        bool hasConnname = connname != NULL && '\0' != connname[0];
-        MsgInfo msg( id, token, hasConnname );
+        MsgCache::Msg msg;
+        msg.id = intAt( result, ii, 0 );
+        if ( NULL != m_cache && m_cache->IsDeleted( msg.id ) ) {
+            continue;           /* delivered; the DB doesn't know yet */
+        }
+        msg.token = intAt( result, ii, 4 );
+        msg.connName.assign( PQgetvalue( result, ii, 5 ),
+                             PQgetlength( result, ii, 5 ) );
+        msg.hid = intAt( result, ii, 6 );
+        msg.devID = intAt( result, ii, 7 );
+        msg.hash.assign( PQgetvalue( result, ii, 8 ),
+                         PQgetlength( result, ii, 8 ) );
+        msg.stored = 0;
+        msg.inDB = true;
 
         decodeMessage( result, m_useB64, ii, 1, 2, msg.msg );
-        size_t msglen = atoi( PQgetvalue( result, ii, 3 ) );
+        size_t msglen = intAt( result, ii, 3 );
         assert( 0 == msglen || msg.msg.size() == msglen );
         msgs.push_back( msg );
     }
-    PQclear( result );
+}
+
+/* static */ void
+DBMgr::toMsgInfo( const vector<MsgCache::Msg>& from,
+                  vector<DBMgr::MsgInfo>& msgs )
+{
+    vector<MsgCache::Msg>::const_iterator iter;
+    for ( iter = from.begin(); iter != from.end(); ++iter ) {
+        MsgInfo msg( iter->id, iter->token, !iter->connName.empty() );
+        msg.msg = iter->msg;
+        msgs.push_back( msg );
+    }
 }
 
 void
 DBMgr::GetStoredMessages( DevIDRelay relayID, vector<MsgInfo>& msgs )
 {
     if ( !hasNoMessages( relayID ) ) {
-        StrWPF query;
-        query.catf( "devid=%d", relayID );
-        storedMessagesImpl( query, msgs, true );
+        vector<MsgCache::Msg> found;
+        if ( NULL == m_cache || !m_cache->GetMailbox( relayID, found ) ) {
+            uint32_t stamp = 0;
+            if ( NULL != m_cache ) {
+                syncCache( relayID, NULL );
+                stamp = m_cache->Stamp();
+            }
+
+            char devid[16];
+            snprintf( devid, sizeof(devid), "%d", relayID );
+            const char* values[] = { devid };
+            storedMessagesImpl( "storedByDev", s_storedByDevSQL,
+                                VSIZE(values), values, found );
+
+            if ( NULL != m_cache ) {
+                m_cache->SetMailbox( relayID, found, stamp );
+            }
+        }
+        toMsgInfo( found, msgs );
 
         if ( 0 == msgs.size() ) {
             setHasNoMessages( relayID );
@@ -1222,14 +1788,54 @@ DBMgr::GetStoredMessages( DevIDRelay relayID, vector<MsgInfo>& msgs )
     }
 }
 
+/* As above, but only the cache's consulted without a query.  Nothing's
+ * written first: gotStoredByDev() merges what's cached with what the DB
+ * has instead.
+ */
+bool
+DBMgr::GetStoredMessages( DevIDRelay relayID, vector<MsgInfo>& msgs,
+                          DoneProc proc, void* closure )
+{
+    bool answered = true;
+    if ( !hasNoMessages( relayID ) ) {
+        vector<MsgCache::Msg> found;
+        if ( NULL != m_cache && m_cache->GetMailbox( relayID, found ) ) {
+            toMsgInfo( found, msgs );
+            if ( 0 == msgs.size() ) {
+                setHasNoMessages( relayID );
+            }
+        } else {
+            Pending* pending = new Pending( this, proc, closure );
+            pending->relayID = relayID;
+            pending->msgs = &msgs;
+            if ( NULL != m_cache ) {
+                pending->stamp = m_cache->Stamp();
+            }
+
+            char devid[16];
+            snprintf( devid, sizeof(devid), "%d", relayID );
+            m_pool->QueryAsync( s_storedByDevSQL, vector<string>( 1, devid ),
+                                1, gotStoredByDev, pending );
+            answered = false;
+        }
+    }
+    return answered;
+}
+
 void
 DBMgr::GetStoredMessages( const char* const connName, HostID hid, 
                           vector<DBMgr::MsgInfo>& msgs )
 {
     if ( !hasNoMessages( connName, hid ) ) {
-        StrWPF query;
-        query.catf( "hid = %d AND connname = '%s'", hid, connName );
-        storedMessagesImpl( query, msgs, false );
+        syncCache( DEVID_NONE, connName );
+
+        char hidStr[16];
+        snprintf( hidStr, sizeof(hidStr), "%d", hid );
+        const char* values[] = { hidStr, connName };
+        vector<MsgCache::Msg> found;
+        storedMessagesImpl( "storedByConn", s_storedByConnSQL, VSIZE(values),
+                            values, found );
+        toMsgInfo( found, msgs );
 
         if ( 0 == msgs.size() ) {
             setHasNoMessages( connName, hid );
@@ -1256,25 +1862,32 @@ DBMgr::RemoveStoredMessages( string& msgids )
 void
 DBMgr::RemoveStoredMessages( const int* msgIDs, int nMsgIDs )
 {
-    if ( nMsgIDs > 0 ) {
-        StrWPF ids;
-        size_t len = 0;
-        int ii;
-        for ( ii = 0; ; ) {
-            ids.catf( "%d", msgIDs[ii] );
-            assert( len < sizeof(ids) );
-            if ( ++ii == nMsgIDs ) {
-                break;
-            } else {
-                ids.append( "," );
-            }
-        }
-        RemoveStoredMessages( ids );
-    }
+    vector<int> ids( msgIDs, msgIDs + nMsgIDs );
+    RemoveStoredMessages( ids );
 }
 
+/* With the cache, deletes are collected and done by the flush thread */
 void 
 DBMgr::RemoveStoredMessages( vector<int>& idv )
+{
+    if ( NULL != m_cache ) {
+        vector<int>::const_iterator iter;
+        for ( iter = idv.begin(); iter != idv.end(); ++iter ) {
+            m_cache->Remove( *iter );
+        }
+    } else {
+        removeStored( idv );
+    }
+}
+
+void
+DBMgr::RemoveStoredMessage( const int msgID )
+{
+    RemoveStoredMessages( &msgID, 1 );
+}
+
+void
+DBMgr::removeStored( const vector<int>& idv )
 {
     if ( 0 < idv.size() ) {
         StrWPF ids;
@@ -1291,9 +1904,146 @@ DBMgr::RemoveStoredMessages( vector<int>& idv )
 }
 
 void
-DBMgr::RemoveStoredMessage( const int msgID )
+DBMgr::syncCache( DevIDRelay devID, const char* connName )
 {
-    RemoveStoredMessages( &msgID, 1 );
+    if ( NULL != m_cache ) {
+        flushCache( 0, devID, connName );
+    }
+}
+
+void
+DBMgr::flushCache( time_t before, DevIDRelay devID, const char* connName )
+{
+    MutexLock ml( &m_flushMutex );
+
+    vector<MsgCache::Msg> msgs;
+    m_cache->TakeUnwritten( before, devID, connName, msgs );
+    for ( size_t first = 0; first < msgs.size(); first += MAX_STORE_BATCH ) {
+        size_t count = msgs.size() - first;
+        if ( count > MAX_STORE_BATCH ) {
+            count = MAX_STORE_BATCH;
+        }
+        vector<StoreReq> reqs( count );
+        vector<StoreReq*> reqps;
+        for ( size_t ii = 0; ii < count; ++ii ) {
+            reqFor( msgs[first + ii], &reqs[ii] );
+            reqs[ii].msgID = -1;
+            reqps.push_back( &reqs[ii] );
+        }
+        writeStores( reqps );
+
+        /* A duplicate skipped means the DB has a message for the device
+           that the cache doesn't */
+        for ( size_t ii = 0; ii < count; ++ii ) {
+            const MsgCache::Msg& msg = msgs[first + ii];
+            if ( 0 == reqs[ii].msgID ) {
+                m_cache->Drop( msg.id );
+                m_cache->Forget( msg.devID );
+            } else if ( 0 < reqs[ii].msgID ) {
+                m_cache->Written( msg.id );
+            } else if ( !m_cache->Unwritten( msg.id ) ) {
+                logf( XW_LOGERROR, "%s: giving up on writing msg %d",
+                      __func__, msg.id );
+            }
+        }
+    }
+
+    vector<int> ids;
+    m_cache->TakeDeletes( ids );
+    removeStored( ids );
+
+    if ( 0 < msgs.size() || 0 < ids.size() ) {
+        logf( XW_LOGINFO, "%s(devid=%d, connName=%s): wrote %zu; deleted %zu",
+              __func__, devID, NULL == connName ? "" : connName, msgs.size(),
+              ids.size() );
+    }
+}
+
+void
+DBMgr::flush_main()
+{
+    for ( ; ; ) {
+        sleep( 1 );
+        flushCache( time( NULL ) - m_flushSecs, DEVID_NONE, NULL );
+    }
+}
+
+/* static */ void*
+DBMgr::flush_thread( void* closure )
+{
+    blockSignals();
+    ((DBMgr*)closure)->flush_main();
+    return NULL;
+}
+
+/* A query that failed leaves the mailbox as it was, not marked empty */
+/* static */ void
+DBMgr::gotStoredByDev( PGresult* result, void* closure )
+{
+    Pending* pending = (Pending*)closure;
+    DBMgr* self = pending->self;
+    bool ok = PGRES_TUPLES_OK == PQresultStatus( result );
+    if ( ok ) {
+        vector<MsgCache::Msg> found;
+        self->readStoredMessages( result, found );
+        logf( XW_LOGINFO, "%s(%d): found %zu", __func__, pending->relayID,
+              found.size() );
+        if ( NULL != self->m_cache ) {
+            vector<MsgCache::Msg> merged;
+            self->m_cache->MergeMailbox( pending->relayID, found,
+                                         pending->stamp, merged );
+            found.swap( merged );
+        }
+        toMsgInfo( found, *pending->msgs );
+        if ( 0 == pending->msgs->size() ) {
+            self->setHasNoMessages( pending->relayID );
+        }
+    }
+    PQclear( result );
+
+    (*pending->proc)( pending->closure, ok );
+    delete pending;
+}
+
+/* static */ void
+DBMgr::gotDevID( PGresult* result, void* closure )
+{
+    Pending* pending = (Pending*)closure;
+    DevIDRelay* devID = (DevIDRelay*)pending->out;
+    bool ok = PGRES_TUPLES_OK == PQresultStatus( result );
+    *devID = DEVID_NONE;
+    if ( 1 == PQntuples( result ) ) {
+        *devID = (DevIDRelay)strtoul( PQgetvalue( result, 0, 0 ), NULL, 10 );
+    }
+    PQclear( result );
+    logf( XW_LOGINFO, "%s() => %d (ok=%d)", __func__, *devID, ok );
+
+    (*pending->proc)( pending->closure, ok );
+    delete pending;
+}
+
+/* static */ void
+DBMgr::gotTokenGame( PGresult* result, void* closure )
+{
+    Pending* pending = (Pending*)closure;
+    TokenGame* game = (TokenGame*)pending->out;
+    bool ok = PGRES_TUPLES_OK == PQresultStatus( result );
+    readTokenGame( result, game );
+    PQclear( result );
+    logf( XW_LOGINFO, "%s() => %d (connname=%s, ok=%d)", __func__, game->cid,
+          game->connName, ok );
+
+    (*pending->proc)( pending->closure, ok );
+    delete pending;
+}
+
+void
+DBMgr::PrintStats( StrWPF& out )
+{
+    m_pool->PrintStats( out );
+    if ( NULL != m_cache ) {
+        m_cache->PrintStats( out );
+    }
 }
 
 int
@@ -1302,7 +2052,7 @@ DBMgr::getCountWhere( const char* table, string& test )
     StrWPF query;
     query.catf( "SELECT count(*) FROM %s WHERE %s", table, test.c_str() );
 
-    PGresult* result = PQexec( getThreadConn(), query.c_str() );
+    PGresult* result = exec( query.c_str() );
     assert( 1 == PQntuples( result ) );
     int count = atoi( PQgetvalue( result, 0, 0 ) );
     PQclear( result );
@@ -1383,51 +2133,40 @@ here_less_seed( const char* seeds, int sumPerDevice, unsigned short seed )
 }
 
 static void
-destr_function( void* conn )
+close_proc( PGconn* conn )
 {
-    logf( XW_LOGINFO, "%s()", __func__ );
-    PGconn* pgconn = (PGconn*)conn;
-    PQfinish( pgconn );
+    if ( NULL != s_instance ) {
+        s_instance->forgetConn( conn );
+    }
 }
 
-void
-DBMgr::clearThreadConn()
+static int
+storedMsgID( PGresult* result )
 {
-    logf( XW_LOGERROR, "%s called()", __func__ );
-    PGconn* conn = (PGconn*)pthread_getspecific( m_conn_key );
-    if ( NULL != conn ) {
-        PQfinish( conn );
-        int result = pthread_setspecific( m_conn_key, NULL );
-        assert( 0 == result );
+    int msgID = -1;
+    if ( PGRES_TUPLES_OK != PQresultStatus( result ) ) {
+        logf( XW_LOGERROR, "%s: store failed: %s", __func__, 
+              PQresultErrorMessage( result ) );
+    } else if ( 1 == PQntuples( result ) ) {
+        msgID = atoi( PQgetvalue( result, 0, 0 ) );
+    } else {
+        logf( XW_LOGINFO, "Not stored; duplicate?" );
+        msgID = 0;
     }
+    return msgID;
 }
 
-PGconn* 
-DBMgr::getThreadConn( void )
-{
-    PGconn* conn = (PGconn*)pthread_getspecific( m_conn_key );
-
-    if ( NULL == conn ) {
-        char buf[128];
-        int port;
-        if ( !RelayConfigs::GetConfigs()->GetValueFor( "DB_NAME", buf, 
-                                                       sizeof(buf) ) ) {
-            assert( 0 );
-        }
-        if ( !RelayConfigs::GetConfigs()->GetValueFor( "DB_PORT", &port ) ) {
-            assert( 0 );
-        }
-        StrWPF params;
-        params.catf( "dbname = %s ", buf );
-        params.catf( "port = %d ", port );
-
-        conn = PQconnectdb( params.c_str() );
-        if ( CONNECTION_OK == PQstatus( conn ) ) {
-            pthread_setspecific( m_conn_key, conn );
-        } else {
-            PQfinish( conn );
-            conn = NULL;
-        }
+/* For binary-format results: INTEGER columns arrive as four bytes in
+   network order */
+static int
+intAt( PGresult* result, int row, int col )
+{
+    int val = 0;
+    if ( !PQgetisnull( result, row, col ) ) {
+        uint32_t tmp;
+        assert( sizeof(tmp) == PQgetlength( result, row, col ) );
+        memcpy( &tmp, PQgetvalue( result, row, col ), sizeof(tmp) );
+        val = (int)ntohl( tmp );
     }
-    return conn;
+    return val;
 }
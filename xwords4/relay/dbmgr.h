@@ -24,6 +24,7 @@
 
 #include <string>
 #include <set>
+#include <map>
 
 #include <libpq-fe.h>
 
@@ -33,6 +34,8 @@
 #include "devid.h"
 #include "strwpf.h"
 #include "querybld.h"
+#include "dbpool.h"
+#include "msgcache.h"
 
 using namespace std;
 
@@ -59,6 +62,23 @@ class DBMgr {
         int m_msgID;
     };
 
+    /* What FindGame() by token reports; nPlayersT is 0 if nothing is */
+    typedef struct {
+        CookieID cid;
+        char connName[MAX_CONNNAME_LEN+1];
+        char room[MAX_INVITE_LEN+1];
+        int lang;
+        int nPlayersT;
+        int nPlayersH;
+    } TokenGame;
+
+    /* For the lookups below that packet handlers can use without blocking:
+       when one returns false its query's been sent, and proc is called with
+       closure, from another thread, once the answer's where the blocking
+       version would have put it.  ok is false if the query failed, in which
+       case the answer's not to be trusted: nothing was found out. */
+    typedef void (*DoneProc)( void* closure, bool ok );
+
     static DBMgr* Get();
 
     ~DBMgr();
@@ -82,6 +102,8 @@ class DBMgr {
                        char* connNameBuf, int connNameBufLen,
                        char* cookieBuf, int cookieBufLen,
                        int* langP, int* nPlayersTP, int* nPlayersHP );
+    bool FindGame( const AddrInfo::ClientToken clientToken, HostID hid,
+                   TokenGame* game, DoneProc proc, void* closure );
 
     bool FindGameFor( const char* connName, char* cookieBuf, int bufLen,
                       unsigned short seed, HostID hid,
@@ -149,6 +171,8 @@ class DBMgr {
     int StoreMessage( const char* const connName, int destHid,
                       const uint8_t* const buf, int len );
     void GetStoredMessages( DevIDRelay relayID, vector<MsgInfo>& msgs );
+    bool GetStoredMessages( DevIDRelay relayID, vector<MsgInfo>& msgs,
+                            DoneProc proc, void* closure );
     void GetStoredMessages( const char* const connName, HostID hid, 
                             vector<DBMgr::MsgInfo>& msgs );
 
@@ -157,22 +181,96 @@ class DBMgr {
     void RemoveStoredMessages( vector<int>& ids );
 
     DevIDRelay getDevID( string& relayID );
+    bool getDevID( string& relayID, DevIDRelay* devID, DoneProc proc,
+                   void* closure );
+
+    /* Drop what we know (prepared statements) about a closing connection */
+    void forgetConn( PGconn* conn );
+
+    /* for ctrl: connection pool use, query latencies, message cache */
+    void PrintStats( StrWPF& out );
 
  private:
     DBMgr();
     bool execSql( const string& query );
     bool execSql( const char* const query ); /* no-results query */
+    /* no-results query whose outcome nobody waits for */
+    void execSqlAsync( const string& query, const string& key = "" )
+        { m_pool->ExecAsync( query, key ); }
     bool execParams( QueryBuilder& qb );
+    /* PQexec()/PQexecParams() on a connection borrowed from m_pool */
+    PGresult* exec( const char* query );
+    PGresult* exec( QueryBuilder& qb );
     void readArray( const char* const connName, const char* column, int arr[] );
-    DevIDRelay getDevID( const char* connName, int hid );
+    DevIDRelay getDevID( const char* connName, int hid,
+                         AddrInfo::ClientToken* tokenp = NULL );
+    static int splitRelayID( const string& relayID, string& connName );
+    static void formatDevIDQuery( StrWPF& query, const char* connName,
+                                  int hid );
+    static void formatTokenGameQuery( StrWPF& query,
+                                      AddrInfo::ClientToken clientToken,
+                                      HostID hid );
+    static bool readTokenGame( PGresult* result, TokenGame* game );
+
+    /* A non-blocking lookup's state, until its proc's called */
+    struct Pending;
+    static void gotStoredByDev( PGresult* result, void* closure );
+    static void gotDevID( PGresult* result, void* closure );
+    static void gotTokenGame( PGresult* result, void* closure );
     DevIDRelay getDevID( const DevID* devID );
     int getCountWhere( const char* table, string& test );
     void RemoveStoredMessages( string& msgIDs );
+    void removeStored( const vector<int>& ids );
     void decodeMessage( PGresult* result, bool useB64, int rowIndx, int b64indx, 
                         int byteaIndex, vector<uint8_t>& buf );
 
-    void storedMessagesImpl( string query, vector<DBMgr::MsgInfo>& msgs, 
-                             bool nullConnnameOK );
+    /* Stores requested at about the same time are written together by
+       whichever caller gets there first. */
+    typedef struct _StoreReq {
+        const char* connName;   /* NULL: addressed by devID alone */
+        HostID hid;
+        DevIDRelay devID;
+        AddrInfo::ClientToken token;
+        const uint8_t* buf;
+        int len;
+        const char* hash;
+        int id;
+        int msgID;              /* id, 0 if a duplicate, -1 on error */
+        bool done;
+    } StoreReq;
+    int storeMessage( StoreReq* req );
+    /* Cache it if possible, otherwise write it now */
+    int storeOrCache( MsgCache::Msg& msg );
+    int nextMsgID();
+    static void reqFor( const MsgCache::Msg& msg, StoreReq* req );
+    void writeStores( vector<StoreReq*>& reqs );
+    PGconn* storeConn();
+#ifdef LIBPQ_HAS_PIPELINING
+    bool pipelineStores( PGconn* conn, vector<StoreReq*>& reqs,
+                         size_t* nDone );
+#endif
+    bool sendStore( PGconn* conn, const StoreReq* req, bool async,
+                    PGresult** resultp );
+
+    /* Prepared on each connection the first time it's used there */
+    bool prepare( PGconn* conn, const char* name, const char* sql );
+    PGresult* execPrepared( const char* name, const char* sql, int nParams,
+                            const char* const* values, int resultFormat );
+
+    void storedMessagesImpl( const char* name, const char* sql, int nParams,
+                             const char* const* values,
+                             vector<MsgCache::Msg>& msgs );
+    void readStoredMessages( PGresult* result, vector<MsgCache::Msg>& msgs );
+    static void toMsgInfo( const vector<MsgCache::Msg>& from,
+                           vector<DBMgr::MsgInfo>& msgs );
+
+    /* Write what's cached that matches, and the deletes pending, so the DB
+       can be queried directly */
+    void syncCache( DevIDRelay devID, const char* connName );
+    void flushCache( time_t before, DevIDRelay devID,
+                     const char* connName );
+    void flush_main();
+    static void* flush_thread( void* closure );
     int CountStoredMessages( const char* const connName, int hid );
     bool UpdateDevice( DevIDRelay relayID );
     void formatUpdate( QueryBuilder& qb, bool append, const char* const desc, 
@@ -180,9 +278,6 @@ class DBMgr {
                        const char* const osVers, unsigned short variantCode,
                        DevIDRelay relayID );
 
-    PGconn* getThreadConn( void );
-    void clearThreadConn();
-
     bool hasNoMessages( const char* const connName, HostID hid );
     void setHasNoMessages( const char* const connName, HostID hid );
     void clearHasNoMessages( const char* const connName, HostID hid );
@@ -192,12 +287,29 @@ class DBMgr {
     void setHasNoMessages( DevIDRelay devid );
     void clearHasNoMessages( DevIDRelay devid );
 
-    void conn_key_alloc();
-    pthread_key_t m_conn_key;
+    DBPool* m_pool;
     bool m_useB64;
 
     char m_interval[64];
 
+    pthread_mutex_t m_preparedMutex;
+    map<PGconn*, set<string> > m_prepared;
+
+    /* NULL if MSGCACHE_SIZE is 0 */
+    MsgCache* m_cache;
+    int m_flushSecs;
+    /* held while writing cached messages or deletes, so a delete can't
+       pass the write of the message it's for */
+    pthread_mutex_t m_flushMutex;
+
+    pthread_mutex_t m_idsMutex;
+    vector<int> m_freeIDs;
+
+    pthread_mutex_t m_storeMutex;
+    pthread_cond_t m_storeCondVar;
+    vector<StoreReq*> m_storeQueue;
+    bool m_storeWriterActive;
+
     pthread_mutex_t m_haveNoMessagesMutex;
     set<DevIDRelay> m_haveNoMessagesDevID;
     set<StrWPF> m_haveNoMessagesConnname;
@@ -0,0 +1,499 @@
+/* -*- compile-command: "make -j3"; -*- */
+
+/*
+ * Copyright 2026 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dbpool.h"
+#include "mlock.h"
+#include "xwrelay_priv.h"
+
+/* Stats writes are all that go through ExecAsync(); every this many queued,
+   postgres isn't keeping up and it's worth a log */
+#define ASYNC_QUEUE_WARN 10000
+
+const uint32_t DBPool::s_bucketMillis[] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 5000, 0xFFFFFFFF,
+};
+
+DBPool::DBPool( const char* connParams, int size, CloseProc proc )
+    : m_connParams(connParams)
+    , m_size(size)
+    , m_closeProc(proc)
+    , m_nOpen(0)
+    , m_nInUse(0)
+    , m_maxInUse(0)
+    , m_nWaits(0)
+    , m_waitMillis(0)
+    , m_nAsyncCoalesced(0)
+    , m_latencies(VSIZE(s_bucketMillis), 0)
+    , m_nQueries(0)
+    , m_nFailed(0)
+{
+    assert( 0 < size );
+    pthread_mutex_init( &m_mutex, NULL );
+    pthread_cond_init( &m_condVar, NULL );
+
+    if ( 0 != pipe( m_asyncPipe ) ) {
+        logf( XW_LOGERROR, "%s: pipe failed: %s", __func__, strerror(errno) );
+    }
+    /* A wakeup's pending if the write end's full; the reader drains */
+    fcntl( m_asyncPipe[0], F_SETFL, O_NONBLOCK );
+    fcntl( m_asyncPipe[1], F_SETFL, O_NONBLOCK );
+
+    pthread_t thread;
+    int result = pthread_create( &thread, NULL, async_thread, this );
+    assert( 0 == result );
+    pthread_detach( thread );
+}
+
+DBPool::~DBPool()
+{
+    pthread_cond_destroy( &m_condVar );
+    pthread_mutex_destroy( &m_mutex );
+}
+
+/* static */ uint32_t
+DBPool::NowMillis()
+{
+    struct timespec tp;
+    clock_gettime( CLOCK_MONOTONIC, &tp );
+    return (tp.tv_sec * 1000) + (tp.tv_nsec / 1000000);
+}
+
+PGconn*
+DBPool::Get()
+{
+    pthread_mutex_lock( &m_mutex );
+    PGconn* conn = getLocked( true );
+    pthread_mutex_unlock( &m_mutex );
+    return conn;
+}
+
+PGconn*
+DBPool::getLocked( bool wait )
+{
+    uint32_t start = 0;
+    while ( wait && m_idle.empty() && m_nOpen >= m_size ) {
+        if ( 0 == start ) {
+            start = NowMillis();
+            ++m_nWaits;
+        }
+        pthread_cond_wait( &m_condVar, &m_mutex );
+    }
+    if ( 0 != start ) {
+        m_waitMillis += NowMillis() - start;
+    }
+
+    PGconn* conn = NULL;
+    if ( !m_idle.empty() ) {
+        conn = m_idle.back();
+        m_idle.pop_back();
+    } else if ( m_nOpen < m_size ) {
+        ++m_nOpen;              /* reserve the slot while connecting */
+        pthread_mutex_unlock( &m_mutex );
+        conn = PQconnectdb( m_connParams.c_str() );
+        if ( CONNECTION_OK != PQstatus( conn ) ) {
+            logf( XW_LOGERROR, "%s: PQconnectdb(%s) failed: %s", __func__,
+                  m_connParams.c_str(), PQerrorMessage( conn ) );
+            PQfinish( conn );
+            conn = NULL;
+        }
+        pthread_mutex_lock( &m_mutex );
+        if ( NULL == conn ) {
+            --m_nOpen;
+            pthread_cond_signal( &m_condVar );
+        }
+    }
+
+    if ( NULL != conn ) {
+        if ( ++m_nInUse > m_maxInUse ) {
+            m_maxInUse = m_nInUse;
+        }
+    }
+    return conn;
+}
+
+void
+DBPool::Put( PGconn* conn, bool bad )
+{
+    if ( NULL != conn ) {
+        bad = bad || CONNECTION_OK != PQstatus( conn );
+        if ( bad ) {
+            logf( XW_LOGERROR, "%s: closing bad connection: %s", __func__,
+                  PQerrorMessage( conn ) );
+            (*m_closeProc)( conn );
+            PQfinish( conn );
+        }
+
+        MutexLock ml( &m_mutex );
+        if ( bad ) {
+            --m_nOpen;
+        } else {
+            m_idle.push_back( conn );
+        }
+        --m_nInUse;
+        pthread_cond_signal( &m_condVar );
+    }
+}
+
+PGresult*
+DBPool::Exec( PGconn* conn, const char* query )
+{
+    uint32_t start = NowMillis();
+    return await( conn, 1 == PQsendQuery( conn, query ), start );
+}
+
+PGresult*
+DBPool::ExecParams( PGconn* conn, const char* query, int nParams,
+                    const char* const* values )
+{
+    uint32_t start = NowMillis();
+    bool sent = 1 == PQsendQueryParams( conn, query, nParams, NULL, values,
+                                        NULL, NULL, 0 );
+    return await( conn, sent, start );
+}
+
+PGresult*
+DBPool::ExecPrepared( PGconn* conn, const char* name, int nParams,
+                      const char* const* values, const int* lengths,
+                      const int* formats, int resultFormat )
+{
+    uint32_t start = NowMillis();
+    bool sent = 1 == PQsendQueryPrepared( conn, name, nParams, values,
+                                          lengths, formats, resultFormat );
+    return await( conn, sent, start );
+}
+
+/* Like PQexec(), return the last result (if there are several) or NULL on
+   failure to send */
+PGresult*
+DBPool::await( PGconn* conn, bool sent, uint32_t start )
+{
+    PGresult* last = NULL;
+    if ( sent ) {
+        PGresult* result;
+        while ( NULL != (result = PQgetResult( conn )) ) {
+            PQclear( last );
+            last = result;
+        }
+    } else {
+        logf( XW_LOGERROR, "%s: send failed: %s", __func__,
+              PQerrorMessage( conn ) );
+    }
+
+    ExecStatusType status = PQresultStatus( last );
+    NoteQuery( start, PGRES_COMMAND_OK == status || PGRES_TUPLES_OK == status );
+    return last;
+}
+
+void
+DBPool::NoteQuery( uint32_t start, bool ok )
+{
+    uint32_t millis = NowMillis() - start;
+    size_t ii;
+    for ( ii = 0; millis >= s_bucketMillis[ii]; ++ii ) {
+    }
+
+    MutexLock ml( &m_mutex );
+    ++m_latencies[ii];
+    ++m_nQueries;
+    if ( !ok ) {
+        ++m_nFailed;
+    }
+}
+
+void
+DBPool::ExecAsync( const string& query, const string& key )
+{
+    {
+        MutexLock ml( &m_mutex );
+        if ( key.empty() ) {
+            AsyncQuery aq = { .key = key, .query = query };
+            m_asyncQueue.push_back( aq );
+        } else if ( m_asyncLatest.end() != m_asyncLatest.find( key ) ) {
+            m_asyncLatest[key] = query;
+            ++m_nAsyncCoalesced;
+            return;             /* it's queued already */
+        } else {
+            m_asyncLatest[key] = query;
+            AsyncQuery aq = { .key = key, .query = "" };
+            m_asyncQueue.push_back( aq );
+        }
+        if ( 0 == m_asyncQueue.size() % ASYNC_QUEUE_WARN ) {
+            logf( XW_LOGERROR, "%s: %zu queued", __func__,
+                  m_asyncQueue.size() );
+        }
+    }
+
+    uint8_t byt = 0;
+    (void)write( m_asyncPipe[1], &byt, 1 );
+}
+
+void
+DBPool::QueryAsync( const string& query, const vector<string>& params,
+                    int resultFormat, ResultProc proc, void* closure )
+{
+    {
+        MutexLock ml( &m_mutex );
+        AsyncRead ar = { .query = query, .params = params,
+                         .resultFormat = resultFormat, .proc = proc,
+                         .closure = closure };
+        m_asyncReads.push_back( ar );
+    }
+
+    uint8_t byt = 0;
+    (void)write( m_asyncPipe[1], &byt, 1 );
+}
+
+/* static */ void*
+DBPool::async_thread( void* closure )
+{
+    blockSignals();
+    ((DBPool*)closure)->async_main();
+    return NULL;
+}
+
+/* The first queued query whose key isn't in flight */
+deque<DBPool::AsyncQuery>::iterator
+DBPool::nextAsyncLocked( const vector<InFlight>& inFlight )
+{
+    deque<AsyncQuery>::iterator iter;
+    for ( iter = m_asyncQueue.begin(); m_asyncQueue.end() != iter; ++iter ) {
+        size_t ii;
+        for ( ii = 0; !iter->key.empty() && ii < inFlight.size(); ++ii ) {
+            if ( inFlight[ii].key == iter->key ) {
+                break;
+            }
+        }
+        if ( ii == inFlight.size() || iter->key.empty() ) {
+            break;
+        }
+    }
+    return iter;
+}
+
+/* Event loop for ExecAsync()'s and QueryAsync()'s queries: send each on a
+ * free connection, then poll() the lot and collect results as they come
+ * in.  Reads go first, on up to half the connections; writes get at most a
+ * quarter, leaving the rest to threads that block.  A write whose key is in
+ * flight waits, but doesn't hold up those behind it; with at most one
+ * queued per key there are never many to skip.
+ */
+void
+DBPool::async_main()
+{
+    size_t maxWrites = m_size / 4;
+    if ( 0 == maxWrites ) {
+        maxWrites = 1;
+    }
+    size_t maxReads = m_size / 2;
+    if ( 0 == maxReads ) {
+        maxReads = 1;
+    }
+    size_t nWrites = 0;
+    size_t nReads = 0;
+    vector<InFlight> inFlight;
+
+    for ( ; ; ) {
+        bool starved = false;
+        for ( ; ; ) {
+            AsyncRead read = { .query = "", .params = vector<string>(),
+                               .resultFormat = 0, .proc = NULL,
+                               .closure = NULL };
+            string query;
+            string key;
+            PGconn* conn = NULL;
+            pthread_mutex_lock( &m_mutex );
+            bool wantRead = nReads < maxReads && !m_asyncReads.empty();
+            bool wantWrite = !wantRead && nWrites < maxWrites
+                && m_asyncQueue.end() != nextAsyncLocked( inFlight );
+            if ( wantRead || wantWrite ) {
+                /* This may drop the mutex to connect, letting ExecAsync()
+                   grow the queue, so look again once it's back */
+                conn = getLocked( false );
+                starved = NULL == conn;
+            }
+            if ( NULL == conn ) {
+                /* nothing to send, or nothing to send it on */
+            } else if ( wantRead ) {
+                read = m_asyncReads.front(); /* we're the only taker */
+                m_asyncReads.pop_front();
+            } else {
+                deque<AsyncQuery>::iterator iter = nextAsyncLocked( inFlight );
+                assert( m_asyncQueue.end() != iter );
+                key = iter->key;
+                if ( key.empty() ) {
+                    query = iter->query;
+                } else {
+                    query = m_asyncLatest[key];
+                    m_asyncLatest.erase( key );
+                }
+                m_asyncQueue.erase( iter );
+            }
+            pthread_mutex_unlock( &m_mutex );
+            if ( NULL == conn ) {
+                break;
+            }
+
+            bool sent;
+            if ( wantRead ) {
+                const char* values[read.params.size() + 1];
+                for ( size_t ii = 0; ii < read.params.size(); ++ii ) {
+                    values[ii] = read.params[ii].c_str();
+                }
+                sent = 1 == PQsendQueryParams( conn, read.query.c_str(),
+                                               read.params.size(), NULL,
+                                               values, NULL, NULL,
+                                               read.resultFormat );
+                query = read.query;
+            } else {
+                sent = 1 == PQsendQuery( conn, query.c_str() );
+            }
+            if ( sent ) {
+                InFlight fl = { .conn = conn, .sent = NowMillis(),
+                                .key = key, .proc = read.proc,
+                                .closure = read.closure, .result = NULL };
+                inFlight.push_back( fl );
+                if ( wantRead ) {
+                    ++nReads;
+                } else {
+                    ++nWrites;
+                }
+            } else {
+                logf( XW_LOGERROR, "%s: PQsendQuery(%s) failed: %s", __func__,
+                      query.c_str(), PQerrorMessage( conn ) );
+                NoteQuery( NowMillis(), false );
+                Put( conn, true );
+                if ( NULL != read.proc ) {
+                    (*read.proc)( NULL, read.closure );
+                }
+            }
+        }
+
+        struct pollfd fds[1 + inFlight.size()];
+        fds[0].fd = m_asyncPipe[0];
+        fds[0].events = POLLIN;
+        for ( size_t ii = 0; ii < inFlight.size(); ++ii ) {
+            fds[1+ii].fd = PQsocket( inFlight[ii].conn );
+            fds[1+ii].events = POLLIN;
+        }
+
+        /* If there was no connection to be had, try again soon */
+        int nReady = poll( fds, VSIZE(fds), starved ? 50 : -1 );
+        if ( 0 > nReady ) {
+            if ( EINTR != errno ) {
+                logf( XW_LOGERROR, "%s: poll failed: %s", __func__,
+                      strerror(errno) );
+            }
+            continue;
+        }
+
+        if ( 0 != fds[0].revents ) {
+            uint8_t buf[64];
+            while ( 0 < read( m_asyncPipe[0], buf, sizeof(buf) ) ) {
+            }
+        }
+
+        for ( int ii = inFlight.size() - 1; ii >= 0; --ii ) {
+            if ( 0 == fds[1+ii].revents ) {
+                continue;
+            }
+            InFlight& fl = inFlight[ii];
+            bool connOK = 1 == PQconsumeInput( fl.conn );
+            bool done = !connOK;
+            while ( !done && !PQisBusy( fl.conn ) ) {
+                PGresult* result = PQgetResult( fl.conn );
+                done = NULL == result;
+                if ( !done ) {
+                    PQclear( fl.result );
+                    fl.result = result;
+                }
+            }
+
+            if ( done ) {
+                ExecStatusType status = PQresultStatus( fl.result );
+                bool queryOK = connOK && ( PGRES_COMMAND_OK == status
+                                           || (NULL != fl.proc
+                                               && PGRES_TUPLES_OK == status) );
+                if ( !queryOK ) {
+                    logf( XW_LOGERROR, "%s: query failed: %s", __func__,
+                          connOK ? PQresultErrorMessage( fl.result )
+                          : PQerrorMessage( fl.conn ) );
+                }
+                NoteQuery( fl.sent, queryOK );
+                Put( fl.conn, !connOK );
+                if ( NULL == fl.proc ) {
+                    PQclear( fl.result );
+                    --nWrites;
+                } else {
+                    (*fl.proc)( connOK ? fl.result : NULL, fl.closure );
+                    if ( !connOK ) {
+                        PQclear( fl.result );
+                    }
+                    --nReads;
+                }
+                inFlight.erase( inFlight.begin() + ii );
+            }
+        }
+    }
+}
+
+void
+DBPool::PrintStats( StrWPF& out )
+{
+    MutexLock ml( &m_mutex );
+
+    out.catf( "connections: %d open of %d; %d in use (max %d)\n",
+              m_nOpen, m_size, m_nInUse, m_maxInUse );
+    out.catf( "waits for a connection: %u, avg %u ms\n", m_nWaits,
+              0 == m_nWaits ? 0 : (uint32_t)(m_waitMillis / m_nWaits) );
+    out.catf( "queries: %u (%u failed); async queued: %zu writes"
+              " (coalesced: %u), %zu reads\n", m_nQueries, m_nFailed,
+              m_asyncQueue.size(), m_nAsyncCoalesced, m_asyncReads.size() );
+
+    out.catf( "latency ms:" );
+    uint32_t p50 = 0;
+    uint32_t p99 = 0;
+    uint32_t sofar = 0;
+    for ( size_t ii = 0; ii < m_latencies.size(); ++ii ) {
+        if ( ii + 1 < m_latencies.size() ) {
+            out.catf( " <%u:%u", s_bucketMillis[ii], m_latencies[ii] );
+        } else {
+            out.catf( " more:%u", m_latencies[ii] );
+        }
+        sofar += m_latencies[ii];
+        if ( 0 == p50 && sofar * 2 >= m_nQueries && 0 < sofar ) {
+            p50 = s_bucketMillis[ii];
+        }
+        if ( 0 == p99 && sofar * 100 >= m_nQueries * 99 && 0 < sofar ) {
+            p99 = s_bucketMillis[ii];
+        }
+    }
+    out.catf( "\n" );
+    if ( 0 < m_nQueries ) {
+        out.catf( "p50 < %u ms; p99 < %u ms\n", p50, p99 );
+    }
+}
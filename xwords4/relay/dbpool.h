@@ -0,0 +1,144 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+
+/*
+ * Copyright 2026 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _DBPOOL_H_
+#define _DBPOOL_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+
+#include <pthread.h>
+#include <libpq-fe.h>
+
+#include "strwpf.h"
+
+using namespace std;
+
+/* A bounded set of postgres connections shared by all threads, in place of
+ * one per thread.  Queries are sent with libpq's async calls and their
+ * results waited for with poll(), and their latency is kept in a histogram
+ * for the ctrl "db" command.  Queries nobody needs the results of can be
+ * handed off entirely: a thread of the pool's own sends them and collects
+ * their results on however many connections are free, so the packet
+ * handler that wanted them run doesn't wait at all.  Queries whose results
+ * are needed can go the same way, with a callback for the result, so a
+ * packet handler can park its packet instead of blocking its thread.
+ */
+class DBPool {
+ public:
+    /* called before a connection is closed */
+    typedef void (*CloseProc)( PGconn* conn );
+
+    DBPool( const char* connParams, int size, CloseProc proc );
+    ~DBPool();
+
+    /* Waits for a free connection, opening one if there are fewer than
+       size.  NULL if postgres can't be reached. */
+    PGconn* Get();
+    /* Done with it; bad ones are closed and replaced as needed */
+    void Put( PGconn* conn, bool bad = false );
+
+    /* Like PQexec() etc., but recording how long they took */
+    PGresult* Exec( PGconn* conn, const char* query );
+    PGresult* ExecParams( PGconn* conn, const char* query, int nParams,
+                          const char* const* values );
+    PGresult* ExecPrepared( PGconn* conn, const char* name, int nParams,
+                            const char* const* values, 
+                            const int* lengths, const int* formats,
+                            int resultFormat );
+    /* For queries run some other way, e.g. pipelined */
+    void NoteQuery( uint32_t start, bool ok );
+    static uint32_t NowMillis();
+
+    /* Queue a query whose results, apart from errors, don't matter.  Those
+       with the same non-empty key run in the order queued, one at a time,
+       and one still queued is replaced by a newer one: pass a key only
+       when the latest query makes earlier ones moot. */
+    void ExecAsync( const string& query, const string& key = "" );
+
+    /* Called on the pool's thread with a QueryAsync() result, NULL if the
+       query couldn't be sent.  The callee PQclear()s it. */
+    typedef void (*ResultProc)( PGresult* result, void* closure );
+    /* Queue a query whose result is wanted, ahead of ExecAsync()'s */
+    void QueryAsync( const string& query, const vector<string>& params,
+                     int resultFormat, ResultProc proc, void* closure );
+
+    void PrintStats( StrWPF& out );
+
+ private:
+    typedef struct {
+        PGconn* conn;
+        uint32_t sent;
+        string key;
+        ResultProc proc;        /* NULL: from ExecAsync() */
+        void* closure;
+        PGresult* result;       /* the last so far, for proc */
+    } InFlight;
+
+    typedef struct {
+        string query;
+        vector<string> params;
+        int resultFormat;
+        ResultProc proc;
+        void* closure;
+    } AsyncRead;
+
+    typedef struct {
+        string key;
+        string query;           /* if keyed, in m_asyncLatest instead */
+    } AsyncQuery;
+
+    PGconn* getLocked( bool wait );
+    PGresult* await( PGconn* conn, bool sent, uint32_t start );
+    deque<AsyncQuery>::iterator
+        nextAsyncLocked( const vector<InFlight>& inFlight );
+    void async_main();
+    static void* async_thread( void* closure );
+
+    string m_connParams;
+    int m_size;
+    CloseProc m_closeProc;
+
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_condVar;
+    vector<PGconn*> m_idle;
+    int m_nOpen;
+    int m_nInUse;
+    int m_maxInUse;
+    uint32_t m_nWaits;          /* Get() calls that found none free */
+    uint64_t m_waitMillis;
+
+    /* for ExecAsync() */
+    deque<AsyncQuery> m_asyncQueue;
+    deque<AsyncRead> m_asyncReads; /* for QueryAsync() */
+    map<string, string> m_asyncLatest;
+    int m_asyncPipe[2];
+    uint32_t m_nAsyncCoalesced;
+
+    /* query latency: bucket ii counts those under s_bucketMillis[ii] */
+    static const uint32_t s_bucketMillis[];
+    vector<uint32_t> m_latencies;
+    uint32_t m_nQueries;
+    uint32_t m_nFailed;
+};
+
+#endif
@@ -0,0 +1,442 @@
+/* -*- compile-command: "make -k -j3"; -*- */
+
+/*
+ * Copyright 2026 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <assert.h>
+#include <algorithm>
+
+#include "msgcache.h"
+#include "mlock.h"
+
+#define MAX_WRITE_TRIES 5
+
+MsgCache::MsgCache( size_t maxMsgs )
+    : m_maxMsgs(maxMsgs)
+    , m_stamp(0)
+    , m_nAdded(0)
+    , m_nFull(0)
+    , m_nHits(0)
+    , m_nMisses(0)
+    , m_nNeverWritten(0)
+    , m_nWritten(0)
+    , m_nDeletes(0)
+    , m_nEvicted(0)
+    , m_nGaveUp(0)
+{
+    pthread_mutex_init( &m_mutex, NULL );
+}
+
+MsgCache::~MsgCache()
+{
+    pthread_mutex_destroy( &m_mutex );
+}
+
+bool
+MsgCache::Add( const Msg& msg, bool* isDup )
+{
+    bool added = false;
+    MutexLock ml( &m_mutex );
+    *isDup = findDupLocked( msg );
+    if ( !*isDup ) {
+        if ( m_msgs.size() >= m_maxMsgs ) {
+            evictLocked( msg.devID );
+        }
+        if ( m_msgs.size() < m_maxMsgs ) {
+            Msg& cached = m_msgs[msg.id] = msg;
+            cached.inDB = false;
+            cached.tries = 0;
+            m_unwritten.insert( msg.id );
+
+            Mailbox& mailbox = m_mailboxes[msg.devID];
+            mailbox.ids.insert( msg.id );
+            mailbox.lastUsed = time( NULL );
+            ++m_nAdded;
+            added = true;
+        } else {
+            ++m_nFull;
+        }
+    }
+    return added;
+}
+
+bool
+MsgCache::GetMailbox( DevIDRelay devID, vector<Msg>& msgs )
+{
+    bool found = false;
+    MutexLock ml( &m_mutex );
+    map<DevIDRelay, Mailbox>::iterator iter = m_mailboxes.find( devID );
+    if ( m_mailboxes.end() != iter && iter->second.complete ) {
+        Mailbox& mailbox = iter->second;
+        set<int>::const_iterator idIter;
+        for ( idIter = mailbox.ids.begin(); idIter != mailbox.ids.end();
+              ++idIter ) {
+            msgs.push_back( m_msgs[*idIter] );
+        }
+        mailbox.lastUsed = time( NULL );
+        found = true;
+        ++m_nHits;
+    } else {
+        ++m_nMisses;
+    }
+    return found;
+}
+
+bool
+MsgCache::CountMailbox( DevIDRelay devID, int* count )
+{
+    bool found = false;
+    MutexLock ml( &m_mutex );
+    map<DevIDRelay, Mailbox>::const_iterator iter = m_mailboxes.find( devID );
+    if ( m_mailboxes.end() != iter && iter->second.complete ) {
+        *count = iter->second.ids.size();
+        found = true;
+        ++m_nHits;
+    } else {
+        ++m_nMisses;
+    }
+    return found;
+}
+
+uint32_t
+MsgCache::Stamp()
+{
+    MutexLock ml( &m_mutex );
+    return m_stamp;
+}
+
+/* Anything cached already is at least as current as what the DB returned,
+ * and anything delivered while the query was in flight must not come back.
+ * If the stamp's changed there may be more such than we can tell, so leave
+ * the mailbox incomplete and let the next read try again.
+ */
+void
+MsgCache::SetMailbox( DevIDRelay devID, const vector<Msg>& fromDB,
+                      uint32_t stamp )
+{
+    MutexLock ml( &m_mutex );
+    setMailboxLocked( devID, fromDB, stamp );
+}
+
+void
+MsgCache::MergeMailbox( DevIDRelay devID, const vector<Msg>& fromDB,
+                        uint32_t stamp, vector<Msg>& msgs )
+{
+    MutexLock ml( &m_mutex );
+    setMailboxLocked( devID, fromDB, stamp );
+
+    map<int, const Msg*> merged;
+    vector<Msg>::const_iterator iter;
+    for ( iter = fromDB.begin(); iter != fromDB.end(); ++iter ) {
+        if ( m_deletes.end() == m_deletes.find( iter->id ) ) {
+            merged[iter->id] = &*iter;
+        }
+    }
+    map<DevIDRelay, Mailbox>::const_iterator mbIter = m_mailboxes.find( devID );
+    if ( m_mailboxes.end() != mbIter ) {
+        const set<int>& ids = mbIter->second.ids;
+        set<int>::const_iterator idIter;
+        for ( idIter = ids.begin(); idIter != ids.end(); ++idIter ) {
+            merged[*idIter] = &m_msgs[*idIter];
+        }
+    }
+
+    map<int, const Msg*>::const_iterator mIter;
+    for ( mIter = merged.begin(); mIter != merged.end(); ++mIter ) {
+        msgs.push_back( *mIter->second );
+    }
+}
+
+void
+MsgCache::setMailboxLocked( DevIDRelay devID, const vector<Msg>& fromDB,
+                            uint32_t stamp )
+{
+    if ( stamp == m_stamp && fromDB.size() <= m_maxMsgs / 4 ) {
+        Mailbox& mailbox = m_mailboxes[devID];
+        vector<Msg>::const_iterator iter;
+        for ( iter = fromDB.begin(); iter != fromDB.end(); ++iter ) {
+            int id = iter->id;
+            if ( m_deletes.end() == m_deletes.find( id )
+                 && m_msgs.end() == m_msgs.find( id ) ) {
+                Msg& cached = m_msgs[id] = *iter;
+                cached.inDB = true;
+                cached.tries = 0;
+                mailbox.ids.insert( id );
+            }
+        }
+        mailbox.complete = true;
+        mailbox.lastUsed = time( NULL );
+
+        if ( m_msgs.size() > m_maxMsgs || m_mailboxes.size() > m_maxMsgs ) {
+            evictLocked( devID );
+        }
+    }
+}
+
+void
+MsgCache::Forget( DevIDRelay devID )
+{
+    MutexLock ml( &m_mutex );
+    map<DevIDRelay, Mailbox>::iterator iter = m_mailboxes.find( devID );
+    if ( m_mailboxes.end() != iter ) {
+        iter->second.complete = false;
+    }
+    ++m_stamp;
+}
+
+void
+MsgCache::Remove( int id )
+{
+    MutexLock ml( &m_mutex );
+    map<int, Msg>::iterator iter = m_msgs.find( id );
+    if ( m_msgs.end() != iter && !iter->second.inDB
+         && 0 == iter->second.tries ) {
+        ++m_nNeverWritten;
+    } else {
+        m_deletes.insert( id );
+        ++m_nDeletes;
+    }
+    if ( m_msgs.end() != iter ) {
+        removeLocked( iter );
+    }
+}
+
+void
+MsgCache::Drop( int id )
+{
+    MutexLock ml( &m_mutex );
+    map<int, Msg>::iterator iter = m_msgs.find( id );
+    if ( m_msgs.end() != iter ) {
+        removeLocked( iter );
+    }
+}
+
+bool
+MsgCache::IsDeleted( int id )
+{
+    MutexLock ml( &m_mutex );
+    return m_deletes.end() != m_deletes.find( id );
+}
+
+bool
+MsgCache::Lookup( int id, string* connName, HostID* hid, int* len )
+{
+    bool found = false;
+    MutexLock ml( &m_mutex );
+    map<int, Msg>::const_iterator iter = m_msgs.find( id );
+    if ( m_msgs.end() != iter ) {
+        *connName = iter->second.connName;
+        *hid = iter->second.hid;
+        *len = iter->second.msg.size();
+        found = true;
+    }
+    return found;
+}
+
+void
+MsgCache::DropGame( const char* connName )
+{
+    MutexLock ml( &m_mutex );
+    map<int, Msg>::iterator iter = m_msgs.begin();
+    while ( m_msgs.end() != iter ) {
+        if ( iter->second.connName == connName ) {
+            removeLocked( iter++ );
+        } else {
+            ++iter;
+        }
+    }
+    ++m_stamp;
+}
+
+void
+MsgCache::TakeUnwritten( time_t before, DevIDRelay devID,
+                         const char* connName, vector<Msg>& msgs )
+{
+    MutexLock ml( &m_mutex );
+    set<int>::iterator iter = m_unwritten.begin();
+    while ( m_unwritten.end() != iter ) {
+        Msg& msg = m_msgs[*iter];
+        if ( (0 == before || msg.stored < before)
+             && (0 == devID || devID == msg.devID)
+             && (NULL == connName || msg.connName == connName) ) {
+            msg.inDB = true;
+            ++msg.tries;
+            msgs.push_back( msg );
+            m_writing.insert( *iter );
+            m_unwritten.erase( iter++ );
+            ++m_nWritten;
+        } else {
+            ++iter;
+        }
+    }
+}
+
+void
+MsgCache::Written( int id )
+{
+    MutexLock ml( &m_mutex );
+    m_writing.erase( id );
+}
+
+/* Past MAX_WRITE_TRIES the message goes, and with it the claim that its
+ * device's mailbox is complete: it may have been written after all.  One
+ * that's no longer here wasn't delivered unless it's awaiting its delete,
+ * so it's lost.
+ */
+bool
+MsgCache::Unwritten( int id )
+{
+    bool retry = true;
+    MutexLock ml( &m_mutex );
+    m_writing.erase( id );
+    map<int, Msg>::iterator iter = m_msgs.find( id );
+    if ( m_msgs.end() == iter ) {
+        if ( m_deletes.end() == m_deletes.find( id ) ) {
+            ++m_nGaveUp;
+            retry = false;
+        }
+    } else {
+        --m_nWritten;
+        if ( MAX_WRITE_TRIES > iter->second.tries ) {
+            iter->second.inDB = false;
+            m_unwritten.insert( id );
+        } else {
+            map<DevIDRelay, Mailbox>::iterator mbIter =
+                m_mailboxes.find( iter->second.devID );
+            if ( m_mailboxes.end() != mbIter ) {
+                mbIter->second.complete = false;
+            }
+            removeLocked( iter );
+            ++m_stamp;
+            ++m_nGaveUp;
+            retry = false;
+        }
+    }
+    return retry;
+}
+
+void
+MsgCache::TakeDeletes( vector<int>& ids )
+{
+    MutexLock ml( &m_mutex );
+    if ( 0 < m_deletes.size() ) {
+        ids.insert( ids.end(), m_deletes.begin(), m_deletes.end() );
+        m_deletes.clear();
+        ++m_stamp;
+    }
+}
+
+void
+MsgCache::PrintStats( StrWPF& out )
+{
+    MutexLock ml( &m_mutex );
+    out.catf( "msg cache: %zu msgs (max %zu; %zu unwritten, %zu writing)"
+              " for %zu devices; %zu deletes pending\n", m_msgs.size(),
+              m_maxMsgs, m_unwritten.size(), m_writing.size(),
+              m_mailboxes.size(), m_deletes.size() );
+    out.catf( "  stored: %u (%u no room); reads: %u hits, %u misses\n",
+              m_nAdded, m_nFull, m_nHits, m_nMisses );
+    out.catf( "  delivered unwritten: %u; written: %u; deletes: %u;"
+              " evicted: %u; gave up: %u\n", m_nNeverWritten, m_nWritten,
+              m_nDeletes, m_nEvicted, m_nGaveUp );
+}
+
+void
+MsgCache::removeLocked( map<int, Msg>::iterator iter )
+{
+    int id = iter->first;
+    map<DevIDRelay, Mailbox>::iterator mbIter =
+        m_mailboxes.find( iter->second.devID );
+    if ( m_mailboxes.end() != mbIter ) {
+        Mailbox& mailbox = mbIter->second;
+        mailbox.ids.erase( id );
+        if ( !mailbox.complete && 0 == mailbox.ids.size() ) {
+            m_mailboxes.erase( mbIter );
+        }
+    }
+    m_unwritten.erase( id );
+    m_writing.erase( id );
+    m_msgs.erase( iter );
+}
+
+/* Drop the least recently used mailboxes that have nothing left to write
+ * or being written, down to 90% of capacity so this doesn't run on every Add().
+ */
+void
+MsgCache::evictLocked( DevIDRelay keep )
+{
+    vector<pair<time_t, DevIDRelay> > candidates;
+    map<DevIDRelay, Mailbox>::const_iterator iter;
+    for ( iter = m_mailboxes.begin(); iter != m_mailboxes.end(); ++iter ) {
+        if ( keep == iter->first ) {
+            continue;
+        }
+        const set<int>& ids = iter->second.ids;
+        set<int>::const_iterator idIter;
+        for ( idIter = ids.begin(); idIter != ids.end(); ++idIter ) {
+            if ( m_unwritten.end() != m_unwritten.find( *idIter )
+                 || m_writing.end() != m_writing.find( *idIter ) ) {
+                break;
+            }
+        }
+        if ( ids.end() == idIter ) {
+            candidates.push_back( make_pair( iter->second.lastUsed,
+                                             iter->first ) );
+        }
+    }
+    sort( candidates.begin(), candidates.end() );
+
+    size_t target = m_maxMsgs - m_maxMsgs / 10;
+    vector<pair<time_t, DevIDRelay> >::const_iterator cand;
+    for ( cand = candidates.begin(); cand != candidates.end(); ++cand ) {
+        if ( m_msgs.size() <= target && m_mailboxes.size() <= target ) {
+            break;
+        }
+        map<DevIDRelay, Mailbox>::iterator mbIter =
+            m_mailboxes.find( cand->second );
+        const set<int>& ids = mbIter->second.ids;
+        set<int>::const_iterator idIter;
+        for ( idIter = ids.begin(); idIter != ids.end(); ++idIter ) {
+            m_msgs.erase( *idIter );
+        }
+        m_mailboxes.erase( mbIter );
+        ++m_nEvicted;
+    }
+}
+
+/* Same test postgres makes when storing, for game messages only */
+bool
+MsgCache::findDupLocked( const Msg& msg )
+{
+    bool found = false;
+    if ( !msg.connName.empty() ) {
+        map<DevIDRelay, Mailbox>::const_iterator iter =
+            m_mailboxes.find( msg.devID );
+        if ( m_mailboxes.end() != iter ) {
+            const set<int>& ids = iter->second.ids;
+            set<int>::const_iterator idIter;
+            for ( idIter = ids.begin(); !found && idIter != ids.end();
+                  ++idIter ) {
+                const Msg& other = m_msgs[*idIter];
+                found = other.hid == msg.hid && other.hash == msg.hash
+                    && other.connName == msg.connName;
+            }
+        }
+    }
+    return found;
+}
@@ -0,0 +1,147 @@
+/* -*-mode: C; fill-column: 78; c-basic-offset: 4; -*- */
+
+/*
+ * Copyright 2026 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef _MSGCACHE_H_
+#define _MSGCACHE_H_
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+
+#include <pthread.h>
+#include <time.h>
+
+#include "xwrelay_priv.h"
+#include "addrinfo.h"
+#include "strwpf.h"
+
+using namespace std;
+
+/* Stored messages, kept in memory per recipient device so that one that's
+ * stored and then delivered and acked within a few seconds never costs a
+ * trip to postgres.  DBMgr writes messages out once they've been here a
+ * while (those still here are then "in the DB"), and batches up the deletes
+ * that acks of written messages require.  Once a device's stored messages
+ * have all been read from the DB its mailbox is "complete" and reads for it
+ * are answered from here until it's evicted, least recently used first, to
+ * keep the whole under a fixed number of messages.  Only mailboxes with
+ * nothing left to write can be evicted; when there's no room, Add() fails
+ * and the caller writes the message itself.
+ */
+class MsgCache {
+ public:
+    typedef struct _Msg {
+        int id;
+        DevIDRelay devID;
+        string connName;        /* empty: addressed by devID alone */
+        HostID hid;
+        AddrInfo::ClientToken token;
+        string hash;            /* same as msgs.msghash */
+        vector<uint8_t> msg;
+        time_t stored;
+        bool inDB;
+        int tries;              /* times a write's been attempted */
+    } Msg;
+
+    MsgCache( size_t maxMsgs );
+    ~MsgCache();
+
+    /* False if there's no room, or if it's a copy of an undelivered message
+       for the same game and player, in which case *isDup is set */
+    bool Add( const Msg& msg, bool* isDup );
+
+    /* If devID's mailbox is complete, its messages in id order */
+    bool GetMailbox( DevIDRelay devID, vector<Msg>& msgs );
+    bool CountMailbox( DevIDRelay devID, int* count );
+    /* Call before reading a mailbox from the DB, then pass to SetMailbox() so
+       it can tell if anything it'd miss happened in the meantime */
+    uint32_t Stamp();
+    void SetMailbox( DevIDRelay devID, const vector<Msg>& fromDB,
+                     uint32_t stamp );
+    /* SetMailbox(), then all devID has waiting: fromDB less what's been
+       delivered, plus what's here, written or not, in id order.  So the DB
+       needn't be sent what's here first. */
+    void MergeMailbox( DevIDRelay devID, const vector<Msg>& fromDB,
+                       uint32_t stamp, vector<Msg>& msgs );
+    /* Something's been stored for devID behind our back */
+    void Forget( DevIDRelay devID );
+
+    /* Delivered.  If it might be in the DB, which it might be once a write's
+       been tried whatever the result, it's queued for TakeDeletes() */
+    void Remove( int id );
+    /* Gone without being delivered: a failed or duplicate write */
+    void Drop( int id );
+    /* Whether a message read from the DB has been delivered since */
+    bool IsDeleted( int id );
+    bool Lookup( int id, string* connName, HostID* hid, int* len );
+    /* A dead game's messages are never delivered */
+    void DropGame( const char* connName );
+
+    /* Messages not yet written that were stored before `before' (0: any
+       time), optionally only those for devID or connName.  They're now
+       considered in the DB, but can't be evicted until Written() or
+       Unwritten() says how the write went.  Unwritten() returns false if
+       it's given up on one after too many tries, so a write that can never
+       work doesn't hold its device's mailbox forever, or if the message is
+       gone from the cache without having been delivered. */
+    void TakeUnwritten( time_t before, DevIDRelay devID, const char* connName,
+                        vector<Msg>& msgs );
+    void Written( int id );
+    bool Unwritten( int id );
+    void TakeDeletes( vector<int>& ids );
+
+    void PrintStats( StrWPF& out );
+
+ private:
+    typedef struct {
+        set<int> ids;
+        bool complete;
+        time_t lastUsed;
+    } Mailbox;
+
+    void setMailboxLocked( DevIDRelay devID, const vector<Msg>& fromDB,
+                           uint32_t stamp );
+    void removeLocked( map<int, Msg>::iterator iter );
+    void evictLocked( DevIDRelay keep );
+    bool findDupLocked( const Msg& msg );
+
+    size_t m_maxMsgs;
+    pthread_mutex_t m_mutex;
+    map<int, Msg> m_msgs;
+    map<DevIDRelay, Mailbox> m_mailboxes;
+    set<int> m_unwritten;
+    set<int> m_writing;         /* taken by TakeUnwritten(), result unknown */
+    set<int> m_deletes;
+    uint32_t m_stamp;
+
+    /* for ctrl */
+    uint32_t m_nAdded;
+    uint32_t m_nFull;
+    uint32_t m_nHits;
+    uint32_t m_nMisses;
+    uint32_t m_nNeverWritten;   /* delivered before they were written */
+    uint32_t m_nWritten;
+    uint32_t m_nDeletes;
+    uint32_t m_nEvicted;
+    uint32_t m_nGaveUp;         /* never could be written */
+};
+
+#endif
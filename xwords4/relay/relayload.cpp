@@ -0,0 +1,1111 @@
+/* -*- compile-command: "make relayload"; -*- */
+
+/*
+ * Copyright 2026 by Eric House (xwords@eehouse.org).  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/* Load generator for the relay's UDP protocol.  Registers two fake devices
+ * per game, each on its own socket, connects them by cookie into two-player
+ * games, and once a game's ALLHERE has reached both sends game messages back
+ * and forth at a fixed total rate, acking everything the relay sends the way
+ * a real device would.  Every few seconds it prints packets/sec each way, the
+ * latency of game messages from send to delivery, and, if the relay's ctrl
+ * port is reachable, DB queue depth from its "db" command.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "xwrelay.h"
+
+using namespace std;
+
+#ifndef DEFAULT_HOST
+# define DEFAULT_HOST "localhost"
+#endif
+#ifndef DEFAULT_PORT
+# define DEFAULT_PORT 10997     /* UDP_PORT */
+#endif
+#ifndef DEFAULT_CTLPORT
+# define DEFAULT_CTLPORT 11000
+#endif
+
+#define CLIENT_VERS 5
+#define LOAD_MAGIC 0x4C4F4144   /* "LOAD" */
+#define MIN_PAYLOAD (sizeof(uint32_t) * 2 + sizeof(uint64_t))
+#define RETRY_MS 3000
+#define SWEEP_MS 100
+
+static const char* g_host = DEFAULT_HOST;
+static int g_port = DEFAULT_PORT;
+static int g_ctlPort = DEFAULT_CTLPORT;
+static int g_nGames = 1000;
+static int g_msgsPerSec = 1000;
+static int g_setupsPerSec = 2000;
+static size_t g_payloadSize = 32;
+static int g_duration = 60;
+static int g_interval = 5;
+static int g_nThreads = 2;
+
+static struct sockaddr_in g_relayAddr;
+static volatile sig_atomic_t g_stop = 0;
+
+static void
+usage( const char * const argv0 )
+{
+    fprintf( stderr, "usage: %s \\\n", argv0 );
+    fprintf( stderr, "\t[-a <host>]     # relay (default: %s) \\\n",
+             DEFAULT_HOST );
+    fprintf( stderr, "\t[-p <port>]     # relay UDP port (default %d) \\\n",
+             DEFAULT_PORT );
+    fprintf( stderr, "\t[-c <port>]     # relay ctrl port, 0 for none "
+             "(default %d) \\\n", DEFAULT_CTLPORT );
+    fprintf( stderr, "\t[-g <n>]        # games, two devices each "
+             "(default %d) \\\n", g_nGames );
+    fprintf( stderr, "\t[-m <n>]        # game messages/sec, all games "
+             "(default %d) \\\n", g_msgsPerSec );
+    fprintf( stderr, "\t[-r <n>]        # devices to set up per sec "
+             "(default %d) \\\n", g_setupsPerSec );
+    fprintf( stderr, "\t[-s <n>]        # message payload bytes, >= %zu "
+             "(default %zu) \\\n", MIN_PAYLOAD, g_payloadSize );
+    fprintf( stderr, "\t[-d <secs>]     # run time (default %d) \\\n",
+             g_duration );
+    fprintf( stderr, "\t[-i <secs>]     # report interval (default %d) \\\n",
+             g_interval );
+    fprintf( stderr, "\t[-t <n>]        # threads (default %d)\n",
+             g_nThreads );
+    exit( 1 );
+}
+
+static uint64_t
+nowUS()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static void
+onSignal( int /*sig*/ )
+{
+    g_stop = 1;
+}
+
+/* Same encoding as the relay's un2vli(): seven bits per byte, high bit set
+   on the last */
+static void
+putVLI( vector<uint8_t>& out, uint32_t nn )
+{
+    bool done = false;
+    do {
+        uint8_t byt = nn & 0x7F;
+        nn >>= 7;
+        done = 0 == nn;
+        if ( done ) {
+            byt |= 0x80;
+        }
+        out.push_back( byt );
+    } while ( !done );
+}
+
+static void
+putVLIString( vector<uint8_t>& out, const string& str )
+{
+    putVLI( out, str.length() );
+    out.insert( out.end(), str.begin(), str.end() );
+}
+
+static void
+putNetShort( vector<uint8_t>& out, uint16_t val )
+{
+    out.push_back( val >> 8 );
+    out.push_back( val & 0xFF );
+}
+
+static void
+putNetLong( vector<uint8_t>& out, uint32_t val )
+{
+    putNetShort( out, val >> 16 );
+    putNetShort( out, val & 0xFFFF );
+}
+
+static bool
+getNetByte( const uint8_t** bufpp, const uint8_t* end, uint8_t* out )
+{
+    bool success = *bufpp < end;
+    if ( success ) {
+        *out = *(*bufpp)++;
+    }
+    return success;
+}
+
+static bool
+getNetShort( const uint8_t** bufpp, const uint8_t* end, uint16_t* out )
+{
+    bool success = *bufpp + 2 <= end;
+    if ( success ) {
+        *out = ((*bufpp)[0] << 8) | (*bufpp)[1];
+        *bufpp += 2;
+    }
+    return success;
+}
+
+static bool
+getNetLong( const uint8_t** bufpp, const uint8_t* end, uint32_t* out )
+{
+    uint16_t hi, lo;
+    bool success = getNetShort( bufpp, end, &hi )
+        && getNetShort( bufpp, end, &lo );
+    if ( success ) {
+        *out = ((uint32_t)hi << 16) | lo;
+    }
+    return success;
+}
+
+static bool
+getVLI( const uint8_t** bufpp, const uint8_t* end, uint32_t* out )
+{
+    uint32_t result = 0;
+    bool success = false;
+    for ( int count = 0; !success && *bufpp < end && count < 5; ++count ) {
+        uint32_t byt = *(*bufpp)++;
+        success = 0 != (byt & 0x80);
+        result |= (byt & 0x7F) << (7 * count);
+    }
+    if ( success ) {
+        *out = result;
+    }
+    return success;
+}
+
+static bool
+getVLIString( const uint8_t** bufpp, const uint8_t* end, string& out )
+{
+    uint32_t len;
+    bool success = getVLI( bufpp, end, &len ) && *bufpp + len <= end;
+    if ( success ) {
+        out.assign( (const char*)*bufpp, len );
+        *bufpp += len;
+    }
+    return success;
+}
+
+typedef enum {
+    DEV_NEW,
+    DEV_REGISTERING,
+    DEV_CONNECTING,
+    DEV_CONNECTED,              /* waiting for ALLHERE */
+    DEV_PLAYING,
+    DEV_DEAD,                   /* relay refused or dropped the game */
+} DevState;
+
+typedef struct _Device {
+    int sock;
+    int indx;
+    DevState state;
+    string relayID;
+    uint32_t token;
+    uint8_t hid;
+    uint16_t cid;
+    uint32_t nextPacketID;
+    uint32_t nextSeq;           /* for messages sent */
+    uint32_t lastSeq;           /* highest received */
+    uint64_t lastSentUS;
+    uint64_t keepAliveUS;
+    struct _Device* partner;
+    uint16_t seed;
+    string cookie;
+} Device;
+
+typedef struct {
+    uint64_t pktsSent;
+    uint64_t pktsRcvd;
+    uint64_t msgsSent;
+    uint64_t msgsRcvd;
+    uint64_t msgsDup;           /* redelivered, or out of order */
+    uint64_t sendErrs;
+    uint64_t denied;
+    vector<uint32_t> latencies; /* microseconds */
+} Stats;
+
+static void
+addStats( Stats* to, const Stats& from )
+{
+    to->pktsSent += from.pktsSent;
+    to->pktsRcvd += from.pktsRcvd;
+    to->msgsSent += from.msgsSent;
+    to->msgsRcvd += from.msgsRcvd;
+    to->msgsDup += from.msgsDup;
+    to->sendErrs += from.sendErrs;
+    to->denied += from.denied;
+    to->latencies.insert( to->latencies.end(), from.latencies.begin(),
+                          from.latencies.end() );
+}
+
+/* Owns the devices for a range of games: their sockets, one epoll set, and
+ * a share of the message rate.  Both devices of a game belong to the same
+ * worker so a game's state never crosses threads.
+ */
+class LoadWorker {
+ public:
+    LoadWorker( int firstGame, int nGames, int msgsPerSec, int setupsPerSec );
+    ~LoadWorker();
+
+    bool Init();
+    void Start();
+    void Join();
+    /* Adds counts since the last call to *stats, and returns the number of
+       games with both devices playing */
+    int TakeStats( Stats* stats );
+
+ private:
+    static void* threadMain( void* arg );
+    void run();
+
+    void readAll( Device* dev );
+    void handlePacket( Device* dev, const uint8_t* ptr, const uint8_t* end );
+    void handleGameMsg( Device* dev, const uint8_t* ptr, const uint8_t* end );
+    void sweep( uint64_t now );
+    void sendGameMsgs( uint64_t now );
+
+    void sendPacket( Device* dev, XWRelayReg cmd, const vector<uint8_t>& body );
+    void sendReg( Device* dev );
+    void sendConnect( Device* dev );
+    void sendMsg( Device* dev );
+    void sendAck( Device* dev, uint32_t packetID );
+    void sendConnAck( Device* dev );
+    void sendRelayID( Device* dev, XWRelayReg cmd );
+    void sendDelGame( Device* dev );
+
+    int m_firstGame;
+    int m_nGames;
+    double m_msgsPerSec;
+    double m_setupsPerSec;
+    vector<Device> m_devices;
+    int m_epoll;
+    pthread_t m_thread;
+
+    size_t m_nextSetup;         /* index of next DEV_NEW device to start */
+    size_t m_nextSender;        /* round robin over games */
+    uint64_t m_sendStart;
+    uint64_t m_nMsgsSent;
+
+    pthread_mutex_t m_statsMutex;
+    Stats m_stats;
+    int m_nPlaying;
+};
+
+LoadWorker::LoadWorker( int firstGame, int nGames, int msgsPerSec,
+                        int setupsPerSec )
+    : m_firstGame(firstGame)
+    , m_nGames(nGames)
+    , m_msgsPerSec(msgsPerSec)
+    , m_setupsPerSec(setupsPerSec)
+    , m_epoll(-1)
+    , m_nextSetup(0)
+    , m_nextSender(0)
+    , m_sendStart(0)
+    , m_nMsgsSent(0)
+    , m_stats()
+    , m_nPlaying(0)
+{
+    pthread_mutex_init( &m_statsMutex, NULL );
+}
+
+LoadWorker::~LoadWorker()
+{
+    vector<Device>::iterator iter;
+    for ( iter = m_devices.begin(); iter != m_devices.end(); ++iter ) {
+        if ( 0 <= iter->sock ) {
+            close( iter->sock );
+        }
+    }
+    if ( 0 <= m_epoll ) {
+        close( m_epoll );
+    }
+    pthread_mutex_destroy( &m_statsMutex );
+}
+
+bool
+LoadWorker::Init()
+{
+    m_epoll = epoll_create1( 0 );
+    if ( 0 > m_epoll ) {
+        fprintf( stderr, "epoll_create1: %s\n", strerror(errno) );
+        return false;
+    }
+
+    /* Resize once, so the partner pointers stay good */
+    m_devices.resize( 2 * m_nGames );
+    pid_t pid = getpid();
+    for ( int ii = 0; ii < m_nGames; ++ii ) {
+        int game = m_firstGame + ii;
+        char cookie[MAX_INVITE_LEN + 1];
+        snprintf( cookie, sizeof(cookie), "load-%d-%d", pid, game );
+
+        for ( int seat = 0; seat < 2; ++seat ) {
+            Device* dev = &m_devices[2 * ii + seat];
+            dev->sock = socket( AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0 );
+            if ( 0 > dev->sock ) {
+                fprintf( stderr, "socket() for device %d: %s\n",
+                         2 * game + seat, strerror(errno) );
+                return false;
+            }
+            if ( 0 != connect( dev->sock, (struct sockaddr*)&g_relayAddr,
+                               sizeof(g_relayAddr) ) ) {
+                fprintf( stderr, "connect(): %s\n", strerror(errno) );
+                return false;
+            }
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.ptr = dev;
+            if ( 0 != epoll_ctl( m_epoll, EPOLL_CTL_ADD, dev->sock, &ev ) ) {
+                fprintf( stderr, "epoll_ctl(): %s\n", strerror(errno) );
+                return false;
+            }
+
+            dev->indx = 2 * game + seat;
+            dev->state = DEV_NEW;
+            do {
+                dev->token = random();
+            } while ( 0 == dev->token );
+            dev->hid = 0;
+            dev->cid = 0;
+            dev->nextPacketID = 1;
+            dev->nextSeq = 0;
+            dev->lastSeq = 0;
+            dev->lastSentUS = 0;
+            dev->keepAliveUS = 0;
+            dev->partner = &m_devices[2 * ii + (1 - seat)];
+            /* The relay takes a repeated seed for the same device
+               reconnecting, so the seats can't share one */
+            do {
+                dev->seed = 1 + (random() % 0xFFFE);
+            } while ( 1 == seat && dev->seed == dev->partner->seed );
+            dev->cookie = cookie;
+        }
+    }
+    return true;
+}
+
+void
+LoadWorker::Start()
+{
+    pthread_create( &m_thread, NULL, threadMain, this );
+}
+
+void
+LoadWorker::Join()
+{
+    pthread_join( m_thread, NULL );
+}
+
+int
+LoadWorker::TakeStats( Stats* stats )
+{
+    pthread_mutex_lock( &m_statsMutex );
+    addStats( stats, m_stats );
+    m_stats = Stats();
+    int nPlaying = m_nPlaying;
+    pthread_mutex_unlock( &m_statsMutex );
+    return nPlaying;
+}
+
+/* static */ void*
+LoadWorker::threadMain( void* arg )
+{
+    ((LoadWorker*)arg)->run();
+    return NULL;
+}
+
+void
+LoadWorker::run()
+{
+    struct epoll_event events[256];
+    uint64_t lastSweep = 0;
+    while ( !g_stop ) {
+        int nEvents = epoll_wait( m_epoll, events, 256, 1 );
+        for ( int ii = 0; ii < nEvents; ++ii ) {
+            readAll( (Device*)events[ii].data.ptr );
+        }
+
+        uint64_t now = nowUS();
+        if ( now - lastSweep >= SWEEP_MS * 1000 ) {
+            sweep( now );
+            lastSweep = now;
+        }
+        sendGameMsgs( now );
+    }
+
+    /* Leave the relay's DB no bigger than we found it, at a pace it can
+       keep up with */
+    int nSent = 0;
+    vector<Device>::iterator iter;
+    for ( iter = m_devices.begin(); iter != m_devices.end(); ++iter ) {
+        if ( DEV_CONNECTED <= iter->state ) {
+            sendDelGame( &*iter );
+            if ( 0 == ++nSent % 100 ) {
+                usleep( 10000 );
+            }
+        }
+    }
+}
+
+void
+LoadWorker::readAll( Device* dev )
+{
+    uint8_t buf[2048];
+    for ( ; ; ) {
+        ssize_t nRead = recv( dev->sock, buf, sizeof(buf), 0 );
+        if ( 0 > nRead ) {
+            break;              /* EAGAIN, or ECONNREFUSED if relay's down */
+        }
+        pthread_mutex_lock( &m_statsMutex );
+        ++m_stats.pktsRcvd;
+        pthread_mutex_unlock( &m_statsMutex );
+        handlePacket( dev, buf, buf + nRead );
+    }
+}
+
+void
+LoadWorker::handlePacket( Device* dev, const uint8_t* ptr, const uint8_t* end )
+{
+    uint8_t proto, cmd;
+    uint32_t packetID;
+    if ( !getNetByte( &ptr, end, &proto ) || XWPDEV_PROTO_VERSION_1 != proto
+         || !getVLI( &ptr, end, &packetID )
+         || !getNetByte( &ptr, end, &cmd ) ) {
+        return;
+    }
+
+    /* The relay stores what it sends until it hears back */
+    if ( XWPDEV_ACK != cmd && XWPDEV_UNAVAIL != cmd ) {
+        sendAck( dev, packetID );
+    }
+
+    switch ( cmd ) {
+    case XWPDEV_REGRSP: {
+        uint16_t maxInterval;
+        if ( DEV_REGISTERING == dev->state
+             && getVLIString( &ptr, end, dev->relayID )
+             && getNetShort( &ptr, end, &maxInterval ) ) {
+            dev->keepAliveUS = (uint64_t)maxInterval * 1000000 / 2;
+            dev->state = DEV_CONNECTING;
+            sendConnect( dev );
+        }
+        break;
+    }
+    case XWPDEV_BADREG:
+        dev->relayID.clear();
+        dev->state = DEV_REGISTERING;
+        sendReg( dev );
+        break;
+    case XWPDEV_HAVEMSGS:
+        sendRelayID( dev, XWPDEV_RQSTMSGS );
+        break;
+    case XWPDEV_MSG: {
+        uint32_t token;
+        if ( getNetLong( &ptr, end, &token ) && token == dev->token ) {
+            handleGameMsg( dev, ptr, end );
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void
+LoadWorker::handleGameMsg( Device* dev, const uint8_t* ptr, const uint8_t* end )
+{
+    uint8_t cmd;
+    if ( !getNetByte( &ptr, end, &cmd ) ) {
+        return;
+    }
+
+    switch ( cmd ) {
+    case XWRELAY_CONNECT_RESP: {
+        uint8_t hid;
+        uint16_t cid;
+        if ( DEV_CONNECTING == dev->state && getNetByte( &ptr, end, &hid )
+             && getNetShort( &ptr, end, &cid ) ) {
+            dev->hid = hid;
+            dev->cid = cid;
+            dev->state = DEV_CONNECTED;
+            /* or the relay drops us after DEVACK seconds */
+            sendConnAck( dev );
+        }
+        break;
+    }
+    case XWRELAY_ALLHERE:
+        if ( DEV_CONNECTED == dev->state ) {
+            dev->state = DEV_PLAYING;
+            if ( DEV_PLAYING == dev->partner->state ) {
+                pthread_mutex_lock( &m_statsMutex );
+                ++m_nPlaying;
+                pthread_mutex_unlock( &m_statsMutex );
+            }
+        }
+        break;
+    case XWRELAY_MSG_FROMRELAY: {
+        uint16_t cid;
+        uint8_t src, dest;
+        uint32_t magic, seq;
+        uint64_t sent;
+        if ( getNetShort( &ptr, end, &cid ) && getNetByte( &ptr, end, &src )
+             && getNetByte( &ptr, end, &dest )
+             && getNetLong( &ptr, end, &magic ) && LOAD_MAGIC == magic
+             && getNetLong( &ptr, end, &seq )
+             && ptr + sizeof(sent) <= end ) {
+            memcpy( &sent, ptr, sizeof(sent) );
+            pthread_mutex_lock( &m_statsMutex );
+            if ( seq > dev->lastSeq ) {
+                dev->lastSeq = seq;
+                ++m_stats.msgsRcvd;
+                m_stats.latencies.push_back( nowUS() - sent );
+            } else {
+                ++m_stats.msgsDup;
+            }
+            pthread_mutex_unlock( &m_statsMutex );
+        }
+        break;
+    }
+    case XWRELAY_CONNECTDENIED:
+    case XWRELAY_DISCONNECT_YOU:
+    case XWRELAY_DISCONNECT_OTHER:
+        if ( DEV_DEAD != dev->state ) {
+            pthread_mutex_lock( &m_statsMutex );
+            if ( DEV_PLAYING == dev->state
+                 && DEV_PLAYING == dev->partner->state ) {
+                --m_nPlaying;
+            }
+            ++m_stats.denied;
+            pthread_mutex_unlock( &m_statsMutex );
+            dev->state = DEV_DEAD;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* Start new devices at the setup rate, retry what the relay hasn't answered
+   (UDP, after all), and keep idle devices' addresses alive */
+void
+LoadWorker::sweep( uint64_t now )
+{
+    size_t nToStart = 1 + (m_setupsPerSec * SWEEP_MS / 1000);
+    for ( ; 0 < nToStart && m_nextSetup < m_devices.size(); --nToStart ) {
+        Device* dev = &m_devices[m_nextSetup++];
+        dev->state = DEV_REGISTERING;
+        sendReg( dev );
+    }
+
+    vector<Device>::iterator iter;
+    for ( iter = m_devices.begin(); iter != m_devices.end(); ++iter ) {
+        Device* dev = &*iter;
+        uint64_t idle = now - dev->lastSentUS;
+        switch ( dev->state ) {
+        case DEV_REGISTERING:
+            if ( idle > RETRY_MS * 1000 ) {
+                sendReg( dev );
+            }
+            break;
+        case DEV_CONNECTING:
+            if ( idle > RETRY_MS * 1000 ) {
+                sendConnect( dev );
+            }
+            break;
+        case DEV_CONNECTED:
+        case DEV_PLAYING:
+            if ( 0 < dev->keepAliveUS && idle > dev->keepAliveUS ) {
+                sendRelayID( dev, XWPDEV_KEEPALIVE );
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/* Keep to the rate across calls: owe a message for every 1/rate seconds
+   since the first one, sent from alternating ends of successive games */
+void
+LoadWorker::sendGameMsgs( uint64_t now )
+{
+    if ( 0 == m_nPlaying || 0 == m_msgsPerSec ) {
+        return;
+    }
+    if ( 0 == m_sendStart ) {
+        m_sendStart = now;
+    }
+
+    uint64_t owed = (uint64_t)((now - m_sendStart) * m_msgsPerSec / 1000000);
+    size_t nGames = m_devices.size() / 2;
+    for ( size_t nTried = 0; m_nMsgsSent < owed && nTried < nGames; ) {
+        size_t game = m_nextSender++ % nGames;
+        Device* dev = &m_devices[2 * game + (m_nextSender / nGames) % 2];
+        if ( DEV_PLAYING == dev->state
+             && DEV_PLAYING == dev->partner->state ) {
+            sendMsg( dev );
+            ++m_nMsgsSent;
+            nTried = 0;
+        } else {
+            ++nTried;
+        }
+    }
+    /* Don't let a stall turn into a burst */
+    if ( owed > m_nMsgsSent + m_msgsPerSec ) {
+        m_nMsgsSent = owed - m_msgsPerSec;
+    }
+}
+
+void
+LoadWorker::sendPacket( Device* dev, XWRelayReg cmd,
+                        const vector<uint8_t>& body )
+{
+    vector<uint8_t> packet;
+    packet.push_back( XWPDEV_PROTO_VERSION_1 );
+    putVLI( packet, XWPDEV_ACK == cmd ? 0 : dev->nextPacketID++ );
+    packet.push_back( cmd );
+    packet.insert( packet.end(), body.begin(), body.end() );
+
+    ssize_t nSent = send( dev->sock, packet.data(), packet.size(), 0 );
+    dev->lastSentUS = nowUS();
+
+    pthread_mutex_lock( &m_statsMutex );
+    if ( nSent == ssize_t(packet.size()) ) {
+        ++m_stats.pktsSent;
+    } else {
+        ++m_stats.sendErrs;
+    }
+    pthread_mutex_unlock( &m_statsMutex );
+}
+
+void
+LoadWorker::sendReg( Device* dev )
+{
+    char devID[32];
+    snprintf( devID, sizeof(devID), "relayload-%d", dev->indx );
+
+    vector<uint8_t> body;
+    putVLIString( body, dev->relayID );
+    body.push_back( ID_TYPE_LINUX );
+    putVLIString( body, devID );
+    putNetShort( body, CLIENT_VERS );
+    putVLIString( body, "relayload" );  /* devDesc */
+    putVLIString( body, "relayload" );  /* model */
+    putVLIString( body, "linux" );      /* osVers */
+    sendPacket( dev, XWPDEV_REG, body );
+}
+
+/* XWRELAY_GAME_CONNECT as a linux client sends it, its devID the relayID
+   we were just given */
+void
+LoadWorker::sendConnect( Device* dev )
+{
+    vector<uint8_t> body;
+    putNetLong( body, dev->token );
+    body.push_back( XWRELAY_GAME_CONNECT );
+    body.push_back( XWRELAY_PROTO_VERSION_CLIENTID );
+    putNetShort( body, CLIENT_VERS );
+    body.push_back( dev->cookie.length() );
+    body.insert( body.end(), dev->cookie.begin(), dev->cookie.end() );
+    body.push_back( 0 );        /* wantsPublic */
+    body.push_back( 0 );        /* makePublic */
+    body.push_back( 1 );        /* nPlayersH */
+    body.push_back( 2 );        /* nPlayersT */
+    putNetShort( body, dev->seed );
+    body.push_back( 1 );        /* langCode: English */
+    body.push_back( ID_TYPE_RELAY );
+    body.insert( body.end(), dev->relayID.begin(), dev->relayID.end() );
+    body.push_back( '\0' );
+    body.push_back( 0 );        /* clientIndx: let relay assign */
+    sendPacket( dev, XWPDEV_MSG, body );
+}
+
+/* Payload: magic, seq, and send time in our own clock, which the partner
+   (in this process) reads back */
+void
+LoadWorker::sendMsg( Device* dev )
+{
+    vector<uint8_t> body;
+    putNetLong( body, dev->token );
+    body.push_back( XWRELAY_MSG_TORELAY );
+    putNetShort( body, dev->cid );
+    body.push_back( dev->hid );
+    body.push_back( dev->partner->hid );
+    putNetLong( body, LOAD_MAGIC );
+    putNetLong( body, ++dev->nextSeq );
+    uint64_t now = nowUS();
+    const uint8_t* nowp = (const uint8_t*)&now;
+    body.insert( body.end(), nowp, nowp + sizeof(now) );
+    body.resize( body.size() + g_payloadSize - MIN_PAYLOAD, 0 );
+    sendPacket( dev, XWPDEV_MSG, body );
+
+    pthread_mutex_lock( &m_statsMutex );
+    ++m_stats.msgsSent;
+    pthread_mutex_unlock( &m_statsMutex );
+}
+
+void
+LoadWorker::sendAck( Device* dev, uint32_t packetID )
+{
+    vector<uint8_t> body;
+    putVLI( body, packetID );
+    sendPacket( dev, XWPDEV_ACK, body );
+}
+
+/* XWRELAY_ACK, confirming the hid CONNECT_RESP assigned */
+void
+LoadWorker::sendConnAck( Device* dev )
+{
+    vector<uint8_t> body;
+    putNetLong( body, dev->token );
+    body.push_back( XWRELAY_ACK );
+    body.push_back( dev->hid );
+    sendPacket( dev, XWPDEV_MSG, body );
+}
+
+/* KEEPALIVE and RQSTMSGS are both just the relayID */
+void
+LoadWorker::sendRelayID( Device* dev, XWRelayReg cmd )
+{
+    vector<uint8_t> body;
+    putVLIString( body, dev->relayID );
+    sendPacket( dev, cmd, body );
+}
+
+void
+LoadWorker::sendDelGame( Device* dev )
+{
+    vector<uint8_t> body;
+    putVLIString( body, dev->relayID );
+    putNetLong( body, dev->token );
+    sendPacket( dev, XWPDEV_DELGAME, body );
+}
+
+static bool
+readToPrompt( int sock, string& out )
+{
+    char buf[1024];
+    out.clear();
+    while ( out.length() < 3
+            || 0 != out.compare( out.length() - 3, 3, "=> " ) ) {
+        ssize_t nRead = recv( sock, buf, sizeof(buf), 0 );
+        if ( 0 >= nRead ) {
+            return false;
+        }
+        out.append( buf, nRead );
+    }
+    return true;
+}
+
+/* The relay's "db" ctrl command, on a connection kept open between calls */
+static bool
+queryDB( int* sockp, string& out )
+{
+    if ( 0 > *sockp ) {
+        struct sockaddr_in addr = g_relayAddr;
+        addr.sin_port = htons( g_ctlPort );
+        int sock = socket( AF_INET, SOCK_STREAM, 0 );
+        struct timeval tv = { 2, 0 };
+        setsockopt( sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv) );
+        if ( 0 != connect( sock, (struct sockaddr*)&addr, sizeof(addr) )
+             || !readToPrompt( sock, out ) ) {
+            close( sock );
+            return false;
+        }
+        *sockp = sock;
+    }
+
+    const char cmd[] = "db\r\n";   /* ctrl strips two chars */
+    bool success = ssize_t(sizeof(cmd) - 1)
+        == send( *sockp, cmd, sizeof(cmd) - 1, 0 )
+        && readToPrompt( *sockp, out );
+    if ( !success ) {
+        close( *sockp );
+        *sockp = -1;
+    }
+    return success;
+}
+
+/* Pull the numbers worth watching out of "db" output; see DBPool and
+   MsgCache PrintStats() */
+static void
+parseDB( const string& out, size_t* queued, size_t* unwritten,
+         unsigned int* queries )
+{
+    const char* str = strstr( out.c_str(), "queries: " );
+    if ( !!str ) {
+        unsigned int failed;
+        sscanf( str, "queries: %u (%u failed); async queued: %zu", queries,
+                &failed, queued );
+    }
+    str = strstr( out.c_str(), "msg cache: " );
+    if ( !!str ) {
+        size_t nMsgs, max;
+        sscanf( str, "msg cache: %zu msgs (max %zu; %zu unwritten)", &nMsgs,
+                &max, unwritten );
+    }
+}
+
+static double
+percentile( const vector<uint32_t>& sorted, int pct )
+{
+    double result = 0;
+    if ( 0 < sorted.size() ) {
+        result = sorted[(sorted.size() - 1) * pct / 100] / 1000.0;
+    }
+    return result;
+}
+
+static void
+printLatencies( vector<uint32_t>& latencies )
+{
+    sort( latencies.begin(), latencies.end() );
+    fprintf( stdout, "; latency ms p50 %.1f p90 %.1f p99 %.1f max %.1f",
+             percentile( latencies, 50 ), percentile( latencies, 90 ),
+             percentile( latencies, 99 ), percentile( latencies, 100 ) );
+}
+
+static bool
+lookupRelay()
+{
+    struct hostent* hostip = gethostbyname( g_host );
+    if ( NULL == hostip ) {
+        fprintf( stderr, "unable to resolve %s\n", g_host );
+        return false;
+    }
+    memset( &g_relayAddr, 0, sizeof(g_relayAddr) );
+    g_relayAddr.sin_family = AF_INET;
+    g_relayAddr.sin_port = htons( g_port );
+    memcpy( &g_relayAddr.sin_addr.s_addr, hostip->h_addr_list[0],
+            sizeof(g_relayAddr.sin_addr.s_addr) );
+    return true;
+}
+
+/* One socket per device, plus some to spare */
+static void
+raiseFileLimit()
+{
+    struct rlimit rl;
+    if ( 0 == getrlimit( RLIMIT_NOFILE, &rl ) ) {
+        rlim_t want = 2 * g_nGames + 64;
+        if ( rl.rlim_cur < want ) {
+            rl.rlim_cur = rl.rlim_max == RLIM_INFINITY || want < rl.rlim_max
+                ? want : rl.rlim_max;
+            (void)setrlimit( RLIMIT_NOFILE, &rl );
+            if ( rl.rlim_cur < want ) {
+                fprintf( stderr, "warning: fd limit %lu is too low for %d "
+                         "devices\n", (unsigned long)rl.rlim_cur,
+                         2 * g_nGames );
+            }
+        }
+    }
+}
+
+int
+main( int argc, char** argv )
+{
+    for ( ; ; ) {
+        int opt = getopt( argc, argv, "a:c:d:g:i:m:p:r:s:t:" );
+        if ( opt < 0 ) {
+            break;
+        }
+        switch ( opt ) {
+        case 'a':
+            g_host = optarg;
+            break;
+        case 'c':
+            g_ctlPort = atoi( optarg );
+            break;
+        case 'd':
+            g_duration = atoi( optarg );
+            break;
+        case 'g':
+            g_nGames = atoi( optarg );
+            break;
+        case 'i':
+            g_interval = atoi( optarg );
+            break;
+        case 'm':
+            g_msgsPerSec = atoi( optarg );
+            break;
+        case 'p':
+            g_port = atoi( optarg );
+            break;
+        case 'r':
+            g_setupsPerSec = atoi( optarg );
+            break;
+        case 's':
+            g_payloadSize = atoi( optarg );
+            break;
+        case 't':
+            g_nThreads = atoi( optarg );
+            break;
+        default:
+            usage( argv[0] );
+        }
+    }
+    if ( optind < argc || 0 >= g_nGames || 0 > g_msgsPerSec
+         || 0 >= g_setupsPerSec || g_payloadSize < MIN_PAYLOAD
+         || 0 >= g_duration || 0 >= g_interval || 0 >= g_nThreads ) {
+        usage( argv[0] );
+    }
+    if ( g_nThreads > g_nGames ) {
+        g_nThreads = g_nGames;
+    }
+
+    if ( !lookupRelay() ) {
+        exit( 1 );
+    }
+    raiseFileLimit();
+    srandom( time( NULL ) ^ getpid() );
+
+    struct sigaction act;
+    memset( &act, 0, sizeof(act) );
+    act.sa_handler = onSignal;
+    sigaction( SIGINT, &act, NULL );
+    sigaction( SIGTERM, &act, NULL );
+
+    vector<LoadWorker*> workers;
+    int firstGame = 0;
+    for ( int ii = 0; ii < g_nThreads; ++ii ) {
+        int nGames = g_nGames / g_nThreads
+            + (ii < g_nGames % g_nThreads ? 1 : 0);
+        int msgsPerSec = g_msgsPerSec / g_nThreads
+            + (ii < g_msgsPerSec % g_nThreads ? 1 : 0);
+        LoadWorker* worker =
+            new LoadWorker( firstGame, nGames, msgsPerSec,
+                            g_setupsPerSec / g_nThreads + 1 );
+        if ( !worker->Init() ) {
+            exit( 1 );
+        }
+        workers.push_back( worker );
+        firstGame += nGames;
+    }
+
+    fprintf( stdout, "%d games (%d devices) against %s:%d; %d msgs/sec "
+             "of %zu bytes; %d threads\n", g_nGames, 2 * g_nGames, g_host,
+             g_port, g_msgsPerSec, g_payloadSize, g_nThreads );
+
+    vector<LoadWorker*>::iterator iter;
+    for ( iter = workers.begin(); iter != workers.end(); ++iter ) {
+        (*iter)->Start();
+    }
+
+    int ctlSock = -1;
+    bool haveCtl = 0 < g_ctlPort;
+    unsigned int prevQueries = 0;
+    Stats total = Stats();
+    uint64_t start = nowUS();
+    uint64_t prev = start;
+    uint64_t firstMsg = 0;      /* when games started playing */
+    uint64_t totalAtFirstMsg = 0;
+
+    while ( !g_stop && nowUS() - start < (uint64_t)g_duration * 1000000 ) {
+        sleep( g_interval );
+
+        Stats stats = Stats();
+        int nPlaying = 0;
+        for ( iter = workers.begin(); iter != workers.end(); ++iter ) {
+            nPlaying += (*iter)->TakeStats( &stats );
+        }
+        uint64_t now = nowUS();
+        double secs = (now - prev) / 1000000.0;
+
+        fprintf( stdout, "%4ds: %d/%d games; pkts/s out %.0f in %.0f; "
+                 "msgs/s out %.0f in %.0f", int((now - start) / 1000000),
+                 nPlaying, g_nGames, stats.pktsSent / secs,
+                 stats.pktsRcvd / secs, stats.msgsSent / secs,
+                 stats.msgsRcvd / secs );
+        if ( 0 < stats.msgsDup || 0 < stats.sendErrs || 0 < stats.denied ) {
+            fprintf( stdout, " (dups %lu, send errs %lu, denied %lu)",
+                     (unsigned long)stats.msgsDup,
+                     (unsigned long)stats.sendErrs,
+                     (unsigned long)stats.denied );
+        }
+        if ( 0 < stats.msgsRcvd ) {
+            vector<uint32_t> latencies( stats.latencies );
+            printLatencies( latencies );
+        }
+
+        string out;
+        if ( haveCtl ) {
+            if ( queryDB( &ctlSock, out ) ) {
+                size_t queued = 0, unwritten = 0;
+                unsigned int queries = prevQueries;
+                parseDB( out, &queued, &unwritten, &queries );
+                fprintf( stdout, "; db queued %zu, unwritten %zu, "
+                         "queries/s %.0f", queued, unwritten,
+                         0 == prevQueries ? 0 : (queries - prevQueries) / secs );
+                prevQueries = queries;
+            } else {
+                fprintf( stdout, "; no ctrl port" );
+                haveCtl = false;
+            }
+        }
+        fprintf( stdout, "\n" );
+        fflush( stdout );
+
+        if ( 0 == firstMsg && 0 < stats.msgsSent ) {
+            firstMsg = prev;
+            totalAtFirstMsg = total.pktsSent + total.pktsRcvd;
+        }
+        addStats( &total, stats );
+        prev = now;
+    }
+
+    g_stop = 1;
+    for ( iter = workers.begin(); iter != workers.end(); ++iter ) {
+        (*iter)->Join();
+        delete *iter;
+    }
+    if ( 0 <= ctlSock ) {
+        close( ctlSock );
+    }
+
+    if ( 0 < firstMsg ) {
+        double secs = (prev - firstMsg) / 1000000.0;
+        fprintf( stdout, "over %.0fs of play: %.0f pkts/s, %.0f msgs/s "
+                 "delivered of %lu sent", secs,
+                 (total.pktsSent + total.pktsRcvd - totalAtFirstMsg) / secs,
+                 total.msgsRcvd / secs, (unsigned long)total.msgsSent );
+        printLatencies( total.latencies );
+        fprintf( stdout, "\n" );
+    }
+
+    return 0;
+}
@@ -22,14 +22,15 @@
 #include <sys/time.h>
 #include <errno.h>
 #include <assert.h>
+#include <time.h>
 #include "timermgr.h"
 #include "xwrelay_priv.h"
 #include "configs.h"
 #include "mlock.h"
 
 TimerMgr::TimerMgr()
-    : m_nextFireTime(0)
-    ,m_nextID(0)
+    : m_nextID(0)
+    , m_nFired(0)
 {
     pthread_mutex_init( &m_timersMutex, NULL );
 }
@@ -44,155 +45,160 @@ TimerMgr::GetTimerMgr()
     return mgr;
 }
 
+/* static */ uint64_t
+TimerMgr::nowMillis()
+{
+    struct timespec tp;
+    clock_gettime( CLOCK_MONOTONIC, &tp );
+    return ((uint64_t)tp.tv_sec * 1000) + (tp.tv_nsec / 1000000);
+}
+
 void
 TimerMgr::SetTimer( time_t inSeconds, TimerProc proc, void* closure,
                     int interval )
 {
-    logf( XW_LOGINFO, "%s: uptime = %ld", __func__, uptime() );
-    TimerInfo ti;
-    ti.proc = proc;
-    ti.closure = closure;
-    ti.when = uptime() + inSeconds;
-    ti.interval = interval;
+    SetTimerMillis( inSeconds * 1000, proc, closure, interval * 1000 );
+}
 
+void
+TimerMgr::SetTimerMillis( uint32_t inMillis, TimerProc proc, void* closure,
+                          uint32_t intervalMillis )
+{
+    TimerKey key( proc, closure );
     MutexLock ml( &m_timersMutex );
-    ti.id = ++m_nextID;
 
-    if ( getTimer( proc, closure ) ) {
-        logf( XW_LOGINFO, "%s: clearing old timer", __func__ );
-        clearTimerImpl( proc, closure );
-    }
-
-    m_timers.push_back( ti );
-
-    figureNextFire();
-    logf( XW_LOGINFO, "setTimer done" );
+    // Replaces any timer already set for proc/closure
+    TimerInfo* tip = &m_timers[key];
+    tip->interval = intervalMillis;
+    schedule_locked( key, tip, nowMillis() + inMillis );
+    logf( XW_LOGINFO, "%s(%d ms): set timer id=%d; %d pending", __func__,
+          inMillis, tip->id, m_timers.size() );
 }
 
-time_t 
-TimerMgr::GetPollTimeoutMillis()
+void
+TimerMgr::schedule_locked( const TimerKey& key, TimerInfo* tip, uint64_t when )
 {
-    MutexLock ml( &m_timersMutex );
-
-    time_t tout = m_nextFireTime;
-    if ( tout == 0 ) {
-        tout = -1;
-    } else {
-        tout -= uptime();
-        if ( tout < 0 ) {
-            tout = 0;
-        }
-        tout *= 1000;           /* convert to milliseconds */
+    tip->when = when;
+    tip->id = ++m_nextID;
+    HeapEntry entry = { .when = when, .id = tip->id, .key = key };
+    m_heap.push( entry );
+
+    // Timers that keep getting reset (e.g. ack timers) leave stale heap
+    // entries far in the future; don't let them pile up.
+    if ( m_heap.size() > 64 + (2 * m_timers.size()) ) {
+        dropStale_locked();
     }
-    return tout;
-} /* GetPollTimeoutMillis */
+}
 
 bool
-TimerMgr::getTimer( TimerProc proc, void* closure )
+TimerMgr::isStale_locked( const HeapEntry& entry )
 {
-    /* Don't call this unless have the lock!!! */
-    list<TimerInfo>::iterator iter;
-    for ( iter = m_timers.begin(); iter != m_timers.end(); ++iter ) {
-        if ( (*iter).proc == proc
-             && (*iter).closure == closure ) {
-            return true;
-        }
-    }
-
-    return false;
-} /* getTimer */
+    unordered_map<TimerKey, TimerInfo, KeyHash>::const_iterator iter
+        = m_timers.find( entry.key );
+    return m_timers.end() == iter || iter->second.id != entry.id;
+}
 
 void
-TimerMgr::figureNextFire()
+TimerMgr::dropStale_locked()
 {
-    /* Don't call this unless have the lock!!! */
-    time_t t = 0x7FFFFFFF;
-    time_t cur = uptime();
-
-    list<TimerInfo>::iterator iter = m_timers.begin();
-
-    while ( iter != m_timers.end() ) {
-        time_t when = iter->when;
-
-        if ( when == 0 ) {
-            if ( iter->interval ) {
-                when = iter->when = cur + iter->interval;
-            } else {
-                m_timers.erase(iter);
-                iter = m_timers.begin();
-                continue;
-            }
+    vector<HeapEntry> live;
+    live.reserve( m_timers.size() );
+    while ( !m_heap.empty() ) {
+        if ( !isStale_locked( m_heap.top() ) ) {
+            live.push_back( m_heap.top() );
         }
+        m_heap.pop();
+    }
+    m_heap = priority_queue<HeapEntry, vector<HeapEntry>, 
+                            greater<HeapEntry> >( greater<HeapEntry>(), live );
+}
 
-        if ( when < t ) {
-            t = when;
-        }
-        ++iter;
+time_t 
+TimerMgr::GetPollTimeoutMillis()
+{
+    MutexLock ml( &m_timersMutex );
+
+    while ( !m_heap.empty() && isStale_locked( m_heap.top() ) ) {
+        m_heap.pop();
     }
 
-    m_nextFireTime = t == 0x7FFFFFFF? 0 : t;
-} /* figureNextFire */
+    time_t tout = -1;
+    if ( !m_heap.empty() ) {
+        uint64_t when = m_heap.top().when;
+        uint64_t now = nowMillis();
+        tout = when <= now ? 0 : when - now;
+    }
+    return tout;
+} /* GetPollTimeoutMillis */
 
 void
 TimerMgr::ClearTimer( TimerProc proc, void* closure )
 {
     MutexLock ml( &m_timersMutex );
-    clearTimerImpl( proc, closure );
+    // Its heap entry goes once it's found to be stale
+    unordered_map<TimerKey, TimerInfo, KeyHash>::iterator iter
+        = m_timers.find( TimerKey( proc, closure ) );
+    if ( m_timers.end() != iter ) {
+        logf( XW_LOGINFO, "clearing timer id=%d", iter->second.id );
+        m_timers.erase( iter );
+    }
 }
 
 void
 TimerMgr::FireElapsedTimers()
 {
-    time_t curTime = uptime();
-
-    vector<TimerProc> procs;
-    vector<void*> closures;
+    vector<TimerKey> keys;
     vector<uint32_t> ids;
     {
         MutexLock ml( &m_timersMutex );
-        /* loop until we get through without firing a single one.  Only fire one
-           per run, though, since calling erase invalidates the iterator.
-           PENDING: all this needs a mutex!!!! */
-        list<TimerInfo>::iterator iter;
-        for ( iter = m_timers.begin(); iter != m_timers.end(); ++iter ) {
-            TimerInfo* tip = &(*iter);
-            if ( tip->when <= curTime ) {
-
-                procs.push_back(tip->proc);
-                closures.push_back(tip->closure);
-                ids.push_back(tip->id);
-
-                if ( tip->interval ) {
-                    tip->when += tip->interval;
-                } else {
-                    tip->when = 0;      /* flag for removal */
+        uint64_t now = nowMillis();
+        while ( !m_heap.empty() && m_heap.top().when <= now ) {
+            HeapEntry entry = m_heap.top();
+            m_heap.pop();
+            if ( isStale_locked( entry ) ) {
+                continue;
+            }
+
+            keys.push_back( entry.key );
+            ids.push_back( entry.id );
+
+            unordered_map<TimerKey, TimerInfo, KeyHash>::iterator iter
+                = m_timers.find( entry.key );
+            uint32_t interval = iter->second.interval;
+            if ( 0 != interval ) {
+                // Fire once however late we are, and keep to the old
+                // schedule where possible
+                uint64_t next = entry.when + interval;
+                if ( next <= now ) {
+                    next = now + interval;
                 }
+                schedule_locked( entry.key, &iter->second, next );
+            } else {
+                m_timers.erase( iter );
             }
         }
+        m_nFired += keys.size();
     }
 
-    vector<TimerProc>::const_iterator procs_iter = procs.begin();
-    vector<void*>::const_iterator closures_iter = closures.begin();
-    vector<uint32_t>::const_iterator ids_iter = ids.begin();
-    while ( procs_iter != procs.end() ) {
-        logf( XW_LOGINFO, "%s: firing timer id=%d", __func__, *ids_iter++ );
-        (*procs_iter++)(*closures_iter++);
+    // Call them without the lock: they're free to set and clear timers
+    for ( size_t ii = 0; ii < keys.size(); ++ii ) {
+        logf( XW_LOGINFO, "%s: firing timer id=%d", __func__, ids[ii] );
+        (*keys[ii].first)( keys[ii].second );
     }
-
-    MutexLock ml( &m_timersMutex );
-    figureNextFire();
 } /* fireElapsedTimers */
 
 void
-TimerMgr::clearTimerImpl( TimerProc proc, void* closure )
+TimerMgr::PrintStats( StrWPF& out )
 {
-    list<TimerInfo>::iterator iter;
-    for ( iter = m_timers.begin(); iter != m_timers.end(); ++iter ) {
-        TimerInfo* tip = &(*iter);
-        if ( tip->proc == proc && tip->closure == closure ) {
-            logf( XW_LOGINFO, "clearing timer id=%d", tip->id );
-            m_timers.erase(iter);
-            break;
-        }
+    size_t nPending;
+    size_t heapSize;
+    uint32_t nFired;
+    {
+        MutexLock ml( &m_timersMutex );
+        nPending = m_timers.size();
+        heapSize = m_heap.size();
+        nFired = m_nFired;
     }
+    out.catf( "pending timers: %zu (heap: %zu); fired: %u; next in %ld ms\n",
+              nPending, heapSize, nFired, GetPollTimeoutMillis() );
 }
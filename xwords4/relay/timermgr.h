@@ -21,52 +21,81 @@
 #ifndef _TIMERMGR_H_
 #define _TIMERMGR_H_
 
-#include "list"
+#include <vector>
+#include <queue>
+#include <unordered_map>
 
 #include <pthread.h>
 
 #include "xwrelay_priv.h"
+#include "strwpf.h"
 
 using namespace std;
 
 typedef void (*TimerProc)( void* closure );
 
-
+/* Timers are found by (proc, closure) in a hash, and ordered by a min-heap
+ * of deadlines.  Clearing or re-setting a timer just updates the hash; the
+ * heap entry it leaves behind is recognized as stale and dropped when it
+ * reaches the top, or when there get to be too many of them.
+ */
 class TimerMgr {
 
  public:
     static TimerMgr* GetTimerMgr();
 
-    void SetTimer( time_t inMillis, TimerProc proc, void* closure,
+    void SetTimer( time_t inSeconds, TimerProc proc, void* closure,
                    int interval ); /* 0 means non-recurring */
+    void SetTimerMillis( uint32_t inMillis, TimerProc proc, void* closure,
+                         uint32_t intervalMillis );
     void ClearTimer( TimerProc proc, void* closure );
   
     time_t GetPollTimeoutMillis();
     void FireElapsedTimers();
 
+    /* for ctrl: how many are pending, etc. */
+    void PrintStats( StrWPF& out );
+
  private:
+    typedef pair<TimerProc, void*> TimerKey;
+
+    struct KeyHash {
+        size_t operator()( const TimerKey& key ) const {
+            return hash<void*>()( (void*)key.first ) * 31
+                + hash<void*>()( key.second );
+        }
+    };
 
     typedef struct {
-        TimerProc proc;
-        void* closure;
-        time_t when;
-        int interval;
-        uint32_t id;
+        uint64_t when;          /* CLOCK_MONOTONIC millis */
+        uint32_t interval;      /* millis */
+        uint32_t id;            /* changes each time it's (re)scheduled */
     } TimerInfo;
-  
+
+    typedef struct _HeapEntry {
+        uint64_t when;
+        uint32_t id;
+        TimerKey key;
+        bool operator>( const struct _HeapEntry& other ) const {
+            return when > other.when;
+        }
+    } HeapEntry;
 
     TimerMgr();
 
+    static uint64_t nowMillis();
+
     /* run once we have the mutex */
-    void clearTimerImpl( TimerProc proc, void* closure );
-    bool getTimer( TimerProc proc, void* closure );
-    void figureNextFire();
+    void schedule_locked( const TimerKey& key, TimerInfo* tip, uint64_t when );
+    bool isStale_locked( const HeapEntry& entry );
+    void dropStale_locked();
   
     pthread_mutex_t m_timersMutex;
-    list<TimerInfo> m_timers;
+    unordered_map<TimerKey, TimerInfo, KeyHash> m_timers;
+    priority_queue<HeapEntry, vector<HeapEntry>, greater<HeapEntry> > m_heap;
 
-    time_t m_nextFireTime;
     uint32_t m_nextID;
+    uint32_t m_nFired;
 };
 
 #endif
@@ -26,7 +26,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
-#include <sys/poll.h>
+#include <sys/epoll.h>
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
@@ -68,6 +68,14 @@ XWThreadPool::XWThreadPool()
     m_pipeWrite = fd[1];
     logf( XW_LOGINFO, "pipes: m_pipeRead: %d; m_pipeWrite: %d",
           m_pipeRead, m_pipeWrite );
+
+    // The pipe stays level-triggered: the listener reads one byte per wakeup
+    m_epfd = epoll_create1( EPOLL_CLOEXEC );
+    struct epoll_event ev = { .events = EPOLLIN, .data = { .fd = m_pipeRead } };
+    if ( 0 > m_epfd || 0 != epoll_ctl( m_epfd, EPOLL_CTL_ADD, m_pipeRead, &ev ) ) {
+        logf( XW_LOGERROR, "%s: epoll setup failed: %s", __func__,
+              strerror(errno) );
+    }
 }
 
 XWThreadPool::~XWThreadPool()
@@ -76,6 +84,7 @@ XWThreadPool::~XWThreadPool()
 
     pthread_rwlock_destroy( &m_activeSocketsRWLock );
     pthread_mutex_destroy ( &m_queueMutex );
+    close( m_epfd );
     free( m_threadInfos );
 } /* ~XWThreadPool */
 
@@ -131,23 +140,26 @@ XWThreadPool::AddSocket( SockType stype, QueueCallback proc, const AddrInfo* fro
         RWWriteLock ml( &m_activeSocketsRWLock );
         assert( m_activeSockets.find( sock ) == m_activeSockets.end() );
         m_activeSockets.insert( pair<int, SockInfo>( sock, si ) );
+
+        // Edge-triggered, so the listener must drain the socket each time
+        // it's reported. Data that arrived before now still gets reported.
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP | EPOLLET,
+                                  .data = { .fd = sock } };
+        if ( 0 != epoll_ctl( m_epfd, EPOLL_CTL_ADD, sock, &ev ) ) {
+            logf( XW_LOGERROR, "%s: epoll_ctl(ADD, %d) failed: %s", __func__,
+                  sock, strerror(errno) );
+        }
     }
-    interrupt_poll();
 }
 
 bool
-XWThreadPool::SocketFound( const AddrInfo* addr )
+XWThreadPool::findSocket( int sock, SockInfo* sip )
 {
-    assert( addr->isTCP() );
-    bool found = false;
-    {
-        RWWriteLock ml( &m_activeSocketsRWLock );
-
-        map<int, SockInfo>::iterator iter = m_activeSockets.find( addr->getSocket() );
-        if ( m_activeSockets.end() != iter 
-             && iter->second.m_addr.equals( *addr ) ) {
-            found = true;
-        }
+    RWReadLock ml( &m_activeSocketsRWLock );
+    map<int, SockInfo>::const_iterator iter = m_activeSockets.find( sock );
+    bool found = m_activeSockets.end() != iter;
+    if ( found ) {
+        *sip = iter->second;
     }
     return found;
 }
@@ -166,6 +178,12 @@ XWThreadPool::RemoveSocket( const AddrInfo* addr )
         map<int, SockInfo>::iterator iter = m_activeSockets.find( sock );
         if ( m_activeSockets.end() != iter && iter->second.m_addr.equals( *addr ) ) {
             m_activeSockets.erase( iter );
+            // kernels before 2.6.9 insist on a non-NULL event even for DEL
+            struct epoll_event ev;
+            if ( 0 != epoll_ctl( m_epfd, EPOLL_CTL_DEL, sock, &ev ) ) {
+                logf( XW_LOGERROR, "%s: epoll_ctl(DEL, %d) failed: %s",
+                      __func__, sock, strerror(errno) );
+            }
             found = true;
         }
         logf( XW_LOGINFO, "%s(): AFTER closing %d: %d sockets active (was %d)", __func__,
@@ -198,11 +216,6 @@ XWThreadPool::CloseSocket( const AddrInfo* addr )
             logf( XW_LOGINFO, "%s(): close(socket=%d) succeeded", __func__, sock );
         }
 
-        /* We always need to interrupt the poll because the socket we're closing
-           will be in the list being listened to.  That or we need to drop sockets
-           that have been removed on some other thread while the poll call's
-           blocking.*/
-        interrupt_poll();
     }
 }
 
@@ -314,140 +327,76 @@ XWThreadPool::interrupt_poll()
 void*
 XWThreadPool::real_listener()
 {
-    int flags = POLLIN | POLLERR | POLLHUP | POLLRDHUP;
     TimerMgr* tmgr = TimerMgr::GetTimerMgr();
-    int nSocketsAllocd = 1;
-
-    struct pollfd* fds = (pollfd*)calloc( nSocketsAllocd, sizeof(fds[0]) );
-    SockInfo* sinfos = (SockInfo*)calloc( nSocketsAllocd, sizeof(sinfos[0]) );
-#ifdef LOG_POLL
-    char* log = (char*)malloc( 4 * nSocketsAllocd );
-#endif
+    struct epoll_event events[64];
 
     for ( ; ; ) {
-
-        pthread_rwlock_rdlock( &m_activeSocketsRWLock );
-        int nSockets = m_activeSockets.size() + 1; /* for pipe */
-#ifdef LOG_POLL
-        int logCapacity = 4 * nSockets;
-        int logLen = 0;
-#endif
-
-        if ( nSockets > nSocketsAllocd ) {
-            fds = (struct pollfd*)realloc( fds, nSockets * sizeof(fds[0]) );
-            sinfos = (SockInfo*)realloc( sinfos, nSockets * sizeof(sinfos[0]) );
-#ifdef LOG_POLL
-            log = (char*)realloc( log, nSockets * 4 );
-#endif
-            nSocketsAllocd = nSockets;
-        }
-        int curfd = 0;
-        
-        fds[curfd].fd = m_pipeRead;
-        fds[curfd].events = flags;
-#ifdef LOG_POLL
-        logLen += snprintf( log+logLen, logCapacity - logLen, "%d,", 
-                            fds[curfd].fd );
-#endif
-        ++curfd;
-
-        map<int, SockInfo>::iterator iter;
-        for ( iter = m_activeSockets.begin(); iter != m_activeSockets.end(); 
-              ++iter ) {
-            fds[curfd].fd = iter->first;
-            sinfos[curfd] = iter->second;
-            fds[curfd].events = flags;
-#ifdef LOG_POLL
-            if ( logCapacity > logLen ) {
-                logLen += snprintf( log+logLen, logCapacity - logLen, "%d,", 
-                                    fds[curfd].fd );
-            }
-#endif
-            assert( curfd < nSockets );
-            ++curfd;
-        }
-        pthread_rwlock_unlock( &m_activeSocketsRWLock );
-
         int nMillis = tmgr->GetPollTimeoutMillis();
 
 #ifdef LOG_POLL
-        logf( XW_LOGINFO, "polling %s nmillis=%d", log, nMillis );
+        logf( XW_LOGINFO, "epoll_wait nmillis=%d", nMillis );
 #endif
-        int nEvents = poll( fds, nSockets, nMillis );
+        int nEvents = epoll_wait( m_epfd, events, VSIZE(events), nMillis );
 #ifdef LOG_POLL
-        logf( XW_LOGINFO, "back from poll: %d", nEvents );
+        logf( XW_LOGINFO, "back from epoll_wait: %d", nEvents );
 #endif
         if ( m_timeToDie ) {
             break;
         }
 
-        if ( nEvents == 0 ) {
+        if ( nEvents < 0 ) {
+            if ( EINTR != errno ) {
+                logf( XW_LOGERROR, "epoll_wait failed: errno: %s (%d)", 
+                      strerror(errno), errno );
+            }
+            continue;
+        }
+
+        // A busy relay may never time out, so check the timers either way
+        if ( nEvents == 0 || 0 == tmgr->GetPollTimeoutMillis() ) {
             tmgr->FireElapsedTimers();
-        } else if ( nEvents < 0 ) {
-            logf( XW_LOGERROR, "poll failed: errno: %s (%d)", 
-                  strerror(errno), errno );
-        } 
+        }
 
-        if ( fds[0].revents != 0 ) {
+        for ( int ii = 0; ii < nEvents; ++ii ) {
+            int sock = events[ii].data.fd;
+            uint32_t revents = events[ii].events;
+
+            if ( sock == m_pipeRead ) {
 #ifdef LOG_POLL
-            logf( XW_LOGINFO, "poll interrupted" );
+                logf( XW_LOGINFO, "poll interrupted" );
 #endif
-            assert( fds[0].revents == POLLIN );
-            uint8_t byt;
-            read( fds[0].fd, &byt, 1 );
-            --nEvents;
-        }
+                uint8_t byt;
+                read( m_pipeRead, &byt, 1 );
+                continue;
+            }
 
-        if ( nEvents > 0 ) {
-            --nSockets;
-            curfd = 1;
-
-            int ii;
-            for ( ii = 0; ii < nSockets && nEvents > 0; ++ii, ++curfd ) {
-
-                if ( fds[curfd].revents != 0 ) {
-                    // int socket = fds[curfd].fd;
-                    SockInfo* sinfo = &sinfos[curfd];
-                    const AddrInfo* addr = &sinfo->m_addr;
-
-                    int sock = addr->getSocket();
-                    assert( fds[curfd].fd == sock );
-                    if ( !SocketFound( addr ) ) {
-                        logf( XW_LOGINFO, "%s(): dropping socket %d: not found",
-                              __func__, addr->getSocket() );
-                        /* no further processing if it's been removed while
-                           we've been sleeping in poll. BUT: shouldn't curfd
-                           be incremented?? */
-                        --nEvents;
-                        continue;
-                    }
-
-                    if ( 0 != (fds[curfd].revents & (POLLIN | POLLPRI)) ) {
-                        if ( !UdpQueue::get()->handle( addr, sinfo->m_proc ) ) {
-                            // This is likely wrong!!! return of 0 means
-                            // remote closed, not error.
-                            RemoveSocket( addr );
-                            EnqueueKill( addr, "got EOF" );
-                        }
-                    } else {
-                        logf( XW_LOGERROR, "%s(): odd revents: %x; bad socket %d",
-                              __func__, fds[curfd].revents, sock );
-                        RemoveSocket( addr );
-                        EnqueueKill( addr, "error/hup in poll()" );
-                    }
-                    --nEvents;
+            // The socket may have been removed (and even its fd reused) by
+            // another thread since epoll_wait() returned; reading a reused
+            // one is harmless.
+            SockInfo sinfo;
+            if ( !findSocket( sock, &sinfo ) ) {
+                logf( XW_LOGINFO, "%s(): dropping socket %d: not found",
+                      __func__, sock );
+                continue;
+            }
+            const AddrInfo* addr = &sinfo.m_addr;
+
+            if ( 0 != (revents & (EPOLLIN | EPOLLPRI)) ) {
+                if ( !UdpQueue::get()->handle( addr, sinfo.m_proc ) ) {
+                    // This is likely wrong!!! return of 0 means
+                    // remote closed, not error.
+                    RemoveSocket( addr );
+                    EnqueueKill( addr, "got EOF" );
                 }
+            } else {
+                logf( XW_LOGERROR, "%s(): odd revents: %x; bad socket %d",
+                      __func__, revents, sock );
+                RemoveSocket( addr );
+                EnqueueKill( addr, "error/hup in epoll_wait()" );
             }
-            assert( nEvents == 0 );
         }
     }
 
-    free( fds );
-    free( sinfos );
-#ifdef LOG_POLL
-    free( log );
-#endif
-
     logf( XW_LOGINFO, "real_listener returning" );
     return NULL;
 } /* real_listener */
@@ -76,8 +76,8 @@ class XWThreadPool {
 
     /* Remove from set being listened on */
     bool RemoveSocket( const AddrInfo* addr );
-    /* test if is in set being listened on */
-    bool SocketFound( const AddrInfo* addr );
+    /* copy out what we know about a socket being listened on */
+    bool findSocket( int sock, SockInfo* sip );
 
     void enqueue( QAction act = Q_READ );
     void enqueue( SockInfo si, QAction act = Q_READ );
@@ -95,9 +95,10 @@ class XWThreadPool {
     void* real_listener();
     static void* listener_main( void* closure );
 
-    /* Sockets main thread listens on */
+    /* Sockets main thread listens on, all registered with m_epfd */
     map<int, SockInfo>m_activeSockets;
     pthread_rwlock_t m_activeSocketsRWLock;
+    int m_epfd;
 
     /* Sockets waiting for a thread to read 'em */
     deque<QueuePr> m_queue;
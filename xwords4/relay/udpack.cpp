@@ -31,11 +31,11 @@ UDPAckTrack::shouldAck( XWRelayReg cmd )
 }
 
 /* static*/ uint32_t
-UDPAckTrack::nextPacketID( XWRelayReg cmd )
+UDPAckTrack::nextPacketID( XWRelayReg cmd, bool tracked )
 {
     uint32_t result = 0;
     if ( shouldAck( cmd ) ) {
-        result = get()->nextPacketIDImpl( cmd );
+        result = get()->nextPacketIDImpl( cmd, tracked );
         assert( PACKETID_NONE != result );
     }
     return result;
@@ -97,11 +97,11 @@ UDPAckTrack::ackLimit()
 }
 
 uint32_t
-UDPAckTrack::nextPacketIDImpl( XWRelayReg cmd )
+UDPAckTrack::nextPacketIDImpl( XWRelayReg cmd, bool tracked )
 {
     MutexLock ml( &m_mutex );
     uint32_t result = ++m_nextID;
-    AckRecord record( cmd , result );
+    AckRecord record( cmd , result, tracked );
     m_pendings.insert( pair<uint32_t,AckRecord>(result, record) );
     return result;
 }
@@ -113,7 +113,7 @@ UDPAckTrack::recordAckImpl( uint32_t packetID )
     map<uint32_t, AckRecord>::iterator iter;
     MutexLock ml( &m_mutex );
     iter = m_pendings.find( packetID );
-    if ( m_pendings.end() == iter ) {
+    if ( m_pendings.end() == iter || iter->second.m_acked ) {
         logf( XW_LOGERROR, "%s: packet ID %d not found", __func__, packetID );
     } else {
         AckRecord& rec = iter->second;
@@ -124,8 +124,12 @@ UDPAckTrack::recordAckImpl( uint32_t packetID )
                   __func__, str.c_str(), took );
         }
 
-        callProc( iter, true );
-        m_pendings.erase( iter );
+        if ( NULL == rec.m_proc && rec.m_tracked ) {
+            rec.m_acked = true; /* setOnAck() will finish up */
+        } else {
+            callProc( iter, true );
+            m_pendings.erase( iter );
+        }
     }
     return str;
 }
@@ -140,6 +144,10 @@ UDPAckTrack::setOnAckImpl( OnAckProc proc, uint32_t packetID, void* data )
         if ( m_pendings.end() != iter ) {
             iter->second.m_proc = proc;
             iter->second.m_data = data;
+            if ( iter->second.m_acked ) {
+                callProc( iter, true );
+                m_pendings.erase( iter );
+            }
         }
     }
     return canAdd;
@@ -153,8 +161,10 @@ UDPAckTrack::printAcksImpl( StrWPF& out )
     MutexLock ml( &m_mutex );
     map<uint32_t, AckRecord>::const_iterator iter;
     for ( iter = m_pendings.begin(); m_pendings.end() != iter; ++iter ) {
-        out.catf( "id: % 8d; stl: %04d\n", iter->first, 
-                  (iter->second.m_createTime + limit) - now );
+        if ( !iter->second.m_acked ) {
+            out.catf( "id: % 8d; stl: %04d\n", iter->first, 
+                      (iter->second.m_createTime + limit) - now );
+        }
     }
 }
 
@@ -165,14 +175,18 @@ UDPAckTrack::doNackImpl( vector<uint32_t>& ids )
     map<uint32_t, AckRecord>::iterator iter;
     if ( 0 == ids.size() ) {
         for ( iter = m_pendings.begin(); m_pendings.end() != iter; ) {
-            callProc( iter, false );
-            m_pendings.erase( iter++ );
+            if ( iter->second.m_acked ) {
+                ++iter;
+            } else {
+                callProc( iter, false );
+                m_pendings.erase( iter++ );
+            }
         }
     } else {
         vector<uint32_t>::const_iterator idsIter;
         for ( idsIter = ids.begin(); ids.end() != idsIter; ++idsIter ) {
             iter = m_pendings.find( *idsIter );
-            if ( m_pendings.end() != iter ) {
+            if ( m_pendings.end() != iter && !iter->second.m_acked ) {
                 callProc( iter, false );
                 m_pendings.erase( iter );
             }
@@ -208,8 +222,11 @@ UDPAckTrack::threadProc()
                 AckRecord& rec = iter->second;
                 time_t took = now - rec.m_createTime;
                 if ( limit < took ) {
-                    older.push_back( rec.toStr() );
-                    callProc( iter, false );
+                    /* acked, but setOnAck() never came: not a leak */
+                    if ( !rec.m_acked ) {
+                        older.push_back( rec.toStr() );
+                        callProc( iter, false );
+                    }
                     m_pendings.erase( iter++ );
                 } else {
                     ++iter;
@@ -31,11 +31,13 @@ typedef void (*OnAckProc)( bool acked, uint32_t packetID, void* data );
 
 class AckRecord {
  public: 
-    AckRecord( XWRelayReg cmd, uint32_t id ) {
+    AckRecord( XWRelayReg cmd, uint32_t id, bool tracked ) {
         m_createTime = time( NULL );
         m_proc = NULL;
         m_cmd = cmd;
         m_id = id;
+        m_tracked = tracked;
+        m_acked = false;
     }
 
     string toStr()
@@ -49,6 +51,8 @@ class AckRecord {
     OnAckProc m_proc;
     XWRelayReg m_cmd;
     void* m_data;
+    bool m_tracked;             /* setOnAck() is coming */
+    bool m_acked;               /* ...but the ack beat it */
  private:
     uint32_t m_id;
 };
@@ -57,7 +61,10 @@ class UDPAckTrack {
  public:
     static const uint32_t PACKETID_NONE = 0;
     
-    static uint32_t nextPacketID( XWRelayReg cmd );
+    /* Pass tracked if setOnAck() will be called for it.  Packets can go
+       out, and their acks be handled on another thread, before that
+       happens; such an ack is held until it does. */
+    static uint32_t nextPacketID( XWRelayReg cmd, bool tracked );
     static string recordAck( uint32_t packetID );
     static bool setOnAck( OnAckProc proc, uint32_t packetID, void* data );
     static bool shouldAck( XWRelayReg cmd );
@@ -70,7 +77,7 @@ class UDPAckTrack {
     static void* thread_main( void* arg );
     UDPAckTrack();
     time_t ackLimit();
-    uint32_t nextPacketIDImpl( XWRelayReg cmd );
+    uint32_t nextPacketIDImpl( XWRelayReg cmd, bool tracked );
     string recordAckImpl( uint32_t packetID );
     bool setOnAckImpl( OnAckProc proc, uint32_t packetID, void* data );
     void callProc( const map<uint32_t, AckRecord>::iterator iter, bool acked );
@@ -22,10 +22,21 @@
 #include <errno.h>
 #include "udpqueue.h"
 #include "mlock.h"
+#include "configs.h"
 
 
 static UdpQueue* s_instance = NULL;
 
+// Each shard thread's Outbox, so send() can find it
+static pthread_key_t s_outboxKey;
+static pthread_once_t s_outboxKeyOnce = PTHREAD_ONCE_INIT;
+
+static void
+makeOutboxKey()
+{
+    pthread_key_create( &s_outboxKey, NULL );
+}
+
 
 void 
 PacketThreadClosure::logStats()
@@ -37,6 +48,14 @@ PacketThreadClosure::logStats()
     }
 }
 
+/* static */ uint32_t
+PacketThreadClosure::nowMillis()
+{
+    struct timespec tp;
+    clock_gettime( CLOCK_MONOTONIC, &tp );
+    return (tp.tv_sec * 1000) + (tp.tv_nsec / 1000000);
+}
+
 bool
 PartialPacket::stillGood() const
 {
@@ -73,24 +92,67 @@ PartialPacket::readAtMost( int len )
     return success;
 }
 
+UdpQueue::Shard::Shard( UdpQueue* owner )
+    : m_owner(owner)
+    , m_maxDepth(0)
+    , m_nDispatched(0)
+    , m_waitMillis(0)
+    , m_maxWaitMillis(0)
+    , m_runMillis(0)
+    , m_maxRunMillis(0)
+    , m_nParks(0)
+    , m_nHeldBack(0)
+{
+    pthread_mutex_init ( &m_queueMutex, NULL );
+    pthread_cond_init( &m_queueCondVar, NULL );
+}
+
+UdpQueue::Shard::~Shard()
+{
+    pthread_cond_destroy( &m_queueCondVar );
+    pthread_mutex_destroy ( &m_queueMutex );
+}
+
 UdpQueue::UdpQueue() 
 {
     m_nextID = 0;
     pthread_mutex_init ( &m_partialsMutex, NULL );
-    pthread_mutex_init ( &m_queueMutex, NULL );
-    pthread_cond_init( &m_queueCondVar, NULL );
+    pthread_mutex_init ( &m_idMutex, NULL );
+
+    // One thread used to do everything, so a slow DB query held up every
+    // game. Now each of several shards gets a thread.
+    int nThreads;
+    if ( !RelayConfigs::GetConfigs()->GetValueFor( "UDPQUEUE_THREADS", 
+                                                   &nThreads ) ) {
+        nThreads = 4;
+    } else if ( nThreads < 1 ) {
+        nThreads = 1;
+    }
+    logf( XW_LOGINFO, "%s(): starting %d threads", __func__, nThreads );
 
-    pthread_t thread;
-    int result = pthread_create( &thread, NULL, thread_main_static, this );
-    assert( result == 0 );
-    result = pthread_detach( thread );
-    assert( result == 0 );
+    for ( int ii = 0; ii < nThreads; ++ii ) {
+        Shard* shard = new Shard( this );
+        m_shards.push_back( shard );
+
+        pthread_t thread;
+        int result = pthread_create( &thread, NULL, thread_main_static, shard );
+        assert( result == 0 );
+        result = pthread_detach( thread );
+        assert( result == 0 );
+    }
 }
 
 UdpQueue::~UdpQueue() 
 {
-    pthread_cond_destroy( &m_queueCondVar );
-    pthread_mutex_destroy ( &m_queueMutex );
+    vector<Shard*>::iterator iter;
+    for ( iter = m_shards.begin(); m_shards.end() != iter; ++iter ) {
+        delete *iter;
+    }
+    vector<PacketThreadClosure*>::iterator iter2;
+    for ( iter2 = m_pool.begin(); m_pool.end() != iter2; ++iter2 ) {
+        delete *iter2;
+    }
+    pthread_mutex_destroy ( &m_idMutex );
     pthread_mutex_destroy ( &m_partialsMutex );
 }
 
@@ -108,6 +170,8 @@ UdpQueue::get()
 // complete packet, dispatch it and delete since the data's been delivered.
 //
 // Return false if socket should no longer be used.
+// Reads as many whole packets as the socket has ready: the listener's epoll
+// is edge-triggered and won't report this socket again until more arrives.
 bool
 UdpQueue::handle( const AddrInfo* addr, QueueCallback cb )
 {
@@ -121,57 +185,260 @@ UdpQueue::handle( const AddrInfo* addr, QueueCallback cb )
     // since having it deleted while in use would be bad.
     MutexLock ml( &m_partialsMutex );
 
-    map<int, PartialPacket*>::iterator iter = m_partialPackets.find( sock );
-    if ( m_partialPackets.end() == iter ) {
-        packet = new PartialPacket( sock );
-        m_partialPackets.insert( pair<int, PartialPacket*>( sock, packet ) );
-    } else {
-        packet = iter->second;
-    }
+    for ( bool more = true; success && more; ) {
+        more = false;
+        map<int, PartialPacket*>::iterator iter = m_partialPackets.find( sock );
+        if ( m_partialPackets.end() == iter ) {
+            packet = new PartialPacket( sock );
+            m_partialPackets.insert( pair<int, PartialPacket*>( sock, packet ) );
+        } else {
+            packet = iter->second;
+        }
 
-    // First see if we've read the length bytes
-    if ( packet->readSoFar() < sizeof( packet->m_len ) ) {
-        if ( packet->readAtMost( sizeof(packet->m_len) - packet->readSoFar() ) ) {
-            uint16_t tmp;
-            memcpy( &tmp, packet->data(), sizeof(tmp) );
-            packet->m_len = ntohs(tmp);
-            success = 0 < packet->m_len;
+        // First see if we've read the length bytes
+        if ( packet->readSoFar() < sizeof( packet->m_len ) ) {
+            if ( packet->readAtMost( sizeof(packet->m_len) - packet->readSoFar() ) ) {
+                uint16_t tmp;
+                memcpy( &tmp, packet->data(), sizeof(tmp) );
+                packet->m_len = ntohs(tmp);
+                success = 0 < packet->m_len;
+            }
         }
-    }
 
-    if ( success && packet->readSoFar() >= sizeof( packet->m_len ) ) {
-        assert( 0 < packet->m_len );
-        int leftToRead = 
-            packet->m_len - (packet->readSoFar() - sizeof(packet->m_len));
-        if ( packet->readAtMost( leftToRead ) ) {
-            handle( addr, packet->data() + sizeof(packet->m_len), 
-                    packet->m_len, cb );
-            packet = NULL;
-            newSocket_locked( sock );
+        if ( success && packet->readSoFar() >= sizeof( packet->m_len ) ) {
+            assert( 0 < packet->m_len );
+            int leftToRead = 
+                packet->m_len - (packet->readSoFar() - sizeof(packet->m_len));
+            if ( packet->readAtMost( leftToRead ) ) {
+                // Everything on a socket stays in order
+                handle( addr, packet->data() + sizeof(packet->m_len), 
+                        packet->m_len, cb, sock );
+                packet = NULL;
+                newSocket_locked( sock );
+                more = true;    // a short read means we've drained it
+            }
         }
-    }
 
-    success = success && (NULL == packet || packet->stillGood());
+        success = success && (NULL == packet || packet->stillGood());
+    }
     logf( XW_LOGVERBOSE0, "%s(sock=%d) => %d", __func__, sock, success );
     return success;
 }
 
 void 
 UdpQueue::handle( const AddrInfo* addr, const uint8_t* buf, int len, 
-                  QueueCallback cb )
+                  QueueCallback cb, uint32_t key )
 {
-    // addr->ref();
-    PacketThreadClosure* ptc = new PacketThreadClosure( addr, buf, len, cb );
-    MutexLock ml( &m_queueMutex );
-    int id = ++m_nextID;
+    // TCP packets can be bigger than the pool's buffers
+    PacketThreadClosure* ptc = len <= MAX_MSG_LEN ? getClosure()
+        : new PacketThreadClosure( len );
+    memcpy( ptc->bufToFill(), buf, len );
+    ptc->init( addr, len, cb );
+    handle( ptc, key );
+}
+
+void
+UdpQueue::handle( PacketThreadClosure* ptc, uint32_t key )
+{
+    int id;
+    {
+        MutexLock ml( &m_idMutex );
+        id = ++m_nextID;
+    }
     ptc->setID( id );
-    logf( XW_LOGINFO, "%s(): enqueuing packet %d (socket %d, len %d)",
-          __func__, id, addr->getSocket(), len );
+    ptc->setKey( key );
+    int indx = key % m_shards.size();
+    logf( XW_LOGINFO, "%s(): enqueuing packet %d (socket %d, len %d, shard %d)",
+          __func__, id, ptc->addr()->getSocket(), ptc->len(), indx );
+    m_shards[indx]->add( ptc );
+}
+
+PacketThreadClosure*
+UdpQueue::getClosure()
+{
+    PacketThreadClosure* ptc = NULL;
+    {
+        MutexLock ml( &m_idMutex );
+        if ( 0 < m_pool.size() ) {
+            ptc = m_pool.back();
+            m_pool.pop_back();
+        }
+    }
+    if ( NULL == ptc ) {
+        ptc = new PacketThreadClosure( MAX_MSG_LEN );
+    }
+    return ptc;
+}
+
+void
+UdpQueue::recycle( PacketThreadClosure* ptc )
+{
+    ptc->release();
+    if ( MAX_MSG_LEN == ptc->capacity() ) {
+        MutexLock ml( &m_idMutex );
+        m_pool.push_back( ptc );
+    } else {
+        delete ptc;
+    }
+}
+
+/* static */ ssize_t
+UdpQueue::send( int sock, const struct sockaddr* dest, const uint8_t* buf,
+                size_t len, bool wait )
+{
+    pthread_once( &s_outboxKeyOnce, makeOutboxKey );
+    Outbox* outbox = (Outbox*)pthread_getspecific( s_outboxKey );
+
+    ssize_t result;
+    if ( NULL != outbox && len <= MAX_MSG_LEN ) {
+        outbox->add( sock, dest, buf, len );
+        result = wait ? outbox->flush() : len;
+    } else {
+        result = sendto( sock, buf, len, 0 /*flags*/, dest, sizeof(*dest) );
+    }
+    return result;
+}
+
+/* static */ void
+UdpQueue::park( PacketThreadClosure* ptc, QueueCallback cb, void* data )
+{
+    logf( XW_LOGINFO, "%s(): parking packet %d", __func__, ptc->getID() );
+    ptc->park( cb, data );
+}
+
+void
+UdpQueue::resume( PacketThreadClosure* ptc, bool ok )
+{
+    m_shards[ptc->key() % m_shards.size()]->resume( ptc, ok );
+}
+
+/* static */ void
+UdpQueue::resumeProc( void* closure, bool ok )
+{
+    get()->resume( (PacketThreadClosure*)closure, ok );
+}
+
+void
+UdpQueue::Outbox::add( int sock, const struct sockaddr* dest,
+                       const uint8_t* buf, size_t len )
+{
+    if ( UDP_BATCH == m_count || (0 < m_count && sock != m_sock) ) {
+        flush();
+    }
+    m_sock = sock;
+    memcpy( m_bufs[m_count], buf, len );
+    m_lens[m_count] = len;
+    m_dests[m_count] = *dest;
+    ++m_count;
+}
+
+ssize_t
+UdpQueue::Outbox::flush()
+{
+    ssize_t result = 0;
+    int lastErrno = 0;
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iovs[UDP_BATCH];
+    memset( msgs, 0, sizeof(msgs) );
+    for ( int ii = 0; ii < m_count; ++ii ) {
+        iovs[ii].iov_base = m_bufs[ii];
+        iovs[ii].iov_len = m_lens[ii];
+        msgs[ii].msg_hdr.msg_name = &m_dests[ii];
+        msgs[ii].msg_hdr.msg_namelen = sizeof(m_dests[ii]);
+        msgs[ii].msg_hdr.msg_iov = &iovs[ii];
+        msgs[ii].msg_hdr.msg_iovlen = 1;
+    }
+
+    // sendmmsg() stops at the first failure; skip that one and go on
+    for ( int sent = 0; sent < m_count; ) {
+        int nSent = sendmmsg( m_sock, &msgs[sent], m_count - sent, 0 );
+        if ( 0 > nSent ) {
+            if ( sent == m_count - 1 ) {
+                lastErrno = errno;
+                result = -1;
+            }
+            logf( XW_LOGERROR, "%s: sendmmsg->errno %d (%s)", __func__, errno,
+                  strerror(errno) );
+            nSent = 1;
+        }
+        sent += nSent;
+    }
+    if ( 0 < m_count && 0 == result ) {
+        result = m_lens[m_count - 1];
+    }
+    m_count = 0;
+    if ( 0 > result ) {
+        errno = lastErrno;      // for the caller's logging
+    }
+    return result;
+}
+
+void
+UdpQueue::Shard::add( PacketThreadClosure* ptc )
+{
+    MutexLock ml( &m_queueMutex );
     m_queue.push_back( ptc );
+    if ( m_maxDepth < m_queue.size() ) {
+        m_maxDepth = m_queue.size();
+    }
 
     pthread_cond_signal( &m_queueCondVar );
 }
 
+void
+UdpQueue::Shard::resume( PacketThreadClosure* ptc, bool ok )
+{
+    MutexLock ml( &m_queueMutex );
+    ptc->setResuming( ok );
+    m_queue.push_back( ptc );
+    pthread_cond_signal( &m_queueCondVar );
+}
+
+void
+UdpQueue::printStats( StrWPF& out )
+{
+    vector<Shard*>::iterator iter;
+    for ( iter = m_shards.begin(); m_shards.end() != iter; ++iter ) {
+        (*iter)->printStats( out, iter - m_shards.begin() );
+    }
+}
+
+void
+UdpQueue::Shard::printStats( StrWPF& out, int indx )
+{
+    MutexLock ml( &m_queueMutex );
+    uint32_t nDispatched = m_nDispatched;
+    if ( 0 == nDispatched ) {
+        nDispatched = 1;        // avoid divide-by-zero below
+    }
+    out.catf( "shard %d: depth: %zu (max %zu); dispatched: %u; "
+              "wait ms: %llu avg, %u max; run ms: %llu avg, %u max; "
+              "parked: %zu (total %u), holding back %zu\n",
+              indx, m_queue.size() + m_batch.size(), m_maxDepth, m_nDispatched,
+              (unsigned long long)(m_waitMillis / nDispatched), m_maxWaitMillis,
+              (unsigned long long)(m_runMillis / nDispatched), m_maxRunMillis,
+              m_parkedKeys.size(), m_nParks, m_nHeldBack );
+}
+
+// FNV-1a. Keys just need to spread evenly over the shards.
+/* static */ uint32_t
+UdpQueue::keyFor( const char* str )
+{
+    uint32_t hash = 2166136261U;
+    for ( ; '\0' != *str; ++str ) {
+        hash ^= (uint8_t)*str;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/* static */ uint32_t
+UdpQueue::keyFor( const AddrInfo* addr )
+{
+    const struct sockaddr_in* sin = &addr->saddr()->u.addr_in;
+    return ntohl( sin->sin_addr.s_addr ) ^ ntohs( sin->sin_port );
+}
+
 // Remove any PartialPacket record with the same socket/fd. This makes sense
 // when the socket's being reused or when we have just dealt with a single
 // packet and might be getting more.
@@ -198,44 +465,116 @@ UdpQueue::newSocket( const AddrInfo* addr )
     newSocket( addr->getSocket() );
 }
 
+// Take everything that's queued each time we wake, and send whatever the
+// callbacks sent once it's all been handled.
 void* 
-UdpQueue::thread_main()
+UdpQueue::Shard::thread_main()
 {
+    pthread_once( &s_outboxKeyOnce, makeOutboxKey );
+    pthread_setspecific( s_outboxKey, &m_outbox );
+
     for ( ; ; ) {
         pthread_mutex_lock( &m_queueMutex );
         while ( m_queue.size() == 0 ) {
             pthread_cond_wait( &m_queueCondVar, &m_queueMutex );
         }
-        PacketThreadClosure* ptc = m_queue.front();
-        m_queue.pop_front();
-
+        assert( m_batch.empty() );
+        m_batch.swap( m_queue );
         pthread_mutex_unlock( &m_queueMutex );
 
-        ptc->noteDequeued();
-
-        time_t age = ptc->ageInSeconds();
-        if ( 30 > age ) {
-            logf( XW_LOGINFO, "%s: dispatching packet %d (socket %d); "
-                  "%d seconds old", __func__, ptc->getID(),
-                  ptc->addr()->getSocket(), age );
-            (*ptc->cb())( ptc );
-            ptc->logStats();
-        } else {
-            logf( XW_LOGINFO, "%s: dropping packet %d; it's %d seconds old!", 
-                  __func__, age );
+        for ( ; ; ) {
+            PacketThreadClosure* ptc;
+            {
+                MutexLock ml( &m_queueMutex );
+                if ( m_batch.empty() ) {
+                    break;
+                }
+                ptc = m_batch.front();
+                m_batch.pop_front();
+            }
+            dispatch( ptc );
         }
-        // ptc->addr()->unref();
-        delete ptc;
+        m_outbox.flush();
     }
     return NULL;
 }
 
+// A packet whose key has one parked waits its turn behind it. When the
+// parked one's done, those waiting go to the front of the batch, ahead of
+// any with the same key that arrived later.
+void
+UdpQueue::Shard::dispatch( PacketThreadClosure* ptc )
+{
+    bool resuming = ptc->resuming();
+    uint32_t key = ptc->key();
+    if ( !resuming ) {
+        MutexLock ml( &m_queueMutex );
+        if ( m_parkedKeys.end() != m_parkedKeys.find( key ) ) {
+            m_heldBack[key].push_back( ptc );
+            ++m_nHeldBack;
+            return;
+        }
+    }
+
+    uint32_t startMillis = PacketThreadClosure::nowMillis();
+    uint32_t waited = startMillis - ptc->queuedMillis();
+    ptc->noteDequeued();
+
+    time_t age = ptc->ageInSeconds();
+    if ( resuming ) {
+        logf( XW_LOGINFO, "%s: resuming packet %d", __func__, ptc->getID() );
+        QueueCallback cb = ptc->parkCb();
+        ptc->unpark();
+        (*cb)( ptc );
+    } else if ( 30 > age ) {
+        logf( XW_LOGINFO, "%s: dispatching packet %d (socket %d); "
+              "%d seconds old", __func__, ptc->getID(),
+              ptc->addr()->getSocket(), age );
+        (*ptc->cb())( ptc );
+        ptc->logStats();
+    } else {
+        logf( XW_LOGINFO, "%s: dropping packet %d; it's %d seconds old!", 
+              __func__, ptc->getID(), age );
+    }
+
+    bool parked = ptc->parked();
+    if ( !parked ) {
+        m_owner->recycle( ptc );
+    }
+
+    uint32_t ran = PacketThreadClosure::nowMillis() - startMillis;
+    MutexLock ml( &m_queueMutex );
+    if ( parked ) {
+        m_parkedKeys.insert( key ); /* already there if re-parked */
+        ++m_nParks;
+    } else if ( resuming ) {
+        m_parkedKeys.erase( key );
+        map<uint32_t, deque<PacketThreadClosure*> >::iterator iter =
+            m_heldBack.find( key );
+        if ( m_heldBack.end() != iter ) {
+            m_batch.insert( m_batch.begin(), iter->second.begin(),
+                            iter->second.end() );
+            m_nHeldBack -= iter->second.size();
+            m_heldBack.erase( iter );
+        }
+    }
+    ++m_nDispatched;
+    m_waitMillis += waited;
+    if ( m_maxWaitMillis < waited ) {
+        m_maxWaitMillis = waited;
+    }
+    m_runMillis += ran;
+    if ( m_maxRunMillis < ran ) {
+        m_maxRunMillis = ran;
+    }
+}
+
 /* static */ void*
 UdpQueue::thread_main_static( void* closure )
 {
     blockSignals();
 
-    UdpQueue* me = (UdpQueue*)closure;
-    return me->thread_main();
+    Shard* shard = (Shard*)closure;
+    return shard->thread_main();
 }
 
@@ -23,36 +23,66 @@
 
 #include <pthread.h>
 #include <deque>
+#include <vector>
 #include <map>
+#include <set>
 
 #include "xwrelay_priv.h"
 #include "addrinfo.h"
+#include "strwpf.h"
 
 using namespace std;
 
+/* How many datagrams are read, or sent, with one system call */
+#define UDP_BATCH 32
+
 class PacketThreadClosure;
 
 typedef void (*QueueCallback)( PacketThreadClosure* closure );
 
+/* These are reused: get one from UdpQueue::getClosure(), fill its buffer,
+   init() it and pass it to UdpQueue::handle(), which recycles it once the
+   callback's run. */
 class PacketThreadClosure {
 public:
-    PacketThreadClosure( const AddrInfo* addr, const uint8_t* buf, 
-                      int len, QueueCallback cb )
-        : m_buf(new uint8_t[len])
-        , m_len(len)
-        , m_addr(*addr)
-        , m_cb(cb)
-        , m_created(time( NULL ))
-        { 
-            memcpy( m_buf, buf, len );
-            m_addr.ref();
-        }
+    PacketThreadClosure( int capacity )
+        : m_buf(new uint8_t[capacity])
+        , m_capacity(capacity)
+        , m_len(0)
+        , m_hasAddr(false)
+        , m_parked(false)
+        , m_resuming(false)
+        , m_resumedOK(false)
+        {}
 
     ~PacketThreadClosure() {
-        m_addr.unref();
+        release();
         delete[] m_buf;
     }
 
+    void init( const AddrInfo* addr, int len, QueueCallback cb ) {
+        assert( !m_hasAddr && len <= m_capacity );
+        m_addr = *addr;
+        m_addr.ref();
+        m_hasAddr = true;
+        m_len = len;
+        m_cb = cb;
+        m_created = time( NULL );
+        m_queuedMillis = nowMillis();
+        m_parked = false;
+        m_resuming = false;
+    }
+
+    /* drop the address (and its socket ref) before going back in the pool */
+    void release() {
+        if ( m_hasAddr ) {
+            m_addr.unref();
+            m_hasAddr = false;
+        }
+    }
+
+    uint8_t* bufToFill() { return m_buf; }
+    int capacity() const { return m_capacity; }
     const uint8_t* buf() const { return m_buf; } 
     int len() const { return m_len; }
     const AddrInfo::AddrUnion* saddr() const { return m_addr.saddr(); }
@@ -63,15 +93,50 @@ public:
     const QueueCallback cb() const { return m_cb; }
     void setID( int id ) { m_id = id; }
     int getID( void ) { return m_id; }
+    uint32_t queuedMillis() const { return m_queuedMillis; }
+    static uint32_t nowMillis();
+
+    /* for UdpQueue's shards */
+    void setKey( uint32_t key ) { m_key = key; }
+    uint32_t key() const { return m_key; }
+    void park( QueueCallback cb, void* data ) {
+        m_parkCb = cb;
+        m_parkData = data;
+        m_parked = true;
+    }
+    bool parked() const { return m_parked; }
+    QueueCallback parkCb() const { return m_parkCb; }
+    void* parkData() const { return m_parkData; }
+    void setResuming( bool ok ) {
+        m_resuming = true;
+        m_resumedOK = ok;
+        m_queuedMillis = nowMillis();
+    }
+    bool resuming() const { return m_resuming; }
+    /* what resume() was told: did whatever it was parked for succeed? */
+    bool resumedOK() const { return m_resumedOK; }
+    void unpark() {
+        m_parked = false;
+        m_resuming = false;
+    }
 
  private:
     uint8_t* m_buf;
+    int m_capacity;
     int m_len;
+    bool m_hasAddr;
     AddrInfo m_addr;
     QueueCallback m_cb;
     time_t m_created;
     time_t m_dequed;
+    uint32_t m_queuedMillis;
     int m_id;
+    uint32_t m_key;
+    bool m_parked;
+    bool m_resuming;            /* resume()d, not yet dispatched */
+    bool m_resumedOK;
+    QueueCallback m_parkCb;
+    void* m_parkData;
 };
 
 class PartialPacket {
@@ -100,21 +165,99 @@ class UdpQueue {
     UdpQueue();
     ~UdpQueue();
     bool handle( const AddrInfo* addr, QueueCallback cb );
+    /* Packets with the same key are handled one at a time, in the order
+       they arrived; others may be handled in parallel. */
     void handle( const AddrInfo* addr, const uint8_t* buf, int len,
-                 QueueCallback cb );
+                 QueueCallback cb, uint32_t key );
+    void handle( PacketThreadClosure* ptc, uint32_t key );
+    PacketThreadClosure* getClosure();
     void newSocket( int sock );
     void newSocket( const AddrInfo* addr );
+    void printStats( StrWPF& out );
+
+    static uint32_t keyFor( const char* str );
+    static uint32_t keyFor( const AddrInfo* addr );
+
+    /* Send now; or, from a callback, along with everything else its shard
+       sends before going idle. Returns what sendto() would, or len if the
+       datagram's been queued. Pass wait when the caller acts on the result
+       (say, by expecting an ack): the shard's batch then goes out first and
+       the result is this datagram's own. */
+    static ssize_t send( int sock, const struct sockaddr* dest,
+                         const uint8_t* buf, size_t len, bool wait );
+
+    /* From a callback that's started something it needn't block for, say a
+       DB query: keep ptc, and hold back later packets with its key, until
+       resume(ptc) is called from any thread (even before this is).  Then cb
+       runs with it in its shard, data in ptc->parkData() and ok in
+       ptc->resumedOK(), and it's recycled once cb returns without parking
+       it again. */
+    static void park( PacketThreadClosure* ptc, QueueCallback cb,
+                      void* data );
+    void resume( PacketThreadClosure* ptc, bool ok );
+    /* resume() as a DBMgr::DoneProc */
+    static void resumeProc( void* closure, bool ok );
 
  private:
+    /* Datagrams sent by one shard's callbacks, waiting for sendmmsg() */
+    class Outbox {
+    public:
+        Outbox() : m_count(0), m_sock(-1) {}
+        void add( int sock, const struct sockaddr* dest,
+                  const uint8_t* buf, size_t len );
+        /* Returns what sendto() would for the last datagram */
+        ssize_t flush();
+
+    private:
+        int m_count;
+        int m_sock;
+        uint8_t m_bufs[UDP_BATCH][MAX_MSG_LEN];
+        size_t m_lens[UDP_BATCH];
+        struct sockaddr m_dests[UDP_BATCH];
+    };
+
+    /* Each shard has its own queue and the one thread that empties it */
+    class Shard {
+    public:
+        Shard( UdpQueue* owner );
+        ~Shard();
+        void add( PacketThreadClosure* ptc );
+        void resume( PacketThreadClosure* ptc, bool ok );
+        void printStats( StrWPF& out, int indx );
+        void* thread_main();
+
+    private:
+        void dispatch( PacketThreadClosure* ptc );
+
+        UdpQueue* m_owner;
+        pthread_mutex_t m_queueMutex;
+        pthread_cond_t m_queueCondVar;
+        deque<PacketThreadClosure*> m_queue;
+        deque<PacketThreadClosure*> m_batch; /* dequeued, not yet handled */
+        Outbox m_outbox;
+        /* Keys with a packet parked, and their packets that came after */
+        set<uint32_t> m_parkedKeys;
+        map<uint32_t, deque<PacketThreadClosure*> > m_heldBack;
+
+        /* stats, protected by m_queueMutex like the queue itself */
+        size_t m_maxDepth;
+        uint32_t m_nDispatched;
+        uint64_t m_waitMillis;  /* total, from enqueue to dispatch */
+        uint32_t m_maxWaitMillis;
+        uint64_t m_runMillis;   /* total spent in callbacks */
+        uint32_t m_maxRunMillis;
+        uint32_t m_nParks;
+        size_t m_nHeldBack;
+    };
+
     void newSocket_locked( int sock );
+    void recycle( PacketThreadClosure* ptc );
     static void* thread_main_static( void* closure );
-    void* thread_main();
 
     pthread_mutex_t m_partialsMutex;
-    pthread_mutex_t m_queueMutex;
-    pthread_cond_t m_queueCondVar;
-    deque<PacketThreadClosure*> m_queue;
-    // map<int, vector<PacketThreadClosure*> > m_bySocket;
+    pthread_mutex_t m_idMutex;  /* for m_nextID and m_pool */
+    vector<Shard*> m_shards;
+    vector<PacketThreadClosure*> m_pool;
     int m_nextID;
     map<int, PartialPacket*> m_partialPackets;
 };
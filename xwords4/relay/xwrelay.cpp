@@ -527,7 +527,7 @@ static void
 assemble_packet( vector<uint8_t>& packet, uint32_t* packetIDP, XWRelayReg cmd, 
                  va_list& app )
 {
-    uint32_t packetNum = UDPAckTrack::nextPacketID( cmd );
+    uint32_t packetNum = UDPAckTrack::nextPacketID( cmd, NULL != packetIDP );
     if ( NULL != packetIDP ) {
         *packetIDP = packetNum;
     }
@@ -607,12 +607,15 @@ get_addr_info_if( const AddrInfo* addr, int* sockp,
     return current;
 }
 
+// Pass wait if an ack's expected: it mustn't be tracked for a packet that
+// only got as far as the queue.
 static ssize_t
 send_packet_via_udp_impl( vector<uint8_t>& packet, 
-                          int sock, const struct sockaddr* dest_addr )
+                          int sock, const struct sockaddr* dest_addr,
+                          bool wait )
 {
-    ssize_t nSent = sendto( sock, packet.data(), packet.size(), 0 /*flags*/,
-                            dest_addr, sizeof(*dest_addr) );
+    ssize_t nSent = UdpQueue::send( sock, dest_addr, packet.data(),
+                                    packet.size(), wait );
     if ( 0 > nSent ) {
         logf( XW_LOGERROR, "%s: sendmsg->errno %d (%s)", __func__, errno, 
               strerror(errno) );
@@ -635,7 +638,9 @@ send_via_udp_impl( int sock, const struct sockaddr* dest_addr,
     vector<uint8_t> packet;
     assemble_packet( packet, packetIDP, cmd, app );
 
-    ssize_t nSent = send_packet_via_udp_impl( packet, sock, dest_addr );
+    // Callers wanting a packet ID will be waiting on its ack
+    ssize_t nSent = send_packet_via_udp_impl( packet, sock, dest_addr,
+                                              NULL != packetIDP );
 #ifdef LOG_UDP_PACKETS
     gchar* b64 = g_base64_encode( (uint8_t*)dest_addr, 
                                   sizeof(*dest_addr) );
@@ -816,7 +821,8 @@ post_or_store( DevIDRelay destDevID, vector<uint8_t>& packet, uint32_t packetID,
         int sock;
         const struct sockaddr* dest_addr;
         if ( get_addr_info_if( &addr, &sock, &dest_addr ) ) {
-            sent = 0 < send_packet_via_udp_impl( packet, sock, dest_addr );
+            sent = 0 < send_packet_via_udp_impl( packet, sock, dest_addr,
+                                                 true );
 
             if ( sent && msgID != 0 ) {
                 MsgClosure* mc = new MsgClosure( destDevID, &packet, msgID,
@@ -1663,14 +1669,11 @@ onMsgAcked( bool acked, uint32_t packetID, void* data )
 }
 
 static void
-retrieveMessages( DevID& devID, const AddrInfo* addr )
+sendMessages( DevIDRelay relayID, const vector<DBMgr::MsgInfo>& msgs,
+              const AddrInfo* addr )
 {
-    DBMgr* dbMgr = DBMgr::Get();
-    vector<DBMgr::MsgInfo> msgs;
-    dbMgr->GetStoredMessages( devID.asRelayID(), msgs );
-
     logf( XW_LOGINFO, "%s(): found %d msgs for %d", __func__, msgs.size(),
-          devID.asRelayID() );
+          relayID );
 
     vector<DBMgr::MsgInfo>::const_iterator iter;
     for ( iter = msgs.begin(); iter != msgs.end(); ++iter ) {
@@ -1687,7 +1690,7 @@ retrieveMessages( DevID& devID, const AddrInfo* addr )
                 vector<uint8_t> newPacket;
                 assemble_packet( newPacket, &packetID, msg.msg );
                 success = 0 < send_packet_via_udp_impl( newPacket, sock, 
-                                                        dest_addr );
+                                                        dest_addr, true );
             }
         }
 
@@ -1695,7 +1698,7 @@ retrieveMessages( DevID& devID, const AddrInfo* addr )
             logf( XW_LOGINFO, "%s: success!", __func__ );
         } else {
             logf( XW_LOGERROR, "%s: unable to send to devID %d", 
-                  __func__, devID.asRelayID() );
+                  __func__, relayID );
             break;
         }
         UDPAckTrack::setOnAck( onMsgAcked, packetID, 
@@ -1703,6 +1706,160 @@ retrieveMessages( DevID& devID, const AddrInfo* addr )
     }
 }
 
+/* A parked packet whose query failed is tried again this many times in all,
+ * then dropped unacked: its device will send it again.
+ */
+#define MAX_DB_TRIES 3
+
+static bool
+retryOrDrop( PacketThreadClosure* ptc, int* tries, const char* what )
+{
+    bool retry = ++*tries < MAX_DB_TRIES;
+    logf( XW_LOGERROR, "%s: query failed for packet %d (try %d); %s",
+          what, ptc->getID(), *tries, retry ? "retrying" : "dropping" );
+    return retry;
+}
+
+/* What a parked packet needs once the DB's answered */
+typedef struct {
+    DevIDRelay relayID;
+    vector<DBMgr::MsgInfo> msgs;
+    int tries;
+} MsgsFetch;
+
+static void ackPacketIf( PacketThreadClosure* ptc );
+static bool fetchMessages( MsgsFetch* fetch, PacketThreadClosure* ptc );
+
+static void
+retrieveMessagesDone( PacketThreadClosure* ptc )
+{
+    MsgsFetch* fetch = (MsgsFetch*)ptc->parkData();
+    if ( ptc->resumedOK() ) {
+        sendMessages( fetch->relayID, fetch->msgs, ptc->addr() );
+        delete fetch;
+        ackPacketIf( ptc );
+    } else if ( !retryOrDrop( ptc, &fetch->tries, __func__ ) ) {
+        delete fetch;
+    } else if ( !fetchMessages( fetch, ptc ) ) {
+        ackPacketIf( ptc );
+    }
+}
+
+// Sends what's stored for fetch->relayID, unless that needs the DB: then
+// returns true with ptc parked until it answers, and fetch handed on.
+static bool
+fetchMessages( MsgsFetch* fetch, PacketThreadClosure* ptc )
+{
+    fetch->msgs.clear();
+    bool parked = !DBMgr::Get()->GetStoredMessages( fetch->relayID,
+                                                    fetch->msgs,
+                                                    UdpQueue::resumeProc,
+                                                    ptc );
+    if ( parked ) {
+        UdpQueue::park( ptc, retrieveMessagesDone, fetch );
+    } else {
+        sendMessages( fetch->relayID, fetch->msgs, ptc->addr() );
+        delete fetch;
+    }
+    return parked;
+}
+
+// Returns true if ptc's parked until the DB answers
+static bool
+retrieveMessages( DevID& devID, PacketThreadClosure* ptc )
+{
+    MsgsFetch* fetch = new MsgsFetch;
+    fetch->relayID = devID.asRelayID();
+    fetch->tries = 0;
+    return fetchMessages( fetch, ptc );
+}
+
+typedef struct {
+    DevIDRelay sender;
+    DevIDRelay invitee;
+    string relayID;             /* of the invitee */
+    int offset;                 /* of the invitation in ptc's buffer */
+    int tries;
+} InviteFetch;
+
+static void
+inviteDone( PacketThreadClosure* ptc )
+{
+    InviteFetch* fetch = (InviteFetch*)ptc->parkData();
+    if ( ptc->resumedOK() ) {
+        logf( XW_LOGVERBOSE0, "got invite from %d for %d", fetch->sender,
+              fetch->invitee );
+        post_invite( fetch->sender, fetch->invitee,
+                     ptc->buf() + fetch->offset, ptc->len() - fetch->offset );
+        delete fetch;
+        ackPacketIf( ptc );
+    } else if ( retryOrDrop( ptc, &fetch->tries, __func__ ) ) {
+        DBMgr::Get()->getDevID( fetch->relayID, &fetch->invitee,
+                                UdpQueue::resumeProc, ptc );
+        UdpQueue::park( ptc, inviteDone, fetch );
+    } else {
+        delete fetch;
+    }
+}
+
+typedef struct {
+    AddrInfo::ClientToken clientToken;
+    HostID srcID;
+    DBMgr::TokenGame game;
+    int tries;
+} AckFetch;
+
+static void
+processAckDone( PacketThreadClosure* ptc )
+{
+    AckFetch* fetch = (AckFetch*)ptc->parkData();
+    if ( ptc->resumedOK() ) {
+        bool success;
+        {
+            SafeCref scr( fetch->clientToken, fetch->srcID, &fetch->game );
+            success = scr.HandleAck( fetch->srcID );
+        }
+        if ( !success ) {
+            AddrInfo addr( g_udpsock, fetch->clientToken, ptc->saddr() );
+            XWThreadPool::GetTPool()->EnqueueKill( &addr, "failure" );
+        }
+        delete fetch;
+        ackPacketIf( ptc );
+    } else if ( retryOrDrop( ptc, &fetch->tries, __func__ ) ) {
+        // Not knowing where the game is isn't a reason to kill the
+        // client: ask again
+        DBMgr::Get()->FindGame( fetch->clientToken, fetch->srcID,
+                                &fetch->game, UdpQueue::resumeProc, ptc );
+        UdpQueue::park( ptc, processAckDone, fetch );
+    } else {
+        delete fetch;
+    }
+}
+
+// An ack for a game that isn't live has to go to the DB for it: park
+// rather than block this thread on that. Everything else, and acks for
+// live games, go through processMessage(). Returns true if ptc's parked.
+static bool
+parkForAck( PacketThreadClosure* ptc, const uint8_t* bufp,
+            const uint8_t* end, AddrInfo::ClientToken clientToken )
+{
+    bool parked = false;
+    HostID srcID;
+    if ( bufp < end && XWRELAY_ACK == *bufp++
+         && getNetByte( &bufp, end, &srcID )
+         && 0 == CRefMgr::Get()->CidForToken( clientToken, srcID ) ) {
+        AckFetch* fetch = new AckFetch;
+        fetch->clientToken = clientToken;
+        fetch->srcID = srcID;
+        fetch->tries = 0;
+        DBMgr::Get()->FindGame( clientToken, srcID, &fetch->game,
+                                UdpQueue::resumeProc, ptc );
+        UdpQueue::park( ptc, processAckDone, fetch );
+        parked = true;
+    }
+    return parked;
+}
+
 const char*
 msgToStr( XWRelayReg msg )
 {
@@ -1744,6 +1901,17 @@ ackPacketIf( const UDPHeader* header, const AddrInfo* addr )
     }
 }
 
+// For a packet that was parked: its ack waited until it was handled
+static void
+ackPacketIf( PacketThreadClosure* ptc )
+{
+    const uint8_t* ptr = ptc->buf();
+    UDPHeader header;
+    if ( getHeader( &ptr, ptr + ptc->len(), &header ) ) {
+        ackPacketIf( &header, ptc->addr() );
+    }
+}
+
 static void
 handle_udp_packet( PacketThreadClosure* ptc )
 {
@@ -1752,6 +1920,7 @@ handle_udp_packet( PacketThreadClosure* ptc )
 
     UDPHeader header;
     if ( getHeader( &ptr, end, &header ) ) {
+        bool parked = false;
         logf( XW_LOGINFO, "%s(msg=%s)", __func__, msgToStr( header.cmd ) );
         switch( header.cmd ) {
         case XWPDEV_REG: {
@@ -1792,8 +1961,11 @@ handle_udp_packet( PacketThreadClosure* ptc )
             ptr += sizeof(clientToken);
             clientToken = ntohl( clientToken );
             if ( AddrInfo::NULL_TOKEN != clientToken ) {
-                AddrInfo addr( g_udpsock, clientToken, ptc->saddr() );
-                (void)processMessage( ptr, end - ptr, &addr, clientToken );
+                parked = parkForAck( ptc, ptr, end, clientToken );
+                if ( !parked ) {
+                    AddrInfo addr( g_udpsock, clientToken, ptc->saddr() );
+                    (void)processMessage( ptr, end - ptr, &addr, clientToken );
+                }
             } else {
                 logf( XW_LOGERROR, "%s: dropping packet with token of 0",
                       __func__ );
@@ -1837,7 +2009,16 @@ handle_udp_packet( PacketThreadClosure* ptc )
                  && getNetString( &ptr, end, relayID ) ) {
                 DevIDRelay invitee;
                 if ( 0 < relayID.size() ) {
-                    invitee = DBMgr::Get()->getDevID( relayID );
+                    InviteFetch* fetch = new InviteFetch;
+                    fetch->sender = sender;
+                    fetch->relayID = relayID;
+                    fetch->offset = ptr - ptc->buf();
+                    fetch->tries = 0;
+                    DBMgr::Get()->getDevID( fetch->relayID, &fetch->invitee,
+                                            UdpQueue::resumeProc, ptc );
+                    UdpQueue::park( ptc, inviteDone, fetch );
+                    parked = true;
+                    break;
                 } else if ( !getNetLong( &ptr, end, &invitee ) ) {
                     break;      // failure
                 }
@@ -1856,7 +2037,7 @@ handle_udp_packet( PacketThreadClosure* ptc )
                 DevMgr::Get()->rememberDevice( devID.asRelayID(), addr );
 
                 if ( XWPDEV_RQSTMSGS == header.cmd ) {
-                    retrieveMessages( devID, addr );
+                    parked = retrieveMessages( devID, ptc );
                 }
             }
             break;
@@ -1892,36 +2073,236 @@ handle_udp_packet( PacketThreadClosure* ptc )
             logf( XW_LOGERROR, "%s: unexpected msg %d", __func__, header.cmd );
         }
 
-        // Do this after the device and address are registered
-        ackPacketIf( &header, ptc->addr() );
+        // Do this after the device and address are registered, and once
+        // the packet's been handled if it had to be parked
+        if ( !parked ) {
+            ackPacketIf( &header, ptc->addr() );
+        }
     }
 }
 
-static void
-read_udp_packet( int udpsock )
+#define MAX_NUM_PLAYERS 4        /* as in dbmgr.cpp */
+
+// A game's packets are keyed by its cid while it's live, however they
+// name it, so whichever seat they come from they're handled in order on
+// one shard. A game that isn't live has no cid yet: its packets are keyed
+// by connName (or a connect's cookie), or failing that by the seat's token,
+// until the first of them brings it back. The cref's own lock keeps that
+// handoff safe; only the order of packets racing it isn't guaranteed.
+static uint32_t
+keyForConnName( const char* connName )
+{
+    CookieID cid = CRefMgr::Get()->CookieIdForName( connName );
+    return 0 != cid ? cid : UdpQueue::keyFor( connName );
+}
+
+static uint32_t
+keyForToken( AddrInfo::ClientToken clientToken, HostID hid )
 {
-    uint8_t buf[MAX_MSG_LEN];
-    AddrInfo::AddrUnion saddr;
-    memset( &saddr, 0, sizeof(saddr) );
-    socklen_t fromlen = sizeof(saddr.u.addr_in);
+    CookieID cid = CRefMgr::Get()->CidForToken( clientToken, hid );
+    return 0 != cid ? cid : clientToken;
+}
 
-    ssize_t nRead = recvfrom( udpsock, buf, sizeof(buf), 0 /*flags*/,
-                              &saddr.u.addr, &fromlen );
-    if ( 0 < nRead ) {
+// XWPDEV_MSG wraps the protocol games spoke over TCP; dig out the game
+static uint32_t
+msgRoutingKey( const uint8_t* ptr, const uint8_t* end,
+               AddrInfo::ClientToken clientToken )
+{
+    uint32_t key = clientToken;
+    if ( ptr < end ) {
+        XWRELAY_Cmd cmd = *ptr++;
+        switch( cmd ) {
+        case XWRELAY_GAME_CONNECT:
+        case XWRELAY_GAME_RECONNECT: {
+            unsigned short clientVersion;
+            unsigned short flags;
+            char cookie[MAX_INVITE_LEN+1];
+            if ( XWRELAY_ERROR_NONE == flagsOK( &ptr, end, &clientVersion,
+                                                &flags )
+                 && readStr( &ptr, end, cookie, sizeof(cookie) ) ) {
+                key = UdpQueue::keyFor( cookie );
+                /* wantsPublic, makePublic, srcID, nPlayersH, nPlayersT,
+                   seed (2), langCode: then the connName */
+                char connName[MAX_CONNNAME_LEN+1];
+                if ( XWRELAY_GAME_RECONNECT == cmd && ptr + 8 <= end ) {
+                    ptr += 8;
+                    if ( readStr( &ptr, end, connName, sizeof(connName) )
+                         && '\0' != connName[0] ) {
+                        key = keyForConnName( connName );
+                    }
+                }
+            }
+            break;
+        }
+        case XWRELAY_ACK: {
+            HostID srcID;
+            if ( getNetByte( &ptr, end, &srcID ) ) {
+                key = keyForToken( clientToken, srcID );
+            }
+            break;
+        }
+        case XWRELAY_GAME_DISCONNECT:
+        case XWRELAY_MSG_TORELAY: {
+            CookieID cid;
+            HostID srcID;
+            if ( getNetShort( &ptr, end, &cid )
+                 && getNetByte( &ptr, end, &srcID ) ) {
+                key = COOKIE_ID_NONE != cid ? cid
+                    : keyForToken( clientToken, srcID );
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    return key;
+}
+
+// UdpQueue handles packets with the same key in order, and others in
+// parallel. So key packets about a game by the game (see above), and those
+// about a device by its devID. Anything else (and anything that won't
+// parse, so that handle_udp_packet() can complain about it) is keyed by
+// where it came from.
+static uint32_t
+routingKey( const uint8_t* buf, int len, const AddrInfo* addr )
+{
+    uint32_t key = UdpQueue::keyFor( addr );
+    const uint8_t* ptr = buf;
+    const uint8_t* end = buf + len;
+
+    UDPHeader header;
+    if ( getHeader( &ptr, end, &header ) ) {
+        switch( header.cmd ) {
+        case XWPDEV_REG: {
+            string relayID;
+            if ( getVLIString( &ptr, end, relayID ) ) {
+                if ( 0 < relayID.size() ) {
+                    key = UdpQueue::keyFor( relayID.c_str() );
+                } else if ( ptr < end ) {
+                    DevID devID( (DevIDType)*ptr++ );
+                    if ( getRelayDevID( &ptr, end, devID ) ) {
+                        key = UdpQueue::keyFor( devID.m_devIDString.c_str() );
+                    }
+                }
+            }
+            break;
+        }
+        case XWPDEV_MSG: {
+            AddrInfo::ClientToken clientToken;
+            if ( getNetLong( &ptr, end, &clientToken ) ) {
+                key = msgRoutingKey( ptr, end, clientToken );
+            }
+            break;
+        }
+        case XWPDEV_MSGNOCONN: {
+            AddrInfo::ClientToken clientToken;
+            HostID hid;
+            char connName[MAX_CONNNAME_LEN+1];
+            if ( getNetLong( &ptr, end, &clientToken )
+                 && parseRelayID( &ptr, end, connName, sizeof(connName),
+                                  &hid ) ) {
+                key = keyForConnName( connName );
+            }
+            break;
+        }
+        case XWPDEV_DELGAME: {
+            // The token's for one seat, whose hid we don't know yet
+            DevID devID( ID_TYPE_RELAY );
+            AddrInfo::ClientToken clientToken;
+            if ( getRelayDevID( &ptr, end, devID ) ) {
+                key = UdpQueue::keyFor( devID.m_devIDString.c_str() );
+                if ( getNetLong( &ptr, end, &clientToken ) ) {
+                    for ( HostID hid = 1; hid <= MAX_NUM_PLAYERS; ++hid ) {
+                        CookieID cid =
+                            CRefMgr::Get()->CidForToken( clientToken, hid );
+                        if ( 0 != cid ) {
+                            key = cid;
+                            break;
+                        }
+                    }
+                }
+            }
+            break;
+        }
+        case XWPDEV_INVITE: {
+            DevIDRelay sender;
+            if ( getNetLong( &ptr, end, &sender ) ) {
+                key = sender;
+            }
+            break;
+        }
+        case XWPDEV_KEEPALIVE:
+        case XWPDEV_RQSTMSGS: {
+            string devID;
+            if ( getVLIString( &ptr, end, devID ) ) {
+                key = UdpQueue::keyFor( devID.c_str() );
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    return key;
+}
+
+// Read everything waiting, up to UDP_BATCH datagrams, with one call and
+// straight into closures UdpQueue will pass to handle_udp_packet(). Slots
+// not filled keep their closures for next time. Only the main thread reads,
+// so the ring needs no lock.
+static void
+read_udp_packets( int udpsock )
+{
+    static PacketThreadClosure* s_ring[UDP_BATCH] = { NULL };
+    UdpQueue* queue = UdpQueue::get();
+
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iovs[UDP_BATCH];
+    AddrInfo::AddrUnion saddrs[UDP_BATCH];
+    memset( msgs, 0, sizeof(msgs) );
+    memset( saddrs, 0, sizeof(saddrs) );
+    for ( int ii = 0; ii < UDP_BATCH; ++ii ) {
+        if ( NULL == s_ring[ii] ) {
+            s_ring[ii] = queue->getClosure();
+        }
+        iovs[ii].iov_base = s_ring[ii]->bufToFill();
+        iovs[ii].iov_len = s_ring[ii]->capacity();
+        msgs[ii].msg_hdr.msg_name = &saddrs[ii].u.addr;
+        msgs[ii].msg_hdr.msg_namelen = sizeof(saddrs[ii].u.addr_in);
+        msgs[ii].msg_hdr.msg_iov = &iovs[ii];
+        msgs[ii].msg_hdr.msg_iovlen = 1;
+    }
+
+    int nMsgs = recvmmsg( udpsock, msgs, UDP_BATCH, MSG_DONTWAIT, NULL );
+    if ( 0 > nMsgs && EAGAIN != errno && EWOULDBLOCK != errno ) {
+        logf( XW_LOGERROR, "%s: recvmmsg->errno %d (%s)", __func__, errno,
+              strerror(errno) );
+    }
+
+    for ( int ii = 0; ii < nMsgs; ++ii ) {
+        int nRead = msgs[ii].msg_len;
+        if ( 0 == nRead ) {
+            continue;
+        }
+        PacketThreadClosure* ptc = s_ring[ii];
+        s_ring[ii] = NULL;
 #ifdef LOG_UDP_PACKETS
-        gchar* b64 = g_base64_encode( (uint8_t*)&saddr, sizeof(saddr) );
-        logf( XW_LOGINFO, "%s: recvfrom=>%d (saddr='%s')", __func__, nRead, b64 );
+        gchar* b64 = g_base64_encode( (uint8_t*)&saddrs[ii], sizeof(saddrs[ii]) );
+        logf( XW_LOGINFO, "%s: recvmmsg=>%d (saddr='%s')", __func__, nRead, b64 );
         g_free( b64 );
 #endif
 #ifdef LOG_PACKET_MD5SUMS
-        gchar* sum = g_compute_checksum_for_data( G_CHECKSUM_MD5, buf, nRead );
-        logf( XW_LOGINFO, "%s: recvfrom=>%d (sum=%s)", __func__, nRead, sum );
+        gchar* sum = g_compute_checksum_for_data( G_CHECKSUM_MD5, ptc->buf(),
+                                                  nRead );
+        logf( XW_LOGINFO, "%s: recvmmsg=>%d (sum=%s)", __func__, nRead, sum );
         g_free( sum );
 #endif
 
-        AddrInfo addr( udpsock, &saddr, false );
+        AddrInfo addr( udpsock, &saddrs[ii], false );
         UDPAger::Get()->Refresh( &addr );
-        UdpQueue::get()->handle( &addr, buf, nRead, handle_udp_packet );
+        ptc->init( &addr, nRead, handle_udp_packet );
+        queue->handle( ptc, routingKey( ptc->buf(), nRead, &addr ) );
     }
 }
 
@@ -2454,7 +2835,7 @@ main( int argc, char** argv )
             if ( -1 != g_udpsock && FD_ISSET( g_udpsock, &rfds ) ) {
                 // This will need to be done in a separate thread, or pushed
                 // to the existing thread pool
-                read_udp_packet( g_udpsock );
+                read_udp_packets( g_udpsock );
                 --retval;
             }
 #ifdef DO_HTTP
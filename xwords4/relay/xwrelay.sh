@@ -14,7 +14,7 @@ LOGFILE=/tmp/xwrelay_log_$$.txt
 date > $LOGFILE
 
 usage() {
-    echo "usage: $0 start | stop | restart | mkdb | debs_install"
+    echo "usage: $0 start | stop | restart | mkdb | upgradedb | debs_install"
 }
 
 setup_user() {
@@ -75,7 +75,7 @@ EOF
 
     cat <<-EOF | psql $DBNAME --file -
 CREATE TABLE msgs ( 
-id SERIAL
+id SERIAL PRIMARY KEY
 ,connName VARCHAR(64)
 ,hid INTEGER
 ,token INTEGER
@@ -85,8 +85,10 @@ id SERIAL
 ,msg BYTEA
 ,msg64 TEXT
 ,msglen INTEGER
+,msghash TEXT
 , UNIQUE ( connName, hid, msg64, stime )
 );
+CREATE INDEX msgs_msghash ON msgs ( connName, hid, msghash );
 EOF
 
     cat <<-EOF | psql $DBNAME --file -
@@ -106,6 +108,22 @@ id INTEGER UNIQUE PRIMARY KEY
 EOF
 }
 
+# Bring a db made by an older mkdb up to date
+upgrade_db() {
+    DBNAME=$(grep '^DB_NAME' $CONFFILE | sed 's,^.*=,,')
+    if [ -z "$DBNAME" ]; then
+        echo "DB_NAME keyword not found"
+        exit 1
+    fi
+    cat <<-EOF | psql $DBNAME --file -
+ALTER TABLE msgs ADD COLUMN IF NOT EXISTS msghash TEXT;
+CREATE UNIQUE INDEX IF NOT EXISTS msgs_id ON msgs ( id );
+UPDATE msgs SET msghash = md5(COALESCE(msg, decode(msg64, 'base64')))
+    WHERE msghash IS NULL;
+CREATE INDEX IF NOT EXISTS msgs_msghash ON msgs ( connName, hid, msghash );
+EOF
+}
+
 do_start() {
     if [ -f $PIDFILE ] && [ -f /proc/$(cat $PIDFILE)/exe ]; then
         echo "already running: pid=$(cat $PIDFILE)" | tee -a $LOGFILE
@@ -165,6 +183,10 @@ case $1 in
         make_db
         ;;
 
+    upgradedb)
+        upgrade_db
+        ;;
+
     debs_install)
 		install_debs
 		;;
@@ -95,6 +95,7 @@ initFromPtr( WasmDictionaryCtxt* dctx, const char* name,
         if ( ! checkSanity( &dctx->super, numEdges ) ) {
             goto closeAndExit;
         }
+        dict_buildTables( &dctx->super, numEdges );
     }
     goto ok;
 